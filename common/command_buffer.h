@@ -0,0 +1,136 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ */
+#ifndef _COMMAND_BUFFER_H
+#define _COMMAND_BUFFER_H
+#include <GL/glew.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+/**
+ * A list of GL commands, recorded into plain memory and executed
+ * later, in the same order.
+ *
+ * Recording does not make any GL calls, so it can be done on any
+ * thread, for example to traverse different parts of a scene on
+ * different threads, each into its own command buffer. execute()
+ * makes the GL calls, so it must be called on the thread that has the
+ * GL context.
+ *
+ * Names of programs and buffers, and attribute and uniform locations,
+ * are recorded as they are, so what they refer to must still exist
+ * when the commands are executed. So must client memory passed to
+ * vertex_attrib_pointer() or draw_elements(). Uniform values are
+ * copied.
+ *
+ * Everything is in this header, so the GL calls made by execute() go
+ * through whatever the including file has defined them to be.
+ */
+class command_buffer {
+public:
+  void use_program(GLuint program) { put(USE_PROGRAM); put(program); }
+  void enable(GLenum cap) { put(ENABLE); put(cap); }
+  void disable(GLenum cap) { put(DISABLE); put(cap); }
+  void viewport(GLint x, GLint y, GLsizei w, GLsizei h) { put(VIEWPORT); put(x); put(y); put(w); put(h); }
+  void scissor(GLint x, GLint y, GLsizei w, GLsizei h) { put(SCISSOR); put(x); put(y); put(w); put(h); }
+  void clear(GLbitfield mask) { put(CLEAR); put(mask); }
+  void color_mask(GLboolean r, GLboolean g, GLboolean b, GLboolean a) { put(COLOR_MASK); put(r | g << 1 | b << 2 | a << 3); }
+  void depth_mask(GLboolean flag) { put(DEPTH_MASK); put(flag); }
+  void stencil_func(GLenum func, GLint ref, GLuint mask) { put(STENCIL_FUNC); put(func); put(ref); put(mask); }
+  void stencil_op(GLenum sfail, GLenum dpfail, GLenum dppass) { put(STENCIL_OP); put(sfail); put(dpfail); put(dppass); }
+  void stencil_mask(GLuint mask) { put(STENCIL_MASK); put(mask); }
+
+  void bind_buffer(GLenum target, GLuint buffer) { put(BIND_BUFFER); put(target); put(buffer); }
+  void enable_vertex_attrib_array(GLuint index) { put(ENABLE_VERTEX_ATTRIB_ARRAY); put(index); }
+  void disable_vertex_attrib_array(GLuint index) { put(DISABLE_VERTEX_ATTRIB_ARRAY); put(index); }
+  void vertex_attrib_pointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer) {
+    put(VERTEX_ATTRIB_POINTER); put(index); put(size); put(type); put(normalized); put(stride); put(pointer);
+  }
+
+  void uniform1i(GLint location, GLint v) { put(UNIFORM1I); put(location); put(v); }
+  void uniform1f(GLint location, GLfloat v) { put(UNIFORM1F); put(location); put(v); }
+  void uniform3f(GLint location, GLfloat x, GLfloat y, GLfloat z) { put(UNIFORM3F); put(location); put(x); put(y); put(z); }
+  void uniform_matrix3fv(GLint location, const GLfloat* m) { put(UNIFORM_MATRIX3FV); put(location); put(m, 9); }
+  void uniform_matrix4fv(GLint location, const GLfloat* m) { put(UNIFORM_MATRIX4FV); put(location); put(m, 16); }
+
+  void draw_arrays(GLenum mode, GLint first, GLsizei count) { put(DRAW_ARRAYS); put(mode); put(first); put(count); }
+  void draw_elements(GLenum mode, GLsizei count, GLenum type, const void* indices) {
+    put(DRAW_ELEMENTS); put(mode); put(count); put(type); put(indices);
+  }
+
+  /**
+   * Make the GL calls for all recorded commands, in the order they
+   * were recorded. The commands are kept, so they can be executed
+   * again.
+   */
+  void execute() const {
+    const uint32_t* p = words.data();
+    const uint32_t* end = p + words.size();
+
+    while (p < end) {
+      uint32_t op = *p++;
+      switch (op) {
+      case USE_PROGRAM: glUseProgram(p[0]); p += 1; break;
+      case ENABLE: glEnable(p[0]); p += 1; break;
+      case DISABLE: glDisable(p[0]); p += 1; break;
+      case VIEWPORT: glViewport(p[0], p[1], p[2], p[3]); p += 4; break;
+      case SCISSOR: glScissor(p[0], p[1], p[2], p[3]); p += 4; break;
+      case CLEAR: glClear(p[0]); p += 1; break;
+      case COLOR_MASK: glColorMask(p[0] & 1, p[0] >> 1 & 1, p[0] >> 2 & 1, p[0] >> 3 & 1); p += 1; break;
+      case DEPTH_MASK: glDepthMask(p[0]); p += 1; break;
+      case STENCIL_FUNC: glStencilFunc(p[0], p[1], p[2]); p += 3; break;
+      case STENCIL_OP: glStencilOp(p[0], p[1], p[2]); p += 3; break;
+      case STENCIL_MASK: glStencilMask(p[0]); p += 1; break;
+      case BIND_BUFFER: glBindBuffer(p[0], p[1]); p += 2; break;
+      case ENABLE_VERTEX_ATTRIB_ARRAY: glEnableVertexAttribArray(p[0]); p += 1; break;
+      case DISABLE_VERTEX_ATTRIB_ARRAY: glDisableVertexAttribArray(p[0]); p += 1; break;
+      case VERTEX_ATTRIB_POINTER: glVertexAttribPointer(p[0], p[1], p[2], p[3], p[4], pointer(p + 5)); p += 7; break;
+      case UNIFORM1I: glUniform1i(p[0], p[1]); p += 2; break;
+      case UNIFORM1F: glUniform1f(p[0], real(p[1])); p += 2; break;
+      case UNIFORM3F: glUniform3fv(p[0], 1, (const GLfloat*)(p + 1)); p += 4; break;
+      case UNIFORM_MATRIX3FV: glUniformMatrix3fv(p[0], 1, GL_FALSE, (const GLfloat*)(p + 1)); p += 10; break;
+      case UNIFORM_MATRIX4FV: glUniformMatrix4fv(p[0], 1, GL_FALSE, (const GLfloat*)(p + 1)); p += 17; break;
+      case DRAW_ARRAYS: glDrawArrays(p[0], p[1], p[2]); p += 3; break;
+      case DRAW_ELEMENTS: glDrawElements(p[0], p[1], p[2], pointer(p + 3)); p += 5; break;
+      }
+    }
+  }
+
+  /**
+   * Forget all recorded commands, but keep the memory for recording
+   * the next ones
+   */
+  void reset() { words.clear(); }
+
+  bool empty() const { return words.empty(); }
+
+  /**
+   * Append all commands of another command buffer, so they are
+   * executed after the ones already recorded
+   */
+  void append(const command_buffer& other) { words.insert(words.end(), other.words.begin(), other.words.end()); }
+
+private:
+  enum opcode {
+    USE_PROGRAM, ENABLE, DISABLE, VIEWPORT, SCISSOR, CLEAR, COLOR_MASK, DEPTH_MASK, STENCIL_FUNC, STENCIL_OP, STENCIL_MASK,
+    BIND_BUFFER, ENABLE_VERTEX_ATTRIB_ARRAY, DISABLE_VERTEX_ATTRIB_ARRAY, VERTEX_ATTRIB_POINTER,
+    UNIFORM1I, UNIFORM1F, UNIFORM3F, UNIFORM_MATRIX3FV, UNIFORM_MATRIX4FV,
+    DRAW_ARRAYS, DRAW_ELEMENTS,
+  };
+
+  // Every argument takes one 32 bit word, except pointers, which take two
+  std::vector<uint32_t> words;
+
+  void put(uint32_t w) { words.push_back(w); }
+  void put(int32_t w) { words.push_back(w); }
+  void put(GLfloat f) { uint32_t w; memcpy(&w, &f, sizeof w); words.push_back(w); }
+  void put(const GLfloat* v, int n) { for (int i = 0; i < n; i++) put(v[i]); }
+  void put(const void* ptr) { uint64_t w = (uintptr_t)ptr; put((uint32_t)w); put((uint32_t)(w >> 32)); }
+
+  static GLfloat real(uint32_t w) { GLfloat f; memcpy(&f, &w, sizeof f); return f; }
+  static const void* pointer(const uint32_t* p) { return (const void*)(uintptr_t)(p[0] | (uint64_t)p[1] << 32); }
+};
+
+#endif
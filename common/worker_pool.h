@@ -0,0 +1,183 @@
+/**
+ * From the OpenGL Programming wikibook: http://en.wikibooks.org/wiki/OpenGL_Programming
+ * This file is in the public domain.
+ */
+#ifndef _WORKER_POOL_H
+#define _WORKER_POOL_H
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed set of threads that are started once and then wait for work,
+ * so splitting a small job over all cores does not cost a thread start
+ * every time.
+ *
+ * run() hands out a number of pieces of work to the threads of the pool
+ * and to the calling thread, and returns when all of them are done.
+ * Only one job runs on the pool at a time. When it is already busy,
+ * because another thread is using it or because run() is called from
+ * inside a job, the new job runs on the calling thread instead, so
+ * callers never wait on each other and nested jobs cannot deadlock.
+ *
+ * The threads are plain std::threads, which cannot be given a stack
+ * size, so they get the platform's default. That can be much smaller
+ * than the stack of the main thread, 512 KB on macOS for example. Jobs
+ * must therefore not keep large arrays on the stack; scratch space of
+ * more than a few tens of KB belongs on the heap, for instance in a
+ * thread_local vector that is reused by every job on that thread.
+ */
+class worker_pool {
+public:
+  /**
+   * Start a pool that runs jobs on the given number of threads,
+   * counting the one calling run()
+   */
+  explicit worker_pool(int threads) : job(NULL), pieces(0), next(0), done(0), running(0), generation(0), stopping(false) {
+    for (int i = 1; i < threads; i++)
+      workers.push_back(std::thread(&worker_pool::work, this));
+  }
+
+  ~worker_pool() {
+    {
+      std::lock_guard<std::mutex> l(lock);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < workers.size(); i++)
+      workers[i].join();
+  }
+
+  /**
+   * The pool shared by everything in the program, with one thread per
+   * core
+   */
+  static worker_pool& shared() {
+    static worker_pool pool(std::max(1u, std::thread::hardware_concurrency()));
+    return pool;
+  }
+
+  /** The number of threads a job can run on, including the caller */
+  int size() const { return workers.size() + 1; }
+
+  /**
+   * Call f(i) for every i from 0 to n - 1, each exactly once, and wait
+   * until they have all returned. Pieces are taken in order, but may
+   * finish in any order.
+   */
+  void run(int n, const std::function<void(int)>& f) {
+    if (n <= 0)
+      return;
+
+    std::unique_lock<std::mutex> owner(busy, std::try_to_lock);
+    if (n == 1 || workers.empty() || inside() || !owner.owns_lock()) {
+      for (int i = 0; i < n; i++)
+        f(i);
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> l(lock);
+      job = &f;
+      pieces = n;
+      next = 0;
+      done = 0;
+      generation++;
+    }
+    wake.notify_all();
+
+    finish();
+
+    // Workers that are still taking part may read job, so wait for them too
+    std::unique_lock<std::mutex> l(lock);
+    finished.wait(l, [this]() { return done == pieces && running == 0; });
+    job = NULL;
+  }
+
+private:
+  std::vector<std::thread> workers;
+  std::mutex busy;  // held by the thread whose job is running
+  std::mutex lock;  // protects everything below
+  std::condition_variable wake, finished;
+  const std::function<void(int)>* job;
+  int pieces;
+  std::atomic<int> next;
+  int done;
+  int running;  // workers taking part in the current job
+  unsigned generation;
+  bool stopping;
+
+  static bool& inside() {
+    static thread_local bool worker = false;
+    return worker;
+  }
+
+  // Take pieces of the current job until there are none left
+  void finish() {
+    int count = 0;
+    for (int i; (i = next++) < pieces; count++)
+      (*job)(i);
+
+    std::lock_guard<std::mutex> l(lock);
+    done += count;
+    if (done == pieces)
+      finished.notify_all();
+  }
+
+  void work() {
+    inside() = true;
+    unsigned seen = 0;
+    std::unique_lock<std::mutex> l(lock);
+
+    for (;;) {
+      wake.wait(l, [&]() { return stopping || (generation != seen && job); });
+      if (stopping)
+        return;
+
+      seen = generation;
+      running++;
+      l.unlock();
+      finish();
+      l.lock();
+      if (--running == 0)
+        finished.notify_all();
+    }
+  }
+};
+
+/**
+ * Call f(start, end) for contiguous ranges covering 0 to n - 1, one
+ * range for each of the given number of threads, or one per thread of
+ * the shared pool if threads is 0. Given a number of threads, the ranges
+ * do not depend on how many threads the pool actually has.
+ */
+template<typename F> void parallel_ranges(int n, int threads, F f) {
+  worker_pool& pool = worker_pool::shared();
+  if (threads <= 0)
+    threads = pool.size();
+  if (threads <= 1 || n < 2) {
+    if (n > 0)
+      f(0, n);
+    return;
+  }
+
+  int per = (n + threads - 1) / threads;
+  pool.run((n + per - 1) / per, [&](int i) { f(i * per, std::min(n, (i + 1) * per)); });
+}
+
+/**
+ * Call f(i) for every i from 0 to n - 1, split over a number of
+ * threads, or one per thread of the shared pool if threads is 0
+ */
+template<typename F> void parallel(int n, int threads, F f) {
+  parallel_ranges(n, threads, [&](int start, int end) {
+    for (int i = start; i < end; i++)
+      f(i);
+  });
+}
+
+#endif
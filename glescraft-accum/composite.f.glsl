@@ -0,0 +1,15 @@
+varying vec2 uv;
+uniform sampler2D accum;
+uniform sampler2D revealage;
+
+void main(void) {
+	float r = texture2D(revealage, uv).r;
+
+	// Nothing translucent here
+	if(r >= 1.0)
+		discard;
+
+	// Weighted average color of all translucent surfaces, blended over the opaque scene by the remaining revealage
+	vec4 a = texture2D(accum, uv);
+	gl_FragColor = vec4(a.rgb / clamp(a.a, 1e-4, 5e4), r);
+}
@@ -1,7 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 #include <time.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <vector>
 
 #include <GL/glew.h>
 #include <GL/glut.h>
@@ -24,6 +28,46 @@ static GLuint texture;
 static GLint uniform_texture;
 static GLuint cursor_vbo;
 static GLint uniform_alpha;
+static GLint uniform_dither;
+static GLint uniform_oit;
+
+static GLuint post_program;
+static GLint post_coord;
+static GLint post_scene;
+static GLint post_depth;
+static GLint post_history;
+static GLint post_reproject;
+static GLint post_pixel;
+static GLint post_history_weight;
+static GLint post_clamp_history;
+static GLint post_focus;
+static GLint post_aperture;
+static GLuint quad_vbo;
+
+static GLuint composite_program;
+static GLint composite_coord;
+static GLint composite_accum;
+static GLint composite_revealage;
+
+/* The scene is rendered once per frame into a floating point buffer.
+   The post-processing pass combines it with the previous result from one of the history buffers,
+   and writes to the other one. */
+
+static GLuint scene_fbo;
+static GLuint scene_color;
+static GLuint scene_depth;
+static GLuint history_fbo[2];
+static GLuint history_color[2];
+static int history_cur;
+static bool history_valid;
+static glm::mat4 prev_vp;
+
+/* Buffers for weighted blended order-independent transparency.
+   They share the depth buffer of the scene, so translucent faces behind opaque ones are rejected. */
+
+static GLuint oit_fbo;
+static GLuint oit_accum;
+static GLuint oit_revealage;
 
 static glm::vec3 position;
 static glm::vec3 forward;
@@ -43,7 +87,19 @@ static bool focus_on_transparent = true;
 static bool motion_blur = false;
 static bool aa = false;
 static bool dof = false;
-static bool transparency = false;
+static int transparency = 0;
+
+// Ways to draw translucent blocks
+#define TRANSPARENCY_OFF 0
+#define TRANSPARENCY_DITHERED 1
+#define TRANSPARENCY_OIT 2
+
+static const char *transparency_names[3] = {"off", "dithered", "weighted blended order-independent"};
+
+// Which faces of a chunk to draw
+#define LAYER_ALL 0
+#define LAYER_OPAQUE 1
+#define LAYER_TRANSLUCENT 2
 
 // Size of one chunk in blocks
 #define CX 16
@@ -81,6 +137,7 @@ struct chunk {
 	int slot;
 	GLuint vbo;
 	int elements;
+	int translucent;
 	time_t lastused;
 	bool changed;
 	bool noised;
@@ -530,6 +587,25 @@ struct chunk {
 			}
 		}
 
+		// Move the faces of translucent blocks to the end, so they can be drawn in a separate pass.
+		// They wait in scratch space that is kept per thread, and only grows as large as the translucent faces need.
+		static thread_local std::vector<byte4> back;
+		int opaque = 0;
+		back.clear();
+
+		for(int j = 0; j < i; j += 6) {
+			if(transparent[vertex[j].w & 127]) {
+				back.insert(back.end(), vertex + j, vertex + j + 6);
+			} else {
+				memmove(vertex + opaque, vertex + j, 6 * sizeof *vertex);
+				opaque += 6;
+			}
+		}
+
+		translucent = back.size();
+		if(translucent)
+			memcpy(vertex + opaque, back.data(), translucent * sizeof *vertex);
+
 		changed = false;
 		elements = i;
 
@@ -570,27 +646,37 @@ struct chunk {
 		glBufferData(GL_ARRAY_BUFFER, i * sizeof *vertex, vertex, GL_STATIC_DRAW);
 	}
 
-	void render() {
+	void render(int layer = LAYER_ALL) {
 		if(changed)
 			update();
 
 		lastused = now;
 
-		if(!elements)
+		int first = layer == LAYER_TRANSLUCENT ? elements - translucent : 0;
+		int count = layer == LAYER_ALL ? elements : layer == LAYER_OPAQUE ? elements - translucent : translucent;
+
+		if(!count)
 			return;
 
 		glBindBuffer(GL_ARRAY_BUFFER, vbo);
 		glVertexAttribPointer(attribute_coord, 4, GL_BYTE, GL_FALSE, 0, 0);
-		glDrawArrays(GL_TRIANGLES, 0, elements);
+		glDrawArrays(GL_TRIANGLES, first, count);
 	}
 };
 
 struct superchunk {
 	chunk *c[SCX][SCY][SCZ];
 	time_t seed;
+	bool generating;
+	std::vector<chunk *> prefetch; // Chunks the camera is expected to see soon, in the order they should be prepared
+	size_t prefetched;             // How many of those have been dealt with
+	glm::vec3 heading;             // The direction the camera was moving in when the prefetch queue was made
+	glm::vec3 looking;             // And the direction it was looking in
 
 	superchunk() {
 		seed = time(NULL);
+		generating = true;
+		prefetched = 0;
 		for(int x = 0; x < SCX; x++)
 			for(int y = 0; y < SCY; y++)
 				for(int z = 0; z < SCZ; z++)
@@ -636,7 +722,91 @@ struct superchunk {
 		c[cx][cy][cz]->set(x & (CX - 1), y & (CY - 1), z & (CZ - 1), type);
 	}
 
-	void render(const glm::mat4 &pv) {
+	// Generate the terrain of a chunk and its neighbours, so it can be meshed
+	void initialize(chunk *ch) {
+		ch->noise(seed);
+		if(ch->left)
+			ch->left->noise(seed);
+		if(ch->right)
+			ch->right->noise(seed);
+		if(ch->below)
+			ch->below->noise(seed);
+		if(ch->above)
+			ch->above->noise(seed);
+		if(ch->front)
+			ch->front->noise(seed);
+		if(ch->back)
+			ch->back->noise(seed);
+		ch->initialized = true;
+	}
+
+	/* Predict which chunks will come into view when the camera keeps moving with the same velocity and looking in the same direction,
+	   by doing the same visibility test as render() from where the camera will be at a few moments up to ahead seconds from now.
+	   The chunks are queued in the order they are expected to come into view, and every frame render() prepares one of them,
+	   after the nearest chunk on the screen that is still missing. When the camera stops, or turns away from the direction the queue was made for,
+	   the queue is thrown away, and a new one is made. */
+
+	void predict(const glm::vec3 &position, const glm::vec3 &velocity, const glm::vec3 &lookat, const glm::vec3 &up, const glm::mat4 &projection, float ahead) {
+		float speed = glm::length(velocity);
+
+		if(speed < 1 || ahead <= 0) {
+			prefetch.clear();
+			prefetched = 0;
+			return;
+		}
+
+		glm::vec3 dir = velocity / speed;
+
+		if(prefetched < prefetch.size() && glm::dot(dir, heading) > 0.9f && glm::dot(lookat, looking) > 0.9f)
+			return;
+
+		prefetch.clear();
+		prefetched = 0;
+		heading = dir;
+		looking = lookat;
+
+		static const int steps = 4;
+
+		std::vector<bool> queued(SCX * SCY * SCZ);
+
+		for(int i = 1; i <= steps; i++) {
+			glm::vec3 p = position + velocity * (ahead * i / steps);
+			glm::mat4 pv = projection * glm::lookAt(p, p + lookat, up);
+			std::vector<std::pair<float, int> > found;
+
+			for(int x = 0; x < SCX; x++) {
+				for(int y = 0; y < SCY; y++) {
+					for(int z = 0; z < SCZ; z++) {
+						chunk *ch = c[x][y][z];
+						if(ch->initialized || queued[(x * SCY + y) * SCZ + z])
+							continue;
+
+						glm::vec4 center = pv * glm::vec4(ch->ax * CX + CX / 2, ch->ay * CY + CY / 2, ch->az * CZ + CZ / 2, 1);
+
+						float d = glm::length(center);
+						center.x /= center.w;
+						center.y /= center.w;
+
+						if(center.z < -CY / 2)
+							continue;
+
+						if(fabsf(center.x) > 1 + fabsf(CY * 2 / center.w) || fabsf(center.y) > 1 + fabsf(CY * 2 / center.w))
+							continue;
+
+						queued[(x * SCY + y) * SCZ + z] = true;
+						found.push_back(std::make_pair(d, (x * SCY + y) * SCZ + z));
+					}
+				}
+			}
+
+			// Nearest to where the camera will be first
+			std::sort(found.begin(), found.end());
+			for(size_t j = 0; j < found.size(); j++)
+				prefetch.push_back(c[found[j].second / (SCY * SCZ)][found[j].second / SCZ % SCY][found[j].second % SCZ]);
+		}
+	}
+
+	void render(const glm::mat4 &pv, int layer = LAYER_ALL) {
 		float ud = 1.0/0.0;
 		int ux = -1;
 		int uy = -1;
@@ -677,26 +847,30 @@ struct superchunk {
 
 					glUniformMatrix4fv(uniform_mvp, 1, GL_FALSE, glm::value_ptr(mvp));
 
-					c[x][y][z]->render();
+					c[x][y][z]->render(layer);
 				}
 			}
 		}
 
-		if(ux >= 0) {
-			c[ux][uy][uz]->noise(seed);
-			if(c[ux][uy][uz]->left)
-				c[ux][uy][uz]->left->noise(seed);
-			if(c[ux][uy][uz]->right)
-				c[ux][uy][uz]->right->noise(seed);
-			if(c[ux][uy][uz]->below)
-				c[ux][uy][uz]->below->noise(seed);
-			if(c[ux][uy][uz]->above)
-				c[ux][uy][uz]->above->noise(seed);
-			if(c[ux][uy][uz]->front)
-				c[ux][uy][uz]->front->noise(seed);
-			if(c[ux][uy][uz]->back)
-				c[ux][uy][uz]->back->noise(seed);
-			c[ux][uy][uz]->initialized = true;
+		// Only generate new chunks once per frame
+		if(layer == LAYER_TRANSLUCENT)
+			return;
+
+		generating = ux >= 0;
+
+		if(ux >= 0)
+			initialize(c[ux][uy][uz]);
+
+		// After that, prepare one chunk that will be on the screen soon
+		while(prefetched < prefetch.size()) {
+			chunk *ch = prefetch[prefetched++];
+			if(ch->initialized)
+				continue;
+
+			initialize(ch);
+			ch->lastused = now;
+			ch->update();
+			break;
 		}
 	}
 };
@@ -730,7 +904,39 @@ static int init_resources() {
 	uniform_alpha = get_uniform(program, "alpha");
 	uniform_texture = get_uniform(program, "texture");
 
-	if(attribute_coord == -1 || uniform_mvp == -1 || uniform_alpha == -1 || uniform_texture == -1)
+	uniform_dither = get_uniform(program, "dither");
+	uniform_oit = get_uniform(program, "oit");
+
+	if(attribute_coord == -1 || uniform_mvp == -1 || uniform_alpha == -1 || uniform_dither == -1 || uniform_oit == -1 || uniform_texture == -1)
+		return 0;
+
+	post_program = create_program("post.v.glsl", "post.f.glsl");
+	if(post_program == 0)
+		return 0;
+
+	post_coord = get_attrib(post_program, "coord");
+	post_scene = get_uniform(post_program, "scene");
+	post_depth = get_uniform(post_program, "depth");
+	post_history = get_uniform(post_program, "history");
+	post_reproject = get_uniform(post_program, "reproject");
+	post_pixel = get_uniform(post_program, "pixel");
+	post_history_weight = get_uniform(post_program, "history_weight");
+	post_clamp_history = get_uniform(post_program, "clamp_history");
+	post_focus = get_uniform(post_program, "focus");
+	post_aperture = get_uniform(post_program, "aperture");
+
+	if(post_coord == -1 || post_scene == -1 || post_depth == -1 || post_history == -1 || post_reproject == -1 || post_pixel == -1 || post_history_weight == -1 || post_clamp_history == -1 || post_focus == -1 || post_aperture == -1)
+		return 0;
+
+	composite_program = create_program("post.v.glsl", "composite.f.glsl");
+	if(composite_program == 0)
+		return 0;
+
+	composite_coord = get_attrib(composite_program, "coord");
+	composite_accum = get_uniform(composite_program, "accum");
+	composite_revealage = get_uniform(composite_program, "revealage");
+
+	if(composite_coord == -1 || composite_accum == -1 || composite_revealage == -1)
 		return 0;
 
 	/* Upload the texture */
@@ -754,8 +960,34 @@ static int init_resources() {
 
 	glGenBuffers(1, &cursor_vbo);
 
+	/* A quad covering the whole screen, for post-processing */
+
+	static const float quad[4][2] = {{-1, -1}, {1, -1}, {-1, 1}, {1, 1}};
+	glGenBuffers(1, &quad_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof quad, quad, GL_STATIC_DRAW);
+
+	/* Offscreen buffers, their storage is allocated in reshape() */
+
+	glGenTextures(1, &scene_color);
+	glGenTextures(1, &scene_depth);
+	glGenTextures(2, history_color);
+	glGenTextures(1, &oit_accum);
+	glGenTextures(1, &oit_revealage);
+	glGenFramebuffers(1, &scene_fbo);
+	glGenFramebuffers(2, history_fbo);
+	glGenFramebuffers(1, &oit_fbo);
+
+	glUseProgram(post_program);
+	glUniform1i(post_scene, 1);
+	glUniform1i(post_depth, 2);
+	glUniform1i(post_history, 3);
+
+	glUseProgram(composite_program);
+	glUniform1i(composite_accum, 4);
+	glUniform1i(composite_revealage, 5);
+
 	glUseProgram(program);
-	glEnableVertexAttribArray(attribute_coord);
 	glPolygonOffset(1, 1);
 
 	glClearColor(0.6, 0.8, 1.0, 0.0);
@@ -763,13 +995,59 @@ static int init_resources() {
 	return 1;
 }
 
+static void allocate_texture(GLuint texture, GLint internalformat, GLenum format, GLenum filter) {
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalformat, ww, wh, 0, format, GL_FLOAT, NULL);
+}
+
 static void reshape(int w, int h) {
 	ww = w;
 	wh = h;
 	glViewport(0, 0, w, h);
+
+	/* Resize the offscreen buffers to match the window */
+
+	glActiveTexture(GL_TEXTURE1);
+
+	allocate_texture(scene_color, GL_RGBA16F, GL_RGBA, GL_LINEAR);
+	allocate_texture(scene_depth, GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, scene_fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, scene_color, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, scene_depth, 0);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if(status != GL_FRAMEBUFFER_COMPLETE)
+		fprintf(stderr, "glCheckFramebufferStatus: error 0x%x\n", status);
+
+	for(int i = 0; i < 2; i++) {
+		allocate_texture(history_color[i], GL_RGBA16F, GL_RGBA, GL_LINEAR);
+		glBindFramebuffer(GL_FRAMEBUFFER, history_fbo[i]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, history_color[i], 0);
+	}
+
+	allocate_texture(oit_accum, GL_RGBA16F, GL_RGBA, GL_NEAREST);
+	allocate_texture(oit_revealage, GL_R16F, GL_RED, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, oit_fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, oit_accum, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, oit_revealage, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, scene_depth, 0);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glActiveTexture(GL_TEXTURE0);
+
+	history_valid = false;
 }
 
 static bool shift;
+static glm::vec3 velocity;
+
+// How many seconds ahead chunks are prepared along the path the camera is moving on
+static float prefetch_time = 2;
 
 static void move(float movespeed = 10) {
 	static int pt = 0;
@@ -781,19 +1059,23 @@ static void move(float movespeed = 10) {
 	int t = glutGet(GLUT_ELAPSED_TIME);
 	float dt = (t - pt) * 1.0e-3;
 	pt = t;
-	
+
+	velocity = glm::vec3(0, 0, 0);
+
 	if(keys & 1)
-		position -= right * movespeed * dt;
+		velocity -= right * movespeed;
 	if(keys & 2)
-		position += right * movespeed * dt;
+		velocity += right * movespeed;
 	if(keys & 4)
-		position += forward * movespeed * dt;
+		velocity += forward * movespeed;
 	if(keys & 8)
-		position -= forward * movespeed * dt;
+		velocity -= forward * movespeed;
 	if(keys & 16)
-		position.y += movespeed * dt;
+		velocity.y += movespeed;
 	if(keys & 32)
-		position.y -= movespeed * dt;
+		velocity.y -= movespeed;
+
+	position += velocity * dt;
 }
 
 static void idle() {
@@ -803,6 +1085,65 @@ static void idle() {
 
 static float focus = 9999;
 
+static void draw_quad(GLint attribute) {
+	glEnableVertexAttribArray(attribute);
+	glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
+	glVertexAttribPointer(attribute, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	glDisableVertexAttribArray(attribute);
+}
+
+/* Weighted blended order-independent transparency: translucent faces are summed into two buffers
+   in whatever order they come, and then composited over the opaque scene in one full-screen pass. */
+
+static void draw_translucent(glm::mat4 &mvp) {
+	static const GLenum buffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+	static const float zero[4] = {0, 0, 0, 0};
+	static const float one[4] = {1, 1, 1, 1};
+
+	glBindFramebuffer(GL_FRAMEBUFFER, oit_fbo);
+	glDrawBuffers(2, buffers);
+	glClearBufferfv(GL_COLOR, 0, zero);
+	glClearBufferfv(GL_COLOR, 1, one);
+
+	// Test against the opaque depth, but don't let translucent faces hide each other
+	glDepthMask(GL_FALSE);
+	glEnable(GL_BLEND);
+	glBlendFunciARB(0, GL_ONE, GL_ONE);
+	glBlendFunciARB(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+
+	glUniform1f(uniform_oit, 1);
+	glUniform1f(uniform_alpha, 1.0 / 256);
+	glUniform1f(uniform_dither, 0);
+
+	world->render(mvp, LAYER_TRANSLUCENT);
+
+	glUniform1f(uniform_oit, 0);
+	glUniform1f(uniform_alpha, 0.5);
+	glDepthMask(GL_TRUE);
+
+	/* Composite the average translucent color over the opaque scene */
+
+	glBindFramebuffer(GL_FRAMEBUFFER, scene_fbo);
+	glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+	glDisable(GL_DEPTH_TEST);
+
+	glActiveTexture(GL_TEXTURE4);
+	glBindTexture(GL_TEXTURE_2D, oit_accum);
+	glActiveTexture(GL_TEXTURE5);
+	glBindTexture(GL_TEXTURE_2D, oit_revealage);
+	glActiveTexture(GL_TEXTURE0);
+
+	glUseProgram(composite_program);
+	draw_quad(composite_coord);
+	glUseProgram(program);
+
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+	glEnableVertexAttribArray(attribute_coord);
+	glUniformMatrix4fv(uniform_mvp, 1, GL_FALSE, glm::value_ptr(mvp));
+}
+
 static void draw_scene(glm::mat4 &mvp, glm::mat4 &view, glm::mat4 &projection) {
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
@@ -811,7 +1152,12 @@ static void draw_scene(glm::mat4 &mvp, glm::mat4 &view, glm::mat4 &projection) {
 
 	/* Then draw chunks */
 
-	world->render(mvp);
+	if(transparency == TRANSPARENCY_OIT) {
+		world->render(mvp, LAYER_OPAQUE);
+		draw_translucent(mvp);
+	} else {
+		world->render(mvp);
+	}
 
 	/* Very naive ray casting algorithm to find out which block we are looking at */
 
@@ -947,75 +1293,233 @@ static const float cuttoff[16] = {
 	3.5/16, 12.5/16, 7.5/16, 8.5/16
 };
 
-static bool display_frame() {
-	static int i = 0;
+/* Low-discrepancy sequence, used for subpixel offsets that cover the pixel evenly over successive frames */
+
+static float halton(int i, int base) {
+	float f = 1;
+	float r = 0;
+
+	while(i > 0) {
+		f /= base;
+		r += f * (i % base);
+		i /= base;
+	}
+
+	return r;
+}
+
+static int framerate = 24;
+
+/* Render the scene into the scene buffer */
+
+static void render_scene(glm::mat4 &mvp, glm::mat4 &view, glm::mat4 &projection, float alpha, bool dither) {
+	glUniform1f(uniform_alpha, alpha);
+	glUniform1f(uniform_dither, dither);
+	glUniformMatrix4fv(uniform_mvp, 1, GL_FALSE, glm::value_ptr(mvp));
 
+	glBindFramebuffer(GL_FRAMEBUFFER, scene_fbo);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glEnableVertexAttribArray(attribute_coord);
 
-	/* Calculate the translation matrix used for anti-aliasing */
+	draw_scene(mvp, view, projection);
 
-	glm::mat4 aamat(1.0f);
-	
-	if(aa)
-		aamat = glm::translate(aamat, glm::vec3((float)(i % 4) / (4 * ww), (float)(i / 4) / (4 * wh), 0.0f));
+	glDisableVertexAttribArray(attribute_coord);
+}
+
+/* Run the post-processing shader over the scene buffer, writing into the currently bound framebuffer */
+
+static void post_process(const glm::mat4 &reproject, float weight, bool clamp_history, float aperture) {
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
 
-	/* Our bokeh is a ring */
-	glm::vec3 bokeh = glm::vec3(0.0f, cosf(i * 2.0 * M_PI / maxi), 0.0f) + right * sinf(i * 2.0 * M_PI / maxi);
+	glUseProgram(post_program);
+	glUniformMatrix4fv(post_reproject, 1, GL_FALSE, glm::value_ptr(reproject));
+	glUniform2f(post_pixel, 1.0 / ww, 1.0 / wh);
+	glUniform1f(post_history_weight, weight);
+	glUniform1f(post_clamp_history, clamp_history);
+	glUniform1f(post_focus, focus);
+	glUniform1f(post_aperture, aperture);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, scene_color);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, scene_depth);
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, history_color[!history_cur]);
+	glActiveTexture(GL_TEXTURE0);
 
-	/* If depth-of-field is enabled, our ring has a non-zero radius */
+	draw_quad(post_coord);
 
-	if(dof)
-		bokeh *= 0.05f;
-	else
-		bokeh *= 0;
+	glUseProgram(program);
+}
 
-	/* If transparency is enabled, we use a different alpha cutoff for every frame */
+static void display() {
+	static int frame = 0;
+	struct timeval tv = {0, 1000000 / framerate};
+	int i = frame++ % maxi;
 
-	float alpha = 0.5;
+	/* Jitter the projection by a different subpixel offset every frame for anti-aliasing */
 
-	if(transparency)
-		alpha = cuttoff[i];
+	glm::mat4 aamat(1.0f);
+	
+	if(aa)
+		aamat = glm::translate(aamat, glm::vec3((halton(i + 1, 2) - 0.5f) * 2 / ww, (halton(i + 1, 3) - 0.5f) * 2 / wh, 0.0f));
 
-	glUniform1f(uniform_alpha, alpha);
+	/* If dithered transparency is enabled, we use a different alpha cutoff for every frame and every pixel */
+
+	bool dither = transparency == TRANSPARENCY_DITHERED;
+	float alpha = dither ? cuttoff[i] : 0.5;
 
 	/* Calculate the MVP matrix */
 
-	//glm::mat4 view = glm::lookAt(position + bokeh, position + lookat * focus, glm::vec3(0.0, 1.0, 0.0));
-	glm::mat4 view = glm::lookAt(position + bokeh, position + lookat * focus, up);
+	glm::mat4 view = glm::lookAt(position, position + lookat, up);
 	glm::mat4 projection = glm::perspective(45.0f, 1.0f*ww/wh, 0.01f, 1000.0f);
 
-	glm::mat4 mvp = aamat * projection * view;
+	glm::mat4 vp = projection * view;
+	glm::mat4 mvp = aamat * vp;
 
-	glUniformMatrix4fv(uniform_mvp, 1, GL_FALSE, glm::value_ptr(mvp));
+	world->predict(position, velocity, lookat, up, projection, prefetch_time);
 
-	draw_scene(mvp, view, projection);
-	glAccum(i ? GL_ACCUM : GL_LOAD, 1.0 / maxi);
+	/* Render the scene, only once */
+
+	render_scene(mvp, view, projection, alpha, dither);
+
+	/* Combine it with the history of previous frames */
 
-	/* And we are done */
+	float weight = 0;
 
-	i++;
-	if(i >= maxi)  {
-		glAccum(GL_RETURN, 1);
-		glutSwapBuffers();
-		i = 0;
+	if(history_valid) {
+		// Motion blur keeps a fading trail of previous frames,
+		// anti-aliasing and dithered transparency average many frames of the same surface
+		if(motion_blur)
+			weight = 0.6;
+		else if(aa || dither)
+			weight = 1 - 1.0 / maxi;
 	}
 
-	return i;
+	// Without motion blur, follow surfaces to where they were in the previous frame
+	glm::mat4 reproject(1.0f);
+	if(!motion_blur)
+		reproject = prev_vp * glm::inverse(mvp);
+
+	// Radius in pixels of the circle of confusion at infinity, for an aperture of 5 cm
+	float aperture = dof ? 0.05f * projection[1][1] * wh / 2 : 0;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, history_fbo[history_cur]);
+	post_process(reproject, weight, !motion_blur && !dof, aperture);
+
+	/* Copy the result to the screen, and we are done */
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, history_fbo[history_cur]);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, ww, wh, 0, 0, ww, wh, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glutSwapBuffers();
+
+	prev_vp = vp;
+	history_cur = !history_cur;
+	history_valid = true;
+
+	select(0, NULL, NULL, NULL, &tv);
 }
 
-static int framerate = 24;
+static double elapsed(const struct timeval &start) {
+	struct timeval end;
+	glFinish();
+	gettimeofday(&end, NULL);
+	return (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_usec - start.tv_usec) * 1e-3;
+}
 
-static void display() {
-	struct timeval tv = {0, 1000000 / framerate};
+/* Compare weighted blended OIT against the accumulation approach, which renders the scene
+   once for every alpha cutoff value and averages the results. Run with --benchmark. */
 
-	if(motion_blur) {
-		display_frame();
-		tv.tv_usec /= maxi;
-	} else {
-		while(display_frame());
+static void benchmark() {
+	const int runs = 10;
+
+	if(!GLEW_ARB_draw_buffers_blend) {
+		fprintf(stderr, "No support for GL_ARB_draw_buffers_blend found\n");
+		return;
 	}
 
-	select(0, NULL, NULL, NULL, &tv);
+	glm::mat4 view = glm::lookAt(position, position + lookat, up);
+	glm::mat4 projection = glm::perspective(45.0f, 1.0f*ww/wh, 0.01f, 1000.0f);
+	glm::mat4 mvp = projection * view;
+	glm::mat4 one(1.0f);
+	struct timeval start;
+	int saved = transparency;
+
+	// Use a fixed world, and generate everything in view
+	world->seed = 1;
+	do {
+		render_scene(mvp, view, projection, 0.5, false);
+	} while(world->generating);
+
+	// Put a wall of glass and a wall of leaves in front of the camera, with water behind
+	for(int x = -8; x <= 8; x++) {
+		for(int y = CY - 8; y <= CY + 4; y++) {
+			world->set(x, y, 8, 9);
+			world->set(x, y, 12, 4);
+			world->set(x, y, 16, 8);
+		}
+	}
+
+	// Accumulation: draw the scene once per cutoff, and add each result with weight 1 / maxi
+	transparency = TRANSPARENCY_OFF;
+	render_scene(mvp, view, projection, 0.5, false);
+
+	static const float zero[4] = {0, 0, 0, 0};
+
+	gettimeofday(&start, NULL);
+	for(int r = 0; r < runs; r++) {
+		glBindFramebuffer(GL_FRAMEBUFFER, history_fbo[0]);
+		glClearBufferfv(GL_COLOR, 0, zero);
+
+		for(int i = 0; i < maxi; i++) {
+			render_scene(mvp, view, projection, cuttoff[i], false);
+			glBindFramebuffer(GL_FRAMEBUFFER, history_fbo[0]);
+			glEnable(GL_BLEND);
+			glBlendColor(0, 0, 0, 1.0 / maxi);
+			glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE);
+			post_process(one, 0, false, 0);
+			glDisable(GL_BLEND);
+		}
+	}
+	double accumulation = elapsed(start) / runs;
+
+	// Weighted blended OIT: the scene is drawn once
+	transparency = TRANSPARENCY_OIT;
+	render_scene(mvp, view, projection, 0.5, false);
+
+	gettimeofday(&start, NULL);
+	for(int r = 0; r < runs; r++)
+		render_scene(mvp, view, projection, 0.5, false);
+	double oit = elapsed(start) / runs;
+
+	// How much do the two images differ?
+	float *a = new float[ww * wh * 4];
+	float *b = new float[ww * wh * 4];
+	glBindFramebuffer(GL_FRAMEBUFFER, history_fbo[0]);
+	glReadPixels(0, 0, ww, wh, GL_RGBA, GL_FLOAT, a);
+	glBindFramebuffer(GL_FRAMEBUFFER, scene_fbo);
+	glReadPixels(0, 0, ww, wh, GL_RGBA, GL_FLOAT, b);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	double difference = 0;
+	for(int i = 0; i < ww * wh * 4; i++)
+		if(i % 4 != 3)
+			difference += fabs(a[i] - b[i]);
+	difference /= ww * wh * 3;
+
+	delete[] a;
+	delete[] b;
+
+	printf("Accumulation, %d passes: %.2f ms per frame\n", maxi, accumulation);
+	printf("Weighted blended OIT, 1 pass: %.2f ms per frame\n", oit);
+	printf("Speedup: %.1fx, mean color difference: %.4f\n", accumulation / oit, difference);
+
+	transparency = saved;
+	history_valid = false;
 }
 
 static void keyboard(unsigned char key, int x, int y) {
@@ -1107,9 +1611,12 @@ static void special(int key, int x, int y) {
 			fprintf(stderr, "Depth-of-field is now %s\n", dof ? "on" : "off");
 			break;
 		case GLUT_KEY_F4:
-			// Toggle transparency
-			transparency = !transparency;
-			fprintf(stderr, "Transparency is now %s\n", transparency ? "on" : "off");
+			// Cycle through transparency modes, skipping OIT if we can't blend each draw buffer differently
+			transparency = (transparency + 1) % 3;
+			if(transparency == TRANSPARENCY_OIT && !GLEW_ARB_draw_buffers_blend)
+				transparency = TRANSPARENCY_OFF;
+			history_valid = false;
+			fprintf(stderr, "Transparency is now %s\n", transparency_names[transparency]);
 			break;
 		case GLUT_KEY_F5:
 			// Toggle focus-on-glass
@@ -1199,6 +1706,8 @@ static void mouse(int button, int state, int x, int y) {
 
 static void free_resources() {
 	glDeleteProgram(program);
+	glDeleteProgram(post_program);
+	glDeleteProgram(composite_program);
 }
 
 int main(int argc, char* argv[]) {
@@ -1213,8 +1722,8 @@ int main(int argc, char* argv[]) {
 		return 1;
 	}
 
-	if (!GLEW_VERSION_2_0) {
-		fprintf(stderr, "No support for OpenGL 2.0 found\n");
+	if (!GLEW_VERSION_3_0) {
+		fprintf(stderr, "No support for OpenGL 3.0 found\n");
 		return 1;
 	}
 
@@ -1227,25 +1736,44 @@ int main(int argc, char* argv[]) {
 	printf("Press F1 to toggle motion blur.\n");
 	printf("Press F2 to toggle anti-aliasing.\n");
 	printf("Press F3 to toggle depth-of-field.\n");
-	printf("Press F4 to toggle transparency.\n");
+	printf("Press F4 to change the transparency mode.\n");
 	printf("Press F5 to toggle focussing on transparent blocks.\n");
 	printf("Press F6 to change the framerate limit.\n");
+	printf("Start with --prefetch SECONDS to change how far ahead chunks are prepared while moving, 0 turns it off.\n");
+
+	bool bench = false;
+
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "--benchmark")) {
+			bench = true;
+		} else if(!strcmp(argv[i], "--prefetch") && i + 1 < argc) {
+			prefetch_time = atof(argv[++i]);
+		} else {
+			fprintf(stderr, "Usage: %s [--benchmark] [--prefetch SECONDS]\n", argv[0]);
+			return 1;
+		}
+	}
 
 	if (init_resources()) {
-		glutSetCursor(GLUT_CURSOR_NONE);
-		glutWarpPointer(320, 240);
-		glutDisplayFunc(display);
-		glutReshapeFunc(reshape);
-		glutIdleFunc(display);
-		glutKeyboardFunc(keyboard);
-		glutKeyboardUpFunc(keyboardup);
-		glutSpecialFunc(special);
-		glutSpecialUpFunc(specialup);
-		glutIdleFunc(idle);
-		glutPassiveMotionFunc(motion);
-		glutMotionFunc(motion);
-		glutMouseFunc(mouse);
-		glutMainLoop();
+		if (bench) {
+			reshape(640, 480);
+			benchmark();
+		} else {
+			glutSetCursor(GLUT_CURSOR_NONE);
+			glutWarpPointer(320, 240);
+			glutDisplayFunc(display);
+			glutReshapeFunc(reshape);
+			glutIdleFunc(display);
+			glutKeyboardFunc(keyboard);
+			glutKeyboardUpFunc(keyboardup);
+			glutSpecialFunc(special);
+			glutSpecialUpFunc(specialup);
+			glutIdleFunc(idle);
+			glutPassiveMotionFunc(motion);
+			glutMotionFunc(motion);
+			glutMouseFunc(mouse);
+			glutMainLoop();
+		}
 	}
 
 	free_resources();
@@ -1,6 +1,8 @@
 varying vec4 texcoord;
 uniform sampler2D texture;
 uniform float alpha;
+uniform float dither;
+uniform float oit;
 
 const vec4 fogcolor = vec4(0.6, 0.8, 1.0, 1.0);
 const float fogdensity = .00003;
@@ -21,8 +23,15 @@ void main(void) {
 	
 	vec4 color = texture2D(texture, coord2d);
 
-	// Very cheap "transparency": don't draw pixels with a low alpha value
-	if(color.a < alpha)
+	// Very cheap "transparency": don't draw pixels with a low alpha value.
+	// When dithering, the cutoff varies over a 4x4 Bayer pattern, so that together with
+	// the per-frame cutoff, neighbouring pixels and successive frames average out.
+	vec2 p = mod(floor(gl_FragCoord.xy), 4.0);
+	vec2 q = mod(p, 2.0);
+	vec2 r = floor(p / 2.0);
+	float bayer = 4.0 * mod(2.0 * q.x + 3.0 * q.y, 4.0) + mod(2.0 * r.x + 3.0 * r.y, 4.0);
+
+	if(color.a < fract(alpha + dither * bayer / 16.0))
 		discard;
 
 	// Attenuate sides of blocks
@@ -33,5 +42,16 @@ void main(void) {
 	float fog = clamp(exp(-fogdensity * z * z), 0.2, 1.0);
 
 	// Final color is a mix of the actual color and the fog color
-	gl_FragColor = mix(fogcolor, color, fog);
+	color.rgb = mix(fogcolor.rgb, color.rgb, fog);
+
+	// For weighted blended order-independent transparency (McGuire and Bavoil, 2013),
+	// sum the premultiplied colors, weighted so that nearby surfaces dominate,
+	// and separately the product of (1 - alpha) using the blend function
+	if(oit > 0.0) {
+		float weight = color.a * clamp(0.03 / (1e-5 + pow(z / 200.0, 4.0)), 1e-2, 3e3);
+		gl_FragData[0] = vec4(color.rgb * color.a, color.a) * weight;
+		gl_FragData[1] = vec4(color.a);
+	} else {
+		gl_FragData[0] = color;
+	}
 }
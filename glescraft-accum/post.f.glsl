@@ -0,0 +1,78 @@
+varying vec2 uv;
+uniform sampler2D scene;
+uniform sampler2D depth;
+uniform sampler2D history;
+uniform mat4 reproject;
+uniform vec2 pixel;
+uniform float history_weight;
+uniform float clamp_history;
+uniform float focus;
+uniform float aperture;
+
+const float near = 0.01;
+const float far = 1000.0;
+
+// Distance from the eye of whatever was drawn at the given texture coordinate
+float eyedepth(vec2 p) {
+	float d = texture2D(depth, p).x;
+	return near * far / (far - d * (far - near));
+}
+
+// Radius in pixels of the circle of confusion of a point at distance z
+float coc(float z) {
+	return min(aperture * abs(1.0 / z - 1.0 / focus), 16.0);
+}
+
+void main(void) {
+	vec4 color = texture2D(scene, uv);
+
+	// Depth of field: gather two rings of samples around this pixel.
+	// A sample only contributes if its own circle of confusion reaches this pixel,
+	// so sharp objects in focus don't smear over the blurry background.
+	if(aperture > 0.0) {
+		float r = coc(eyedepth(uv));
+		vec4 sum = color;
+		float total = 1.0;
+
+		for(int i = 0; i < 24; i++) {
+			float ring = i < 8 ? 0.5 : 1.0;
+			float a = float(i) * (i < 8 ? 0.785398 : 0.392699);
+			vec2 offset = vec2(cos(a), sin(a)) * r * ring;
+			vec2 p = uv + offset * pixel;
+			float w = clamp(coc(eyedepth(p)) / max(r * ring, 0.001), 0.0, 1.0);
+			sum += texture2D(scene, p) * w;
+			total += w;
+		}
+
+		color = sum / total;
+	}
+
+	// Find where this pixel was in the previous frame
+	vec4 prev = reproject * vec4(uv * 2.0 - 1.0, texture2D(depth, uv).x * 2.0 - 1.0, 1.0);
+	vec2 prevuv = prev.xy / prev.w * 0.5 + 0.5;
+
+	float weight = history_weight;
+	if(any(lessThan(prevuv, vec2(0.0))) || any(greaterThan(prevuv, vec2(1.0))))
+		weight = 0.0;
+
+	vec4 old = texture2D(history, prevuv);
+
+	// Clamp the history to the colors around this pixel in the current frame,
+	// so surfaces that were just uncovered don't leave ghosts behind
+	if(clamp_history > 0.0) {
+		vec4 lo = color;
+		vec4 hi = color;
+
+		for(int y = -1; y <= 1; y++) {
+			for(int x = -1; x <= 1; x++) {
+				vec4 c = texture2D(scene, uv + vec2(float(x), float(y)) * pixel);
+				lo = min(lo, c);
+				hi = max(hi, c);
+			}
+		}
+
+		old = clamp(old, lo, hi);
+	}
+
+	gl_FragColor = mix(color, old, weight);
+}
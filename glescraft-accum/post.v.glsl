@@ -0,0 +1,7 @@
+attribute vec2 coord;
+varying vec2 uv;
+
+void main(void) {
+	uv = coord * 0.5 + 0.5;
+	gl_Position = vec4(coord, 0.0, 1.0);
+}
@@ -0,0 +1,68 @@
+/* Benchmark adaptor for glescraft-accum */
+
+#include <GL/glew.h>
+#include <GL/glut.h>
+
+#include "headless.h"
+#include "bench.h"
+
+#define main glescraft_main
+#include "../glescraft-accum/glescraft.cpp"
+#undef main
+
+const char *bench_variant = "glescraft-accum";
+const int bench_vertex_size = sizeof(byte4);
+
+bool bench_init(int width, int height, int seed) {
+	int argc = 1;
+	char *argv[] = {(char *)"bench", NULL};
+
+	glutInit(&argc, argv);
+	glutInitWindowSize(width, height);
+	glutCreateWindow("GLEScraft benchmark");
+
+	// Without GLX, glewInit() reports an error, but it has loaded all GL functions by then
+	glewInit();
+
+	if(!init_resources())
+		return false;
+
+	reshape(width, height);
+	world->seed = seed;
+
+	// Don't sleep between frames
+	framerate = 1 << 30;
+
+	return true;
+}
+
+void bench_camera(float x, float y, float z, float yaw, float pitch) {
+	position = glm::vec3(x, y, z);
+	angle = glm::vec3(yaw, pitch, 0);
+	update_vectors();
+}
+
+void bench_frame(int time) {
+	headless_time = time;
+	now = time / 1000;
+	display();
+}
+
+int bench_remesh() {
+	int chunks = 0;
+
+	for(int x = 0; x < SCX; x++) {
+		for(int y = 0; y < SCY; y++) {
+			for(int z = 0; z < SCZ; z++) {
+				chunk *c = world->c[x][y][z];
+				if(!c->initialized)
+					continue;
+
+				c->update();
+				chunks++;
+			}
+		}
+	}
+
+	return chunks;
+}
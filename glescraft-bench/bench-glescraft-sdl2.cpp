@@ -0,0 +1,75 @@
+/* Benchmark adaptor for glescraft-sdl2 */
+
+#include <SDL.h>
+#include <SDL_opengles2.h>
+
+#include "bench.h"
+
+#define main glescraft_main
+#include "../glescraft-sdl2/glescraft.cpp"
+#undef main
+
+const char *bench_variant = "glescraft-sdl2";
+const int bench_vertex_size = sizeof(byte4);
+
+bool bench_init(int width, int height, int seed) {
+	// Render without a visible window, unless the user asked for a specific video driver
+	setenv("SDL_VIDEODRIVER", "offscreen", 0);
+
+	if(SDL_Init(SDL_INIT_VIDEO)) {
+		fprintf(stderr, "SDL_Init: %s\n", SDL_GetError());
+		return false;
+	}
+
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_ES);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 2);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 0);
+
+	SDL_Window *window = SDL_CreateWindow("GLEScraft benchmark",
+		SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+		width, height, SDL_WINDOW_OPENGL);
+
+	if(!window || !SDL_GL_CreateContext(window)) {
+		fprintf(stderr, "Could not create an OpenGL ES 2.0 context: %s\n", SDL_GetError());
+		return false;
+	}
+
+	if(!init_resources())
+		return false;
+
+	reshape(width, height);
+	world->seed = seed;
+
+	return true;
+}
+
+void bench_camera(float x, float y, float z, float yaw, float pitch) {
+	position = glm::vec3(x, y, z);
+	angle = glm::vec3(yaw, pitch, 0);
+	update_vectors();
+}
+
+void bench_frame(int time) {
+	// physics() would read the real clock, so set the time used for the chunk LRU directly
+	now = time;
+	render();
+}
+
+int bench_remesh() {
+	int chunks = 0;
+
+	for(int x = 0; x < SCX; x++) {
+		for(int y = 0; y < SCY; y++) {
+			for(int z = 0; z < SCZ; z++) {
+				chunk *c = world->c[x][y][z];
+				if(!c->initialized)
+					continue;
+
+				c->update();
+				chunks++;
+			}
+		}
+	}
+
+	return chunks;
+}
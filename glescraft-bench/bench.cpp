@@ -0,0 +1,168 @@
+/*
+ * Headless benchmark for the glescraft variants.
+ * It flies the camera along a fixed path through a world generated from a fixed seed,
+ * with a fixed timestep, and prints the results as JSON.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <vector>
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include "bench.h"
+
+/* bench.h redirects these to the wrappers, but here we want the real ones */
+#undef glDrawArrays
+#undef glBufferData
+#undef glBufferSubData
+#undef glCopyBufferSubData
+
+struct bench_counters bench_counters;
+
+void bench_glDrawArrays(GLenum mode, GLint first, GLsizei count) {
+	bench_counters.draw_calls++;
+	bench_counters.vertices_drawn += count;
+	glDrawArrays(mode, first, count);
+}
+
+void bench_glDrawElements(GLenum mode, GLsizei count, GLenum type, const void *indices) {
+	bench_counters.draw_calls++;
+	bench_counters.vertices_drawn += count;
+	glDrawElements(mode, count, type, indices);
+}
+
+// Whether the buffer bound to target was created for static data
+static bool is_static(GLenum target) {
+	GLint usage;
+	glGetBufferParameteriv(target, GL_BUFFER_USAGE, &usage);
+	return usage == GL_STATIC_DRAW;
+}
+
+void bench_glBufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage) {
+	if(data) {
+		bench_counters.uploads++;
+		bench_counters.bytes_uploaded += size;
+		if(usage == GL_STATIC_DRAW)
+			bench_counters.mesh_bytes += size;
+	}
+	glBufferData(target, size, data, usage);
+}
+
+void bench_glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data) {
+	bench_counters.uploads++;
+	bench_counters.bytes_uploaded += size;
+	if(is_static(target))
+		bench_counters.mesh_bytes += size;
+	glBufferSubData(target, offset, size, data);
+}
+
+// Meshes streamed through a mapped buffer are copied from there into their own buffer, which counts as an upload too
+void bench_glCopyBufferSubData(GLenum readtarget, GLenum writetarget, GLintptr readoffset, GLintptr writeoffset, GLsizeiptr size) {
+	bench_counters.uploads++;
+	bench_counters.bytes_uploaded += size;
+	if(is_static(writetarget))
+		bench_counters.mesh_bytes += size;
+	glCopyBufferSubData(readtarget, writetarget, readoffset, writeoffset, size);
+}
+
+static double now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e3 + tv.tv_usec * 1e-3;
+}
+
+static double percentile(std::vector<double> sorted, double p) {
+	std::sort(sorted.begin(), sorted.end());
+	return sorted[std::min(sorted.size() - 1, (size_t)(p / 100 * sorted.size()))];
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [--frames N] [--size WIDTH HEIGHT] [--seed N]\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	int frames = 300;
+	int width = 640;
+	int height = 480;
+	int seed = 1;
+
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "--frames") && i + 1 < argc)
+			frames = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--size") && i + 2 < argc) {
+			width = atoi(argv[++i]);
+			height = atoi(argv[++i]);
+		} else if(!strcmp(argv[i], "--seed") && i + 1 < argc)
+			seed = atoi(argv[++i]);
+		else
+			usage(argv[0]);
+	}
+
+	if(frames < 1 || width < 1 || height < 1)
+		usage(argv[0]);
+
+	if(!bench_init(width, height, seed)) {
+		fprintf(stderr, "%s: could not initialize\n", bench_variant);
+		return 1;
+	}
+
+	/* The camera script: fly forward over the terrain at 10 blocks per second while slowly looking around.
+	   Every frame advances the clock by exactly 1/60th of a second. */
+
+	std::vector<double> times(frames);
+
+	memset(&bench_counters, 0, sizeof bench_counters);
+
+	for(int i = 0; i < frames; i++) {
+		float t = i / 60.0;
+		bench_camera(8 * sinf(t * 0.5), 34, 10 * t, 0.5 * sinf(t * 0.3), -0.3 - 0.1 * cosf(t * 0.7));
+
+		double start = now();
+		bench_frame(i * 1000 / 60);
+		glFinish();
+		times[i] = now() - start;
+	}
+
+	struct bench_counters rendering = bench_counters;
+
+	double total = 0;
+	for(int i = 0; i < frames; i++)
+		total += times[i];
+
+	/* Now measure meshing on its own, by rebuilding the mesh of every chunk that was generated */
+
+	memset(&bench_counters, 0, sizeof bench_counters);
+
+	double start = now();
+	int chunks = bench_remesh();
+	glFinish();
+	double meshing = now() - start;
+
+	printf("{\n");
+	printf("\t\"variant\": \"%s\",\n", bench_variant);
+	printf("\t\"renderer\": \"%s\",\n", glGetString(GL_RENDERER));
+	printf("\t\"width\": %d,\n", width);
+	printf("\t\"height\": %d,\n", height);
+	printf("\t\"seed\": %d,\n", seed);
+	printf("\t\"frames\": %d,\n", frames);
+	printf("\t\"ms_per_frame\": {\"mean\": %.3f, \"median\": %.3f, \"p95\": %.3f, \"max\": %.3f},\n",
+			total / frames, percentile(times, 50), percentile(times, 95), percentile(times, 100));
+	printf("\t\"draw_calls\": %ld,\n", rendering.draw_calls);
+	printf("\t\"draw_calls_per_frame\": %.1f,\n", (double)rendering.draw_calls / frames);
+	printf("\t\"vertices_drawn\": %ld,\n", rendering.vertices_drawn);
+	printf("\t\"vertices_uploaded\": %ld,\n", rendering.mesh_bytes / bench_vertex_size);
+	printf("\t\"bytes_uploaded\": %ld,\n", rendering.bytes_uploaded);
+	printf("\t\"meshing\": {\"chunks\": %d, \"ms\": %.3f, \"ms_per_chunk\": %.4f, \"vertices\": %ld}\n",
+			chunks, meshing, chunks ? meshing / chunks : 0, bench_counters.mesh_bytes / bench_vertex_size);
+	printf("}\n");
+
+	return 0;
+}
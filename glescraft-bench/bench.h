@@ -0,0 +1,49 @@
+/*
+ * Interface between the benchmark driver (bench.cpp) and the adaptors for each glescraft variant.
+ * An adaptor includes the variant's source code, after this header, so that the
+ * draw and upload calls made by the variant go through the counting wrappers below.
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+struct bench_counters {
+	long draw_calls;
+	long vertices_drawn;
+	long uploads;
+	long bytes_uploaded;
+	long mesh_bytes; // Bytes written to GL_STATIC_DRAW buffers, which is what chunk meshes use
+};
+
+extern struct bench_counters bench_counters;
+
+/* Implemented by each adaptor */
+
+extern const char *bench_variant;
+extern const int bench_vertex_size;
+
+bool bench_init(int width, int height, int seed);
+void bench_camera(float x, float y, float z, float yaw, float pitch);
+void bench_frame(int time);
+int bench_remesh();
+
+/* Counting wrappers, implemented in bench.cpp */
+
+void bench_glDrawArrays(GLenum mode, GLint first, GLsizei count);
+void bench_glDrawElements(GLenum mode, GLsizei count, GLenum type, const void *indices);
+void bench_glBufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage);
+void bench_glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data);
+void bench_glCopyBufferSubData(GLenum readtarget, GLenum writetarget, GLintptr readoffset, GLintptr writeoffset, GLsizeiptr size);
+
+#undef glDrawArrays
+#undef glDrawElements
+#undef glBufferData
+#undef glBufferSubData
+#undef glCopyBufferSubData
+#define glDrawArrays bench_glDrawArrays
+#define glDrawElements bench_glDrawElements
+#define glBufferData bench_glBufferData
+#define glBufferSubData bench_glBufferSubData
+#define glCopyBufferSubData bench_glCopyBufferSubData
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * Entity simulation benchmark for glescraft.
+ * It generates a square region of the world, drops a large number of mobs and items on it,
+ * and measures how long each call to entities::tick() takes. No GL context is created and no GL calls are made.
+ *
+ * The exit status is 1 if the median time per tick is over the budget.
+ */
+
+#include <sys/time.h>
+#include <algorithm>
+
+#define main glescraft_main
+#include "../glescraft/glescraft.cpp"
+#undef main
+
+static double now_ms() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e3 + tv.tv_usec * 1e-3;
+}
+
+static double percentile(std::vector<double> sorted, double p) {
+	std::sort(sorted.begin(), sorted.end());
+	return sorted[std::min(sorted.size() - 1, (size_t)(p / 100 * sorted.size()))];
+}
+
+// Height of the highest block under a square of 2 * r by 2 * r blocks
+static int ground(const superchunk *w, float x, float z, float r) {
+	int top = world_lo[1];
+
+	for(int bx = floorf(x - r); bx < ceilf(x + r); bx++) {
+		for(int bz = floorf(z - r); bz < ceilf(z + r); bz++) {
+			int y = world_lo[1] + CY * SCY - 1;
+			while(y > top && !w->get(bx, y, bz))
+				y--;
+			top = y;
+		}
+	}
+
+	return top + 1;
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [--entities N] [--ticks N] [--threads N] [--size N] [--seed N] [--budget MS]\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	int count = 10000;
+	int ticks = 300;
+	int threads = 0;
+	int size = 8;
+	int seed = 1;
+	double budget = 2;
+
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "--entities") && i + 1 < argc)
+			count = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--ticks") && i + 1 < argc)
+			ticks = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--threads") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--size") && i + 1 < argc)
+			size = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--seed") && i + 1 < argc)
+			seed = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--budget") && i + 1 < argc)
+			budget = atof(argv[++i]);
+		else
+			usage(argv[0]);
+	}
+
+	if(count < 1 || ticks < 1 || size < 1 || size > SCX || size > SCZ)
+		usage(argv[0]);
+
+	/* Generate a region of size x size chunk columns in the middle of the world */
+
+	superchunk *w = new superchunk;
+	w->seed = seed;
+	srand(seed);
+
+	int x0 = (SCX - size) / 2;
+	int z0 = (SCZ - size) / 2;
+
+	for(int x = x0; x < x0 + size; x++)
+		for(int y = 0; y < SCY; y++)
+			for(int z = z0; z < z0 + size; z++)
+				w->generate(w->c[x][y][z]);
+
+	/* Drop the entities from just above the ground at random places in the region. One in five is a small item that lies still. */
+
+	entities e;
+	float lx = world_lo[0] + x0 * CX + MAXRADIUS;
+	float lz = world_lo[2] + z0 * CZ + MAXRADIUS;
+	float extent = size * CX - 2 * MAXRADIUS;
+
+	for(int i = 0; i < count; i++) {
+		float x = lx + rand() * extent / RAND_MAX;
+		float z = lz + rand() * extent / RAND_MAX;
+
+		float y = ground(w, x, z, MAXRADIUS) + rand() * 2.0 / RAND_MAX;
+
+		if(i % 5 == 4) {
+			e.spawn(x, y, z, 0.125, 0.25, 0, 0);
+		} else {
+			float a = rand() * 2 * M_PI / RAND_MAX;
+			e.spawn(x, y, z, 0.3, 1.8, sinf(a) * 2, cosf(a) * 2);
+		}
+	}
+
+	std::vector<double> times;
+	long contacts = 0;
+
+	for(int i = 0; i < ticks; i++) {
+		double start = now_ms();
+		e.tick(w, 1.0 / 60, threads);
+		times.push_back(now_ms() - start);
+		contacts += e.contacts;
+	}
+
+	double sum = 0;
+	for(size_t i = 0; i < times.size(); i++)
+		sum += times[i];
+
+	double median = percentile(times, 50);
+
+	printf("{\n");
+	printf("\t\"entities\": %d,\n", count);
+	printf("\t\"ticks\": %d,\n", ticks);
+	printf("\t\"threads\": %d,\n", threads > 0 ? threads : worker_pool::shared().size());
+	printf("\t\"size\": %d,\n", size);
+	printf("\t\"seed\": %d,\n", seed);
+	printf("\t\"contacts_per_tick\": %.1f,\n", (double)contacts / ticks);
+	printf("\t\"ms_per_tick\": {\"mean\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f},\n",
+			sum / ticks, median, percentile(times, 90), percentile(times, 99), percentile(times, 100));
+	printf("\t\"budget_ms\": %.3f,\n", budget);
+	printf("\t\"within_budget\": %s\n", median <= budget ? "true" : "false");
+	printf("}\n");
+
+	return median <= budget ? 0 : 1;
+}
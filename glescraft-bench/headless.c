@@ -0,0 +1,130 @@
+/*
+ * A tiny stand-in for GLUT that renders into an offscreen EGL pbuffer,
+ * so the GLUT based glescraft variants can be benchmarked without a display.
+ * Only the functions used by those variants are implemented.
+ * Run with EGL_PLATFORM=surfaceless if there is no X server.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <EGL/egl.h>
+#include <GL/glut.h>
+
+#include "headless.h"
+
+static int width = 640;
+static int height = 480;
+
+int headless_time;
+
+void glutInit(int *argcp, char **argv) {
+}
+
+void glutInitDisplayMode(unsigned int mode) {
+}
+
+void glutInitWindowSize(int w, int h) {
+	width = w;
+	height = h;
+}
+
+int glutCreateWindow(const char *title) {
+	EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if(display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+		fprintf(stderr, "Could not initialize EGL\n");
+		exit(1);
+	}
+
+	static const EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_DEPTH_SIZE, 24,
+		EGL_NONE
+	};
+
+	EGLConfig config;
+	EGLint n;
+	if(!eglChooseConfig(display, config_attribs, &config, 1, &n) || n < 1) {
+		fprintf(stderr, "No suitable EGL config found\n");
+		exit(1);
+	}
+
+	eglBindAPI(EGL_OPENGL_API);
+
+	const EGLint surface_attribs[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+	EGLSurface surface = eglCreatePbufferSurface(display, config, surface_attribs);
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+
+	if(surface == EGL_NO_SURFACE || context == EGL_NO_CONTEXT || !eglMakeCurrent(display, surface, surface, context)) {
+		fprintf(stderr, "Could not create an offscreen OpenGL context\n");
+		exit(1);
+	}
+
+	return 1;
+}
+
+/* Time does not pass by itself, the benchmark driver sets it for every frame */
+int glutGet(GLenum what) {
+	switch(what) {
+		case GLUT_ELAPSED_TIME:
+			return headless_time;
+		case GLUT_WINDOW_WIDTH:
+			return width;
+		case GLUT_WINDOW_HEIGHT:
+			return height;
+		default:
+			return 0;
+	}
+}
+
+int glutGetModifiers(void) {
+	return 0;
+}
+
+void glutSwapBuffers(void) {
+}
+
+void glutPostRedisplay(void) {
+}
+
+void glutSetCursor(int cursor) {
+}
+
+void glutWarpPointer(int x, int y) {
+}
+
+void glutMainLoop(void) {
+}
+
+void glutDisplayFunc(void (*callback)(void)) {
+}
+
+void glutReshapeFunc(void (*callback)(int, int)) {
+}
+
+void glutIdleFunc(void (*callback)(void)) {
+}
+
+void glutKeyboardFunc(void (*callback)(unsigned char, int, int)) {
+}
+
+void glutKeyboardUpFunc(void (*callback)(unsigned char, int, int)) {
+}
+
+void glutSpecialFunc(void (*callback)(int, int, int)) {
+}
+
+void glutSpecialUpFunc(void (*callback)(int, int, int)) {
+}
+
+void glutMouseFunc(void (*callback)(int, int, int, int)) {
+}
+
+void glutMotionFunc(void (*callback)(int, int)) {
+}
+
+void glutPassiveMotionFunc(void (*callback)(int, int)) {
+}
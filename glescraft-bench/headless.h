@@ -0,0 +1,15 @@
+#ifndef _HEADLESS_H
+#define _HEADLESS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Value returned by glutGet(GLUT_ELAPSED_TIME), in milliseconds */
+extern int headless_time;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,423 @@
+/*
+ * Top-down map tiles of glescraft worlds.
+ * It generates a square region of the world on all cores, optionally applies the edits from a recording made with
+ * glescraft --record, and writes a pyramid of PNG tiles: DIR/ZOOM/X/Y.png, where ZOOM 0 is a single tile showing
+ * the whole region, and at the highest zoom level every pixel is one block. No GL context is created and no GL calls are made.
+ *
+ * A manifest with a hash of every chunk column is written next to the tiles. With --incremental, only the tiles
+ * showing columns whose hash changed since the last run are rendered again, along with the tiles above them in the pyramid.
+ */
+
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <png.h>
+#include <algorithm>
+
+#define main glescraft_main
+#include "../glescraft/glescraft.cpp"
+#undef main
+
+// Colour of the top of every type of block
+static const uint8_t mapcolors[16][3] = {
+	{0, 0, 0}, {134, 96, 67}, {110, 140, 60}, {95, 159, 53}, {60, 120, 40}, {102, 81, 51}, {125, 125, 125}, {219, 211, 160},
+	{50, 90, 200}, {200, 220, 230}, {150, 70, 60}, {110, 110, 120}, {160, 130, 80}, {240, 240, 240}, {30, 30, 30}, {255, 0, 255},
+};
+
+// What can be seen of a chunk column from above
+struct column {
+	uint8_t top[CX][CZ];   // The highest block that is not air or water
+	int16_t height[CX][CZ]; // The y coordinate of that block
+	uint8_t depth[CX][CZ];  // How much water is on top of it
+	uint64_t hash;
+	bool changed;
+};
+
+static double now_ms() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e3 + tv.tv_usec * 1e-3;
+}
+
+/* Generate the terrain of the chunk columns in a region. Trees can grow into the neighbouring columns,
+   so only columns that are at least three columns apart are generated at the same time. The terrain of
+   every chunk only depends on the seed and its position, so the result is the same for any number of threads.
+   The first version of the generator placed trees with rand(), so that one only runs on a single thread,
+   and its trees are not the same as in glescraft, which generates chunks in a different order.
+   Lighting is not needed for the map, so chunks are not lit. Smooth terrain has the same blocks, so the map
+   looks the same, but its chunks get their density field like in glescraft. */
+
+static void generate(superchunk *w, int x0, int z0, int size, int threads) {
+	if(!w->generator)
+		threads = 1;
+
+	for(int phase = 0; phase < 9; phase++) {
+		std::vector<int> todo;
+
+		for(int x = x0; x < x0 + size; x++)
+			for(int z = z0; z < z0 + size; z++)
+				if(x % 3 == phase / 3 && z % 3 == phase % 3)
+					todo.push_back(x * SCZ + z);
+
+		parallel(todo.size(), threads, [&](int i) {
+			for(int y = 0; y < SCY; y++) {
+				chunk *ch = w->c[todo[i] / SCZ][y][todo[i] % SCZ];
+				ch->smooth = w->smooth;
+				ch->noise(w->seed, w->generator);
+			}
+		});
+	}
+}
+
+static void summarize(const superchunk *w, int cx, int cz, column &col) {
+	uint64_t h = 1469598103934665603UL;
+
+	for(int x = 0; x < CX; x++) {
+		for(int z = 0; z < CZ; z++) {
+			int y = CY * SCY - 1;
+			uint8_t type = 0;
+			int depth = 0;
+
+			for(; y >= 0; y--) {
+				type = w->c[cx][y / CY][cz]->blk[x][y % CY][z];
+				if(type == 8)
+					depth++;
+				else if(type)
+					break;
+			}
+
+			col.top[x][z] = y >= 0 ? type : 0;
+			col.height[x][z] = y + world_lo[1];
+			col.depth[x][z] = std::min(depth, 255);
+
+			uint8_t v[4] = {col.top[x][z], (uint8_t)col.height[x][z], (uint8_t)(col.height[x][z] >> 8), col.depth[x][z]};
+			for(int i = 0; i < 4; i++)
+				h = (h ^ v[i]) * 1099511628211UL;
+		}
+	}
+
+	col.hash = h;
+}
+
+/* The colour of a block seen from above. Slopes facing the north-west are lit, the others are in the shade,
+   and water gets darker the deeper it is. */
+
+static void shade(const column *cols, int size, int bx, int bz, uint8_t *rgba) {
+	const column &c = cols[bx / CX * size + bz / CZ];
+	int x = bx % CX;
+	int z = bz % CZ;
+	int h = c.height[x][z];
+	int nw = h;
+
+	if(bx > 0 && bz > 0)
+		nw = cols[(bx - 1) / CX * size + (bz - 1) / CZ].height[(bx - 1) % CX][(bz - 1) % CZ];
+
+	float light = std::min(1.3f, std::max(0.7f, 1.0f + (h - nw) * 0.1f));
+	float water = c.depth[x][z] ? std::min(0.85f, 0.4f + c.depth[x][z] * 0.05f) : 0;
+
+	for(int i = 0; i < 3; i++) {
+		float v = mapcolors[c.top[x][z]][i] * light * (1 - water) + mapcolors[8][i] * water;
+		rgba[i] = std::min(255.0f, v);
+	}
+
+	rgba[3] = c.top[x][z] || c.depth[x][z] ? 255 : 0;
+}
+
+static bool write_png(const char *filename, const uint8_t *rgba, int width, int height) {
+	FILE *f = fopen(filename, "wb");
+	if(!f) {
+		perror(filename);
+		return false;
+	}
+
+	png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	png_infop info = png_create_info_struct(png);
+
+	if(setjmp(png_jmpbuf(png))) {
+		png_destroy_write_struct(&png, &info);
+		fclose(f);
+		fprintf(stderr, "%s: could not write PNG\n", filename);
+		return false;
+	}
+
+	png_init_io(png, f);
+	png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png, info);
+
+	for(int y = 0; y < height; y++)
+		png_write_row(png, (png_bytep)(rgba + y * width * 4));
+
+	png_write_end(png, NULL);
+	png_destroy_write_struct(&png, &info);
+	fclose(f);
+	return true;
+}
+
+static void makedir(const char *path) {
+	if(mkdir(path, 0777) && errno != EEXIST) {
+		perror(path);
+		exit(1);
+	}
+}
+
+/* The manifest starts with the seed, the size of the region and the size of the tiles,
+   followed by a line for every chunk column with its position and hash. */
+
+static bool load_manifest(const char *filename, int seed, int size, int tile, column *cols) {
+	FILE *f = fopen(filename, "r");
+	if(!f)
+		return false;
+
+	int s, n, t;
+	if(fscanf(f, "%d %d %d", &s, &n, &t) != 3 || s != seed || n != size || t != tile) {
+		fclose(f);
+		return false;
+	}
+
+	int x, z;
+	unsigned long long hash;
+
+	while(fscanf(f, "%d %d %llx", &x, &z, &hash) == 3)
+		if(x >= 0 && x < size && z >= 0 && z < size)
+			cols[x * size + z].changed = cols[x * size + z].hash != hash;
+
+	fclose(f);
+	return true;
+}
+
+static void save_manifest(const char *filename, int seed, int size, int tile, const column *cols) {
+	FILE *f = fopen(filename, "w");
+	if(!f) {
+		perror(filename);
+		exit(1);
+	}
+
+	fprintf(f, "%d %d %d\n", seed, size, tile);
+	for(int x = 0; x < size; x++)
+		for(int z = 0; z < size; z++)
+			fprintf(f, "%d %d %016llx\n", x, z, (unsigned long long)cols[x * size + z].hash);
+
+	fclose(f);
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [--out DIR] [--seed N] [--size N] [--tile N] [--threads N] [--replay FILE] [--incremental]\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	const char *out = "tiles";
+	const char *recordingfile = NULL;
+	int seed = 1;
+	int size = SCX;
+	int tile = 256;
+	int threads = 0;
+	bool incremental = false;
+
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "--out") && i + 1 < argc)
+			out = argv[++i];
+		else if(!strcmp(argv[i], "--seed") && i + 1 < argc)
+			seed = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--size") && i + 1 < argc)
+			size = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--tile") && i + 1 < argc)
+			tile = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--threads") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--replay") && i + 1 < argc)
+			recordingfile = argv[++i];
+		else if(!strcmp(argv[i], "--incremental"))
+			incremental = true;
+		else
+			usage(argv[0]);
+	}
+
+	if(size < 1 || size > SCX || size > SCZ || tile < 16)
+		usage(argv[0]);
+
+	if(threads <= 0)
+		threads = std::thread::hardware_concurrency();
+
+	/* Generate a region of size x size chunk columns in the middle of the world, and apply the edits */
+
+	double start = now_ms();
+
+	// The seed of a recording, whether its terrain is smooth and the version of the generator decide which world it was made in
+	int generator = GENERATOR;
+	bool smooth = false;
+
+	if(recordingfile) {
+		int width, height;
+
+		replaying = fopen(recordingfile, "rb");
+		if(!replaying) {
+			perror(recordingfile);
+			return 1;
+		}
+
+		if(!replay_header(seed, width, height, smooth, generator)) {
+			fprintf(stderr, "%s: not a recording\n", recordingfile);
+			return 1;
+		}
+	}
+
+	world = new superchunk;
+	world->seed = seed;
+	world->smooth = smooth;
+	world->generator = generator;
+	srand(seed);
+
+	int x0 = (SCX - size) / 2;
+	int z0 = (SCZ - size) / 2;
+
+	generate(world, x0, z0, size, threads);
+
+	// Only changes to blocks matter for the map, but replaying the camera and the mobs as well costs little
+	if(replaying) {
+		while(replay_next());
+		fclose(replaying);
+		replaying = NULL;
+	}
+
+	double generated = now_ms();
+
+	/* Find out what can be seen from above, and which columns changed since the last run */
+
+	std::vector<column> cols(size * size);
+
+	parallel(size * size, threads, [&](int i) {
+		summarize(world, x0 + i / size, z0 + i % size, cols[i]);
+		cols[i].changed = true;
+	});
+
+	char manifest[4096];
+	snprintf(manifest, sizeof manifest, "%s/manifest", out);
+
+	bool loaded = incremental && load_manifest(manifest, seed, size, tile, cols.data());
+
+	/* The image of the whole region, one pixel per block, with north at the top */
+
+	int extent = size * CX;
+	std::vector<uint8_t> image(extent * extent * 4);
+
+	parallel(extent, threads, [&](int bz) {
+		for(int bx = 0; bx < extent; bx++)
+			shade(cols.data(), size, bx, bz, &image[(bz * extent + bx) * 4]);
+	});
+
+	/* The pyramid. At the highest zoom level a tile covers tile x tile blocks, every level below covers twice as much in each direction. */
+
+	int levels = 1;
+	while((tile << (levels - 1)) < extent)
+		levels++;
+
+	struct tileid {
+		int zoom, x, y;
+	};
+
+	std::vector<tileid> todo;
+	int skipped = 0;
+
+	for(int zoom = 0; zoom < levels; zoom++) {
+		int scale = 1 << (levels - 1 - zoom); // Blocks per pixel
+		int span = tile * scale;              // Blocks per tile
+		int count = (extent + span - 1) / span;
+
+		for(int tx = 0; tx < count; tx++) {
+			for(int ty = 0; ty < count; ty++) {
+				char filename[4096];
+				snprintf(filename, sizeof filename, "%s/%d/%d/%d.png", out, zoom, tx, ty);
+
+				/* A tile has to be rendered again if a column it shows changed. The shading of a block depends on the one to the north-west of it,
+				   so that includes columns that only touch the tile on the north and west side. */
+
+				bool dirty = !loaded || access(filename, F_OK);
+
+				for(int cx = std::max(0, (tx * span - 1) / CX); !dirty && cx < size && cx * CX < (tx + 1) * span; cx++)
+					for(int cz = std::max(0, (ty * span - 1) / CZ); !dirty && cz < size && cz * CZ < (ty + 1) * span; cz++)
+						dirty = cols[cx * size + cz].changed;
+
+				if(!dirty) {
+					skipped++;
+					continue;
+				}
+
+				tileid t = {zoom, tx, ty};
+				todo.push_back(t);
+			}
+		}
+	}
+
+	/* Directories are made first, so the tiles can be written on all threads */
+
+	char path[4096];
+	makedir(out);
+
+	for(size_t i = 0; i < todo.size(); i++) {
+		snprintf(path, sizeof path, "%s/%d", out, todo[i].zoom);
+		makedir(path);
+		snprintf(path, sizeof path, "%s/%d/%d", out, todo[i].zoom, todo[i].x);
+		makedir(path);
+	}
+
+	std::atomic<int> failed(0);
+
+	parallel(todo.size(), threads, [&](int i) {
+		const tileid &t = todo[i];
+		int scale = 1 << (levels - 1 - t.zoom);
+		std::vector<uint8_t> pixels(tile * tile * 4);
+
+		// Every pixel is the average of the blocks it covers, blocks outside the region are transparent
+		for(int py = 0; py < tile; py++) {
+			for(int px = 0; px < tile; px++) {
+				int sum[4] = {0, 0, 0, 0};
+
+				for(int by = (t.y * tile + py) * scale; by < (t.y * tile + py + 1) * scale && by < extent; by++) {
+					for(int bx = (t.x * tile + px) * scale; bx < (t.x * tile + px + 1) * scale && bx < extent; bx++) {
+						const uint8_t *p = &image[(by * extent + bx) * 4];
+						for(int k = 0; k < 3; k++)
+							sum[k] += p[k] * p[3];
+						sum[3] += p[3];
+					}
+				}
+
+				uint8_t *p = &pixels[(py * tile + px) * 4];
+				for(int k = 0; k < 3; k++)
+					p[k] = sum[3] ? sum[k] / sum[3] : 0;
+				p[3] = sum[3] / (scale * scale);
+			}
+		}
+
+		char filename[4096];
+		snprintf(filename, sizeof filename, "%s/%d/%d/%d.png", out, t.zoom, t.x, t.y);
+		if(!write_png(filename, pixels.data(), tile, tile))
+			failed++;
+	});
+
+	if(failed)
+		return 1;
+
+	save_manifest(manifest, seed, size, tile, cols.data());
+
+	double rendered = now_ms();
+
+	int changed = 0;
+	for(size_t i = 0; i < cols.size(); i++)
+		changed += cols[i].changed;
+
+	printf("{\n");
+	printf("\t\"seed\": %d,\n", seed);
+	printf("\t\"size\": %d,\n", size);
+	printf("\t\"threads\": %d,\n", threads);
+	printf("\t\"levels\": %d,\n", levels);
+	printf("\t\"columns_changed\": %d,\n", loaded ? changed : (int)cols.size());
+	printf("\t\"tiles_written\": %d,\n", (int)todo.size());
+	printf("\t\"tiles_skipped\": %d,\n", skipped);
+	printf("\t\"generate_ms\": %.1f,\n", generated - start);
+	printf("\t\"render_ms\": %.1f\n", rendered - generated);
+	printf("}\n");
+
+	return 0;
+}
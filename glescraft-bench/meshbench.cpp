@@ -0,0 +1,444 @@
+/*
+ * Terrain generation and meshing benchmark for glescraft.
+ * It generates square regions of the world for a fixed set of seeds and region sizes,
+ * and then builds the mesh of every section in them, and the bricks and brick mesh used for distant chunks.
+ * No GL context is created and no GL calls are made,
+ * so this runs on machines without a GPU or display.
+ *
+ * With --smooth the sections are meshed as smooth terrain instead of blocks.
+ *
+ * With --save FILE the median timings and quad counts are written to FILE,
+ * with --baseline FILE they are compared against it, and the exit status is 1 if anything got worse.
+ *
+ * With --packcheck nothing is timed. Instead, each region is checked to come out the same
+ * whether or not its chunks were packed in between, see packcheck(). The exit status is 1 if it does not.
+ */
+
+#include <sys/time.h>
+#include <algorithm>
+
+#define main glescraft_main
+#include "../glescraft/glescraft.cpp"
+#undef main
+
+// Everything measured for one seed and region size
+struct result {
+	int seed;
+	int size;
+	int chunks;
+	std::vector<double> generate; // Time to generate and light each chunk, in ms
+	std::vector<double> mesh;     // Time to mesh all sections of each chunk, in ms
+	std::vector<double> brick;    // Time to build the bricks of each chunk and their mesh, in ms
+	long vertices;
+	long merged;
+	long meshbytes;               // Size of the meshes of all sections, as they would be uploaded
+	long brickbytes;              // Memory used by the bricks of all chunks
+	long packedbytes;             // Memory used by all chunks once they are packed, bricks included
+	long farvertices;
+};
+
+static double now_ms() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e3 + tv.tv_usec * 1e-3;
+}
+
+static double percentile(std::vector<double> sorted, double p) {
+	std::sort(sorted.begin(), sorted.end());
+	return sorted[std::min(sorted.size() - 1, (size_t)(p / 100 * sorted.size()))];
+}
+
+static double total(const std::vector<double> &times) {
+	double sum = 0;
+	for(size_t i = 0; i < times.size(); i++)
+		sum += times[i];
+	return sum;
+}
+
+/* Generate a region of size x size chunk columns in the middle of the world, and mesh it.
+   glm::simplex() does not take a seed, so the seed only changes the random numbers used for placing trees.
+   Each round starts with a fresh world, so generation is measured from scratch every time. */
+
+static void run(result &res, int rounds, bool smooth) {
+	static byte4 vertex[SECTIONVERTICES];
+	static uint8_t vlight[SECTIONVERTICES];
+
+	int x0 = (SCX - res.size) / 2;
+	int z0 = (SCZ - res.size) / 2;
+
+	for(int round = 0; round < rounds; round++) {
+		superchunk *w = new superchunk;
+		w->seed = res.seed;
+		w->smooth = smooth;
+
+		for(int x = x0; x < x0 + res.size; x++) {
+			for(int y = 0; y < SCY; y++) {
+				for(int z = z0; z < z0 + res.size; z++) {
+					double start = now_ms();
+					w->generate(w->c[x][y][z]);
+					res.generate.push_back(now_ms() - start);
+				}
+			}
+		}
+
+		res.vertices = 0;
+		res.merged = 0;
+		res.meshbytes = 0;
+
+		for(int x = x0; x < x0 + res.size; x++) {
+			for(int y = 0; y < SCY; y++) {
+				for(int z = z0; z < z0 + res.size; z++) {
+					double start = now_ms();
+					for(int s = 0; s < SECTIONS; s++) {
+						if(smooth) {
+							sectionmesh m;
+							w->c[x][y][z]->build(s, m);
+							res.vertices += m.elements;
+							res.meshbytes += m.bytes;
+						} else {
+							int merged;
+							int i = w->c[x][y][z]->mesh(s, vertex, vlight, merged);
+							res.vertices += i;
+							res.merged += merged;
+							res.meshbytes += meshbytes(i, 0);
+						}
+					}
+					res.mesh.push_back(now_ms() - start);
+				}
+			}
+		}
+
+		res.brickbytes = 0;
+		res.farvertices = 0;
+
+		for(int x = x0; x < x0 + res.size; x++) {
+			for(int y = 0; y < SCY; y++) {
+				for(int z = z0; z < z0 + res.size; z++) {
+					chunk *ch = w->c[x][y][z];
+					double start = now_ms();
+					ch->bricked = false;
+					ch->rebrick();
+					res.farvertices += ch->farmesh(vertex, vlight);
+					res.brick.push_back(now_ms() - start);
+					res.brickbytes += ch->brickbytes();
+				}
+			}
+		}
+
+		// Only after all the far meshes are built, those read the light of the neighbours
+		res.packedbytes = 0;
+
+		for(int x = x0; x < x0 + res.size; x++) {
+			for(int y = 0; y < SCY; y++) {
+				for(int z = z0; z < z0 + res.size; z++) {
+					chunk *ch = w->c[x][y][z];
+					ch->pack();
+					res.packedbytes += ch->brickbytes() + ch->packed.size();
+				}
+			}
+		}
+
+		for(int x = 0; x < SCX; x++)
+			for(int y = 0; y < SCY; y++)
+				for(int z = 0; z < SCZ; z++)
+					delete w->c[x][y][z];
+		delete w;
+	}
+
+	res.chunks = res.size * res.size * SCY;
+}
+
+static void print_timings(const char *name, const std::vector<double> &times, int voxels, bool last) {
+	double sum = total(times);
+	printf("\t\t\"%s\": {\"ms\": %.3f, \"chunks_per_s\": %.1f, \"voxels_per_s\": %.0f, \"ms_per_chunk\": {\"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f}}%s\n",
+			name, sum, times.size() * 1e3 / sum, (double)voxels * times.size() * 1e3 / sum,
+			percentile(times, 50), percentile(times, 90), percentile(times, 99), percentile(times, 100), last ? "" : ",");
+}
+
+/* Count the differences between a world that packed its chunks and one that did not. Packed chunks are read
+   through their bricks with at() and solid(), and with unpack set, they are then unpacked and compared in full. */
+
+static long packdiff(superchunk *a, superchunk *b, bool unpack) {
+	long diff = 0;
+
+	for(int x = 0; x < SCX; x++) {
+		for(int y = 0; y < SCY; y++) {
+			for(int z = 0; z < SCZ; z++) {
+				chunk *p = a->c[x][y][z];
+				chunk *q = b->c[x][y][z];
+
+				if(p->noised != q->noised) {
+					diff++;
+					continue;
+				}
+
+				if(!p->noised)
+					continue;
+
+				for(int i = 0; i < CX; i++) {
+					for(int j = 0; j < CY; j++) {
+						for(int k = 0; k < CZ; k++) {
+							int bx = world_lo[0] + x * CX + i;
+							int by = world_lo[1] + y * CY + j;
+							int bz = world_lo[2] + z * CZ + k;
+							diff += p->at(i, j, k) != q->blk[i][j][k];
+							diff += a->solid(bx, by, bz) != b->solid(bx, by, bz);
+						}
+					}
+				}
+
+				if(!unpack)
+					continue;
+
+				p->unpack();
+				diff += p->blocks != q->blocks;
+				diff += memcmp(p->light, q->light, CX * CY * CZ) != 0;
+				diff += !p->density != !q->density || (p->density && memcmp(p->density, q->density, CX * CY * CZ));
+				diff += !p->flow != !q->flow || (p->flow && memcmp(p->flow, q->flow, CX * CY * CZ));
+			}
+		}
+	}
+
+	return diff;
+}
+
+/* Generate the same region in two worlds, and pack every chunk of one of them. Then make the same changes to both:
+   edits, water that flows for a while, and newly generated chunks next to the packed ones, whose trees may reach into them.
+   All of those unpack what they need. Returns the number of differences, before and after the changes. */
+
+static long packcheck(int seed, int size, bool smooth) {
+	superchunk *w[2];
+	int x0 = (SCX - size) / 2;
+	int z0 = (SCZ - size) / 2;
+
+	for(int k = 0; k < 2; k++) {
+		w[k] = new superchunk;
+		w[k]->seed = seed;
+		w[k]->smooth = smooth;
+
+		for(int x = x0; x < x0 + size; x++)
+			for(int y = 0; y < SCY; y++)
+				for(int z = z0; z < z0 + size; z++)
+					w[k]->initialize(w[k]->c[x][y][z]);
+	}
+
+	for(int x = 0; x < SCX; x++)
+		for(int y = 0; y < SCY; y++)
+			for(int z = 0; z < SCZ; z++)
+				if(w[0]->c[x][y][z]->noised)
+					w[0]->c[x][y][z]->pack();
+
+	long diff = packdiff(w[0], w[1], false);
+
+	int bx = world_lo[0] + x0 * CX;
+	int bz = world_lo[2] + z0 * CZ;
+	int e = size * CX;
+
+	for(int k = 0; k < 2; k++) {
+		w[k]->set(bx + e / 4, 10, bz + e / 4, 3);
+		w[k]->set(bx + e / 2, 5, bz + e / 3, 0);
+		w[k]->sphere(bx + e / 3, 5, bz + e * 3 / 4, 6, 0);
+		w[k]->fill(bx + e / 2, 0, bz + e / 2, bx + e / 2 + 10, 12, bz + e / 2 + 10, 8);
+		w[k]->set(bx + e * 3 / 4, 30, bz + e * 3 / 4, 8);
+
+		for(int t = 0; t < 40; t++)
+			w[k]->flow();
+
+		if(x0 > 0)
+			for(int y = 0; y < SCY; y++)
+				for(int z = z0; z < z0 + size; z++)
+					w[k]->initialize(w[k]->c[x0 - 1][y][z]);
+	}
+
+	diff += packdiff(w[0], w[1], true);
+
+	for(int k = 0; k < 2; k++) {
+		for(int x = 0; x < SCX; x++)
+			for(int y = 0; y < SCY; y++)
+				for(int z = 0; z < SCZ; z++)
+					delete w[k]->c[x][y][z];
+		delete w[k];
+	}
+
+	return diff;
+}
+
+/* The baseline file has one line per seed and size: seed, size, median generation and meshing time per chunk, and number of quads */
+
+static void save(const char *filename, const std::vector<result> &results) {
+	FILE *f = fopen(filename, "w");
+	if(!f) {
+		perror(filename);
+		exit(1);
+	}
+
+	for(size_t i = 0; i < results.size(); i++) {
+		const result &r = results[i];
+		fprintf(f, "%d %d %.6f %.6f %ld\n", r.seed, r.size, percentile(r.generate, 50), percentile(r.mesh, 50), r.vertices / 6);
+	}
+
+	fclose(f);
+}
+
+static bool compare(const char *filename, const std::vector<result> &results, double tolerance) {
+	FILE *f = fopen(filename, "r");
+	if(!f) {
+		perror(filename);
+		exit(1);
+	}
+
+	bool ok = true;
+	int seed, size;
+	double generate, mesh;
+	long quads;
+
+	while(fscanf(f, "%d %d %lf %lf %ld", &seed, &size, &generate, &mesh, &quads) == 5) {
+		for(size_t i = 0; i < results.size(); i++) {
+			const result &r = results[i];
+			if(r.seed != seed || r.size != size)
+				continue;
+
+			double g = percentile(r.generate, 50);
+			double m = percentile(r.mesh, 50);
+
+			if(g > generate * (1 + tolerance)) {
+				fprintf(stderr, "seed %d size %d: generation regressed from %.4f to %.4f ms per chunk\n", seed, size, generate, g);
+				ok = false;
+			}
+			if(m > mesh * (1 + tolerance)) {
+				fprintf(stderr, "seed %d size %d: meshing regressed from %.4f to %.4f ms per chunk\n", seed, size, mesh, m);
+				ok = false;
+			}
+			if(r.vertices / 6 > quads) {
+				fprintf(stderr, "seed %d size %d: quads increased from %ld to %ld\n", seed, size, quads, r.vertices / 6);
+				ok = false;
+			}
+		}
+	}
+
+	fclose(f);
+	return ok;
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [--seeds N...] [--sizes N...] [--rounds N] [--smooth] [--save FILE] [--baseline FILE] [--tolerance PERCENT] [--packcheck]\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	std::vector<int> seeds;
+	std::vector<int> sizes;
+	int rounds = 3;
+	const char *savefile = NULL;
+	const char *baseline = NULL;
+	double tolerance = 10;
+	bool smooth = false;
+	bool check = false;
+
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "--seeds")) {
+			while(i + 1 < argc && argv[i + 1][0] != '-')
+				seeds.push_back(atoi(argv[++i]));
+		} else if(!strcmp(argv[i], "--sizes")) {
+			while(i + 1 < argc && argv[i + 1][0] != '-')
+				sizes.push_back(atoi(argv[++i]));
+		} else if(!strcmp(argv[i], "--rounds") && i + 1 < argc)
+			rounds = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--smooth"))
+			smooth = true;
+		else if(!strcmp(argv[i], "--save") && i + 1 < argc)
+			savefile = argv[++i];
+		else if(!strcmp(argv[i], "--baseline") && i + 1 < argc)
+			baseline = argv[++i];
+		else if(!strcmp(argv[i], "--tolerance") && i + 1 < argc)
+			tolerance = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--packcheck"))
+			check = true;
+		else
+			usage(argv[0]);
+	}
+
+	if(seeds.empty()) {
+		seeds.push_back(1);
+		seeds.push_back(2);
+		seeds.push_back(3);
+	}
+
+	if(sizes.empty()) {
+		sizes.push_back(4);
+		sizes.push_back(8);
+		sizes.push_back(16);
+	}
+
+	if(rounds < 1)
+		usage(argv[0]);
+
+	for(size_t i = 0; i < sizes.size(); i++)
+		if(sizes[i] < 1 || sizes[i] > SCX || sizes[i] > SCZ)
+			usage(argv[0]);
+
+	if(check) {
+		long total = 0;
+
+		printf("[\n");
+		for(size_t i = 0; i < seeds.size(); i++) {
+			for(size_t j = 0; j < sizes.size(); j++) {
+				long diff = packcheck(seeds[i], sizes[j], smooth);
+				total += diff;
+				printf("\t{\"seed\": %d, \"size\": %d, \"differences\": %ld}%s\n", seeds[i], sizes[j], diff,
+						i + 1 < seeds.size() || j + 1 < sizes.size() ? "," : "");
+			}
+		}
+		printf("]\n");
+
+		return total ? 1 : 0;
+	}
+
+	std::vector<result> results;
+
+	for(size_t i = 0; i < seeds.size(); i++) {
+		for(size_t j = 0; j < sizes.size(); j++) {
+			result r;
+			r.seed = seeds[i];
+			r.size = sizes[j];
+			run(r, rounds, smooth);
+			results.push_back(r);
+		}
+	}
+
+	/* The merge ratio is the number of block faces per quad, so 1 means no faces were merged at all */
+
+	printf("[\n");
+	for(size_t i = 0; i < results.size(); i++) {
+		const result &r = results[i];
+		long quads = r.vertices / 6;
+		int voxels = CX * CY * CZ;
+
+		printf("\t{\n");
+		printf("\t\t\"seed\": %d,\n", r.seed);
+		printf("\t\t\"size\": %d,\n", r.size);
+		printf("\t\t\"chunks\": %d,\n", r.chunks);
+		printf("\t\t\"rounds\": %d,\n", rounds);
+		print_timings("generate", r.generate, voxels, false);
+		print_timings("mesh", r.mesh, voxels, false);
+		print_timings("bricks", r.brick, voxels, false);
+		printf("\t\t\"quads\": %ld,\n", quads);
+		printf("\t\t\"merged\": %ld,\n", r.merged);
+		printf("\t\t\"merge_ratio\": %.3f,\n", quads ? (double)(quads + r.merged) / quads : 1.0);
+		printf("\t\t\"mesh_bytes_per_chunk\": %.1f,\n", (double)r.meshbytes / r.chunks);
+		printf("\t\t\"far_quads\": %ld,\n", r.farvertices / 6);
+		printf("\t\t\"brick_bytes_per_chunk\": %.1f,\n", (double)r.brickbytes / r.chunks);
+		printf("\t\t\"packed_bytes_per_chunk\": %.1f,\n", (double)r.packedbytes / r.chunks);
+		printf("\t\t\"block_bytes_per_chunk\": %d\n", CX * CY * CZ);
+		printf("\t}%s\n", i + 1 < results.size() ? "," : "");
+	}
+	printf("]\n");
+
+	if(savefile)
+		save(savefile, results);
+
+	if(baseline && !compare(baseline, results, tolerance / 100))
+		return 1;
+
+	return 0;
+}
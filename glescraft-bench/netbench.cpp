@@ -0,0 +1,248 @@
+/*
+ * Loopback benchmark for the glescraft world server.
+ * It starts a world server in a child process, with a square region of the world generated up front,
+ * and connects to it as a viewer, once through shared memory and once through the Unix socket only.
+ * For both, it measures how fast the region arrives, and how long it takes from sending an edit
+ * until the blocks and light levels it changed have been applied to the viewer's copy of the world.
+ * No GL context is created and no GL calls are made.
+ */
+
+#include <sys/wait.h>
+
+#define main glescraft_main
+#include "../glescraft/glescraft.cpp"
+#undef main
+
+// Everything measured for one way of connecting
+struct result {
+	bool shm;
+	int chunks;
+	double catchup;              // Time until all chunks arrived, in ms
+	uint64_t bytes;              // Bytes received until then
+	std::vector<float> latency;  // Time from sending each edit until it was applied, in ms
+	uint64_t editbytes;          // Bytes received for all edits together
+	long sections;               // Sections the edits caused to be meshed again
+};
+
+// Wait until the server accepts connections, it only starts listening once it has generated the region
+static bool wait_for_server(const char *path, pid_t child) {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof addr.sun_path, "%s", path);
+
+	while(waitpid(child, NULL, WNOHANG) == 0) {
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		bool ok = connect(fd, (struct sockaddr *)&addr, sizeof addr) == 0;
+		close(fd);
+
+		if(ok)
+			return true;
+
+		usleep(10000);
+	}
+
+	return false;
+}
+
+// Receive until cond() is true, returns false if the server went away first
+template<typename F> static bool receive_until(F cond) {
+	while(!cond()) {
+		if(server->link.closed)
+			return false;
+
+		receive_world();
+		std::this_thread::yield();
+	}
+
+	return true;
+}
+
+// Count the sections that are waiting to be meshed, and pretend they have been
+static int remesh() {
+	int sections = 0;
+
+	for(int x = 0; x < SCX; x++)
+		for(int y = 0; y < SCY; y++)
+			for(int z = 0; z < SCZ; z++)
+				for(int s = 0; s < SECTIONS; s++)
+					if(world->c[x][y][z]->sec[s].changed.exchange(false))
+						sections++;
+
+	return sections;
+}
+
+static bool run(const char *path, bool useshm, int size, int edits, result &res) {
+	world = new superchunk;
+
+	if(!connect_server(path, useshm))
+		return false;
+
+	res.shm = server->link.inring != NULL;
+
+	/* The server sends every chunk it has when a viewer connects */
+
+	int expected = size * size * SCY;
+	double start = wallclock();
+
+	if(!receive_until([=]() { return server->chunks >= expected; }))
+		return false;
+
+	res.catchup = wallclock() - start;
+	res.chunks = server->chunks;
+	res.bytes = server->link.received;
+
+	remesh();
+
+	/* Place a block on top of a random column in the region, and remove it again with the next edit.
+	   Columns with water on top are skipped, so the edits do not make any water flow. */
+
+	int lx = world_lo[0] + (SCX - size) / 2 * CX;
+	int lz = world_lo[2] + (SCZ - size) / 2 * CZ;
+	int x = 0, y = 0, z = 0;
+
+	res.editbytes = 0;
+	res.sections = 0;
+
+	for(int i = 0; i < edits; i++) {
+		if(i % 2 == 0) {
+			do {
+				x = lx + rand() % (size * CX);
+				z = lz + rand() % (size * CZ);
+				y = world_hi[1] - 1;
+				while(y > world_lo[1] && !world->get(x, y, z))
+					y--;
+			} while(world->get(x, y, z) == 8 || y >= world_hi[1] - 1);
+			y++;
+		}
+
+		command cmd = {'S', x, y, z, 0, (uint8_t)(i % 2 == 0 ? 6 : 0)};
+		uint64_t before = server->link.received;
+		double sent = wallclock();
+
+		send_command(cmd);
+		server->link.flush();
+
+		if(!receive_until([]() { return server->acknowledged == server->sent; }))
+			return false;
+
+		res.latency.push_back(wallclock() - sent);
+		res.editbytes += server->link.received - before;
+		res.sections += remesh();
+	}
+
+	disconnect_server();
+
+	for(int x = 0; x < SCX; x++)
+		for(int y = 0; y < SCY; y++)
+			for(int z = 0; z < SCZ; z++)
+				delete world->c[x][y][z];
+	delete world;
+	world = NULL;
+
+	return true;
+}
+
+static void print_result(const result &r, int edits, bool last) {
+	double raw = (double)r.chunks * CX * CY * CZ * 2;
+
+	printf("\t\"%s\": {\n", r.shm ? "shm" : "socket");
+	printf("\t\t\"chunks\": %d,\n", r.chunks);
+	printf("\t\t\"catchup_ms\": %.3f,\n", r.catchup);
+	printf("\t\t\"chunks_per_s\": %.1f,\n", r.chunks * 1e3 / r.catchup);
+	printf("\t\t\"mb_per_s\": %.2f,\n", r.bytes / r.catchup * 1e-3);
+	printf("\t\t\"bytes_per_chunk\": %.1f,\n", (double)r.bytes / r.chunks);
+	printf("\t\t\"compression\": %.2f,\n", raw / r.bytes);
+	printf("\t\t\"edit_latency_ms\": {\"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f},\n",
+			percentile(r.latency, 50), percentile(r.latency, 90), percentile(r.latency, 99), percentile(r.latency, 100));
+	printf("\t\t\"bytes_per_edit\": %.1f,\n", (double)r.editbytes / edits);
+	printf("\t\t\"sections_remeshed_per_edit\": %.2f\n", (double)r.sections / edits);
+	printf("\t}%s\n", last ? "" : ",");
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [--size N] [--edits N] [--seed N] [--transport shm|socket|both] [--path PATH]\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	int size = 8;
+	int edits = 1000;
+	int seed = 1;
+	const char *transport = "both";
+	char path[108];
+
+	snprintf(path, sizeof path, "/tmp/glescraft-netbench-%d.sock", (int)getpid());
+
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "--size") && i + 1 < argc)
+			size = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--edits") && i + 1 < argc)
+			edits = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--seed") && i + 1 < argc)
+			seed = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--transport") && i + 1 < argc)
+			transport = argv[++i];
+		else if(!strcmp(argv[i], "--path") && i + 1 < argc)
+			snprintf(path, sizeof path, "%s", argv[++i]);
+		else
+			usage(argv[0]);
+	}
+
+	if(size < 1 || size > SCX || size > SCZ || edits < 1)
+		usage(argv[0]);
+
+	std::vector<bool> modes;
+	if(!strcmp(transport, "shm") || !strcmp(transport, "both"))
+		modes.push_back(true);
+	if(!strcmp(transport, "socket") || !strcmp(transport, "both"))
+		modes.push_back(false);
+	if(modes.empty())
+		usage(argv[0]);
+
+	fflush(stdout);
+	pid_t child = fork();
+
+	if(child == 0) {
+		// The server's own messages would end up in the middle of the results
+		if(!freopen("/dev/null", "w", stdout)) {
+			perror("/dev/null");
+			_exit(1);
+		}
+		_exit(serve(path, seed, size));
+	}
+
+	if(child < 0 || !wait_for_server(path, child)) {
+		fprintf(stderr, "The world server did not start\n");
+		return 1;
+	}
+
+	srand(seed);
+
+	std::vector<result> results;
+	bool ok = true;
+
+	for(size_t i = 0; i < modes.size() && ok; i++) {
+		result r;
+		ok = run(path, modes[i], size, edits, r);
+		results.push_back(r);
+	}
+
+	kill(child, SIGTERM);
+	waitpid(child, NULL, 0);
+
+	if(!ok) {
+		fprintf(stderr, "Lost the connection to the world server\n");
+		return 1;
+	}
+
+	printf("{\n");
+	printf("\t\"size\": %d,\n", size);
+	printf("\t\"seed\": %d,\n", seed);
+	printf("\t\"edits\": %d,\n", edits);
+	for(size_t i = 0; i < results.size(); i++)
+		print_result(results[i], edits, i + 1 == results.size());
+	printf("}\n");
+
+	return 0;
+}
@@ -0,0 +1,726 @@
+/*
+ * Software renderer for glescraft worlds, for machines without a GPU.
+ * It runs the simulation like glescraft does, either along a recording made with glescraft --record,
+ * or along a circle around the middle of the world, and draws every frame on the CPU. No GL context is created and no GL calls are made.
+ *
+ * It draws the same section meshes glescraft uploads to its VBOs, with the same transformations as glescraft.v.glsl,
+ * and colours every pixel the way glescraft.f.glsl does: the same texture coordinates, nearest texel from the textures.c atlas,
+ * discarding texels with a low alpha value, side faces darker than top faces, baked in light and fog.
+ * Only the world is drawn, not the entities, the cursor or the cross.
+ *
+ * Drawing is split in two stages, both running on all cores:
+ * - Transforming: the sections to draw are divided over the threads, in the order glescraft draws them. Every thread transforms its
+ *   triangles, clips them, and puts them in the bins of the screen tiles they touch.
+ * - Rasterizing: every thread takes the next tile that has not been done yet, and draws the triangles in its bins,
+ *   going through the bins of the threads in order, so they are drawn in the same order as by glescraft.
+ *   Edge functions are evaluated for a row of pixels at a time, in fixed point, so shared edges never leave gaps or are drawn twice.
+ *
+ * With --out DIR, every Nth frame is written to DIR as a PNG file. A hash of all frames is printed along with the timings,
+ * it does not depend on the number of threads or the size of the tiles.
+ */
+
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <png.h>
+#include <algorithm>
+#include <unordered_map>
+
+#define main glescraft_main
+#include "../glescraft/glescraft.cpp"
+#undef main
+
+#define SUBPIXEL 16 // Vertex positions are snapped to 1/16th of a pixel
+#define LANES 8     // Pixels tested against the edge functions at once
+#define GUARD 8.0f  // Triangles only need to be clipped when they reach this many times the size of the screen away from its center
+
+static const float fogcolor[3] = {0.6, 0.8, 1.0};
+
+// A vertex after transformation, before the perspective divide
+struct clipvertex {
+	float x, y, z, w;
+	float a[4]; // Texture coordinates and brightness
+};
+
+// A triangle ready to be rasterized, with its attributes divided by w, so they can be interpolated linearly on the screen
+struct triangle {
+	int32_t x[3], y[3]; // Position on the screen in fixed point, y pointing down
+	float z[3];         // Depth in the depth buffer
+	float iw[3];        // 1 / w
+	float a[3][4];      // Attributes divided by w
+	int8_t tw;          // Texture index, the same for all vertices of a face
+};
+
+// What one thread of the transform stage produced
+struct geometry {
+	std::vector<triangle> triangles;
+	std::vector<std::vector<int> > bins; // Indices of the triangles touching every tile
+	long clipped;
+};
+
+// Copies of the meshes glescraft would have in its VBOs, as separate triangles, with coordinates in blocks
+struct softmesh {
+	std::vector<glm::vec4> vertex;
+	std::vector<uint8_t> light;
+};
+
+static std::unordered_map<const section *, softmesh> meshes;
+
+static double now_ms() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e3 + tv.tv_usec * 1e-3;
+}
+
+static double percentile(std::vector<double> sorted, double p) {
+	std::sort(sorted.begin(), sorted.end());
+	return sorted[std::min(sorted.size() - 1, (size_t)(p / 100 * sorted.size()))];
+}
+
+// GLSL fract(), glescraft's fract() is something else
+static float fraction(float x) {
+	return x - floorf(x);
+}
+
+// Rounds towards minus infinity, unlike /
+static int floordiv(int64_t a, int b) {
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+/* Transforming */
+
+class renderer {
+	int width, height;
+	int tile;
+	int tilesx, tilesy;
+	int threads;
+	std::vector<geometry> geo;
+	std::vector<uint8_t> image; // RGB, top row first
+
+	// Which of the clipping planes a vertex is outside of
+	static int outcode(const clipvertex &v) {
+		return (v.z < -v.w) | (v.z > v.w) << 1 | (v.x < -GUARD * v.w) << 2 | (v.x > GUARD * v.w) << 3 | (v.y < -GUARD * v.w) << 4 | (v.y > GUARD * v.w) << 5;
+	}
+
+	// Signed distance to a clipping plane, positive inside
+	static float distance(const clipvertex &v, int plane) {
+		switch(plane) {
+		case 0: return v.z + v.w;
+		case 1: return v.w - v.z;
+		case 2: return GUARD * v.w + v.x;
+		case 3: return GUARD * v.w - v.x;
+		case 4: return GUARD * v.w + v.y;
+		default: return GUARD * v.w - v.y;
+		}
+	}
+
+	static clipvertex lerp(const clipvertex &a, const clipvertex &b, float t) {
+		clipvertex v;
+		v.x = a.x + (b.x - a.x) * t;
+		v.y = a.y + (b.y - a.y) * t;
+		v.z = a.z + (b.z - a.z) * t;
+		v.w = a.w + (b.w - a.w) * t;
+		for(int i = 0; i < 4; i++)
+			v.a[i] = a.a[i] + (b.a[i] - a.a[i]) * t;
+		return v;
+	}
+
+	// Do the perspective divide and viewport transformation, and put the triangle in the bins of the tiles it touches
+	void emit(geometry &g, const clipvertex *v, int8_t tw) {
+		triangle t;
+		t.tw = tw;
+
+		for(int i = 0; i < 3; i++) {
+			float iw = 1 / v[i].w;
+			t.x[i] = lrintf((v[i].x * iw * 0.5f + 0.5f) * width * SUBPIXEL);
+			t.y[i] = lrintf((0.5f - v[i].y * iw * 0.5f) * height * SUBPIXEL);
+			t.z[i] = v[i].z * iw * 0.5f + 0.5f;
+			t.iw[i] = iw;
+			for(int k = 0; k < 4; k++)
+				t.a[i][k] = v[i].a[k] * iw;
+		}
+
+		// Faces are not culled, so the ones seen through glass and leaves are drawn, but it has to be in a fixed winding order
+		int64_t area = (int64_t)(t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) - (int64_t)(t.y[1] - t.y[0]) * (t.x[2] - t.x[0]);
+		if(!area)
+			return;
+
+		if(area < 0) {
+			std::swap(t.x[1], t.x[2]);
+			std::swap(t.y[1], t.y[2]);
+			std::swap(t.z[1], t.z[2]);
+			std::swap(t.iw[1], t.iw[2]);
+			for(int k = 0; k < 4; k++)
+				std::swap(t.a[1][k], t.a[2][k]);
+		}
+
+		// The pixels whose centers are inside the bounding box
+		int x0 = std::max(0, floordiv(std::min(t.x[0], std::min(t.x[1], t.x[2])) - SUBPIXEL / 2 + SUBPIXEL - 1, SUBPIXEL));
+		int y0 = std::max(0, floordiv(std::min(t.y[0], std::min(t.y[1], t.y[2])) - SUBPIXEL / 2 + SUBPIXEL - 1, SUBPIXEL));
+		int x1 = std::min(width - 1, floordiv(std::max(t.x[0], std::max(t.x[1], t.x[2])) - SUBPIXEL / 2, SUBPIXEL));
+		int y1 = std::min(height - 1, floordiv(std::max(t.y[0], std::max(t.y[1], t.y[2])) - SUBPIXEL / 2, SUBPIXEL));
+
+		if(x0 > x1 || y0 > y1)
+			return;
+
+		int index = g.triangles.size();
+		g.triangles.push_back(t);
+
+		for(int ty = y0 / tile; ty <= y1 / tile; ty++)
+			for(int tx = x0 / tile; tx <= x1 / tile; tx++)
+				g.bins[ty * tilesx + tx].push_back(index);
+	}
+
+	// Clip a triangle against the planes its vertices are outside of, and emit what is left of it
+	void clip(geometry &g, const clipvertex *v, int planes, int8_t tw) {
+		clipvertex poly[9], next[9];
+		int n = 3;
+
+		for(int i = 0; i < 3; i++)
+			poly[i] = v[i];
+
+		for(int p = 0; p < 6 && n; p++) {
+			if(!(planes & 1 << p))
+				continue;
+
+			int m = 0;
+			for(int i = 0; i < n; i++) {
+				const clipvertex &a = poly[i];
+				const clipvertex &b = poly[(i + 1) % n];
+				float da = distance(a, p);
+				float db = distance(b, p);
+
+				if(da >= 0)
+					next[m++] = a;
+				if((da >= 0) != (db >= 0))
+					next[m++] = lerp(a, b, da / (da - db));
+			}
+
+			n = m;
+			std::copy(next, next + n, poly);
+		}
+
+		g.clipped++;
+
+		// What is left is convex, so it can be drawn as a fan
+		for(int i = 2; i < n; i++) {
+			clipvertex tri[3] = {poly[0], poly[i - 1], poly[i]};
+			emit(g, tri, tw);
+		}
+	}
+
+	// The same as glescraft.v.glsl, for every vertex of a section mesh
+	void transform(geometry &g, const glm::mat4 &mvp, const glm::vec3 &offset, const softmesh &m) {
+		for(size_t i = 0; i + 2 < m.vertex.size(); i += 3) {
+			clipvertex v[3];
+			int inside = 0x3f, outside = 0;
+
+			for(int j = 0; j < 3; j++) {
+				const glm::vec4 &c = m.vertex[i + j];
+				glm::vec4 p = mvp * glm::vec4(glm::vec3(c) + offset, 1);
+
+				int sky = m.light[i + j] >> 4;
+				int block = m.light[i + j] & 15;
+
+				v[j].x = p.x;
+				v[j].y = p.y;
+				v[j].z = p.z;
+				v[j].w = p.w;
+				v[j].a[0] = c.x;
+				v[j].a[1] = c.y;
+				v[j].a[2] = c.z;
+				v[j].a[3] = 0.1f + 0.9f * std::max(sky, block) / 15.0f;
+
+				int code = outcode(v[j]);
+				inside &= code;
+				outside |= code;
+			}
+
+			// Entirely outside one of the planes
+			if(inside)
+				continue;
+
+			int8_t tw = lrintf(m.vertex[i].w);
+
+			if(outside)
+				clip(g, v, outside, tw);
+			else
+				emit(g, v, tw);
+		}
+	}
+
+	/* Rasterizing */
+
+	// The same as glescraft.f.glsl, returns false if the pixel is discarded
+	static bool shade(const float *a, int8_t tw, float depth, float w, float fogdensity, uint8_t *rgb) {
+		float s, t, intensity;
+
+		if(tw < 0) {
+			s = (fraction(a[0]) + tw) / 16.0f;
+			t = a[2];
+			intensity = 1.0;
+		} else {
+			s = (fraction(a[0] + a[2]) + tw) / 16.0f;
+			t = -a[1];
+			intensity = 0.85;
+		}
+
+		// Nearest texel, repeating the texture in both directions
+		int u = (int)floorf(s * textures.width) & (textures.width - 1);
+		int v = (int)floorf(t * textures.height) & (textures.height - 1);
+		const uint8_t *texel = (const uint8_t *)textures.pixel_data + (v * textures.width + u) * 4;
+
+		if(texel[3] / 255.0f < 0.4f)
+			return false;
+
+		// gl_FragCoord.z / gl_FragCoord.w
+		float z = depth * w;
+		float fog = std::min(1.0f, std::max(0.2f, expf(-fogdensity * z * z)));
+
+		for(int i = 0; i < 3; i++) {
+			float c = texel[i] / 255.0f * intensity * a[3];
+			rgb[i] = lrintf((fogcolor[i] * (1 - fog) + c * fog) * 255);
+		}
+
+		return true;
+	}
+
+	// Draw the part of a triangle that is inside the rectangle from (tx0, ty0) to (tx1, ty1), into the tile's own buffers
+	static void rasterize(const triangle &t, int tx0, int ty0, int tx1, int ty1, int stride, float *depth, uint8_t *rgb, float fogdensity) {
+		int x0 = std::max(tx0, floordiv(std::min(t.x[0], std::min(t.x[1], t.x[2])) - SUBPIXEL / 2 + SUBPIXEL - 1, SUBPIXEL));
+		int y0 = std::max(ty0, floordiv(std::min(t.y[0], std::min(t.y[1], t.y[2])) - SUBPIXEL / 2 + SUBPIXEL - 1, SUBPIXEL));
+		int x1 = std::min(tx1, floordiv(std::max(t.x[0], std::max(t.x[1], t.x[2])) - SUBPIXEL / 2, SUBPIXEL));
+		int y1 = std::min(ty1, floordiv(std::max(t.y[0], std::max(t.y[1], t.y[2])) - SUBPIXEL / 2, SUBPIXEL));
+
+		if(x0 > x1 || y0 > y1)
+			return;
+
+		/* Edge function i is zero on the edge opposite of vertex i, and equal to twice the area at vertex i.
+		   A pixel is inside when all three are positive. Pixels exactly on an edge belong to only one of the triangles sharing it,
+		   so those edge functions are made one smaller for the other triangle. */
+
+		int64_t e[3], dx[3], dy[3], bias[3];
+		int64_t px = (int64_t)x0 * SUBPIXEL + SUBPIXEL / 2;
+		int64_t py = (int64_t)y0 * SUBPIXEL + SUBPIXEL / 2;
+
+		for(int i = 0; i < 3; i++) {
+			int j = (i + 1) % 3;
+			int k = (i + 2) % 3;
+			int64_t a = t.y[j] - t.y[k];
+			int64_t b = t.x[k] - t.x[j];
+
+			e[i] = b * (py - t.y[j]) + a * (px - t.x[j]);
+			bias[i] = a > 0 || (a == 0 && b > 0) ? 0 : -1;
+			dx[i] = a * SUBPIXEL;
+			dy[i] = b * SUBPIXEL;
+		}
+
+		float l = 1.0f / (e[0] + e[1] + e[2]);
+
+		for(int i = 0; i < 3; i++)
+			e[i] += bias[i];
+		float dz1 = t.z[1] - t.z[0], dz2 = t.z[2] - t.z[0];
+		float dw1 = t.iw[1] - t.iw[0], dw2 = t.iw[2] - t.iw[0];
+
+		for(int y = y0; y <= y1; y++) {
+			int64_t r0 = e[0], r1 = e[1], r2 = e[2];
+
+			for(int x = x0; x <= x1; x += LANES) {
+				int64_t e1[LANES], e2[LANES];
+				bool inside[LANES];
+				bool any = false;
+
+				for(int k = 0; k < LANES; k++) {
+					int64_t a0 = r0 + dx[0] * k;
+					e1[k] = r1 + dx[1] * k;
+					e2[k] = r2 + dx[2] * k;
+					inside[k] = (a0 | e1[k] | e2[k]) >= 0 && x + k <= x1;
+					any |= inside[k];
+				}
+
+				r0 += dx[0] * LANES;
+				r1 += dx[1] * LANES;
+				r2 += dx[2] * LANES;
+
+				if(!any)
+					continue;
+
+				for(int k = 0; k < LANES; k++) {
+					if(!inside[k])
+						continue;
+
+					float b1 = e1[k] * l;
+					float b2 = e2[k] * l;
+					int i = (y - ty0) * stride + x + k - tx0;
+
+					// Depth test before looking at the texture, but depth is only written if the pixel is not discarded
+					float z = t.z[0] + dz1 * b1 + dz2 * b2;
+					if(z >= depth[i])
+						continue;
+
+					float w = 1 / (t.iw[0] + dw1 * b1 + dw2 * b2);
+					float a[4];
+					for(int n = 0; n < 4; n++)
+						a[n] = (t.a[0][n] + (t.a[1][n] - t.a[0][n]) * b1 + (t.a[2][n] - t.a[0][n]) * b2) * w;
+
+					if(shade(a, t.tw, z, w, fogdensity, rgb + i * 3))
+						depth[i] = z;
+				}
+			}
+
+			for(int i = 0; i < 3; i++)
+				e[i] += dy[i];
+		}
+	}
+
+	void draw_tile(int n, float fogdensity) {
+		int tx0 = n % tilesx * tile;
+		int ty0 = n / tilesx * tile;
+		int tx1 = std::min(width, tx0 + tile) - 1;
+		int ty1 = std::min(height, ty0 + tile) - 1;
+		int w = tx1 - tx0 + 1;
+		int h = ty1 - ty0 + 1;
+
+		std::vector<float> depth(w * h, 1.0f);
+		std::vector<uint8_t> rgb(w * h * 3);
+
+		for(int i = 0; i < w * h; i++)
+			for(int k = 0; k < 3; k++)
+				rgb[i * 3 + k] = lrintf(fogcolor[k] * 255);
+
+		for(size_t g = 0; g < geo.size(); g++) {
+			const std::vector<int> &bin = geo[g].bins[n];
+			for(size_t i = 0; i < bin.size(); i++)
+				rasterize(geo[g].triangles[bin[i]], tx0, ty0, tx1, ty1, w, depth.data(), rgb.data(), fogdensity);
+		}
+
+		for(int y = 0; y < h; y++)
+			memcpy(&image[((ty0 + y) * width + tx0) * 3], &rgb[y * w * 3], w * 3);
+	}
+
+public:
+	long triangles;
+	long clipped;
+	double transform_ms;
+	double raster_ms;
+
+	renderer(int width, int height, int tile, int threads): width(width), height(height), tile(tile), threads(threads) {
+		tilesx = (width + tile - 1) / tile;
+		tilesy = (height + tile - 1) / tile;
+		geo.resize(threads);
+		image.resize(width * height * 3);
+	}
+
+	const uint8_t *pixels() const {
+		return image.data();
+	}
+
+	// Draw the visible chunks of a snapshot, in the same way glescraft's display() does
+	void draw(const snapshot &f) {
+		double start = now_ms();
+
+		glm::mat4 view = glm::lookAt(f.eye, f.eye + f.lookat, f.up);
+		glm::mat4 projection = glm::perspective(45.0f, 1.0f * width / height, 0.01f, f.radius);
+		glm::mat4 mvp = projection * view;
+
+		/* Give every thread a part of the sections to draw, in the order they are drawn, with about the same number of vertices */
+
+		struct item {
+			const softmesh *mesh;
+			glm::vec3 offset;
+		};
+
+		std::vector<item> items;
+		long total = 0;
+
+		// Chunks that are far away only have the mesh of their bricks drawn
+		for(size_t i = 0; i < f.visible.size() + f.far.size(); i++) {
+			bool far = i >= f.visible.size();
+			chunk *c = far ? f.far[i - f.visible.size()] : f.visible[i];
+			glm::vec3 offset((c->ax - f.origin.x) * CX, (c->ay - f.origin.y) * CY, (c->az - f.origin.z) * CZ);
+
+			for(int s = far ? FARSECTION : 0; s < (far ? FARSECTION + 1 : SECTIONS); s++) {
+				auto it = meshes.find(&c->sec[s]);
+				if(it == meshes.end() || it->second.vertex.empty())
+					continue;
+
+				item m = {&it->second, offset};
+				items.push_back(m);
+				total += it->second.vertex.size();
+			}
+		}
+
+		std::vector<size_t> first(threads + 1, items.size());
+		long sum = 0;
+		int next = 0;
+
+		for(size_t i = 0; i < items.size() && next < threads; i++) {
+			while(next < threads && sum >= total * next / threads)
+				first[next++] = i;
+			sum += items[i].mesh->vertex.size();
+		}
+
+		parallel(threads, threads, [&](int n) {
+			geometry &g = geo[n];
+			g.triangles.clear();
+			g.bins.resize(tilesx * tilesy);
+			for(size_t i = 0; i < g.bins.size(); i++)
+				g.bins[i].clear();
+			g.clipped = 0;
+
+			for(size_t i = first[n]; i < first[n + 1]; i++)
+				transform(g, mvp, items[i].offset, *items[i].mesh);
+		});
+
+		double transformed = now_ms();
+
+		/* Tiles take very different amounts of time, so threads take the next one as soon as they are done */
+
+		float fogdensity = viewing.fogdensity(f.radius);
+		std::atomic<int> todo(0);
+
+		parallel(threads, threads, [&](int) {
+			for(int n; (n = todo++) < tilesx * tilesy;)
+				draw_tile(n, fogdensity);
+		});
+
+		triangles = clipped = 0;
+		for(int i = 0; i < threads; i++) {
+			triangles += geo[i].triangles.size();
+			clipped += geo[i].clipped;
+		}
+
+		transform_ms = transformed - start;
+		raster_ms = now_ms() - transformed;
+	}
+};
+
+// Keep the meshes the simulation built for the sections up to the snapshot that was just acquired, glescraft would have uploaded them now
+static void take_meshes() {
+	std::vector<sectionmesh> todo;
+	todo.swap(snapshots[front_snapshot].uploads);
+
+	for(size_t i = 0; i < todo.size(); i++) {
+		const sectionmesh &t = todo[i];
+		softmesh &m = meshes[&t.c->sec[t.s]];
+		const uint8_t *data = t.data.data();
+
+		m.vertex.clear();
+		m.light.clear();
+
+		// Blocks have a byte4 per vertex, smooth terrain a byte4 in fixed point relative to the middle of the section per vertex and indices
+		const glm::vec4 bias(CX / 2, t.s * SY + SY / 2, CZ / 2, 0);
+
+		for(int j = 0; j < t.elements; j++) {
+			if(!t.vertices) {
+				const byte4 &c = ((const byte4 *)data)[j];
+				m.vertex.push_back(glm::vec4((int8_t)c.x, (int8_t)c.y, (int8_t)c.z, (int8_t)c.w));
+				m.light.push_back(data[t.elements * sizeof(byte4) + j]);
+			} else {
+				const uint8_t *index = data + indexoffset(t.vertices);
+				int k = indexsize(t.vertices) == sizeof(uint32_t) ? ((const uint32_t *)index)[j] : ((const uint16_t *)index)[j];
+				const byte4 &c = ((const byte4 *)data)[k];
+				m.vertex.push_back(glm::vec4((int8_t)c.x / (float)SMOOTHSCALE, (int8_t)c.y / (float)SMOOTHSCALE, (int8_t)c.z / (float)SMOOTHSCALE, (int8_t)c.w) + bias);
+				m.light.push_back(data[t.vertices * sizeof(byte4) + k]);
+			}
+		}
+	}
+}
+
+static bool write_png(const char *filename, const uint8_t *rgb, int width, int height) {
+	FILE *f = fopen(filename, "wb");
+	if(!f) {
+		perror(filename);
+		return false;
+	}
+
+	png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	png_infop info = png_create_info_struct(png);
+
+	if(setjmp(png_jmpbuf(png))) {
+		png_destroy_write_struct(&png, &info);
+		fclose(f);
+		fprintf(stderr, "%s: could not write PNG\n", filename);
+		return false;
+	}
+
+	png_init_io(png, f);
+	png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png, info);
+
+	for(int y = 0; y < height; y++)
+		png_write_row(png, (png_bytep)(rgb + y * width * 3));
+
+	png_write_end(png, NULL);
+	png_destroy_write_struct(&png, &info);
+	fclose(f);
+	return true;
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [--replay FILE | --seed N --frames N] [--size WIDTHxHEIGHT] [--threads N] [--tile N] [--radius BLOCKS] [--smooth] [--out DIR [--every N]]\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	const char *recordingfile = NULL;
+	const char *out = NULL;
+	int seed = 1;
+	int frames = 600;
+	int width = 640;
+	int height = 480;
+	int threads = 0;
+	int tile = 64;
+	int every = 1;
+	float radius = 0;
+	bool smooth = false;
+
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "--replay") && i + 1 < argc)
+			recordingfile = argv[++i];
+		else if(!strcmp(argv[i], "--seed") && i + 1 < argc)
+			seed = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--frames") && i + 1 < argc)
+			frames = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--size") && i + 1 < argc && sscanf(argv[i + 1], "%dx%d", &width, &height) == 2)
+			i++;
+		else if(!strcmp(argv[i], "--threads") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--tile") && i + 1 < argc)
+			tile = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--radius") && i + 1 < argc)
+			radius = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--smooth"))
+			smooth = true;
+		else if(!strcmp(argv[i], "--out") && i + 1 < argc)
+			out = argv[++i];
+		else if(!strcmp(argv[i], "--every") && i + 1 < argc)
+			every = atoi(argv[++i]);
+		else
+			usage(argv[0]);
+	}
+
+	if(threads <= 0)
+		threads = std::thread::hardware_concurrency();
+
+	// A recording has the seed of its world, the version of the generator that made it and the size of its window
+	int generator = GENERATOR;
+
+	if(recordingfile) {
+		replaying = fopen(recordingfile, "rb");
+		if(!replaying) {
+			perror(recordingfile);
+			return 1;
+		}
+
+		if(!replay_header(seed, width, height, smooth, generator)) {
+			fprintf(stderr, "%s: not a recording\n", recordingfile);
+			return 1;
+		}
+	}
+
+	// Coordinates on the screen have to fit in fixed point, even at the edges of the guard band
+	if(frames < 1 || width < 1 || height < 1 || width > 8192 || height > 8192 || tile < LANES || every < 1 || threads < 1)
+		usage(argv[0]);
+
+	if(out && mkdir(out, 0777) && errno != EEXIST) {
+		perror(out);
+		return 1;
+	}
+
+	/* Set up the world the way glescraft does. Recordings are replayed with the same settings as glescraft uses for them. */
+
+	world = new superchunk;
+	world->seed = seed;
+	world->smooth = smooth;
+	world->generator = generator;
+	srand(seed);
+
+	aspect = 1.0f * width / height;
+
+	if(radius > 0)
+		viewing.radius = radius;
+
+	/* Without a recording, fly around the middle of the world, just above the highest blocks, looking down a bit.
+	   Chunks are generated as fast as glescraft ever does, and the chunks in front of the start are generated before the first frame. */
+
+	float circle = CX * SCX / 4;
+
+	if(!replaying) {
+		viewing.budget = MAXBUDGET;
+		position = glm::vec3(0, CY + 1, circle);
+		angle = glm::vec3(M_PI / 2, -0.3, 0);
+		update_vectors();
+
+		for(int i = 0; i < 60; i++)
+			tick();
+		acquire();
+		take_meshes();
+	}
+
+	renderer r(width, height, tile, threads);
+	std::vector<double> times, transform, raster;
+	long triangles = 0, clipped = 0;
+	uint64_t hash = 1469598103934665603UL;
+
+	for(int i = 0; !replay_done && (replaying || i < frames); i++) {
+		if(!replaying) {
+			float a = 2 * M_PI * i / frames;
+			position = glm::vec3(circle * sinf(a), CY + 1, circle * cosf(a));
+			angle = glm::vec3(a + M_PI / 2, -0.3, 0);
+		}
+
+		tick();
+		if(!acquire())
+			break;
+		take_meshes();
+
+		r.draw(snapshots[front_snapshot]);
+
+		times.push_back(r.transform_ms + r.raster_ms);
+		transform.push_back(r.transform_ms);
+		raster.push_back(r.raster_ms);
+		triangles += r.triangles;
+		clipped += r.clipped;
+
+		const uint8_t *p = r.pixels();
+		for(int j = 0; j < width * height * 3; j++)
+			hash = (hash ^ p[j]) * 1099511628211UL;
+
+		if(out && times.size() % every == 0) {
+			char filename[4096];
+			snprintf(filename, sizeof filename, "%s/%05d.png", out, (int)times.size());
+			if(!write_png(filename, p, width, height))
+				return 1;
+		}
+	}
+
+	if(times.empty()) {
+		fprintf(stderr, "Nothing was drawn\n");
+		return 1;
+	}
+
+	int n = times.size();
+	double sum = 0;
+	for(int i = 0; i < n; i++)
+		sum += times[i];
+
+	printf("{\n");
+	printf("\t\"width\": %d,\n", width);
+	printf("\t\"height\": %d,\n", height);
+	printf("\t\"seed\": %d,\n", seed);
+	printf("\t\"frames\": %d,\n", n);
+	printf("\t\"threads\": %d,\n", threads);
+	printf("\t\"tile\": %d,\n", tile);
+	printf("\t\"triangles_per_frame\": %.1f,\n", (double)triangles / n);
+	printf("\t\"clipped_per_frame\": %.1f,\n", (double)clipped / n);
+	printf("\t\"ms_per_frame\": {\"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f},\n",
+			sum / n, percentile(times, 50), percentile(times, 90), percentile(times, 99), percentile(times, 100));
+	printf("\t\"transform_ms\": {\"p50\": %.3f, \"max\": %.3f},\n", percentile(transform, 50), percentile(transform, 100));
+	printf("\t\"raster_ms\": {\"p50\": %.3f, \"max\": %.3f},\n", percentile(raster, 50), percentile(raster, 100));
+	printf("\t\"fps\": %.1f,\n", n * 1e3 / sum);
+	printf("\t\"hash\": \"%016llx\"\n", (unsigned long long)hash);
+	printf("}\n");
+
+	return 0;
+}
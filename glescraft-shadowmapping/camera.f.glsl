@@ -1,10 +1,11 @@
 varying vec4 texcoord;
-varying vec4 lightcoord;
+varying vec4 lightcoord[3];
 varying vec3 normal;
 uniform vec3 lightpos;
 uniform float depth_offset;
 uniform sampler2D texture;
-uniform sampler2D shadowmap;
+uniform sampler2D shadowmap[3];
+uniform float cascade_end[3];
 
 varying vec4 pos;
 const vec4 fogcolor = vec4(0.6, 0.8, 1.0, 1.0);
@@ -32,19 +33,35 @@ void main(void) {
 	intensity *= clamp(dot(normal, lightdir), 0.0, 1.0);
 
 
-	vec4 lightcoorddiv = lightcoord;
+	// Pick the cascade that covers this fragment's distance from the camera
+	float depth = 1.0 / gl_FragCoord.w;
+	vec4 lightcoorddiv;
+	float shadowdepth;
+
+	if(depth < cascade_end[0]) {
+		lightcoorddiv = lightcoord[0];
+		shadowdepth = texture2D(shadowmap[0], lightcoorddiv.xy).z;
+	} else if(depth < cascade_end[1]) {
+		lightcoorddiv = lightcoord[1];
+		shadowdepth = texture2D(shadowmap[1], lightcoorddiv.xy).z;
+	} else if(depth < cascade_end[2]) {
+		lightcoorddiv = lightcoord[2];
+		shadowdepth = texture2D(shadowmap[2], lightcoorddiv.xy).z;
+	} else {
+		// Beyond the last cascade, nothing is in the shadow
+		lightcoorddiv = vec4(0.0);
+		shadowdepth = 1.0;
+	}
+
+	// The light projections are orthographic, so there is no need to divide by w
 	lightcoorddiv.z += depth_offset;
-	lightcoorddiv /= lightcoord.w;
 
 	// If the depth found in the shadow map is less than that of this fragment,
 	// something else along the same ray of light is closer to the light source,
 	// so we are in the shadow.
-	
-	// Uncomment to prevent everything outside the light source's FOV being in the shadow.
-	// if(all(equal(lightcoorddiv.xy, clamp(lightcoorddiv.xy, 0, 1))))
 
-	if(texture2D(shadowmap, lightcoorddiv.xy).z < lightcoorddiv.z)
-		intensity = 0;
+	if(shadowdepth < lightcoorddiv.z)
+		intensity = 0.0;
 
 	// Attenuate sides of blocks
 	color.xyz *= intensity + 0.15;
@@ -2,11 +2,11 @@ attribute vec4 coord;
 
 uniform mat4 model;
 uniform mat4 cvp;
-uniform mat4 lvp;
+uniform mat4 lvp[3];
 
 varying vec3 lightvec;
 varying vec4 texcoord;
-varying vec4 lightcoord;
+varying vec4 lightcoord[3];
 varying vec3 normal;
 varying vec4 pos;
 
@@ -26,6 +26,7 @@ void main(void) {
 		normal = vec3(-1.0, 0.0, 0.0);
 
 	pos = model * vec4(coord.xyz, 1);
-	lightcoord = lvp * pos;
+	for(int i = 0; i < 3; i++)
+		lightcoord[i] = lvp[i] * pos;
 	gl_Position = cvp * pos;
 }
@@ -26,11 +26,11 @@ static GLint camera_cvp;
 static GLint camera_lvp;
 static GLint camera_texture;
 static GLint camera_shadowmap;
+static GLint camera_cascade_end;
 static GLint camera_lightpos;
 static GLint camera_depth_offset;
 
 static GLuint texture;
-static GLuint shadowmap;
 static GLuint ground_vbo;
 static GLuint cursor_vbo;
 static GLuint fbo;
@@ -50,7 +50,6 @@ static uint8_t buildtype = 1;
 static time_t now;
 static unsigned int keys;
 static bool mode;
-static float lightfov = 60;
 static GLint shadow_face = GL_BACK;
 
 // Size of one chunk in blocks
@@ -66,9 +65,32 @@ static GLint shadow_face = GL_BACK;
 // Sea level
 #define SEALEVEL 4
 
-// Width and height of shadow map
+// Number of shadow map cascades, must match the shaders
+#define CASCADES 3
+
+// Memory budget for all cascades together, in megabytes
+static int shadow_budget = 48;
+
+// Width and height of each cascade, derived from the budget
 static int shadow_size = 1024;
 
+// Distance from the camera up to which shadows are drawn
+static float shadow_distance = 200;
+
+// Redraw a cascade when the light has turned by more than this many radians
+static const float shadow_angle = 0.01;
+
+static GLuint shadowmap[CASCADES];
+
+// What each cascade was last drawn with, so it only needs to be redrawn when that no longer fits
+static struct cascade {
+	glm::mat4 lvp;
+	glm::vec3 center;
+	glm::vec3 lightdir;
+	float radius;
+	bool valid;
+} cascades[CASCADES];
+
 // Number of VBO slots for chunks
 #define CHUNKSLOTS (SCX * SCY * SCZ)
 
@@ -94,6 +116,7 @@ struct chunk {
 	int elements;
 	time_t lastused;
 	bool changed;
+	bool dirty;
 	bool noised;
 	bool initialized;
 	int ax;
@@ -106,6 +129,7 @@ struct chunk {
 		lastused = now;
 		slot = 0;
 		changed = true;
+		dirty = false;
 		initialized = false;
 		noised = false;
 	}
@@ -116,6 +140,7 @@ struct chunk {
 		lastused = now;
 		slot = 0;
 		changed = true;
+		dirty = false;
 		initialized = false;
 		noised = false;
 	}
@@ -189,6 +214,7 @@ struct chunk {
 		// Change the block
 		blk[x][y][z] = type;
 		changed = true;
+		dirty = true;
 
 		// When updating blocks at the edge of this chunk,
 		// visibility of blocks in the neighbouring chunk might change.
@@ -647,7 +673,7 @@ struct superchunk {
 		c[cx][cy][cz]->set(x & (CX - 1), y & (CY - 1), z & (CZ - 1), type);
 	}
 
-	void render(const glm::mat4 &cvp, const glm::mat4 &lvp, bool light) {
+	void render(const glm::mat4 &cvp) {
 		float ud = 1.0/0.0;
 		int ux = -1;
 		int uy = -1;
@@ -685,13 +711,8 @@ struct superchunk {
 						continue;
 					}
 
-					if(light) {
-						glUniformMatrix4fv(light_model, 1, GL_FALSE, glm::value_ptr(model));
-					} else {
-						glUniformMatrix4fv(camera_model, 1, GL_FALSE, glm::value_ptr(model));
-					}
-
-					c[x][y][z]->render(light ? light_coord : camera_coord);
+					glUniformMatrix4fv(camera_model, 1, GL_FALSE, glm::value_ptr(model));
+					c[x][y][z]->render(camera_coord);
 				}
 			}
 		}
@@ -711,7 +732,83 @@ struct superchunk {
 			if(c[ux][uy][uz]->back)
 				c[ux][uy][uz]->back->noise(seed);
 			c[ux][uy][uz]->initialized = true;
+			c[ux][uy][uz]->dirty = true;
+		}
+	}
+
+	// Half the size of a chunk's bounding box along each axis of an orthographic light projection
+	static glm::vec3 extents(const glm::mat4 &lvp) {
+		return glm::vec3(
+			fabsf(lvp[0][0]) * CX / 2 + fabsf(lvp[1][0]) * CY / 2 + fabsf(lvp[2][0]) * CZ / 2,
+			fabsf(lvp[0][1]) * CX / 2 + fabsf(lvp[1][1]) * CY / 2 + fabsf(lvp[2][1]) * CZ / 2,
+			fabsf(lvp[0][2]) * CX / 2 + fabsf(lvp[1][2]) * CY / 2 + fabsf(lvp[2][2]) * CZ / 2);
+	}
+
+	glm::vec4 center(int x, int y, int z, const glm::mat4 &lvp) const {
+		return lvp * glm::vec4(c[x][y][z]->ax * CX + CX / 2, c[x][y][z]->ay * CY + CY / 2, c[x][y][z]->az * CZ + CZ / 2, 1);
+	}
+
+	// Draw only the chunks that can cast a shadow into the given rectangle of one cascade.
+	// The light projection is orthographic, so a chunk's bounding box in clip space
+	// is its projected center plus the projected half extents along each axis.
+	void render_shadow(const glm::mat4 &lvp, const glm::vec4 &rect) {
+		glm::vec3 e = extents(lvp);
+
+		for(int x = 0; x < SCX; x++) {
+			for(int y = 0; y < SCY; y++) {
+				for(int z = 0; z < SCZ; z++) {
+					if(!c[x][y][z]->initialized)
+						continue;
+
+					glm::vec4 cc = center(x, y, z, lvp);
+
+					if(cc.x + e.x < rect.x || cc.x - e.x > rect.z || cc.y + e.y < rect.y || cc.y - e.y > rect.w || fabsf(cc.z) - e.z > 1)
+						continue;
+
+					glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(c[x][y][z]->ax * CX, c[x][y][z]->ay * CY, c[x][y][z]->az * CZ));
+					glUniformMatrix4fv(light_model, 1, GL_FALSE, glm::value_ptr(model));
+					c[x][y][z]->render(light_coord);
+				}
+			}
+		}
+	}
+
+	// Find the rectangle in a cascade's clip space that covers all chunks changed since the shadow maps were drawn
+	bool dirty_rect(const glm::mat4 &lvp, glm::vec4 &rect) const {
+		glm::vec3 e = extents(lvp);
+		bool found = false;
+
+		for(int x = 0; x < SCX; x++) {
+			for(int y = 0; y < SCY; y++) {
+				for(int z = 0; z < SCZ; z++) {
+					if(!c[x][y][z]->dirty || !c[x][y][z]->initialized)
+						continue;
+
+					glm::vec4 cc = center(x, y, z, lvp);
+
+					if(fabsf(cc.x) - e.x > 1 || fabsf(cc.y) - e.y > 1 || fabsf(cc.z) - e.z > 1)
+						continue;
+
+					if(!found)
+						rect = glm::vec4(1, 1, -1, -1);
+
+					rect.x = fminf(rect.x, cc.x - e.x);
+					rect.y = fminf(rect.y, cc.y - e.y);
+					rect.z = fmaxf(rect.z, cc.x + e.x);
+					rect.w = fmaxf(rect.w, cc.y + e.y);
+					found = true;
+				}
+			}
 		}
+
+		return found;
+	}
+
+	void clean() {
+		for(int x = 0; x < SCX; x++)
+			for(int y = 0; y < SCY; y++)
+				for(int z = 0; z < SCZ; z++)
+					c[x][y][z]->dirty = false;
 	}
 };
 
@@ -734,6 +831,32 @@ static void update_vectors() {
 	up = glm::cross(right, lookat);
 }
 
+// Force all cascades to be redrawn in the next frame
+static void invalidate_shadowmaps() {
+	for(int i = 0; i < CASCADES; i++)
+		cascades[i].valid = false;
+}
+
+// Make each cascade as large as the memory budget allows, assuming 32 bits per depth texel
+static void resize_shadowmaps() {
+	GLint max_size = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+
+	long budget = (long)shadow_budget << 20;
+	shadow_size = 64;
+	while(shadow_size * 2 <= max_size && CASCADES * 4L * (shadow_size * 2) * (shadow_size * 2) <= budget)
+		shadow_size *= 2;
+
+	for(int i = 0; i < CASCADES; i++) {
+		glActiveTexture(GL_TEXTURE1 + i);
+		glBindTexture(GL_TEXTURE_2D, shadowmap[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, shadow_size, shadow_size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	invalidate_shadowmaps();
+}
+
 static int init_resources() {
 	light_program = create_program("light.v.glsl", "light.f.glsl");
 	camera_program = create_program("camera.v.glsl", "camera.f.glsl");
@@ -751,13 +874,14 @@ static int init_resources() {
 	camera_lvp = get_uniform(camera_program, "lvp");
 	camera_texture = get_uniform(camera_program, "texture");
 	camera_shadowmap = get_uniform(camera_program, "shadowmap");
+	camera_cascade_end = get_uniform(camera_program, "cascade_end");
 	camera_lightpos = get_uniform(camera_program, "lightpos");
 	camera_depth_offset = get_uniform(camera_program, "depth_offset");
 
 	if(light_coord == -1 || light_model == -1 || light_lvp == -1)
 		return 0;
 
-	if(camera_coord == -1 || camera_cvp == -1 || camera_lvp == -1 || camera_texture == -1 || camera_shadowmap == -1 || camera_lightpos == -1)
+	if(camera_coord == -1 || camera_cvp == -1 || camera_lvp == -1 || camera_texture == -1 || camera_shadowmap == -1 || camera_cascade_end == -1 || camera_lightpos == -1)
 		return 0;
 
 	glEnableVertexAttribArray(light_coord);
@@ -772,27 +896,27 @@ static int init_resources() {
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-	/* Prepare shadow map texture */
-	glActiveTexture(GL_TEXTURE1);
-	glGenTextures(1, &shadowmap);
-	glBindTexture(GL_TEXTURE_2D, shadowmap);
-	glUniform1i(camera_shadowmap, 1);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); // Always use NEAREST for shadow maps
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER); // If it's supported, this is a tad more realistic
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &shadow_size); // Try to get the maximum size
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, shadow_size, shadow_size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	/* Prepare shadow map textures, one per cascade, on texture units 1 and up */
+	glGenTextures(CASCADES, shadowmap);
+	for(int i = 0; i < CASCADES; i++) {
+		glActiveTexture(GL_TEXTURE1 + i);
+		glBindTexture(GL_TEXTURE_2D, shadowmap[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); // Always use NEAREST for shadow maps
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER); // If it's supported, this is a tad more realistic
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	resize_shadowmaps();
 
 	/* Framebuffer for the shadow map */
 	glGenFramebuffers(1, &fbo);
 	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 	glDrawBuffer(GL_NONE);
 	glReadBuffer(GL_NONE);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, shadowmap, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, shadowmap[0], 0);
 
 	GLenum status = GL_FALSE;
 	if ((status = glCheckFramebufferStatus(GL_FRAMEBUFFER)) != GL_FRAMEBUFFER_COMPLETE) {
@@ -846,30 +970,128 @@ static void display() {
 	if(!mode) {
 		lightpos = glm::vec3(100.0 * cosf(t / 10000.0), 200.0, 100.0 * sinf(t / 10000.0)); // round
 		//lightpos = glm::vec3(100.0 * cosf(t / 10000.0), 100.0 * sinf(t / 10000.0), 0.0); // night/day
-		lightlookat = position + lookat;
+		lightlookat = glm::vec3(0.0, 0.0, 0.0);
 	}
 
-	glm::mat4 lview = glm::lookAt(lightpos, lightlookat, glm::vec3(0.0, 1.0, 0.0));
-	glm::mat4 lprojection = glm::perspective(lightfov, 1.0f, 1.0f, 10000.0f);
-	glm::mat4 lvp = lprojection * lview;
-
+	float aspect = 1.0f * ww / wh;
 	glm::mat4 cview = glm::lookAt(position, position + lookat, up);
-	glm::mat4 cprojection = glm::perspective(45.0f, 1.0f * ww / wh, 0.01f, 1000.0f);
+	glm::mat4 cprojection = glm::perspective(45.0f, aspect, 0.01f, 1000.0f);
 	glm::mat4 cvp = cprojection * cview;
 
-	/* First pass: render world as seen from the light source */
-	
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-	glViewport(0, 0, shadow_size, shadow_size);
-	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-	glClear(GL_DEPTH_BUFFER_BIT);
+	/* The sun is far away, so treat it as a directional light shining towards the point it looks at */
+
+	glm::vec3 lightdir = glm::normalize(lightlookat - lightpos);
+	glm::vec3 lightup = fabsf(lightdir.y) > 0.99 ? glm::vec3(0.0, 0.0, 1.0) : glm::vec3(0.0, 1.0, 0.0);
+
+	static const glm::mat4 bias(
+			0.5, 0.0, 0.0, 0.0,
+			0.0, 0.5, 0.0, 0.0,
+			0.0, 0.0, 0.5, 0.0,
+			0.5, 0.5, 0.5, 1.0);
+
+	/* First pass: render world as seen from the light source, but only for cascades that are out of date */
+
+	glm::mat4 lvp[CASCADES];
+	float cascade_end[CASCADES];
+	float begin = 0.01;
+	bool bound = false;
+
+	for(int i = 0; i < CASCADES; i++) {
+		// Split the shadow distance halfway between a logarithmic and a uniform distribution,
+		// so the nearby cascades get most of the resolution
+		float f = (i + 1.0f) / CASCADES;
+		float end = 0.75f * powf(shadow_distance, f) + 0.25f * shadow_distance * f;
+
+		// Find a bounding sphere around this slice of the camera frustum
+		glm::mat4 inverse = glm::inverse(glm::perspective(45.0f, aspect, begin, end) * cview);
+		glm::vec3 corners[8];
+		glm::vec3 center(0);
+
+		for(int j = 0; j < 8; j++) {
+			glm::vec4 corner = inverse * glm::vec4(j & 1 ? 1 : -1, j & 2 ? 1 : -1, j & 4 ? 1 : -1, 1);
+			corners[j] = glm::vec3(corner) / corner.w;
+			center += corners[j];
+		}
+
+		center /= 8.0f;
+
+		float radius = 0;
+		for(int j = 0; j < 8; j++)
+			radius = fmaxf(radius, glm::length(corners[j] - center));
+
+		cascade_end[i] = end;
+		begin = end;
+
+		// The cached cascade can be reused as long as the light has not turned too far
+		// and the slice still lies entirely inside the area it covers
+		struct cascade *c = &cascades[i];
+		bool redraw = !c->valid || glm::dot(lightdir, c->lightdir) < cosf(shadow_angle) || glm::length(center - c->center) + radius > c->radius;
+		glm::vec4 rect(-1, -1, 1, 1);
+
+		if(redraw) {
+			// Cover a bit more than needed, so the camera can move a while before we have to redraw
+			c->radius = ceilf(radius * 1.25f);
+			c->center = center;
+			c->lightdir = lightdir;
+			c->valid = true;
+
+			// Move the light far enough back that everything between the sun and the slice can cast shadows into it
+			float pullback = c->radius + CY * SCY * 4;
+
+			glm::mat4 lview = glm::lookAt(center - lightdir * pullback, center, lightup);
+			glm::mat4 lprojection = glm::ortho(-c->radius, c->radius, -c->radius, c->radius, 0.0f, pullback + c->radius);
+
+			// Snap to whole texels, so shadow edges don't crawl when the cascade moves
+			glm::vec4 origin = lprojection * lview * glm::vec4(0, 0, 0, 1) * (shadow_size / 2.0f);
+			lprojection[3][0] += (roundf(origin.x) - origin.x) * 2.0f / shadow_size;
+			lprojection[3][1] += (roundf(origin.y) - origin.y) * 2.0f / shadow_size;
+
+			c->lvp = lprojection * lview;
+		} else if(!world->dirty_rect(c->lvp, rect)) {
+			// Nothing changed, keep the cached shadow map
+			lvp[i] = bias * c->lvp;
+			continue;
+		}
+
+		if(!bound) {
+			glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+			glViewport(0, 0, shadow_size, shadow_size);
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+			glUseProgram(light_program);
+			glCullFace(shadow_face);
+			bound = true;
+		}
+
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, shadowmap[i], 0);
+		glUniformMatrix4fv(light_lvp, 1, GL_FALSE, glm::value_ptr(c->lvp));
+
+		if(!redraw) {
+			// Only clear and redraw the texels covered by the chunks that changed
+			int x0 = floorf((rect.x + 1) / 2 * shadow_size);
+			int y0 = floorf((rect.y + 1) / 2 * shadow_size);
+			int x1 = ceilf((rect.z + 1) / 2 * shadow_size);
+			int y1 = ceilf((rect.w + 1) / 2 * shadow_size);
+			x0 = glm::clamp(x0, 0, shadow_size);
+			y0 = glm::clamp(y0, 0, shadow_size);
+			x1 = glm::clamp(x1, 0, shadow_size);
+			y1 = glm::clamp(y1, 0, shadow_size);
+
+			// Every chunk touching the scissored texels has to be drawn again
+			rect = glm::vec4(x0, y0, x1, y1) * (2.0f / shadow_size) - 1.0f;
+
+			glEnable(GL_SCISSOR_TEST);
+			glScissor(x0, y0, x1 - x0, y1 - y0);
+		}
 
-	glUseProgram(light_program);
-	glUniformMatrix4fv(light_lvp, 1, GL_FALSE, glm::value_ptr(lvp));
+		glClear(GL_DEPTH_BUFFER_BIT);
+		world->render_shadow(c->lvp, rect);
+		glDisable(GL_SCISSOR_TEST);
 
-	glCullFace(shadow_face);
+		lvp[i] = bias * c->lvp;
+	}
 
-	world->render(lvp, lvp, true);
+	// All cascades have seen the changed chunks now
+	world->clean();
 
 	/* Second pass: render world as seen from the camera */
 
@@ -880,28 +1102,26 @@ static void display() {
 
 	glUseProgram(camera_program);
 
-	static const glm::mat4 bias(
-			0.5, 0.0, 0.0, 0.0,
-			0.0, 0.5, 0.0, 0.0,
-			0.0, 0.0, 0.5, 0.0,
-			0.5, 0.5, 0.5, 1.0);
-
 	glUniform3f(camera_lightpos, lightpos.x, lightpos.y, lightpos.z);
 	glUniform1f(camera_depth_offset, shadow_face == GL_FRONT ? 0 : -0.001);
 
-	lvp = bias * lvp;
 	glUniformMatrix4fv(camera_cvp, 1, GL_FALSE, glm::value_ptr(cvp));
-	glUniformMatrix4fv(camera_lvp, 1, GL_FALSE, glm::value_ptr(lvp));
-
-	glUniform1i(camera_shadowmap, 1);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, shadowmap);
+	glUniformMatrix4fv(camera_lvp, CASCADES, GL_FALSE, glm::value_ptr(lvp[0]));
+	glUniform1fv(camera_cascade_end, CASCADES, cascade_end);
+
+	GLint units[CASCADES];
+	for(int i = 0; i < CASCADES; i++) {
+		units[i] = 1 + i;
+		glActiveTexture(GL_TEXTURE1 + i);
+		glBindTexture(GL_TEXTURE_2D, shadowmap[i]);
+	}
+	glUniform1iv(camera_shadowmap, CASCADES, units);
 
 	glCullFace(GL_BACK);
 	
 	glEnable(GL_POLYGON_OFFSET_FILL);
 
-	world->render(cvp, lvp, false);
+	world->render(cvp);
 
 	/* Very naive ray casting algorithm to find out which block we are looking at */
 
@@ -1053,23 +1273,22 @@ static void special(int key, int x, int y) {
 				printf("Rotation light position.\n");
 			break;
 		case GLUT_KEY_F2:
-			lightfov += 15;
-			if(lightfov >= 180)
-				lightfov = 15;
-			printf("Current FOV of light source is %.0f\n", lightfov);
+			shadow_distance *= 2;
+			if(shadow_distance > 400)
+				shadow_distance = 50;
+			invalidate_shadowmaps();
+			printf("Current shadow distance is %.0f\n", shadow_distance);
 			break;
 		case GLUT_KEY_F3:
-			shadow_size *= 2;
-			if(shadow_size > 8192)
-				shadow_size = 256;
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, shadowmap);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, shadow_size, shadow_size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-			glBindTexture(GL_TEXTURE_2D, 0);
-			printf("Current size of shadow map is %d x %d\n", shadow_size, shadow_size);
+			shadow_budget *= 4;
+			if(shadow_budget > 192)
+				shadow_budget = 3;
+			resize_shadowmaps();
+			printf("Current shadow map budget is %d MB, %d cascades of %d x %d\n", shadow_budget, CASCADES, shadow_size, shadow_size);
 			break;
 		case GLUT_KEY_F4:
 			shadow_face = shadow_face == GL_FRONT ? GL_BACK : GL_FRONT;
+			invalidate_shadowmaps();
 			printf("Current face culled in light view is %s\n", shadow_face == GL_FRONT ? "front" : "back");
 			break;
 	}
@@ -1217,8 +1436,8 @@ int main(int argc, char* argv[]) {
 	printf("Press the right mouse button to remove a block.\n");
 	printf("Use the scrollwheel to select different types of blocks.\n");
 	printf("Press F1 to toggle light position latch.\n");
-	printf("Press F2 to change light source FOV.\n");
-	printf("Press F3 to change the size of the shadow map.\n");
+	printf("Press F2 to change the shadow distance.\n");
+	printf("Press F3 to change the memory budget of the shadow maps.\n");
 	printf("Press F4 to change which faces are being culled.\n");
 
 	if (init_resources()) {
@@ -2,6 +2,29 @@
 #include <stdlib.h>
 #include <math.h>
 #include <time.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include <GL/glew.h>
 #include <GL/glut.h>
@@ -13,15 +36,23 @@
 #include <glm/gtc/noise.hpp>
 
 #include "../common/shader_utils.h"
+#include "../common/command_buffer.h"
+#include "../common/worker_pool.h"
 
 #include "textures.c"
 
 static GLuint program;
 static GLint attribute_coord;
+static GLint attribute_light;
 static GLint uniform_mvp;
+static GLint uniform_offset;
+static GLint uniform_fogdensity;
+static GLint uniform_coordscale;
+static GLint uniform_coordbias;
 static GLuint texture;
 static GLint uniform_texture;
 static GLuint cursor_vbo;
+static GLuint entity_vbo;
 
 static glm::vec3 position;
 static glm::vec3 forward;
@@ -36,9 +67,27 @@ static int face;
 static uint8_t buildtype = 1;
 
 static time_t now;
-static unsigned int keys;
+static std::atomic<unsigned int> keys;
 static bool select_using_depthbuffer = false;
 
+// Aspect ratio of the window, used by the simulation thread to find out which chunks are visible
+static std::atomic<float> aspect(4.0 / 3.0);
+
+// Aspect ratio of the window size in the header of a recording, kept while recording or replaying it, see reshape()
+static float path_aspect;
+
+// Camera path recording and replay, see record_frame() and replay_next()
+static FILE *recording;
+static FILE *replaying;
+static float timestep = 1.0 / 60;
+static int replayed;
+static std::atomic<bool> replay_done;
+static GLuint timer_query[4];
+static std::vector<float> cpu_times;
+static std::vector<float> gpu_times;
+static std::vector<long> upload_sizes;
+static int frames;
+
 // Size of one chunk in blocks
 #define CX 16
 #define CY 32
@@ -52,10 +101,49 @@ static bool select_using_depthbuffer = false;
 // Sea level
 #define SEALEVEL 4
 
+// Version of the terrain generator, recordings made with an older one are replayed with that one, see chunk::noise()
+#define GENERATOR 1
+
+// Water flows one block every this many simulation ticks
+#define FLOWTICKS 6
+
+// Height of the sections a chunk is divided into, each section is meshed separately
+#define SY 16
+#define SECTIONS (CY / SY)
+
+// Most vertices the mesh of a section can have, when every block shows all six sides like leaves do
+#define SECTIONVERTICES (CX * SY * CZ * 36)
+
 // Number of VBO slots for chunks
 #define CHUNKSLOTS (SCX * SCY * SCZ)
 
+// Bricks of BRICK x BRICK x BRICK blocks, see chunk::rebrick()
+#define BRICK 4
+#define BX (CX / BRICK)
+#define BY (CY / BRICK)
+#define BZ (CZ / BRICK)
+#define BRICKVOLUME (BRICK * BRICK * BRICK)
+
+// Brick values from MIXED up are an index into the mixed bricks of a chunk, lower ones are a block type
+#define MIXED 16
+
+// A mixed brick with more than two types of blocks stores them as 4 bits each, after a byte with this flag
+#define NIBBLES 0x80
+
+// Chunks further away than this many blocks are drawn with the mesh of their bricks, which goes in an extra section
+#define FARFIELD 192
+#define FARSECTION SECTIONS
+
+// Chunks further away from the camera than this many blocks, horizontally, only keep their bricks, see chunk::pack()
+#define PACKDISTANCE (FARFIELD + 2 * CX)
+
+// Number of VBO slots for chunk sections
+#define SECTIONSLOTS (CHUNKSLOTS * (SECTIONS + 1))
+
 static const int transparent[16] = {2, 0, 0, 0, 1, 0, 0, 0, 3, 4, 0, 0, 0, 0, 0, 0}; 
+
+// Amount of light emitted by each type of block, the white block doubles as a lamp
+static const int emission[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 15, 0, 0};
 static const char *blocknames[16] = {
 	"air", "dirt", "topsoil", "grass", "leaves", "wood", "stone", "sand",
 	"water", "glass", "brick", "ore", "woodrings", "white", "black", "x-y"
@@ -65,18 +153,244 @@ struct byte4 {
 	uint8_t x, y, z, w;
 	byte4() {}
 	byte4(uint8_t x, uint8_t y, uint8_t z, uint8_t w): x(x), y(y), z(z), w(w) {}
+	bool operator==(const byte4 &o) const { return x == o.x && y == o.y && z == o.z && w == o.w; }
 };
 
-static struct chunk *chunk_slot[CHUNKSLOTS] = {0};
+// Vertices of smooth terrain are byte4s like those of blocks, but in steps of 1 / SMOOTHSCALE blocks,
+// relative to the middle of their section, so a section and the half block around it fit. See chunk::smoothmesh().
+#define SMOOTHSCALE 14
+
+// Density of the terrain around a block that was placed, minus that around one that was removed.
+// Generated terrain changes by DENSITYSLOPE per block away from the surface.
+#define SOLIDITY 32
+#define DENSITYSLOPE 32
+
+/* Streaming uploads. The meshes built for the simulation thread, and the geometry drawn every frame,
+   are written with memcpy into ring buffers, instead of each being handed to glBufferData() on its own.
+   With OpenGL 4.4 or ARB_buffer_storage, a ring buffer is a GL buffer that stays mapped all the time.
+   Meshes are copied from it into the VBOs of their sections with glCopyBufferSubData(), all together at the start of a frame,
+   and the per-frame geometry is drawn straight from it. After every frame a fence is inserted,
+   and once the GPU has passed it, the part of the ring buffer used up to then can be written again.
+   Without it, a ring buffer is plain memory: meshes are uploaded from it with glBufferSubData(),
+   and per-frame geometry goes into a stream VBO, which is orphaned every time the ring buffer wraps around.
+   Several threads can reserve space in a ring buffer at once, such as the workers building meshes,
+   but space is only given back by the GL thread. */
+
+#define MESHSTREAM (16 << 20)
+#define FRAMESTREAM (8 << 20)
+
+struct streambuffer {
+	GLuint vbo;                 // Buffer to copy or draw from, 0 if not needed
+	uint8_t *base;              // Where to write: the mapped contents of vbo, or plain memory
+	size_t size;
+	bool persistent;            // base is mapped
+	std::atomic<uint64_t> head; // Bytes reserved since the start, including skipped ones
+	std::atomic<uint64_t> tail; // Everything before this may be overwritten
+	uint64_t streamed;          // Without mapping, how far the contents were uploaded to vbo
+	std::deque<std::pair<GLsync, uint64_t> > fences; // Where the GPU will be done up to, once each fence has passed
+
+	streambuffer(): vbo(0), base(0), size(0), persistent(false), head(0), tail(0), streamed(0) {}
+
+	void init(size_t n, bool map, bool gl) {
+		size = n;
+
+		if(gl) {
+			glGenBuffers(1, &vbo);
+			glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		}
 
-struct chunk {
-	uint8_t blk[CX][CY][CZ];
-	struct chunk *left, *right, *below, *above, *front, *back;
+		if(map) {
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_ARRAY_BUFFER, n, NULL, flags);
+			base = (uint8_t *)glMapBufferRange(GL_ARRAY_BUFFER, 0, n, flags);
+
+			// The storage cannot be changed anymore, so start over with a new buffer
+			if(!base) {
+				glDeleteBuffers(1, &vbo);
+				init(n, false, gl);
+				return;
+			}
+		} else {
+			if(gl)
+				glBufferData(GL_ARRAY_BUFFER, n, NULL, GL_STREAM_DRAW);
+			base = new uint8_t[n];
+		}
+
+		persistent = map;
+	}
+
+	// Reserve n bytes in one piece, and return their position. Returns false if there is not enough room.
+	// This can be called from any number of threads at once.
+	bool reserve(size_t n, uint64_t &pos) {
+		uint64_t h = head.load(std::memory_order_relaxed);
+
+		// Without a GL context, it is never initialized
+		if(!size)
+			return false;
+
+		do {
+			pos = h;
+
+			// Never wrap around in the middle, skip the rest of the buffer instead
+			if(pos % size + n > size)
+				pos += size - pos % size;
+
+			if(pos + n - tail.load(std::memory_order_acquire) > size)
+				return false;
+		} while(!head.compare_exchange_weak(h, pos + n, std::memory_order_release, std::memory_order_relaxed));
+
+		return true;
+	}
+
+	uint8_t *at(uint64_t pos) const {
+		return base + pos % size;
+	}
+
+	// Without mapping, upload n bytes written at pos to vbo, orphaning it when we have wrapped around
+	void stream(uint64_t pos, size_t n) {
+		if(pos / size != streamed / size)
+			glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, pos % size, n, at(pos));
+		streamed = pos + n;
+	}
+
+	// Everything before end has been handed to GL, it can be overwritten once the GPU is done with it
+	void retire(uint64_t end) {
+		if(persistent)
+			fences.push_back(std::make_pair(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), end));
+		else
+			tail.store(end, std::memory_order_release);
+	}
+
+	// Give back the space of the fences that have passed. With wait, wait for the oldest one.
+	void reclaim(bool wait) {
+		while(!fences.empty()) {
+			GLenum result = glClientWaitSync(fences.front().first, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000 : 0);
+			if(result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+				break;
+
+			glDeleteSync(fences.front().first);
+			tail.store(fences.front().second, std::memory_order_release);
+			fences.pop_front();
+			wait = false;
+		}
+	}
+};
+
+static streambuffer mesh_stream;
+static streambuffer frame_stream;
+static long upload_bytes; // Bytes uploaded by the last frame
+
+// The part of a chunk between y = SY * n and y = SY * (n + 1), with its own VBO.
+// Changes are tracked by the simulation thread, everything else belongs to the GL thread.
+struct section {
 	int slot;
 	GLuint vbo;
-	int elements;
+	int elements; // Number of vertices to draw, or of indices if the mesh is indexed
+	int vertices; // Number of vertices of an indexed mesh, 0 if it is not
+	size_t capacity; // Number of bytes the VBO has room for
 	time_t lastused;
-	bool changed;
+	std::atomic<bool> changed;
+
+	section() {
+		slot = 0;
+		vbo = 0;
+		elements = 0;
+		vertices = 0;
+		capacity = 0;
+		lastused = now;
+		changed = true;
+	}
+};
+
+static struct section *section_slot[SECTIONSLOTS] = {0};
+
+// Layout of the mesh of a section, in its VBO and everywhere else it is stored: the vertices, followed by their light values.
+// An indexed mesh has its indices after the light values, aligned to their size.
+// They are 16 bit, or 32 bit if the mesh has more vertices than that can address.
+static size_t indexsize(int vertices) {
+	return vertices > 65536 ? sizeof(uint32_t) : sizeof(uint16_t);
+}
+
+static size_t indexoffset(int vertices) {
+	return (vertices * (sizeof(byte4) + 1) + indexsize(vertices) - 1) & ~(indexsize(vertices) - 1);
+}
+
+static size_t meshbytes(int elements, int vertices) {
+	return vertices ? indexoffset(vertices) + elements * indexsize(vertices) : elements * (sizeof(byte4) + 1);
+}
+
+// The mesh of a section, built by the simulation thread and waiting to be uploaded by the GL thread.
+// It is in the mesh stream, or in data if it did not fit.
+struct sectionmesh {
+	struct chunk *c;
+	int s;
+	int elements;
+	int vertices;
+	size_t bytes;
+	bool streamed;
+	uint64_t pos;
+	std::vector<uint8_t> data;
+
+	// Make room for a mesh of n bytes and return where to write it. With stream, that is in the mesh stream if it has room,
+	// otherwise, or if it does not, in data.
+	uint8_t *output(size_t n, bool stream) {
+		bytes = n;
+		streamed = stream && n && mesh_stream.reserve(n, pos);
+
+		if(streamed) {
+			std::vector<uint8_t>().swap(data);
+			return mesh_stream.at(pos);
+		}
+
+		data.resize(n);
+		return data.data();
+	}
+};
+
+// Run length encoding, as pairs of a count and a byte. Terrain has long runs of the same block and light level along the z axis.
+static void compress(const uint8_t *src, size_t n, std::vector<uint8_t> &msg) {
+	for(size_t i = 0; i < n;) {
+		size_t run = 1;
+		while(i + run < n && run < 255 && src[i + run] == src[i])
+			run++;
+
+		msg.push_back(run);
+		msg.push_back(src[i]);
+		i += run;
+	}
+}
+
+// Returns false if the data does not decode to exactly n bytes
+static bool expand(const uint8_t *&src, const uint8_t *end, uint8_t *dst, size_t n) {
+	for(size_t i = 0; i < n;) {
+		if(end - src < 2 || !src[0] || i + src[0] > n)
+			return false;
+
+		memset(dst + i, src[1], src[0]);
+		i += src[0];
+		src += 2;
+	}
+
+	return true;
+}
+
+struct chunk {
+	uint8_t (*blk)[CY][CZ];      // The blocks, not allocated while the chunk is packed, see pack()
+	uint8_t (*light)[CY][CZ];    // Skylight in the high nibble, block light in the low nibble. Not allocated while packed.
+	struct chunk *left, *right, *below, *above, *front, *back;
+	struct section sec[SECTIONS + 1]; // The last one holds the mesh of the bricks, for when the chunk is far away
+	uint8_t (*flow)[CY][CZ];     // Level of flowing water, 0 for still water. Only allocated once water flows in this chunk.
+	int8_t (*density)[CY][CZ];   // Density of the terrain at the center of each block, only in smooth worlds, see smoothmesh()
+	bool smooth;                 // Draw the opaque blocks as smooth terrain
+	std::vector<uint16_t> active; // Blocks the next water update has to look at, see superchunk::flow()
+	uint8_t brick[BX][BY][BZ];    // Block type of bricks that are all the same, MIXED + index into mixoffset for the others
+	uint8_t coarse[BX][BY][BZ];   // What a brick looks like from far away, 0 if it is mostly air
+	std::vector<uint8_t> mixed;   // The blocks of the mixed bricks, see rebrick()
+	std::vector<uint16_t> mixoffset; // Where each mixed brick starts in mixed
+	bool bricked;                 // The bricks are up to date
+	std::vector<uint8_t> packed;  // The light, density and water levels of a packed chunk
+	int blocks;
 	bool noised;
 	bool initialized;
 	int ax;
@@ -84,25 +398,52 @@ struct chunk {
 	int az;
 
 	chunk(): ax(0), ay(0), az(0) {
-		memset(blk, 0, sizeof blk);
+		blk = new uint8_t[CX][CY][CZ];
+		light = new uint8_t[CX][CY][CZ];
+		memset(blk, 0, CX * CY * CZ);
+		memset(light, 0xf0, CX * CY * CZ);
 		left = right = below = above = front = back = 0;
-		lastused = now;
-		slot = 0;
-		changed = true;
+		flow = 0;
+		density = 0;
+		smooth = false;
+		memset(brick, 0, sizeof brick);
+		memset(coarse, 0, sizeof coarse);
+		bricked = true;
+		blocks = 0;
 		initialized = false;
 		noised = false;
 	}
 
 	chunk(int x, int y, int z): ax(x), ay(y), az(z) {
-		memset(blk, 0, sizeof blk);
+		blk = new uint8_t[CX][CY][CZ];
+		light = new uint8_t[CX][CY][CZ];
+		memset(blk, 0, CX * CY * CZ);
+		memset(light, 0xf0, CX * CY * CZ);
 		left = right = below = above = front = back = 0;
-		lastused = now;
-		slot = 0;
-		changed = true;
+		flow = 0;
+		density = 0;
+		smooth = false;
+		memset(brick, 0, sizeof brick);
+		memset(coarse, 0, sizeof coarse);
+		bricked = true;
+		blocks = 0;
 		initialized = false;
 		noised = false;
 	}
 
+	~chunk() {
+		delete[] blk;
+		delete[] light;
+		delete[] flow;
+		delete[] density;
+	}
+
+	// Block at (x, y, z) in this chunk, also if it is packed.
+	// The others read blk directly, so they are only used on chunks that are not packed, and next to chunks that are not.
+	uint8_t at(int x, int y, int z) const {
+		return blk ? blk[x][y][z] : brickget(x, y, z);
+	}
+
 	uint8_t get(int x, int y, int z) const {
 		if(x < 0)
 			return left ? left->blk[x + CX][y][z] : 0;
@@ -119,6 +460,41 @@ struct chunk {
 		return blk[x][y][z];
 	}
 
+	uint8_t getlight(int x, int y, int z) const {
+		if(x < 0)
+			return left ? left->light[x + CX][y][z] : 0xf0;
+		if(x >= CX)
+			return right ? right->light[x - CX][y][z] : 0xf0;
+		if(y < 0)
+			return below ? below->light[x][y + CY][z] : 0;
+		if(y >= CY)
+			return above ? above->light[x][y - CY][z] : 0xf0;
+		if(z < 0)
+			return front ? front->light[x][y][z + CZ] : 0xf0;
+		if(z >= CZ)
+			return back ? back->light[x][y][z - CZ] : 0xf0;
+		return light[x][y][z];
+	}
+
+	// Water level of a block: 8 for still water, 1 to 7 for flowing water, 0 if there is no water
+	int waterlevel(int x, int y, int z) const {
+		if(x < 0)
+			return left ? left->waterlevel(x + CX, y, z) : 0;
+		if(x >= CX)
+			return right ? right->waterlevel(x - CX, y, z) : 0;
+		if(y < 0)
+			return below ? below->waterlevel(x, y + CY, z) : 0;
+		if(y >= CY)
+			return above ? above->waterlevel(x, y - CY, z) : 0;
+		if(z < 0)
+			return front ? front->waterlevel(x, y, z + CZ) : 0;
+		if(z >= CZ)
+			return back ? back->waterlevel(x, y, z - CZ) : 0;
+		if(blk[x][y][z] != 8)
+			return 0;
+		return flow && flow[x][y][z] ? flow[x][y][z] : 8;
+	}
+
 	bool isblocked(int x1, int y1, int z1, int x2, int y2, int z2) {
 		// Invisible blocks are always "blocked"
 		if(!blk[x1][y1][z1])
@@ -169,24 +545,97 @@ struct chunk {
 			return;
 		}
 
-		// Change the block
+		// Keep track of the number of non-air blocks
+		if(!blk[x][y][z] && type)
+			blocks++;
+		else if(blk[x][y][z] && !type)
+			blocks--;
+
+		// Change the block, only the section it is in needs to be meshed again
 		blk[x][y][z] = type;
-		changed = true;
+		if(flow)
+			flow[x][y][z] = 0;
+
+		// Smooth terrain grows around new blocks and caves in around removed ones, but only opaque blocks are part of it
+		if(density) {
+			if(type && !transparent[type])
+				density[x][y][z] = std::max((int)density[x][y][z], SOLIDITY);
+			else
+				density[x][y][z] = std::min((int)density[x][y][z], -SOLIDITY);
+		}
+		touch(x, y, z, x, y, z);
+	}
 
-		// When updating blocks at the edge of this chunk,
-		// visibility of blocks in the neighbouring chunk might change.
-		if(x == 0 && left)
-			left->changed = true;
-		if(x == CX - 1 && right)
-			right->changed = true;
-		if(y == 0 && below)
-			below->changed = true;
-		if(y == CY - 1 && above)
-			above->changed = true;
-		if(z == 0 && front)
-			front->changed = true;
-		if(z == CZ - 1 && back)
-			back->changed = true;
+	// Mark the sections overlapping the box (x0, y0, z0) - (x1, y1, z1) as changed
+	void touch(int x0, int y0, int z0, int x1, int y1, int z1) {
+		// When updating blocks at the edge of a section,
+		// visibility of blocks in the section above or below might change.
+		int s0 = (y0 - 1) / SY;
+		int s1 = (y1 + 1) / SY;
+		if(s0 < 0)
+			s0 = 0;
+		if(s1 >= SECTIONS)
+			s1 = SECTIONS - 1;
+
+		for(int s = s0; s <= s1; s++)
+			sec[s].changed = true;
+
+		// Same for blocks at the edge of this chunk and the neighbouring chunk.
+		for(int s = y0 / SY; s <= y1 / SY; s++) {
+			if(x0 == 0 && left)
+				left->sec[s].changed = true;
+			if(x1 == CX - 1 && right)
+				right->sec[s].changed = true;
+			if(z0 == 0 && front)
+				front->sec[s].changed = true;
+			if(z1 == CZ - 1 && back)
+				back->sec[s].changed = true;
+		}
+
+		if(y0 == 0 && below)
+			below->sec[SECTIONS - 1].changed = true;
+		if(y1 == CY - 1 && above)
+			above->sec[0].changed = true;
+
+		// The bricks are built again when they are needed.
+		// Bricks at the edge of this chunk are also seen by the brick mesh of the neighbouring chunk.
+		bricked = false;
+		sec[FARSECTION].changed = true;
+
+		if(x0 < BRICK && left)
+			left->sec[FARSECTION].changed = true;
+		if(x1 >= CX - BRICK && right)
+			right->sec[FARSECTION].changed = true;
+		if(y0 < BRICK && below)
+			below->sec[FARSECTION].changed = true;
+		if(y1 >= CY - BRICK && above)
+			above->sec[FARSECTION].changed = true;
+		if(z0 < BRICK && front)
+			front->sec[FARSECTION].changed = true;
+		if(z1 >= CZ - BRICK && back)
+			back->sec[FARSECTION].changed = true;
+	}
+
+	// Mark all sections of this chunk as needing an update
+	void markchanged() {
+		for(int s = 0; s <= FARSECTION; s++)
+			sec[s].changed = true;
+		bricked = false;
+	}
+
+	// Edits always leave still water behind, so forget the water levels in a row of blocks
+	void settle(int x, int y, int z, int n) {
+		if(flow)
+			memset(&flow[x][y][z], 0, n);
+	}
+
+	// Have the next water update look at the air and water blocks in a box, in local coordinates
+	void activate(int x0, int y0, int z0, int x1, int y1, int z1) {
+		for(int x = x0; x <= x1; x++)
+			for(int y = y0; y <= y1; y++)
+				for(int z = z0; z <= z1; z++)
+					if(!blk[x][y][z] || blk[x][y][z] == 8)
+						active.push_back((x * CY + y) * CZ + z);
 	}
 
 	static float noise2d(float x, float y, int seed, int octaves, float persistence) {
@@ -217,12 +666,30 @@ struct chunk {
 		return sum;
 	}
 
-	void noise(int seed) {
+	/* Random numbers for placing trees. Every chunk has its own sequence, which only depends on the seed and where the chunk is,
+	   so the terrain does not depend on the order in which chunks are generated, and chunks can be generated on different threads.
+	   Version 0 of the generator used rand() instead, so its trees depend on everything else that called rand() before.
+	   That only works on one thread, and is kept to replay old recordings. */
+
+	static uint32_t rng(uint32_t &state, int generator) {
+		if(!generator)
+			return rand();
+
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	void noise(int seed, int generator = GENERATOR) {
 		if(noised)
 			return;
 		else
 			noised = true;
 
+		uint32_t state = ((seed * 73856093u) ^ (ax * 19349663u) ^ (ay * 83492791u) ^ (az * 2654435761u)) | 1;
+		float surface[CX][CZ];
+
 		for(int x = 0; x < CX; x++) {
 			for(int z = 0; z < CZ; z++) {
 				// Land height
@@ -230,6 +697,9 @@ struct chunk {
 				int h = n * 2;
 				int y = 0;
 
+				// Where smooth terrain crosses the center of the columns of blocks, between the center of the top block and the one above it
+				surface[x][z] = n * 2 > 0 ? n * 2 - 0.5 : n * 2 + 0.5;
+
 				// Land blocks
 				for(y = 0; y < CY; y++) {
 					// Are we above "ground" level?
@@ -241,9 +711,9 @@ struct chunk {
 						// Otherwise, we are in the air
 						} else {
 							// A tree!
-							if(get(x, y - 1, z) == 3 && (rand() & 0xff) == 0) {
+							if(get(x, y - 1, z) == 3 && (rng(state, generator) & 0xff) == 0) {
 								// Trunk
-								h = (rand() & 0x3) + 3;
+								h = (rng(state, generator) & 0x3) + 3;
 								for(int i = 0; i < h; i++)
 									set(x, y + i, z, 5);
 
@@ -251,7 +721,7 @@ struct chunk {
 								for(int ix = -3; ix <= 3; ix++) { 
 									for(int iy = -3; iy <= 3; iy++) { 
 										for(int iz = -3; iz <= 3; iz++) { 
-											if(ix * ix + iy * iy + iz * iz < 8 + (rand() & 1) && !get(x + ix, y + h + iy, z + iz))
+											if(ix * ix + iy * iy + iz * iz < 8 + (int)(rng(state, generator) & 1) && !get(x + ix, y + h + iy, z + iz))
 												set(x + ix, y + h + iy, z + iz, 4);
 										}
 									}
@@ -279,26 +749,76 @@ struct chunk {
 				}
 			}
 		}
-		changed = true;
+
+		// Most blocks were written directly, so count them again
+		blocks = 0;
+		for(int x = 0; x < CX; x++)
+			for(int y = 0; y < CY; y++)
+				for(int z = 0; z < CZ; z++)
+					if(blk[x][y][z])
+						blocks++;
+
+		if(smooth)
+			densify(surface);
+
+		markchanged();
+	}
+
+	/* The density field of smooth terrain is positive inside it and negative outside, and goes through zero at the surface.
+	   Generated terrain gets its density from the height of the land, which is continuous, instead of the whole blocks.
+	   Only the opaque blocks are part of the terrain. So that the terrain always has the same shape as the blocks
+	   that are used for everything else, the density is made to agree with them where they differ. */
+
+	void densify(const float surface[CX][CZ]) {
+		if(!density)
+			density = new int8_t[CX][CY][CZ];
+
+		for(int x = 0; x < CX; x++) {
+			for(int y = 0; y < CY; y++) {
+				for(int z = 0; z < CZ; z++) {
+					int d = lrintf((surface[x][z] - (y + ay * CY + 0.5f)) * DENSITYSLOPE);
+					d = std::max(-2 * SOLIDITY, std::min(2 * SOLIDITY, d));
+
+					bool opaque = blk[x][y][z] && !transparent[blk[x][y][z]];
+					if(opaque && d <= 0)
+						d = SOLIDITY;
+					else if(!opaque && d > 0)
+						d = -SOLIDITY;
+
+					density[x][y][z] = d;
+				}
+			}
+		}
 	}
 
-	void update() {
-		byte4 vertex[CX * CY * CZ * 18];
+	// Build the mesh for one section into vertex and vlight, which must have room for SECTIONVERTICES vertices.
+	// Returns the number of vertices, merged is set to the number of faces that were merged into a previous quad.
+	// Without opaque, only the faces of transparent blocks are included.
+	// This does not touch any GL state, so it can be used without a GL context.
+	int mesh(int s, byte4 *vertex, uint8_t *vlight, int &merged, bool opaque = true) {
+		// A copy of the pointer, which the compiler does not have to load again after every write to the mesh
+		const uint8_t (*const blk)[CY][CZ] = this->blk;
+		int y0 = s * SY;
+		int y1 = y0 + SY;
 		int i = 0;
-		int merged = 0;
-		bool vis = false;;
+		bool vis = false;
+
+		merged = 0;
 
 		// View from negative x
 
 		for(int x = CX - 1; x >= 0; x--) {
-			for(int y = 0; y < CY; y++) {
+			for(int y = y0; y < y1; y++) {
 				for(int z = 0; z < CZ; z++) {
 					// Line of sight blocked?
-					if(isblocked(x, y, z, x - 1, y, z)) {
+					if(isblocked(x, y, z, x - 1, y, z) || (!opaque && !transparent[blk[x][y][z]])) {
 						vis = false;
 						continue;
 					}
 
+					// Light falling on this face
+					uint8_t l = getlight(x - 1, y, z);
+
 					uint8_t top = blk[x][y][z];
 					uint8_t bottom = blk[x][y][z];
 					uint8_t side = blk[x][y][z];
@@ -313,7 +833,7 @@ struct chunk {
 					}
 
 					// Same block as previous one? Extend it.
-					if(vis && z != 0 && blk[x][y][z] == blk[x][y][z - 1]) {
+					if(vis && z != 0 && blk[x][y][z] == blk[x][y][z - 1] && l == vlight[i - 1]) {
 						vertex[i - 5] = byte4(x, y, z + 1, side);
 						vertex[i - 2] = byte4(x, y, z + 1, side);
 						vertex[i - 1] = byte4(x, y + 1, z + 1, side);
@@ -326,6 +846,7 @@ struct chunk {
 						vertex[i++] = byte4(x, y + 1, z, side);
 						vertex[i++] = byte4(x, y, z + 1, side);
 						vertex[i++] = byte4(x, y + 1, z + 1, side);
+						memset(vlight + i - 6, l, 6);
 					}
 					
 					vis = true;
@@ -336,13 +857,16 @@ struct chunk {
 		// View from positive x
 
 		for(int x = 0; x < CX; x++) {
-			for(int y = 0; y < CY; y++) {
+			for(int y = y0; y < y1; y++) {
 				for(int z = 0; z < CZ; z++) {
-					if(isblocked(x, y, z, x + 1, y, z)) {
+					if(isblocked(x, y, z, x + 1, y, z) || (!opaque && !transparent[blk[x][y][z]])) {
 						vis = false;
 						continue;
 					}
 
+					// Light falling on this face
+					uint8_t l = getlight(x + 1, y, z);
+
 					uint8_t top = blk[x][y][z];
 					uint8_t bottom = blk[x][y][z];
 					uint8_t side = blk[x][y][z];
@@ -354,7 +878,7 @@ struct chunk {
 						top = bottom = 12;
 					}
 
-					if(vis && z != 0 && blk[x][y][z] == blk[x][y][z - 1]) {
+					if(vis && z != 0 && blk[x][y][z] == blk[x][y][z - 1] && l == vlight[i - 1]) {
 						vertex[i - 4] = byte4(x + 1, y, z + 1, side);
 						vertex[i - 2] = byte4(x + 1, y + 1, z + 1, side);
 						vertex[i - 1] = byte4(x + 1, y, z + 1, side);
@@ -366,6 +890,7 @@ struct chunk {
 						vertex[i++] = byte4(x + 1, y + 1, z, side);
 						vertex[i++] = byte4(x + 1, y + 1, z + 1, side);
 						vertex[i++] = byte4(x + 1, y, z + 1, side);
+						memset(vlight + i - 6, l, 6);
 					}
 					vis = true;
 				}
@@ -375,13 +900,16 @@ struct chunk {
 		// View from negative y
 
 		for(int x = 0; x < CX; x++) {
-			for(int y = CY - 1; y >= 0; y--) {
+			for(int y = y1 - 1; y >= y0; y--) {
 				for(int z = 0; z < CZ; z++) {
-					if(isblocked(x, y, z, x, y - 1, z)) {
+					if(isblocked(x, y, z, x, y - 1, z) || (!opaque && !transparent[blk[x][y][z]])) {
 						vis = false;
 						continue;
 					}
 
+					// Light falling on this face
+					uint8_t l = getlight(x, y - 1, z);
+
 					uint8_t top = blk[x][y][z];
 					uint8_t bottom = blk[x][y][z];
 
@@ -391,7 +919,7 @@ struct chunk {
 						top = bottom = 12;
 					}
 
-					if(vis && z != 0 && blk[x][y][z] == blk[x][y][z - 1]) {
+					if(vis && z != 0 && blk[x][y][z] == blk[x][y][z - 1] && l == vlight[i - 1]) {
 						vertex[i - 4] = byte4(x, y, z + 1, bottom + 128);
 						vertex[i - 2] = byte4(x + 1, y, z + 1, bottom + 128);
 						vertex[i - 1] = byte4(x, y, z + 1, bottom + 128);
@@ -403,6 +931,7 @@ struct chunk {
 						vertex[i++] = byte4(x + 1, y, z, bottom + 128);
 						vertex[i++] = byte4(x + 1, y, z + 1, bottom + 128);
 						vertex[i++] = byte4(x, y, z + 1, bottom + 128);
+						memset(vlight + i - 6, l, 6);
 					}
 					vis = true;
 				}
@@ -412,13 +941,16 @@ struct chunk {
 		// View from positive y
 
 		for(int x = 0; x < CX; x++) {
-			for(int y = 0; y < CY; y++) {
+			for(int y = y0; y < y1; y++) {
 				for(int z = 0; z < CZ; z++) {
-					if(isblocked(x, y, z, x, y + 1, z)) {
+					if(isblocked(x, y, z, x, y + 1, z) || (!opaque && !transparent[blk[x][y][z]])) {
 						vis = false;
 						continue;
 					}
 
+					// Light falling on this face
+					uint8_t l = getlight(x, y + 1, z);
+
 					uint8_t top = blk[x][y][z];
 					uint8_t bottom = blk[x][y][z];
 
@@ -428,7 +960,7 @@ struct chunk {
 						top = bottom = 12;
 					}
 
-					if(vis && z != 0 && blk[x][y][z] == blk[x][y][z - 1]) {
+					if(vis && z != 0 && blk[x][y][z] == blk[x][y][z - 1] && l == vlight[i - 1]) {
 						vertex[i - 5] = byte4(x, y + 1, z + 1, top + 128);
 						vertex[i - 2] = byte4(x, y + 1, z + 1, top + 128);
 						vertex[i - 1] = byte4(x + 1, y + 1, z + 1, top + 128);
@@ -440,6 +972,7 @@ struct chunk {
 						vertex[i++] = byte4(x + 1, y + 1, z, top + 128);
 						vertex[i++] = byte4(x, y + 1, z + 1, top + 128);
 						vertex[i++] = byte4(x + 1, y + 1, z + 1, top + 128);
+						memset(vlight + i - 6, l, 6);
 					}
 					vis = true;
 				}
@@ -450,12 +983,15 @@ struct chunk {
 
 		for(int x = 0; x < CX; x++) {
 			for(int z = CZ - 1; z >= 0; z--) {
-				for(int y = 0; y < CY; y++) {
-					if(isblocked(x, y, z, x, y, z - 1)) {
+				for(int y = y0; y < y1; y++) {
+					if(isblocked(x, y, z, x, y, z - 1) || (!opaque && !transparent[blk[x][y][z]])) {
 						vis = false;
 						continue;
 					}
 
+					// Light falling on this face
+					uint8_t l = getlight(x, y, z - 1);
+
 					uint8_t top = blk[x][y][z];
 					uint8_t bottom = blk[x][y][z];
 					uint8_t side = blk[x][y][z];
@@ -467,7 +1003,7 @@ struct chunk {
 						top = bottom = 12;
 					}
 
-					if(vis && y != 0 && blk[x][y][z] == blk[x][y - 1][z]) {
+					if(vis && y != y0 && blk[x][y][z] == blk[x][y - 1][z] && l == vlight[i - 1]) {
 						vertex[i - 5] = byte4(x, y + 1, z, side);
 						vertex[i - 3] = byte4(x, y + 1, z, side);
 						vertex[i - 2] = byte4(x + 1, y + 1, z, side);
@@ -479,6 +1015,7 @@ struct chunk {
 						vertex[i++] = byte4(x, y + 1, z, side);
 						vertex[i++] = byte4(x + 1, y + 1, z, side);
 						vertex[i++] = byte4(x + 1, y, z, side);
+						memset(vlight + i - 6, l, 6);
 					}
 					vis = true;
 				}
@@ -489,12 +1026,15 @@ struct chunk {
 
 		for(int x = 0; x < CX; x++) {
 			for(int z = 0; z < CZ; z++) {
-				for(int y = 0; y < CY; y++) {
-					if(isblocked(x, y, z, x, y, z + 1)) {
+				for(int y = y0; y < y1; y++) {
+					if(isblocked(x, y, z, x, y, z + 1) || (!opaque && !transparent[blk[x][y][z]])) {
 						vis = false;
 						continue;
 					}
 
+					// Light falling on this face
+					uint8_t l = getlight(x, y, z + 1);
+
 					uint8_t top = blk[x][y][z];
 					uint8_t bottom = blk[x][y][z];
 					uint8_t side = blk[x][y][z];
@@ -506,7 +1046,7 @@ struct chunk {
 						top = bottom = 12;
 					}
 
-					if(vis && y != 0 && blk[x][y][z] == blk[x][y - 1][z]) {
+					if(vis && y != y0 && blk[x][y][z] == blk[x][y - 1][z] && l == vlight[i - 1]) {
 						vertex[i - 4] = byte4(x, y + 1, z + 1, side);
 						vertex[i - 3] = byte4(x, y + 1, z + 1, side);
 						vertex[i - 1] = byte4(x + 1, y + 1, z + 1, side);
@@ -518,257 +1058,4164 @@ struct chunk {
 						vertex[i++] = byte4(x, y + 1, z + 1, side);
 						vertex[i++] = byte4(x + 1, y, z + 1, side);
 						vertex[i++] = byte4(x + 1, y + 1, z + 1, side);
+						memset(vlight + i - 6, l, 6);
 					}
 					vis = true;
 				}
 			}
 		}
 
-		changed = false;
-		elements = i;
+		return i;
+	}
+
+	/* Bricks. The chunk is also stored as BX x BY x BZ bricks of BRICK^3 blocks, for distant terrain and for casting rays.
+	   A brick whose blocks are all the same takes a single byte, only the others keep a copy of their blocks in mixed.
+	   Most of those only have two types of blocks, like air and grass or rock and ore, which take the two types and a bit per block.
+	   The rest takes 4 bits per block. So the bricks of a chunk take about a KB, instead of the CX * CY * CZ bytes of blk.
+	   Rays skip bricks of air in one step, and chunks that are far away are drawn as a mesh of bricks instead of blocks.
+	   Changes only clear bricked, the bricks are built again by the simulation thread before they are used. */
 
-		// If this chunk is empty, no need to allocate a chunk slot.
-		if(!elements)
+	void rebrick() {
+		if(bricked)
 			return;
 
-		// If we don't have an active slot, find one
-		if(chunk_slot[slot] != this) {
-			int lru = 0;
-			for(int i = 0; i < CHUNKSLOTS; i++) {
-				// If there is an empty slot, use it
-				if(!chunk_slot[i]) {
-					lru = i;
-					break;
+		bricked = true;
+		mixed.clear();
+		mixoffset.clear();
+
+		for(int bx = 0; bx < BX; bx++) {
+			for(int by = 0; by < BY; by++) {
+				for(int bz = 0; bz < BZ; bz++) {
+					uint8_t b[BRICKVOLUME];
+					int count[16] = {0};
+					int types[16] = {0};
+					int filled = 0;
+					int n = 0;
+					bool same = true;
+
+					for(int x = bx * BRICK; x < (bx + 1) * BRICK; x++) {
+						for(int y = by * BRICK; y < (by + 1) * BRICK; y++) {
+							for(int z = bz * BRICK; z < (bz + 1) * BRICK; z++) {
+								uint8_t type = blk[x][y][z];
+								b[n++] = type;
+								same &= type == b[0];
+								types[type]++;
+
+								if(!type)
+									continue;
+
+								// Blocks that are open to the sky decide what the brick looks like, so grass stays green
+								filled++;
+								count[type] += transparent[y + 1 < CY ? blk[x][y + 1][z] : above ? above->at(x, 0, z) : 0] ? BRICKVOLUME : 1;
+							}
+						}
+					}
+
+					if(same) {
+						brick[bx][by][bz] = b[0];
+					} else {
+						brick[bx][by][bz] = MIXED + mixoffset.size();
+						mixoffset.push_back(mixed.size());
+						pack(b, types);
+					}
+
+					// From far away, a brick is solid if at least half of it is
+					int best = 0;
+					for(int t = 1; t < 16; t++)
+						if(count[t] > count[best])
+							best = t;
+
+					coarse[bx][by][bz] = filled * 2 >= BRICKVOLUME ? best : 0;
 				}
-				// Otherwise try to find the least recently used slot
-				if(chunk_slot[i]->lastused < chunk_slot[lru]->lastused)
-					lru = i;
 			}
+		}
+	}
 
-			// If the slot is empty, create a new VBO
-			if(!chunk_slot[lru]) {
-				glGenBuffers(1, &vbo);
-			// Otherwise, steal it from the previous slot owner
-			} else {
-				vbo = chunk_slot[lru]->vbo;
-				chunk_slot[lru]->changed = true;
+	// Append the blocks of a mixed brick to mixed: two types followed by a bit for each block if there are only two,
+	// otherwise NIBBLES followed by 4 bits for each block
+	void pack(const uint8_t *b, const int *types) {
+		uint8_t kinds[2];
+		int n = 0;
+
+		for(int t = 0; t < 16; t++)
+			if(types[t] && n++ < 2)
+				kinds[n - 1] = t;
+
+		if(n == 2) {
+			mixed.push_back(kinds[0]);
+			mixed.push_back(kinds[1]);
+			for(int i = 0; i < BRICKVOLUME; i += 8) {
+				uint8_t bits = 0;
+				for(int j = 0; j < 8; j++)
+					bits |= (b[i + j] == kinds[1]) << j;
+				mixed.push_back(bits);
 			}
-
-			slot = lru;
-			chunk_slot[slot] = this;
+		} else {
+			mixed.push_back(NIBBLES);
+			for(int i = 0; i < BRICKVOLUME; i += 2)
+				mixed.push_back(b[i] | b[i + 1] << 4);
 		}
+	}
 
-		// Upload vertices
+	// Block at (x, y, z) in this chunk, read from the bricks
+	uint8_t brickget(int x, int y, int z) const {
+		uint8_t b = brick[x / BRICK][y / BRICK][z / BRICK];
+		if(b < MIXED)
+			return b;
 
-		glBindBuffer(GL_ARRAY_BUFFER, vbo);
-		glBufferData(GL_ARRAY_BUFFER, i * sizeof *vertex, vertex, GL_STATIC_DRAW);
+		const uint8_t *m = &mixed[mixoffset[b - MIXED]];
+		int i = ((x % BRICK) * BRICK + y % BRICK) * BRICK + z % BRICK;
+
+		if(m[0] & NIBBLES)
+			return m[1 + i / 2] >> (i % 2 * 4) & 0xf;
+		return m[m[2 + i / 8] >> (i % 8) & 1];
 	}
 
-	void render() {
-		if(changed)
-			update();
+	// Memory used by the bricks
+	size_t brickbytes() const {
+		return sizeof brick + sizeof coarse + mixed.size() + mixoffset.size() * sizeof mixoffset[0];
+	}
 
-		lastused = now;
+	/* Packing. A chunk that is far away is only drawn with the mesh of its bricks, and the bricks hold all of its blocks.
+	   So pack() frees blk and light, and keeps the light, and the density and water levels if there are any,
+	   run length encoded in packed, after a byte saying which of those are there. That takes a chunk from 16 KB
+	   to about 1.4 KB, bricks included, or 2.5 KB with the density of smooth terrain. Blocks of a packed chunk
+	   are read from the bricks with at(). Everything that needs more, like lighting, meshing the sections and edits,
+	   calls unpack() first, which builds blk again from the bricks. Only the simulation thread packs and unpacks chunks. */
 
-		if(!elements)
+	void pack() {
+		if(!blk || !active.empty())
 			return;
 
-		glBindBuffer(GL_ARRAY_BUFFER, vbo);
-		glVertexAttribPointer(attribute_coord, 4, GL_BYTE, GL_FALSE, 0, 0);
-		glDrawArrays(GL_TRIANGLES, 0, elements);
+		rebrick();
+		packed.push_back((density ? 1 : 0) | (flow ? 2 : 0));
+		compress(&light[0][0][0], CX * CY * CZ, packed);
+		if(density)
+			compress((const uint8_t *)&density[0][0][0], CX * CY * CZ, packed);
+		if(flow)
+			compress(&flow[0][0][0], CX * CY * CZ, packed);
+		std::vector<uint8_t>(packed).swap(packed);
+
+		delete[] blk;
+		delete[] light;
+		delete[] density;
+		delete[] flow;
+		blk = 0;
+		light = 0;
+		density = 0;
+		flow = 0;
 	}
-};
 
-struct superchunk {
-	chunk *c[SCX][SCY][SCZ];
-	time_t seed;
+	void unpack() {
+		if(blk)
+			return;
 
-	superchunk() {
-		seed = time(NULL);
-		for(int x = 0; x < SCX; x++)
-			for(int y = 0; y < SCY; y++)
-				for(int z = 0; z < SCZ; z++)
-					c[x][y][z] = new chunk(x - SCX / 2, y - SCY / 2, z - SCZ / 2);
+		blk = new uint8_t[CX][CY][CZ];
+		for(int x = 0; x < CX; x++)
+			for(int y = 0; y < CY; y++)
+				for(int z = 0; z < CZ; z += BRICK)
+					if(brick[x / BRICK][y / BRICK][z / BRICK] < MIXED)
+						memset(&blk[x][y][z], brick[x / BRICK][y / BRICK][z / BRICK], BRICK);
+					else
+						for(int i = z; i < z + BRICK; i++)
+							blk[x][y][i] = brickget(x, y, i);
 
-		for(int x = 0; x < SCX; x++)
-			for(int y = 0; y < SCY; y++)
-				for(int z = 0; z < SCZ; z++) {
-					if(x > 0)
-						c[x][y][z]->left = c[x - 1][y][z];
-					if(x < SCX - 1)
-						c[x][y][z]->right = c[x + 1][y][z];
-					if(y > 0)
-						c[x][y][z]->below = c[x][y - 1][z];
-					if(y < SCY - 1)
-						c[x][y][z]->above = c[x][y + 1][z];
-					if(z > 0)
-						c[x][y][z]->front = c[x][y][z - 1];
-					if(z < SCZ - 1)
-						c[x][y][z]->back = c[x][y][z + 1];
-				}
-	}
+		const uint8_t *p = packed.data() + 1;
+		const uint8_t *end = packed.data() + packed.size();
 
-	uint8_t get(int x, int y, int z) const {
-		int cx = (x + CX * (SCX / 2)) / CX;
-		int cy = (y + CY * (SCY / 2)) / CY;
-		int cz = (z + CZ * (SCZ / 2)) / CZ;
+		light = new uint8_t[CX][CY][CZ];
+		expand(p, end, &light[0][0][0], CX * CY * CZ);
 
-		if(cx < 0 || cx >= SCX || cy < 0 || cy >= SCY || cz <= 0 || cz >= SCZ)
-			return 0;
+		if(packed[0] & 1) {
+			density = new int8_t[CX][CY][CZ];
+			expand(p, end, (uint8_t *)&density[0][0][0], CX * CY * CZ);
+		}
 
-		return c[cx][cy][cz]->get(x & (CX - 1), y & (CY - 1), z & (CZ - 1));
-	}
+		if(packed[0] & 2) {
+			flow = new uint8_t[CX][CY][CZ];
+			expand(p, end, &flow[0][0][0], CX * CY * CZ);
+		}
 
-	void set(int x, int y, int z, uint8_t type) {
-		int cx = (x + CX * (SCX / 2)) / CX;
-		int cy = (y + CY * (SCY / 2)) / CY;
-		int cz = (z + CZ * (SCZ / 2)) / CZ;
+		std::vector<uint8_t>().swap(packed);
+	}
 
-		if(cx < 0 || cx >= SCX || cy < 0 || cy >= SCY || cz <= 0 || cz >= SCZ)
-			return;
+	// What a brick looks like from far away, for coordinates up to one brick outside this chunk
+	uint8_t coarseat(int bx, int by, int bz) {
+		chunk *ch = this;
+
+		if(bx < 0)
+			ch = left, bx += BX;
+		else if(bx >= BX)
+			ch = right, bx -= BX;
+		else if(by < 0)
+			ch = below, by += BY;
+		else if(by >= BY)
+			ch = above, by -= BY;
+		else if(bz < 0)
+			ch = front, bz += BZ;
+		else if(bz >= BZ)
+			ch = back, bz -= BZ;
+
+		if(!ch)
+			return 0;
 
-		c[cx][cy][cz]->set(x & (CX - 1), y & (CY - 1), z & (CZ - 1), type);
+		ch->rebrick();
+		return ch->coarse[bx][by][bz];
 	}
 
-	void render(const glm::mat4 &pv) {
-		float ud = 1.0 / 0.0;
-		int ux = -1;
-		int uy = -1;
-		int uz = -1;
+	// The brightest light in a box of blocks next to this chunk, for the side of a brick facing it
+	uint8_t boxlight(int x0, int y0, int z0, int x1, int y1, int z1) const {
+		int sky = 0;
+		int block = 0;
+
+		for(int x = x0; x <= x1; x++) {
+			for(int y = y0; y <= y1; y++) {
+				for(int z = z0; z <= z1; z++) {
+					uint8_t l = getlight(x, y, z);
+					sky = std::max(sky, l >> 4);
+					block = std::max(block, l & 0xf);
+				}
+			}
+		}
 
-		for(int x = 0; x < SCX; x++) {
-			for(int y = 0; y < SCY; y++) {
-				for(int z = 0; z < SCZ; z++) {
-					glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(c[x][y][z]->ax * CX, c[x][y][z]->ay * CY, c[x][y][z]->az * CZ));
-					glm::mat4 mvp = pv * model;
+		return sky << 4 | block;
+	}
 
-					// Is this chunk on the screen?
-					glm::vec4 center = mvp * glm::vec4(CX / 2, CY / 2, CZ / 2, 1);
+	static void quad(byte4 *vertex, int &i, byte4 a, byte4 b, byte4 c, byte4 d) {
+		vertex[i++] = a;
+		vertex[i++] = b;
+		vertex[i++] = c;
+		vertex[i++] = c;
+		vertex[i++] = b;
+		vertex[i++] = d;
+	}
 
-					float d = glm::length(center);
-					center.x /= center.w;
-					center.y /= center.w;
+	// Build the mesh of the bricks that look solid from far away, with a quad for every side facing a brick that does not.
+	// This has the same layout as the mesh of a section, but only takes a few hundred vertices for the whole chunk.
+	int farmesh(byte4 *vertex, uint8_t *vlight) {
+		const int n = BRICK;
+		int i = 0;
 
-					// If it is behind the camera, don't bother drawing it
-					if(center.z < -CY / 2)
-						continue;
+		rebrick();
 
-					// If it is outside the screen, don't bother drawing it
-					if(fabsf(center.x) > 1 + fabsf(CY * 2 / center.w) || fabsf(center.y) > 1 + fabsf(CY * 2 / center.w))
+		for(int bx = 0; bx < BX; bx++) {
+			for(int by = 0; by < BY; by++) {
+				for(int bz = 0; bz < BZ; bz++) {
+					uint8_t top = coarse[bx][by][bz];
+					if(!top)
 						continue;
 
-					// If this chunk is not initialized, skip it
-					if(!c[x][y][z]->initialized) {
-						// But if it is the closest to the camera, mark it for initialization
-						if(ux < 0 || d < ud) {
-							ud = d;
-							ux = x;
-							uy = y;
-							uz = z;
-						}
-						continue;
+					uint8_t bottom = top;
+					uint8_t side = top;
+
+					if(top == 3) {
+						bottom = 1;
+						side = 2;
+					} else if(top == 5) {
+						top = bottom = 12;
 					}
 
-					glUniformMatrix4fv(uniform_mvp, 1, GL_FALSE, glm::value_ptr(mvp));
+					int x = bx * n;
+					int y = by * n;
+					int z = bz * n;
 
-					c[x][y][z]->render();
+					if(!coarseat(bx - 1, by, bz)) {
+						quad(vertex, i, byte4(x, y, z, side), byte4(x, y, z + n, side), byte4(x, y + n, z, side), byte4(x, y + n, z + n, side));
+						memset(vlight + i - 6, boxlight(x - 1, y, z, x - 1, y + n - 1, z + n - 1), 6);
+					}
+					if(!coarseat(bx + 1, by, bz)) {
+						quad(vertex, i, byte4(x + n, y, z, side), byte4(x + n, y + n, z, side), byte4(x + n, y, z + n, side), byte4(x + n, y + n, z + n, side));
+						memset(vlight + i - 6, boxlight(x + n, y, z, x + n, y + n - 1, z + n - 1), 6);
+					}
+					if(!coarseat(bx, by - 1, bz)) {
+						quad(vertex, i, byte4(x, y, z, bottom + 128), byte4(x + n, y, z, bottom + 128), byte4(x, y, z + n, bottom + 128), byte4(x + n, y, z + n, bottom + 128));
+						memset(vlight + i - 6, boxlight(x, y - 1, z, x + n - 1, y - 1, z + n - 1), 6);
+					}
+					if(!coarseat(bx, by + 1, bz)) {
+						quad(vertex, i, byte4(x, y + n, z, top + 128), byte4(x, y + n, z + n, top + 128), byte4(x + n, y + n, z, top + 128), byte4(x + n, y + n, z + n, top + 128));
+						memset(vlight + i - 6, boxlight(x, y + n, z, x + n - 1, y + n, z + n - 1), 6);
+					}
+					if(!coarseat(bx, by, bz - 1)) {
+						quad(vertex, i, byte4(x, y, z, side), byte4(x, y + n, z, side), byte4(x + n, y, z, side), byte4(x + n, y + n, z, side));
+						memset(vlight + i - 6, boxlight(x, y, z - 1, x + n - 1, y + n - 1, z - 1), 6);
+					}
+					if(!coarseat(bx, by, bz + 1)) {
+						quad(vertex, i, byte4(x, y, z + n, side), byte4(x + n, y, z + n, side), byte4(x, y + n, z + n, side), byte4(x + n, y + n, z + n, side));
+						memset(vlight + i - 6, boxlight(x, y, z + n, x + n - 1, y + n - 1, z + n), 6);
+					}
 				}
 			}
 		}
 
-		if(ux >= 0) {
-			c[ux][uy][uz]->noise(seed);
-			if(c[ux][uy][uz]->left)
-				c[ux][uy][uz]->left->noise(seed);
-			if(c[ux][uy][uz]->right)
-				c[ux][uy][uz]->right->noise(seed);
-			if(c[ux][uy][uz]->below)
-				c[ux][uy][uz]->below->noise(seed);
-			if(c[ux][uy][uz]->above)
-				c[ux][uy][uz]->above->noise(seed);
-			if(c[ux][uy][uz]->front)
-				c[ux][uy][uz]->front->noise(seed);
-			if(c[ux][uy][uz]->back)
-				c[ux][uy][uz]->back->noise(seed);
-			c[ux][uy][uz]->initialized = true;
-		}
+		return i;
 	}
+
+	/* Smooth terrain, for worlds made with --smooth. The opaque blocks are drawn as the surface where the density field
+	   goes through zero, built with surface nets. The samples of the field are at the centers of the blocks.
+	   Every cell between eight samples that the surface passes through gets a vertex, at the average of the points
+	   where the surface crosses the edges of the cell, and every edge between two samples that the surface crosses
+	   gets a quad between the vertices of the four cells around it. A section makes the quads of the edges that start
+	   at its own blocks, so it needs the samples one block around it, and the quads of neighbouring sections meet exactly.
+	   A vertex is shared by all quads around it with the same texture, so the mesh is indexed.
+	   That is about 17 bytes per quad, one vertex and six 16 bit indices, against 30 for a quad of blocks.
+	   Surface nets cannot merge coplanar quads the way mesh() does though, so a smooth section has almost twice as many
+	   quads and takes about a third more room than a blocky one: around 6.2 KB per chunk on meshbench against 4.7 KB.
+	   Water, leaves and glass are still drawn as blocks, in the same mesh. */
+
+	// Density, type and light of a block, also for blocks outside this chunk
+	void sample(int x, int y, int z, int &d, uint8_t &type, uint8_t &l) const {
+		const chunk *ch = 0;
+
+		if(x < 0)
+			ch = left, x += CX;
+		else if(x >= CX)
+			ch = right, x -= CX;
+		else if(y < 0)
+			ch = below, y += CY;
+		else if(y >= CY)
+			ch = above, y -= CY;
+		else if(z < 0)
+			ch = front, z += CZ;
+		else if(z >= CZ)
+			ch = back, z -= CZ;
+		else
+			ch = this;
+
+		if(ch == this) {
+			type = blk[x][y][z];
+			l = light[x][y][z];
+
+			// Chunks received from a world server do not have a density field, so make one up from the blocks
+			d = density ? density[x][y][z] : type && !transparent[type] ? SOLIDITY : -SOLIDITY;
+		} else if(ch) {
+			ch->sample(x, y, z, d, type, l);
+		} else {
+			d = -SOLIDITY;
+			type = 0;
+			l = 0xf0;
+		}
+	}
+
+	void smoothmesh(int s, sectionmesh &m, bool stream) {
+		enum { NX = CX + 2, NY = SY + 2, NZ = CZ + 2 };
+
+		int y0 = s * SY;
+		int d[NX][NY][NZ];
+		uint8_t type[NX][NY][NZ];
+		uint8_t l[NX][NY][NZ];
+
+		// Sample [0][0][0] is the block at (-1, y0 - 1, -1)
+		for(int x = 0; x < NX; x++)
+			for(int y = 0; y < NY; y++)
+				for(int z = 0; z < NZ; z++)
+					sample(x - 1, y0 + y - 1, z - 1, d[x][y][z], type[x][y][z], l[x][y][z]);
+
+		std::vector<byte4> vertex;
+		std::vector<uint8_t> vlight;
+		std::vector<uint32_t> index;
+
+		// Up to three vertices with different textures per cell, for reuse
+		std::vector<int> cached((NX - 1) * (NY - 1) * (NZ - 1) * 3, -1);
+
+		auto vertexat = [&](const int *p, uint8_t w) {
+			int *slot = &cached[((p[0] * (NY - 1) + p[1]) * (NZ - 1) + p[2]) * 3];
+
+			for(int i = 0; i < 3 && slot[i] >= 0; i++)
+				if(vertex[slot[i]].w == w)
+					return slot[i];
+
+			// Average the points where the surface crosses the edges of the cell, and take the brightest of the samples outside it
+			float sum[3] = {0, 0, 0};
+			int crossings = 0;
+			int sky = 0;
+			int block = 0;
+
+			for(int i = 0; i < 8; i++) {
+				int a[3] = {p[0] + (i & 1), p[1] + (i >> 1 & 1), p[2] + (i >> 2 & 1)};
+				int da = d[a[0]][a[1]][a[2]];
+
+				if(da <= 0) {
+					sky = std::max(sky, l[a[0]][a[1]][a[2]] >> 4);
+					block = std::max(block, l[a[0]][a[1]][a[2]] & 0xf);
+				}
+
+				for(int axis = 0; axis < 3; axis++) {
+					if(i & 1 << axis)
+						continue;
+
+					int j = i | 1 << axis;
+					int db = d[p[0] + (j & 1)][p[1] + (j >> 1 & 1)][p[2] + (j >> 2 & 1)];
+					if((da > 0) == (db > 0))
+						continue;
+
+					float t = (float)da / (da - db);
+					sum[0] += (i & 1) + (axis == 0) * t;
+					sum[1] += (i >> 1 & 1) + (axis == 1) * t;
+					sum[2] += (i >> 2 & 1) + (axis == 2) * t;
+					crossings++;
+				}
+			}
+
+			// Samples are at the centers of blocks, vertices are relative to the middle of the section
+			vertex.push_back(byte4(
+					lrintf((p[0] - 0.5f + sum[0] / crossings - CX / 2) * SMOOTHSCALE),
+					lrintf((p[1] - 0.5f + sum[1] / crossings - SY / 2) * SMOOTHSCALE),
+					lrintf((p[2] - 0.5f + sum[2] / crossings - CZ / 2) * SMOOTHSCALE),
+					w));
+			vlight.push_back(sky << 4 | block);
+
+			for(int i = 0; i < 3; i++) {
+				if(slot[i] < 0) {
+					slot[i] = vertex.size() - 1;
+					break;
+				}
+			}
+
+			return (int)vertex.size() - 1;
+		};
+
+		for(int x = 1; x < NX - 1; x++) {
+			for(int y = 1; y < NY - 1; y++) {
+				for(int z = 1; z < NZ - 1; z++) {
+					for(int a = 0; a < 3; a++) {
+						int p[3] = {x, y, z};
+						int q[3] = {x, y, z};
+						q[a]++;
+
+						bool inside = d[x][y][z] > 0;
+						if(inside == (d[q[0]][q[1]][q[2]] > 0))
+							continue;
+
+						// Textures are chosen like for the faces of the block inside the surface
+						const int *solid = inside ? p : q;
+						uint8_t top = type[solid[0]][solid[1]][solid[2]];
+						uint8_t bottom = top;
+						uint8_t side = top;
+
+						if(top == 3) {
+							bottom = 1;
+							side = 2;
+						} else if(top == 5) {
+							top = bottom = 12;
+						}
+
+						uint8_t w = a != 1 ? side : inside ? top + 128 : bottom + 128;
+
+						// The four cells around the edge, facing away from the inside
+						int b = (a + 1) % 3;
+						int c = (a + 2) % 3;
+						int cell[4][3];
+
+						for(int i = 0; i < 4; i++) {
+							std::copy(p, p + 3, cell[i]);
+							cell[i][b] -= (i == 1 || i == 2);
+							cell[i][c] -= (i >= 2);
+						}
+
+						int v[4];
+						for(int i = 0; i < 4; i++)
+							v[i] = vertexat(cell[i], w);
+
+						static const int front[6] = {0, 1, 2, 0, 2, 3};
+						static const int back[6] = {0, 2, 1, 0, 3, 2};
+						for(int i = 0; i < 6; i++)
+							index.push_back(v[inside ? front[i] : back[i]]);
+					}
+				}
+			}
+		}
+
+		// Add the faces of the transparent blocks, sharing the corners of each quad.
+		// Room for them is kept per thread, it is too large for the stack of a worker thread.
+		static thread_local std::vector<byte4> faces(SECTIONVERTICES);
+		static thread_local std::vector<uint8_t> flight(SECTIONVERTICES);
+		int merged;
+		int n = mesh(s, faces.data(), flight.data(), merged, false);
+
+		for(int i = 0; i + 6 <= n; i += 6) {
+			int corner[6];
+
+			for(int j = 0; j < 6; j++) {
+				corner[j] = -1;
+				for(int k = 0; k < j; k++)
+					if(faces[i + j] == faces[i + k])
+						corner[j] = corner[k];
+
+				if(corner[j] < 0) {
+					const byte4 &f = faces[i + j];
+					corner[j] = vertex.size();
+					vertex.push_back(byte4((f.x - CX / 2) * SMOOTHSCALE, (f.y - y0 - SY / 2) * SMOOTHSCALE, (f.z - CZ / 2) * SMOOTHSCALE, f.w));
+					vlight.push_back(flight[i + j]);
+				}
+
+				index.push_back(corner[j]);
+			}
+		}
+
+		m.vertices = vertex.size();
+		m.elements = m.vertices ? index.size() : 0;
+		uint8_t *out = m.output(meshbytes(m.elements, m.vertices), stream);
+
+		if(m.vertices) {
+			size_t end = vertex.size() * sizeof(byte4) + vlight.size();
+			memcpy(out, vertex.data(), vertex.size() * sizeof(byte4));
+			memcpy(out + vertex.size() * sizeof(byte4), vlight.data(), vlight.size());
+			memset(out + end, 0, indexoffset(m.vertices) - end);
+
+			if(indexsize(m.vertices) == sizeof(uint32_t)) {
+				memcpy(out + indexoffset(m.vertices), index.data(), index.size() * sizeof(uint32_t));
+			} else {
+				uint16_t *short_index = (uint16_t *)(out + indexoffset(m.vertices));
+				for(size_t i = 0; i < index.size(); i++)
+					short_index[i] = index[i];
+			}
+		}
+	}
+
+	// Add the sections that changed since they were last meshed to todo. Dirty flags are only checked once per tick,
+	// so any number of edits to a section in one tick cause only one update.
+	// With far set, only the mesh of the bricks is checked, otherwise only the sections.
+	void changes(std::vector<std::pair<chunk *, int> > &todo, bool far = false) {
+		for(int s = far ? FARSECTION : 0; s < (far ? FARSECTION + 1 : SECTIONS); s++) {
+			if(!sec[s].changed)
+				continue;
+
+			sec[s].changed = false;
+			todo.push_back(std::make_pair(this, s));
+		}
+	}
+
+	// Build the mesh of a section, or with FARSECTION of the bricks, into m, laid out as in its VBO.
+	// With stream, it is written straight into the mesh stream if that has room, see sectionmesh::output().
+	// This only reads from the world, so sections can be built on several threads at once.
+	// The mesh of the bricks may build the bricks of the neighbouring chunks, so that one can not.
+	void build(int s, sectionmesh &m, bool stream = false) {
+		m.c = this;
+		m.s = s;
+
+		if(smooth && s != FARSECTION) {
+			smoothmesh(s, m, stream);
+			return;
+		}
+
+		// Room for the largest possible mesh, kept per thread, as it is too large for the stack of a worker thread
+		static thread_local std::vector<byte4> vertex(SECTIONVERTICES);
+		static thread_local std::vector<uint8_t> vlight(SECTIONVERTICES);
+		int merged;
+		int i = s == FARSECTION ? farmesh(vertex.data(), vlight.data()) : mesh(s, vertex.data(), vlight.data(), merged);
+
+		m.elements = i;
+		m.vertices = 0;
+		uint8_t *out = m.output(meshbytes(i, 0), stream);
+
+		if(i) {
+			memcpy(out, vertex.data(), i * sizeof vertex[0]);
+			memcpy(out + i * sizeof vertex[0], vlight.data(), i * sizeof vlight[0]);
+		}
+	}
+
+	// Build the mesh for one section and upload it right away, for use without a simulation thread
+	void update(int s) {
+		sectionmesh m;
+
+		sec[s].changed = false;
+		build(s, m);
+		upload(m, m.data.data());
+	}
+
+	// Upload a mesh of this chunk to the VBO of its section, this must be called from the GL thread
+	void upload(const sectionmesh &m, const uint8_t *data) {
+		if(!allocate(m))
+			return;
+
+		glBufferSubData(GL_ARRAY_BUFFER, 0, m.bytes, data);
+	}
+
+	// Copy a mesh, stored the same way as in a VBO, from another buffer
+	void copy(const sectionmesh &m, GLuint from, size_t offset) {
+		if(!allocate(m))
+			return;
+
+		glBindBuffer(GL_COPY_READ_BUFFER, from);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ARRAY_BUFFER, offset, 0, m.bytes);
+	}
+
+	// Make sure the section of a mesh has a VBO with room for it, and bind it. Returns false if the mesh is empty.
+	// The storage is only reallocated when it has to grow.
+	bool allocate(const sectionmesh &m) {
+		int s = m.s;
+
+		sec[s].elements = m.elements;
+		sec[s].vertices = m.vertices;
+
+		// If this section is empty, no need to allocate a slot.
+		if(!m.elements)
+			return false;
+
+		// If we don't have an active slot, find one
+		if(section_slot[sec[s].slot] != &sec[s]) {
+			int lru = 0;
+			for(int i = 0; i < SECTIONSLOTS; i++) {
+				// If there is an empty slot, use it
+				if(!section_slot[i]) {
+					lru = i;
+					break;
+				}
+				// Otherwise try to find the least recently used slot
+				if(section_slot[i]->lastused < section_slot[lru]->lastused)
+					lru = i;
+			}
+
+			// If the slot is empty, create a new VBO
+			if(!section_slot[lru]) {
+				glGenBuffers(1, &sec[s].vbo);
+				sec[s].capacity = 0;
+			// Otherwise, steal it from the previous slot owner
+			} else {
+				sec[s].vbo = section_slot[lru]->vbo;
+				sec[s].capacity = section_slot[lru]->capacity;
+				section_slot[lru]->elements = 0;
+				section_slot[lru]->capacity = 0;
+				section_slot[lru]->changed = true;
+			}
+
+			sec[s].slot = lru;
+			section_slot[lru] = &sec[s];
+		}
+
+		// Vertices go first, followed by their light values, and for smooth terrain by the indices
+
+		glBindBuffer(GL_ARRAY_BUFFER, sec[s].vbo);
+
+		if(m.bytes > sec[s].capacity) {
+			glBufferData(GL_ARRAY_BUFFER, m.bytes, NULL, GL_STATIC_DRAW);
+			sec[s].capacity = m.bytes;
+		}
+
+		return true;
+	}
+
+	// Record the commands to draw the sections of this chunk, or with far set the mesh of its bricks.
+	// This does not make any GL calls, so it can be done on any thread while the GL thread is not uploading meshes.
+	void render(command_buffer &cmd, bool far = false) {
+		for(int s = far ? FARSECTION : 0; s < (far ? FARSECTION + 1 : SECTIONS); s++) {
+			sec[s].lastused = now;
+
+			if(!sec[s].elements)
+				continue;
+
+			cmd.bind_buffer(GL_ARRAY_BUFFER, sec[s].vbo);
+
+			if(!sec[s].vertices) {
+				cmd.vertex_attrib_pointer(attribute_coord, 4, GL_BYTE, GL_FALSE, 0, 0);
+				cmd.vertex_attrib_pointer(attribute_light, 1, GL_UNSIGNED_BYTE, GL_FALSE, 0, (void *)(sec[s].elements * sizeof(byte4)));
+				cmd.draw_arrays(GL_TRIANGLES, 0, sec[s].elements);
+				continue;
+			}
+
+			// Smooth terrain, the indices are in the same VBO
+			cmd.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, sec[s].vbo);
+			cmd.vertex_attrib_pointer(attribute_coord, 4, GL_BYTE, GL_FALSE, 0, 0);
+			cmd.vertex_attrib_pointer(attribute_light, 1, GL_UNSIGNED_BYTE, GL_FALSE, 0, (void *)(sec[s].vertices * sizeof(byte4)));
+			cmd.uniform1f(uniform_coordscale, 1.0 / SMOOTHSCALE);
+			cmd.uniform3f(uniform_coordbias, CX / 2, s * SY + SY / 2, CZ / 2);
+			cmd.draw_elements(GL_TRIANGLES, sec[s].elements, indexsize(sec[s].vertices) == sizeof(uint32_t) ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT, (void *)indexoffset(sec[s].vertices));
+			cmd.uniform1f(uniform_coordscale, 1);
+			cmd.uniform3f(uniform_coordbias, 0, 0, 0);
+			cmd.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		}
+	}
+};
+
+// A ray to be cast into the world
+struct rayquery {
+	glm::vec3 origin;
+	glm::vec3 direction;
+	float maxdist;
+};
+
+// The first block hit by a ray
+struct rayhit {
+	int x, y, z;
+	int face;       // Face the ray entered through, as in mouse(): 0-2 when travelling along -x/-y/-z, 3-5 along +x/+y/+z, -1 if inside
+	float distance; // Distance along the ray, in multiples of its direction vector
+	uint8_t type;   // 0 if nothing was hit
+};
+
+// Bounds of the world in block coordinates
+static const int world_lo[3] = {-CX * SCX / 2, -CY * SCY / 2, -CZ * SCZ / 2};
+static const int world_hi[3] = {CX * SCX / 2, CY * SCY / 2, CZ * SCZ / 2};
+static const int chunk_size[3] = {CX, CY, CZ};
+
+// The six neighbours of a block, in the same order as the faces, with straight down at index 1
+static const int neighbours[6][3] = {{-1, 0, 0}, {0, -1, 0}, {0, 0, -1}, {1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+
+// A block whose light still has to be added or removed
+struct lightnode {
+	int x, y, z;
+	int level;
+	lightnode(int x, int y, int z, int level): x(x), y(y), z(z), level(level) {}
+};
+
+// Shift to get the skylight or block light out of chunk::light
+#define SKYLIGHT 4
+#define BLOCKLIGHT 0
+
+struct superchunk {
+	chunk *c[SCX][SCY][SCZ];
+	int8_t skyheight[SCX * CX][SCZ * CZ]; // Lowest y coordinate of each column that sees the sky
+	time_t seed;
+	bool remote;                          // Chunks are received from a world server, instead of being generated here
+	bool smooth;                          // Draw the terrain as a smooth surface instead of blocks
+	int generator;                        // Version of the terrain generator
+
+	// Called with the box of blocks changed by every edit, including flowing water, if set
+	void (*edited)(int x0, int y0, int z0, int x1, int y1, int z1);
+
+	superchunk() {
+		seed = time(NULL);
+		remote = false;
+		smooth = false;
+		generator = GENERATOR;
+		edited = NULL;
+
+		// The world starts out empty, so the sky reaches all the way down
+		for(int x = 0; x < SCX * CX; x++)
+			for(int z = 0; z < SCZ * CZ; z++)
+				skyheight[x][z] = world_lo[1];
+
+		for(int x = 0; x < SCX; x++)
+			for(int y = 0; y < SCY; y++)
+				for(int z = 0; z < SCZ; z++)
+					c[x][y][z] = new chunk(x - SCX / 2, y - SCY / 2, z - SCZ / 2);
+
+		for(int x = 0; x < SCX; x++)
+			for(int y = 0; y < SCY; y++)
+				for(int z = 0; z < SCZ; z++) {
+					if(x > 0)
+						c[x][y][z]->left = c[x - 1][y][z];
+					if(x < SCX - 1)
+						c[x][y][z]->right = c[x + 1][y][z];
+					if(y > 0)
+						c[x][y][z]->below = c[x][y - 1][z];
+					if(y < SCY - 1)
+						c[x][y][z]->above = c[x][y + 1][z];
+					if(z > 0)
+						c[x][y][z]->front = c[x][y][z - 1];
+					if(z < SCZ - 1)
+						c[x][y][z]->back = c[x][y][z + 1];
+				}
+	}
+
+	uint8_t get(int x, int y, int z) const {
+		int cx = (x + CX * (SCX / 2)) / CX;
+		int cy = (y + CY * (SCY / 2)) / CY;
+		int cz = (z + CZ * (SCZ / 2)) / CZ;
+
+		if(cx < 0 || cx >= SCX || cy < 0 || cy >= SCY || cz < 0 || cz >= SCZ)
+			return 0;
+
+		return c[cx][cy][cz]->at(x & (CX - 1), y & (CY - 1), z & (CZ - 1));
+	}
+
+	/* Whether a block stops entities. Water does not. The edges and bottom of the world do,
+	   and so do chunks that have not been generated yet, so entities stay in the part of the world that exists. */
+
+	bool solid(int x, int y, int z) const {
+		if(y >= world_lo[1] + CY * SCY)
+			return false;
+		if(x < world_lo[0] || x >= world_lo[0] + CX * SCX || y < world_lo[1] || z < world_lo[2] || z >= world_lo[2] + CZ * SCZ)
+			return true;
+
+		const chunk *ch = c[(x - world_lo[0]) / CX][(y - world_lo[1]) / CY][(z - world_lo[2]) / CZ];
+		if(!ch->noised)
+			return true;
+
+		uint8_t type = ch->at(x & (CX - 1), y & (CY - 1), z & (CZ - 1));
+		return type && type != 8;
+	}
+
+	void set(int x, int y, int z, uint8_t type) {
+		int cx = (x + CX * (SCX / 2)) / CX;
+		int cy = (y + CY * (SCY / 2)) / CY;
+		int cz = (z + CZ * (SCZ / 2)) / CZ;
+
+		if(cx < 0 || cx >= SCX || cy < 0 || cy >= SCY || cz < 0 || cz >= SCZ)
+			return;
+
+		c[cx][cy][cz]->unpack();
+		c[cx][cy][cz]->set(x & (CX - 1), y & (CY - 1), z & (CZ - 1), type);
+		relight(x, y, z, x, y, z);
+		activate(x - 1, y - 1, z - 1, x + 1, y + 1, z + 1);
+		if(edited)
+			edited(x, y, z, x, y, z);
+	}
+
+	// Generate the terrain of a chunk if that was not done yet, and light it
+	void generate(chunk *ch) {
+		if(!ch || ch->noised)
+			return;
+
+		// Trees may grow into neighbouring chunks
+		int x = ch->ax * CX;
+		int y = ch->ay * CY;
+		int z = ch->az * CZ;
+		unpack(x - CX, y - CY, z - CZ, x + 2 * CX - 1, y + 2 * CY - 1, z + 2 * CZ - 1);
+
+		ch->smooth = smooth;
+		ch->noise(seed, generator);
+		relight(x - 3, y, z - 3, x + CX + 2, y + CY + 8, z + CZ + 2);
+	}
+
+	// Find the chunk containing a block, and the coordinates of the block within that chunk.
+	// The coordinates are set even outside the world, where there is no chunk.
+	chunk *locate(int x, int y, int z, int &lx, int &ly, int &lz) const {
+		lx = x & (CX - 1);
+		ly = y & (CY - 1);
+		lz = z & (CZ - 1);
+
+		if(x < world_lo[0] || x >= world_hi[0] || y < world_lo[1] || y >= world_hi[1] || z < world_lo[2] || z >= world_hi[2])
+			return 0;
+
+		return c[(x - world_lo[0]) / CX][(y - world_lo[1]) / CY][(z - world_lo[2]) / CZ];
+	}
+
+	// Unpack the chunks overlapping a box of blocks, see chunk::pack()
+	void unpack(int x0, int y0, int z0, int x1, int y1, int z1) {
+		int lo[3] = {x0, y0, z0};
+		int hi[3] = {x1, y1, z1};
+
+		for(int a = 0; a < 3; a++) {
+			if(hi[a] < world_lo[a] || lo[a] >= world_hi[a])
+				return;
+			lo[a] = (std::max(lo[a], world_lo[a]) - world_lo[a]) / chunk_size[a];
+			hi[a] = (std::min(hi[a], world_hi[a] - 1) - world_lo[a]) / chunk_size[a];
+		}
+
+		for(int x = lo[0]; x <= hi[0]; x++)
+			for(int y = lo[1]; y <= hi[1]; y++)
+				for(int z = lo[2]; z <= hi[2]; z++)
+					c[x][y][z]->unpack();
+	}
+
+	/* Voxel lighting. Every block has a skylight and a block light level from 0 to 15.
+	   Light spreads to neighbouring non-opaque blocks, losing one level per step,
+	   except for direct sunlight, which goes straight down without getting weaker.
+	   When blocks change, relight() first removes all light that might have come from them
+	   with a flood fill, then floods back the light from the sky, from light sources
+	   and from the unaffected blocks around the hole. Only light that depends on the
+	   changed blocks is touched, so this is cheap for single block edits. */
+
+	void relight(int x0, int y0, int z0, int x1, int y1, int z1) {
+		std::vector<lightnode> skyremove, blockremove, skyadd, blockadd;
+
+		// Light can spread 15 blocks out of the box, and sunlight goes all the way down
+		unpack(x0 - 16, world_lo[1], z0 - 16, x1 + 16, world_hi[1] - 1, z1 + 16);
+
+		if(x0 < world_lo[0])
+			x0 = world_lo[0];
+		if(x1 >= world_hi[0])
+			x1 = world_hi[0] - 1;
+		if(z0 < world_lo[2])
+			z0 = world_lo[2];
+		if(z1 >= world_hi[2])
+			z1 = world_hi[2] - 1;
+
+		for(int x = x0; x <= x1; x++) {
+			for(int z = z0; z <= z1; z++) {
+				// Find the new height of the sky in this column
+				int8_t &height = skyheight[x - world_lo[0]][z - world_lo[2]];
+				int old = height;
+
+				height = world_lo[1];
+				for(int y = world_hi[1] - 1; y >= world_lo[1]; y--) {
+					if(get(x, y, z)) {
+						height = y + 1;
+						break;
+					}
+				}
+
+				int ylo = y0;
+				int yhi = y1;
+
+				// If it changed, all the blocks in between lost or gained direct sunlight
+				if(height != old) {
+					int lo = height < old ? height : old;
+					int hi = height > old ? height : old;
+					if(lo < ylo)
+						ylo = lo;
+					if(hi - 1 > yhi)
+						yhi = hi - 1;
+				}
+
+				if(ylo < world_lo[1])
+					ylo = world_lo[1];
+				if(yhi >= world_hi[1])
+					yhi = world_hi[1] - 1;
+
+				for(int y = ylo; y <= yhi; y++) {
+					int lx, ly, lz;
+					chunk *ch = locate(x, y, z, lx, ly, lz);
+					uint8_t l = ch->light[lx][ly][lz];
+					skyremove.push_back(lightnode(x, y, z, l >> SKYLIGHT));
+					blockremove.push_back(lightnode(x, y, z, l & 15));
+					setlight(ch, lx, ly, lz, SKYLIGHT, 0);
+					setlight(ch, lx, ly, lz, BLOCKLIGHT, 0);
+				}
+			}
+		}
+
+		unlight(skyremove, skyadd, SKYLIGHT);
+		unlight(blockremove, blockadd, BLOCKLIGHT);
+		spread(skyadd, SKYLIGHT);
+		spread(blockadd, BLOCKLIGHT);
+	}
+
+private:
+	void setlight(chunk *ch, int lx, int ly, int lz, int shift, int level) {
+		uint8_t &l = ch->light[lx][ly][lz];
+		l = (l & ~(15 << shift)) | level << shift;
+		ch->touch(lx, ly, lz, lx, ly, lz);
+	}
+
+	// The light a block has by itself, without light coming in from its neighbours
+	int ownlight(chunk *ch, int lx, int ly, int lz, int x, int z, int shift) const {
+		if(shift == SKYLIGHT)
+			return ch->ay * CY + ly >= skyheight[x - world_lo[0]][z - world_lo[2]] ? 15 : 0;
+		else
+			return emission[ch->blk[lx][ly][lz]];
+	}
+
+	// Remove light that depends on the blocks in the remove list, and find out what needs to be flooded back in
+	void unlight(std::vector<lightnode> &remove, std::vector<lightnode> &add, int shift) {
+		for(size_t i = 0; i < remove.size(); i++) {
+			lightnode n = remove[i];
+
+			for(int d = 0; d < 6; d++) {
+				int x = n.x + neighbours[d][0];
+				int y = n.y + neighbours[d][1];
+				int z = n.z + neighbours[d][2];
+				int lx, ly, lz;
+				chunk *ch = locate(x, y, z, lx, ly, lz);
+
+				if(!ch)
+					continue;
+
+				int l = (ch->light[lx][ly][lz] >> shift) & 15;
+
+				if(!l)
+					continue;
+
+				// Direct sunlight going down keeps its level, so we have to follow it all the way
+				if(l < n.level || (shift == SKYLIGHT && d == 1 && l == 15 && n.level == 15)) {
+					setlight(ch, lx, ly, lz, shift, 0);
+					remove.push_back(lightnode(x, y, z, l));
+				} else {
+					add.push_back(lightnode(x, y, z, l));
+				}
+			}
+		}
+
+		// Blocks that give off light by themselves get it back
+		for(size_t i = 0; i < remove.size(); i++) {
+			int lx, ly, lz;
+			chunk *ch = locate(remove[i].x, remove[i].y, remove[i].z, lx, ly, lz);
+			int l = ownlight(ch, lx, ly, lz, remove[i].x, remove[i].z, shift);
+
+			if(l) {
+				setlight(ch, lx, ly, lz, shift, l);
+				add.push_back(lightnode(remove[i].x, remove[i].y, remove[i].z, l));
+			}
+		}
+	}
+
+	// Flood light outwards from the blocks in the add list
+	void spread(std::vector<lightnode> &add, int shift) {
+		for(size_t i = 0; i < add.size(); i++) {
+			lightnode n = add[i];
+			int lx, ly, lz;
+			chunk *ch = locate(n.x, n.y, n.z, lx, ly, lz);
+
+			// The light might have changed since this block was added to the list
+			int level = (ch->light[lx][ly][lz] >> shift) & 15;
+
+			if(level <= 1)
+				continue;
+
+			for(int d = 0; d < 6; d++) {
+				int x = n.x + neighbours[d][0];
+				int y = n.y + neighbours[d][1];
+				int z = n.z + neighbours[d][2];
+				chunk *nch = locate(x, y, z, lx, ly, lz);
+
+				if(!nch || !transparent[nch->blk[lx][ly][lz]])
+					continue;
+
+				int l = shift == SKYLIGHT && d == 1 && level == 15 ? 15 : level - 1;
+
+				if(((nch->light[lx][ly][lz] >> shift) & 15) < l) {
+					setlight(nch, lx, ly, lz, shift, l);
+					add.push_back(lightnode(x, y, z, l));
+				}
+			}
+		}
+	}
+
+public:
+
+	/* Bulk edits. These work on a whole box of blocks at a time, going chunk by chunk,
+	   so the chunk lookup and the marking of changed sections is done once per chunk
+	   instead of once per block. Box coordinates are inclusive. */
+
+	/* Call f(chunk, x0, y0, z0, x1, y1, z1) with the part of the box that falls in each chunk, in local coordinates.
+	   If f returns true, the chunk was modified and the sections it overlaps are marked as changed. */
+	template<typename F> void foreach_chunk(int x0, int y0, int z0, int x1, int y1, int z1, F f) {
+		int lo[3] = {x0, y0, z0};
+		int hi[3] = {x1, y1, z1};
+
+		for(int a = 0; a < 3; a++) {
+			if(lo[a] < world_lo[a])
+				lo[a] = world_lo[a];
+			if(hi[a] >= world_hi[a])
+				hi[a] = world_hi[a] - 1;
+			if(lo[a] > hi[a])
+				return;
+		}
+
+		for(int cx = (lo[0] - world_lo[0]) / CX; cx <= (hi[0] - world_lo[0]) / CX; cx++) {
+			for(int cy = (lo[1] - world_lo[1]) / CY; cy <= (hi[1] - world_lo[1]) / CY; cy++) {
+				for(int cz = (lo[2] - world_lo[2]) / CZ; cz <= (hi[2] - world_lo[2]) / CZ; cz++) {
+					int ox = world_lo[0] + cx * CX;
+					int oy = world_lo[1] + cy * CY;
+					int oz = world_lo[2] + cz * CZ;
+					int lx0 = lo[0] > ox ? lo[0] - ox : 0;
+					int ly0 = lo[1] > oy ? lo[1] - oy : 0;
+					int lz0 = lo[2] > oz ? lo[2] - oz : 0;
+					int lx1 = hi[0] < ox + CX - 1 ? hi[0] - ox : CX - 1;
+					int ly1 = hi[1] < oy + CY - 1 ? hi[1] - oy : CY - 1;
+					int lz1 = hi[2] < oz + CZ - 1 ? hi[2] - oz : CZ - 1;
+
+					chunk *ch = c[cx][cy][cz];
+					ch->unpack();
+					if(f(ch, lx0, ly0, lz0, lx1, ly1, lz1))
+						ch->touch(lx0, ly0, lz0, lx1, ly1, lz1);
+				}
+			}
+		}
+	}
+
+	// Count the non-air blocks in a row, so we can keep chunk::blocks up to date
+	static int count(const uint8_t *row, int n) {
+		int total = 0;
+		for(int i = 0; i < n; i++)
+			total += row[i] != 0;
+		return total;
+	}
+
+	// Fill a box with one type of block
+	void fill(int x0, int y0, int z0, int x1, int y1, int z1, uint8_t type) {
+		foreach_chunk(x0, y0, z0, x1, y1, z1, [=](chunk *ch, int lx0, int ly0, int lz0, int lx1, int ly1, int lz1) {
+			int n = lz1 - lz0 + 1;
+			for(int x = lx0; x <= lx1; x++) {
+				for(int y = ly0; y <= ly1; y++) {
+					uint8_t *row = &ch->blk[x][y][lz0];
+					ch->blocks += (type ? n : 0) - count(row, n);
+					memset(row, type, n);
+					ch->settle(x, y, lz0, n);
+				}
+			}
+			return true;
+		});
+
+		relight(x0, y0, z0, x1, y1, z1);
+		activate(x0 - 1, y0 - 1, z0 - 1, x1 + 1, y1 + 1, z1 + 1);
+		if(edited)
+			edited(x0, y0, z0, x1, y1, z1);
+	}
+
+	// Fill a sphere with one type of block, use type 0 to carve out a hole
+	void sphere(int cx, int cy, int cz, float radius, uint8_t type) {
+		int r = ceilf(radius);
+		float r2 = radius * radius;
+
+		foreach_chunk(cx - r, cy - r, cz - r, cx + r, cy + r, cz + r, [&](chunk *ch, int lx0, int ly0, int lz0, int lx1, int ly1, int lz1) {
+			// Position of the center of the sphere relative to this chunk
+			int ox = cx - (ch->ax * CX);
+			int oy = cy - (ch->ay * CY);
+			int oz = cz - (ch->az * CZ);
+			bool modified = false;
+
+			for(int x = lx0; x <= lx1; x++) {
+				for(int y = ly0; y <= ly1; y++) {
+					// Find the part of this row that lies within the sphere
+					float d2 = r2 - (x - ox) * (x - ox) - (y - oy) * (y - oy);
+					if(d2 < 0)
+						continue;
+
+					int dz = sqrtf(d2);
+					int z0 = oz - dz > lz0 ? oz - dz : lz0;
+					int z1 = oz + dz < lz1 ? oz + dz : lz1;
+					if(z0 > z1)
+						continue;
+
+					int n = z1 - z0 + 1;
+					uint8_t *row = &ch->blk[x][y][z0];
+					ch->blocks += (type ? n : 0) - count(row, n);
+					memset(row, type, n);
+					ch->settle(x, y, z0, n);
+					modified = true;
+				}
+			}
+			return modified;
+		});
+
+		relight(cx - r, cy - r, cz - r, cx + r, cy + r, cz + r);
+		activate(cx - r - 1, cy - r - 1, cz - r - 1, cx + r + 1, cy + r + 1, cz + r + 1);
+		if(edited)
+			edited(cx - r, cy - r, cz - r, cx + r, cy + r, cz + r);
+	}
+
+	// Replace all blocks of one type in a box with another type
+	void replace(int x0, int y0, int z0, int x1, int y1, int z1, uint8_t from, uint8_t to) {
+		foreach_chunk(x0, y0, z0, x1, y1, z1, [=](chunk *ch, int lx0, int ly0, int lz0, int lx1, int ly1, int lz1) {
+			int replaced = 0;
+			for(int x = lx0; x <= lx1; x++) {
+				for(int y = ly0; y <= ly1; y++) {
+					uint8_t *row = &ch->blk[x][y][0];
+					for(int z = lz0; z <= lz1; z++) {
+						if(row[z] == from)
+							ch->settle(x, y, z, 1);
+						replaced += row[z] == from;
+						row[z] = row[z] == from ? to : row[z];
+					}
+				}
+			}
+
+			if(!from && to)
+				ch->blocks += replaced;
+			else if(from && !to)
+				ch->blocks -= replaced;
+
+			return replaced > 0;
+		});
+
+		relight(x0, y0, z0, x1, y1, z1);
+		activate(x0 - 1, y0 - 1, z0 - 1, x1 + 1, y1 + 1, z1 + 1);
+		if(edited)
+			edited(x0, y0, z0, x1, y1, z1);
+	}
+
+	/* Paste a template of sx * sy * sz blocks, stored in the same order as chunk::blk,
+	   with its lowest corner at (x, y, z). If skipair is true, air in the template does not overwrite the world. */
+	void paste(int x, int y, int z, int sx, int sy, int sz, const uint8_t *blocks, bool skipair = false) {
+		foreach_chunk(x, y, z, x + sx - 1, y + sy - 1, z + sz - 1, [&](chunk *ch, int lx0, int ly0, int lz0, int lx1, int ly1, int lz1) {
+			// Position of the template relative to this chunk
+			int ox = x - (ch->ax * CX);
+			int oy = y - (ch->ay * CY);
+			int oz = z - (ch->az * CZ);
+			int n = lz1 - lz0 + 1;
+
+			for(int bx = lx0; bx <= lx1; bx++) {
+				for(int by = ly0; by <= ly1; by++) {
+					uint8_t *row = &ch->blk[bx][by][lz0];
+					const uint8_t *src = blocks + ((bx - ox) * sy + (by - oy)) * sz + (lz0 - oz);
+
+					ch->blocks -= count(row, n);
+
+					if(skipair) {
+						for(int i = 0; i < n; i++) {
+							if(src[i])
+								ch->settle(bx, by, lz0 + i, 1);
+							row[i] = src[i] ? src[i] : row[i];
+						}
+					} else {
+						memcpy(row, src, n);
+						ch->settle(bx, by, lz0, n);
+					}
+
+					ch->blocks += count(row, n);
+				}
+			}
+			return true;
+		});
+
+		relight(x, y, z, x + sx - 1, y + sy - 1, z + sz - 1);
+		activate(x - 1, y - 1, z - 1, x + sx, y + sy, z + sz);
+		if(edited)
+			edited(x, y, z, x + sx - 1, y + sy - 1, z + sz - 1);
+	}
+
+	/* Flowing water, as a cellular automaton. Still water, like the sea, is a source that never changes.
+	   Every update, each active block computes its next water level from the current state of its neighbours:
+	   a block with water above it becomes falling water of level 7, otherwise it gets one level less than
+	   the highest of its horizontal neighbours that rests on something solid or on still water.
+	   Only blocks next to something that changed are active, so the cost scales with the amount of moving water.
+	   The next state of all chunks is computed in parallel while the world is only being read,
+	   and then applied in one go, so the result does not depend on the order in which blocks are visited. */
+
+	// Have the next water update look at the air and water blocks in a box
+	void activate(int x0, int y0, int z0, int x1, int y1, int z1) {
+		foreach_chunk(x0, y0, z0, x1, y1, z1, [](chunk *ch, int lx0, int ly0, int lz0, int lx1, int ly1, int lz1) {
+			ch->activate(lx0, ly0, lz0, lx1, ly1, lz1);
+			return false;
+		});
+	}
+
+	// The next water level of a block, or -1 if it does not change
+	static int nextlevel(const chunk *ch, int x, int y, int z) {
+		static const int horizontal[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+
+		uint8_t type = ch->blk[x][y][z];
+		if(type && type != 8)
+			return -1;
+
+		int level = ch->waterlevel(x, y, z);
+		if(level == 8)
+			return -1;
+
+		int next = 0;
+
+		if(ch->waterlevel(x, y + 1, z)) {
+			next = 7;
+		} else {
+			for(int d = 0; d < 4; d++) {
+				int nx = x + horizontal[d][0];
+				int nz = z + horizontal[d][1];
+				int n = ch->waterlevel(nx, y, nz);
+				if(n <= 1 || n - 1 <= next)
+					continue;
+
+				// Water that can still fall down does not spread sideways
+				uint8_t support = ch->get(nx, y - 1, nz);
+				if(!support || (support == 8 && ch->waterlevel(nx, y - 1, nz) != 8))
+					continue;
+
+				next = n - 1;
+			}
+		}
+
+		return next == level ? -1 : next;
+	}
+
+	// Compute the changes to the water in a list of chunks, as (block index << 8 | level)
+	static void nextlevels(chunk *const *chunks, std::vector<uint32_t> *changes, int n) {
+		for(int i = 0; i < n; i++) {
+			chunk *ch = chunks[i];
+			std::vector<uint16_t> todo;
+			todo.swap(ch->active);
+
+			std::sort(todo.begin(), todo.end());
+			todo.erase(std::unique(todo.begin(), todo.end()), todo.end());
+
+			for(size_t j = 0; j < todo.size(); j++) {
+				int x = todo[j] / (CY * CZ);
+				int y = todo[j] / CZ % CY;
+				int z = todo[j] % CZ;
+				int next = nextlevel(ch, x, y, z);
+				if(next >= 0)
+					changes[i].push_back(todo[j] << 8 | next);
+			}
+		}
+	}
+
+	// Do one water update, using up to the given number of threads, or one per core if threads is 0.
+	// Returns the number of blocks that changed.
+	int flow(int threads = 0) {
+		std::vector<chunk *> busy;
+
+		for(int x = 0; x < SCX; x++)
+			for(int y = 0; y < SCY; y++)
+				for(int z = 0; z < SCZ; z++)
+					if(!c[x][y][z]->active.empty() && c[x][y][z]->noised)
+						busy.push_back(c[x][y][z]);
+
+		if(busy.empty())
+			return 0;
+
+		// The water levels of the neighbours are read in parallel below, so they cannot be unpacked on demand
+		for(size_t i = 0; i < busy.size(); i++)
+			unpack(busy[i]->ax * CX - 1, busy[i]->ay * CY - 1, busy[i]->az * CZ - 1, busy[i]->ax * CX + CX, busy[i]->ay * CY + CY, busy[i]->az * CZ + CZ);
+
+		if(threads <= 0)
+			threads = worker_pool::shared().size();
+
+		/* Compute the next state, each thread only writes to the active lists of its own chunks */
+
+		int n = busy.size();
+		std::vector<std::vector<uint32_t> > changes(n);
+
+		if(threads <= 1 || n < 4) {
+			nextlevels(&busy[0], &changes[0], n);
+		} else {
+			parallel_ranges(n, threads, [&](int start, int end) { nextlevels(&busy[start], &changes[start], end - start); });
+		}
+
+		/* Apply the changes. Only blocks that turn from air into water or back need to be relit and meshed again,
+		   levels are not visible in the mesh. */
+
+		int changed = 0;
+
+		for(int i = 0; i < n; i++) {
+			chunk *ch = busy[i];
+			int lo[3] = {CX, CY, CZ};
+			int hi[3] = {-1, -1, -1};
+
+			for(size_t j = 0; j < changes[i].size(); j++) {
+				int index = changes[i][j] >> 8;
+				int level = changes[i][j] & 0xff;
+				int x = index / (CY * CZ);
+				int y = index / CZ % CY;
+				int z = index % CZ;
+
+				if(!ch->flow) {
+					ch->flow = new uint8_t[CX][CY][CZ];
+					memset(ch->flow, 0, CX * CY * CZ);
+				}
+
+				ch->flow[x][y][z] = level;
+
+				if(!level != !ch->blk[x][y][z]) {
+					ch->blk[x][y][z] = level ? 8 : 0;
+					ch->blocks += level ? 1 : -1;
+
+					int p[3] = {x, y, z};
+					for(int a = 0; a < 3; a++) {
+						lo[a] = std::min(lo[a], p[a]);
+						hi[a] = std::max(hi[a], p[a]);
+					}
+				}
+
+				// Blocks at the edge of this chunk also wake up the blocks next to them in the neighbouring chunks
+				if(x > 0 && x < CX - 1 && y > 0 && y < CY - 1 && z > 0 && z < CZ - 1)
+					ch->activate(x - 1, y - 1, z - 1, x + 1, y + 1, z + 1);
+				else
+					activate(ch->ax * CX + x - 1, ch->ay * CY + y - 1, ch->az * CZ + z - 1, ch->ax * CX + x + 1, ch->ay * CY + y + 1, ch->az * CZ + z + 1);
+
+				changed++;
+			}
+
+			if(hi[0] < 0)
+				continue;
+
+			ch->touch(lo[0], lo[1], lo[2], hi[0], hi[1], hi[2]);
+			relight(ch->ax * CX + lo[0], ch->ay * CY + lo[1], ch->az * CZ + lo[2], ch->ax * CX + hi[0], ch->ay * CY + hi[1], ch->az * CZ + hi[2]);
+			if(edited)
+				edited(ch->ax * CX + lo[0], ch->ay * CY + lo[1], ch->az * CZ + lo[2], ch->ax * CX + hi[0], ch->ay * CY + hi[1], ch->az * CZ + hi[2]);
+		}
+
+		return changed;
+	}
+
+	/* Find the first block hit by a ray, using the Amanatides-Woo voxel traversal.
+	   This only reads from the world, so it can be called from several threads at once,
+	   as long as nobody is calling set() or cull() at the same time. */
+
+	bool raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxdist, rayhit &hit) const {
+		rayquery ray = {origin, direction, maxdist};
+		raycast(&ray, &hit, 1);
+		return hit.type;
+	}
+
+	// Cast many rays at once, for line-of-sight tests and the like
+	void raycast(const rayquery *rays, rayhit *hits, int n) const {
+		static const int batch = 64;
+		float o[3][batch], d[3][batch], inv[3][batch];
+		float t0[batch], t1[batch];
+		int axis[batch];
+
+		for(int base = 0; base < n; base += batch) {
+			int m = n - base < batch ? n - base : batch;
+
+			for(int i = 0; i < m; i++) {
+				for(int a = 0; a < 3; a++) {
+					o[a][i] = rays[base + i].origin[a];
+					d[a][i] = rays[base + i].direction[a];
+				}
+				t0[i] = 0;
+				t1[i] = rays[base + i].maxdist;
+				axis[i] = -1;
+			}
+
+			// Clip the rays against the bounds of the world.
+			// There are no branches here, so the compiler can vectorise these loops.
+			// Directions parallel to an axis get a huge but finite inverse, since -ffast-math does not like infinities.
+			// It keeps the sign of the direction, traverse() steps the way the inverse points.
+			for(int a = 0; a < 3; a++) {
+				for(int i = 0; i < m; i++) {
+					inv[a][i] = fabsf(d[a][i]) < 1e-20f ? copysignf(1e30f, d[a][i]) : 1.0f / d[a][i];
+					float ta = (world_lo[a] - o[a][i]) * inv[a][i];
+					float tb = (world_hi[a] - o[a][i]) * inv[a][i];
+					float tnear = ta < tb ? ta : tb;
+					float tfar = ta < tb ? tb : ta;
+					axis[i] = tnear > t0[i] ? a : axis[i];
+					t0[i] = tnear > t0[i] ? tnear : t0[i];
+					t1[i] = tfar < t1[i] ? tfar : t1[i];
+				}
+			}
+
+			for(int i = 0; i < m; i++) {
+				const float ro[3] = {o[0][i], o[1][i], o[2][i]};
+				const float rd[3] = {d[0][i], d[1][i], d[2][i]};
+				const float ri[3] = {inv[0][i], inv[1][i], inv[2][i]};
+				traverse(ro, rd, ri, t0[i], t1[i], axis[i], hits[base + i]);
+			}
+		}
+	}
+
+	// Same as above, but split the rays over a number of threads
+	void raycast(const rayquery *rays, rayhit *hits, int n, int threads) const {
+		if(threads <= 0)
+			threads = worker_pool::shared().size();
+
+		// Not worth starting threads for just a few rays
+		if(threads <= 1 || n < 256) {
+			raycast(rays, hits, n);
+			return;
+		}
+
+		parallel_ranges(n, threads, [=](int start, int end) { raycast(rays + start, hits + start, end - start); });
+	}
+
+private:
+	/* Walk along a ray that has already been clipped to the world, from parameter t to tmax.
+	   Chunks without any blocks are skipped in one go, and so are bricks of air in chunks whose bricks are up to date.
+	   Otherwise we step from voxel to voxel.
+	   All t values are computed relative to the ray origin, so skipping does not accumulate errors. */
+
+	void traverse(const float o[3], const float d[3], const float inv[3], float t, float tmax, int axis, rayhit &hit) const {
+		int pos[3];
+		int step[3];
+		float tnext[3];
+		float tdelta[3];
+
+		hit.type = 0;
+		hit.face = -1;
+		hit.distance = tmax;
+
+		if(t > tmax)
+			return;
+
+		// Find the voxel where the ray enters the world
+		for(int a = 0; a < 3; a++) {
+			step[a] = inv[a] < 0 ? -1 : 1;
+			tdelta[a] = fabsf(inv[a]);
+
+			if(a == axis)
+				pos[a] = step[a] > 0 ? world_lo[a] : world_hi[a] - 1;
+			else
+				pos[a] = floorf(o[a] + d[a] * t);
+
+			if(pos[a] < world_lo[a])
+				pos[a] = world_lo[a];
+			if(pos[a] >= world_hi[a])
+				pos[a] = world_hi[a] - 1;
+		}
+
+		for(;;) {
+			// Which chunk are we in?
+			int ci[3];
+			int lo[3];
+			int hi[3];
+
+			for(int a = 0; a < 3; a++) {
+				ci[a] = (pos[a] - world_lo[a]) / chunk_size[a];
+				lo[a] = world_lo[a] + ci[a] * chunk_size[a];
+				hi[a] = lo[a] + chunk_size[a];
+				tnext[a] = (pos[a] + (step[a] > 0) - o[a]) * inv[a];
+			}
+
+			const chunk *ch = c[ci[0]][ci[1]][ci[2]];
+			const int base[3] = {lo[0], lo[1], lo[2]};
+			bool bricks = ch->blocks && ch->bricked;
+			bool empty = !ch->blocks;
+
+			// If its bricks are up to date, narrow it down to the brick we are in
+			if(bricks) {
+				for(int a = 0; a < 3; a++) {
+					lo[a] = base[a] + (pos[a] - base[a]) / BRICK * BRICK;
+					hi[a] = lo[a] + BRICK;
+				}
+
+				empty = !ch->brick[(lo[0] - base[0]) / BRICK][(lo[1] - base[1]) / BRICK][(lo[2] - base[2]) / BRICK];
+			}
+
+			if(empty) {
+				// Empty chunk or brick, skip to the point where the ray leaves it
+				int next = 0;
+				float texit[3];
+
+				for(int a = 0; a < 3; a++) {
+					texit[a] = ((step[a] > 0 ? hi[a] : lo[a]) - o[a]) * inv[a];
+					if(texit[a] < texit[next])
+						next = a;
+				}
+
+				t = texit[next];
+				if(t > tmax)
+					return;
+
+				for(int a = 0; a < 3; a++) {
+					if(a == next) {
+						pos[a] = step[a] > 0 ? hi[a] : lo[a] - 1;
+					} else {
+						pos[a] = floorf(o[a] + d[a] * t);
+						if(pos[a] < lo[a])
+							pos[a] = lo[a];
+						if(pos[a] >= hi[a])
+							pos[a] = hi[a] - 1;
+					}
+				}
+
+				axis = next;
+			} else {
+				// Step through the voxels of this chunk or brick
+				for(;;) {
+					int x = pos[0] - base[0];
+					int y = pos[1] - base[1];
+					int z = pos[2] - base[2];
+					uint8_t type = bricks ? ch->brickget(x, y, z) : ch->blk[x][y][z];
+
+					if(type) {
+						hit.x = pos[0];
+						hit.y = pos[1];
+						hit.z = pos[2];
+						hit.face = axis < 0 ? -1 : axis + (step[axis] > 0 ? 3 : 0);
+						hit.distance = t;
+						hit.type = type;
+						return;
+					}
+
+					int next = 0;
+					if(tnext[1] < tnext[next])
+						next = 1;
+					if(tnext[2] < tnext[next])
+						next = 2;
+
+					t = tnext[next];
+					if(t > tmax)
+						return;
+
+					pos[next] += step[next];
+					tnext[next] += tdelta[next];
+					axis = next;
+
+					if(pos[next] < lo[next] || pos[next] >= hi[next])
+						break;
+				}
+			}
+
+			if(pos[axis] < world_lo[axis] || pos[axis] >= world_hi[axis])
+				return;
+		}
+	}
+
+public:
+
+	// Find the chunks that are on the screen, mesh the sections of those that changed,
+	// and generate the nearest chunk that is still missing. This runs on the simulation thread.
+	// The view matrix is relative to the lower corner of the chunk origin, which is the chunk the camera is in.
+	// Chunks further away than radius are skipped, and up to budget chunks are generated.
+	// Chunks further away than FARFIELD go in far instead of visible, and only the mesh of their bricks is kept up to date.
+	void cull(const glm::mat4 &pv, const glm::ivec3 &origin, float radius, int budget, std::vector<chunk *> &visible, std::vector<chunk *> &far, std::vector<sectionmesh> &meshes) {
+		std::vector<std::pair<float, int> > missing;
+		std::vector<std::pair<chunk *, int> > todo;
+
+		for(int x = 0; x < SCX; x++) {
+			for(int y = 0; y < SCY; y++) {
+				for(int z = 0; z < SCZ; z++) {
+					// Is this chunk on the screen?
+					glm::vec4 center = pv * glm::vec4((c[x][y][z]->ax - origin.x) * CX + CX / 2, (c[x][y][z]->ay - origin.y) * CY + CY / 2, (c[x][y][z]->az - origin.z) * CZ + CZ / 2, 1);
+
+					float d = glm::length(center);
+					center.x /= center.w;
+					center.y /= center.w;
+
+					// If it is behind the camera, or too far away, don't bother drawing it
+					if(center.z < -CY / 2 || center.w - CY > radius)
+						continue;
+
+					// If it is outside the screen, don't bother drawing it
+					if(fabsf(center.x) > 1 + fabsf(CY * 2 / center.w) || fabsf(center.y) > 1 + fabsf(CY * 2 / center.w))
+						continue;
+
+					// If this chunk is not initialized, skip it, but remember it for initialization
+					if(!c[x][y][z]->initialized) {
+						missing.push_back(std::make_pair(d, (x * SCY + y) * SCZ + z));
+						continue;
+					}
+
+					// Also keep the bricks up to date, so rays cast into this chunk can use them
+					c[x][y][z]->rebrick();
+
+					if(center.w > FARFIELD) {
+						c[x][y][z]->changes(todo, true);
+						far.push_back(c[x][y][z]);
+					} else {
+						c[x][y][z]->changes(todo);
+						visible.push_back(c[x][y][z]);
+					}
+				}
+			}
+		}
+
+		// Meshing reads the blocks and light of the chunk and its neighbours, so those cannot stay packed
+		std::vector<bool> needed(SCX * SCY * SCZ);
+
+		for(size_t i = 0; i < visible.size(); i++)
+			keep(visible[i], true, needed);
+		for(size_t i = 0; i < todo.size(); i++)
+			if(todo[i].second == FARSECTION)
+				keep(todo[i].first, false, needed);
+
+		remesh(todo, meshes);
+
+		// Pack the chunks this tick did not need, if they are a bit past the near field, so turning the camera rarely unpacks any
+		for(int x = 0; x < SCX; x++) {
+			for(int y = 0; y < SCY; y++) {
+				for(int z = 0; z < SCZ; z++) {
+					chunk *ch = c[x][y][z];
+					int dx = (ch->ax - origin.x) * CX;
+					int dz = (ch->az - origin.z) * CZ;
+					if(ch->noised && !needed[(x * SCY + y) * SCZ + z] && dx * dx + dz * dz > PACKDISTANCE * PACKDISTANCE)
+						ch->pack();
+				}
+			}
+		}
+
+		// Initialize the ones closest to the camera, unless they come from a world server
+		budget = remote ? 0 : std::min(budget, (int)missing.size());
+		std::partial_sort(missing.begin(), missing.begin() + budget, missing.end());
+
+		for(int i = 0; i < budget; i++)
+			initialize(c[missing[i].second / (SCY * SCZ)][missing[i].second / SCZ % SCY][missing[i].second % SCZ]);
+	}
+
+	// Unpack a chunk and its neighbours, with the ones diagonally next to it if diagonal is set, and mark them as needed
+	void keep(chunk *ch, bool diagonal, std::vector<bool> &needed) {
+		int x = ch->ax * CX - world_lo[0];
+		int y = ch->ay * CY - world_lo[1];
+		int z = ch->az * CZ - world_lo[2];
+
+		for(int dx = -1; dx <= 1; dx++) {
+			for(int dy = -1; dy <= 1; dy++) {
+				for(int dz = -1; dz <= 1; dz++) {
+					if(!diagonal && abs(dx) + abs(dy) + abs(dz) > 1)
+						continue;
+
+					int cx = x / CX + dx;
+					int cy = y / CY + dy;
+					int cz = z / CZ + dz;
+					if(cx < 0 || cx >= SCX || cy < 0 || cy >= SCY || cz < 0 || cz >= SCZ)
+						continue;
+
+					c[cx][cy][cz]->unpack();
+					needed[(cx * SCY + cy) * SCZ + cz] = true;
+				}
+			}
+		}
+	}
+
+	// Build the meshes of the sections in todo, and queue them for upload.
+	// The meshes of the bricks go first, since building them may build the bricks of neighbouring chunks.
+	// The sections only read from the world, so they are split over a number of threads, one per core if threads is 0.
+	// Each thread writes the meshes it builds straight into the mesh stream.
+	static void remesh(const std::vector<std::pair<chunk *, int> > &todo, std::vector<sectionmesh> &meshes, int threads = 0) {
+		size_t first = meshes.size();
+		std::vector<int> sections;
+
+		meshes.resize(first + todo.size());
+
+		for(size_t i = 0; i < todo.size(); i++) {
+			if(todo[i].second == FARSECTION)
+				todo[i].first->build(FARSECTION, meshes[first + i], true);
+			else
+				sections.push_back(i);
+		}
+
+		int n = sections.size();
+
+		if(threads <= 0)
+			threads = worker_pool::shared().size();
+
+		auto build = [&](int start, int end) {
+			for(int i = start; i < end; i++)
+				todo[sections[i]].first->build(todo[sections[i]].second, meshes[first + sections[i]], true);
+		};
+
+		// Most ticks only change a section or two, that is not worth waking the workers for
+		if(threads <= 1 || n < 4)
+			build(0, n);
+		else
+			parallel_ranges(n, threads, build);
+	}
+
+	// Generate a chunk and its neighbours, so it can be meshed
+	void initialize(chunk *ch) {
+		generate(ch);
+		generate(ch->left);
+		generate(ch->right);
+		generate(ch->below);
+		generate(ch->above);
+		generate(ch->front);
+		generate(ch->back);
+		ch->initialized = true;
+	}
+};
+
+/* Entities, such as mobs and items, that move through the world and collide with it and with each other.
+   An entity is an axis aligned box, with its position at the center of the bottom face.
+   They are stored as a structure of arrays, so the update loop only touches the fields it needs,
+   and every tick they are all updated in parallel.
+
+   The broadphase for entity-vs-entity tests is a grid of columns of CELL x CELL blocks, numbered chunk by chunk.
+   The entities are sorted by the column they are in, with a counting sort,
+   so entities close to each other in the world are also close to each other in memory,
+   and the entities in a column are found with a single lookup. They hardly move between ticks, so instead of
+   sorting them every tick, the search for neighbours reaches as far further as they may have moved since the last sort,
+   and they are only sorted again once that is RESORT blocks. Indices into the arrays change when the entities are sorted, id[] does not. */
+
+#define MAXRADIUS 0.5f // Entities are at most one block wide
+#define MAXHEIGHT 2.0f // and two blocks high
+#define CELL 2         // Width of the columns of the broadphase grid
+#define COLUMNS (SCX * CX / CELL * SCZ * CZ / CELL)
+#define PUSHSCALE 65536 // Pushes between entities are added up in steps of 1 / PUSHSCALE blocks
+#define RESORT 0.5f     // Blocks entities may have moved along x or z before they are sorted into their columns again
+
+struct entities {
+	std::vector<float> x, y, z;
+	std::vector<float> vx, vy, vz;
+	std::vector<float> radius;      // Half the width of the box
+	std::vector<float> height;
+	std::vector<uint8_t> onground;
+	std::vector<int> id;
+	long contacts;                  // Number of overlapping pairs found during the last tick
+
+	entities(): contacts(0), next_id(0), widest(0), drift(RESORT) {}
+
+	int size() const {
+		return x.size();
+	}
+
+	// Add an entity, and return its id
+	int spawn(float px, float py, float pz, float r, float h, float svx, float svz) {
+		x.push_back(px);
+		y.push_back(py);
+		z.push_back(pz);
+		vx.push_back(svx);
+		vy.push_back(0);
+		vz.push_back(svz);
+		radius.push_back(std::min(r, MAXRADIUS));
+		height.push_back(std::min(h, MAXHEIGHT));
+		widest = std::max(widest, radius.back());
+		onground.push_back(0);
+		id.push_back(next_id);
+		drift = RESORT;
+		return next_id++;
+	}
+
+	/* Update all entities. The new positions are written to separate arrays, so every entity sees
+	   the positions of all the others as they were at the start of the tick, no matter which thread gets to it first.
+	   That makes the result independent of the number of threads. */
+
+	void tick(const superchunk *w, float dt, int threads = 0) {
+		int n = size();
+		if(!n)
+			return;
+
+		if(drift >= RESORT) {
+			sort();
+			sortedx = x;
+			sortedz = z;
+			drift = 0;
+		}
+
+		nx.resize(n);
+		ny.resize(n);
+		nz.resize(n);
+		pushx.assign(n, 0);
+		pushz.assign(n, 0);
+
+		if(threads <= 0)
+			threads = worker_pool::shared().size();
+
+		// Not worth waking the workers for just a few entities
+		if(threads <= 1 || n < 1024) {
+			contacts = collide(0, n, true);
+			drift = move(w, dt, 0, n);
+		} else {
+			std::atomic<long> found(0);
+			parallel_ranges(n, threads, [&](int start, int end) { found += collide(start, end, false); });
+
+			// The farthest move decides how far the next searches have to reach, which does not depend on how the work is split
+			int per = (n + threads - 1) / threads;
+			std::vector<float> moved((n + per - 1) / per, 0);
+			parallel_ranges(n, threads, [&](int start, int end) { moved[start / per] = move(w, dt, start, end); });
+			drift = *std::max_element(moved.begin(), moved.end());
+
+			// Every pair was found by both of its entities
+			contacts = found / 2;
+		}
+
+		x.swap(nx);
+		y.swap(ny);
+		z.swap(nz);
+	}
+
+private:
+	std::vector<float> nx, ny, nz;   // Positions at the end of the tick
+	std::vector<int> pushx, pushz;   // How far other entities push each entity, in 1 / PUSHSCALE blocks
+	std::vector<int> key;            // Column each entity is in
+	std::vector<int> column;         // Index of the first entity in each column, and one past the last
+	std::vector<int> fill;           // Next free place in each column while sorting
+	std::vector<int> order;          // Index each entity had before sorting
+	std::vector<float> sortedf;      // Room to sort the arrays into, kept so sorting does not allocate every tick
+	std::vector<int> sortedi;
+	std::vector<uint8_t> sortedb;
+	int next_id;
+	float widest;                    // Largest radius of any entity that was spawned
+	std::vector<float> sortedx, sortedz; // Positions of the entities when they were last sorted
+	float drift;                     // How far any entity has moved along x or z since then
+
+	// Rounding to whole blocks, without the branches of floorf() and ceilf(). Offset first so truncating rounds down,
+	// in double precision so that does not round the position itself. Far more than the size of the world.
+	static int floor(float v) {
+		return (int)(v + 1048576.0) - 1048576;
+	}
+
+	static int ceiling(float v) {
+		return -floor(-v);
+	}
+
+	// Grid coordinates of the column a point is in. Entities that left the world end up in the columns at its edge.
+	static int cellx(float x) {
+		return std::max(0, std::min(SCX * CX / CELL - 1, floor(x / CELL) - world_lo[0] / CELL));
+	}
+
+	static int cellz(float z) {
+		return std::max(0, std::min(SCZ * CZ / CELL - 1, floor(z / CELL) - world_lo[2] / CELL));
+	}
+
+	// Index of a column in the grid. Columns are never negative, so they are unsigned, which makes the divisions shifts.
+	static int index(unsigned cx, unsigned cz) {
+		static const unsigned px = CX / CELL;
+		static const unsigned pz = CZ / CELL;
+		return ((cx / px) * SCZ + cz / pz) * px * pz + (cx % px) * pz + cz % pz;
+	}
+
+	template<typename T> void permute(std::vector<T> &v, std::vector<T> &sorted) {
+		sorted.resize(v.size());
+		for(size_t k = 0; k < v.size(); k++)
+			sorted[k] = v[order[k]];
+		v.swap(sorted);
+	}
+
+	void sort() {
+		int n = size();
+
+		key.resize(n);
+		order.resize(n);
+		column.assign(COLUMNS + 1, 0);
+
+		for(int i = 0; i < n; i++) {
+			key[i] = index(cellx(x[i]), cellz(z[i]));
+			column[key[i] + 1]++;
+		}
+
+		for(int c = 0; c < COLUMNS; c++)
+			column[c + 1] += column[c];
+
+		fill.assign(column.begin(), column.end() - 1);
+
+		for(int i = 0; i < n; i++)
+			order[fill[key[i]]++] = i;
+
+		permute(x, sortedf);
+		permute(y, sortedf);
+		permute(z, sortedf);
+		permute(vx, sortedf);
+		permute(vy, sortedf);
+		permute(vz, sortedf);
+		permute(radius, sortedf);
+		permute(height, sortedf);
+		permute(onground, sortedb);
+		permute(id, sortedi);
+	}
+
+	/* Swept AABB against the voxels: move a box along one axis, by at most d, and return how far it can go
+	   before it runs into a solid block. Only the layers of blocks that the leading face passes through are checked,
+	   so a box that somehow ended up inside a block can always move out of it.
+	   Boxes stop a small distance away from blocks, so rounding never puts them inside one. */
+
+	static float sweep(const superchunk *w, const float lo[3], const float hi[3], int axis, float d) {
+		static const float skin = 1e-3;
+		int a1 = (axis + 1) % 3;
+		int a2 = (axis + 2) % 3;
+
+		// Most of the time the leading face stays within the same layer of blocks. Which way it moves is hard to predict,
+		// so this does not depend on it: moving up the axis is mirrored into moving down it
+		float face = d > 0 ? -hi[axis] : lo[axis];
+		if(floor(face - fabsf(d)) == floor(face))
+			return d;
+
+		int first, last, step;
+
+		if(d > 0) {
+			first = ceiling(hi[axis]);
+			last = ceiling(hi[axis] + d) - 1;
+			step = 1;
+		} else {
+			first = floor(lo[axis]) - 1;
+			last = floor(lo[axis] + d);
+			step = -1;
+		}
+
+		int lo1 = floor(lo[a1]);
+		int hi1 = ceiling(hi[a1]) - 1;
+		int lo2 = floor(lo[a2]);
+		int hi2 = ceiling(hi[a2]) - 1;
+
+		for(int k = first; k != last + step; k += step) {
+			for(int i = lo1; i <= hi1; i++) {
+				for(int j = lo2; j <= hi2; j++) {
+					int pos[3];
+					pos[axis] = k;
+					pos[a1] = i;
+					pos[a2] = j;
+
+					if(!w->solid(pos[0], pos[1], pos[2]))
+						continue;
+
+					if(d > 0)
+						return std::min(d, std::max(0.0f, k - skin - hi[axis]));
+					else
+						return std::max(d, std::min(0.0f, k + 1 + skin - lo[axis]));
+				}
+			}
+		}
+
+		return d;
+	}
+
+	/* Find the entities overlapping entities start to end, and add up how far they push each other. Overlapping entities
+	   push each other apart sideways, along the axis with the least overlap, each going half the way. They do not stand on top of each other.
+	   The push of j on i is exactly the opposite of that of i on j, and pushes are added up as integers, so the order they are added in
+	   does not matter. With once, only the first entity of every pair looks at it, and adds the push to both, which halves the work
+	   but only works on a single thread. Otherwise every entity looks at all its neighbours and only adds its own push.
+	   Either way the pushes come out the same. Returns the number of overlapping pairs, counted from both sides unless once. */
+
+	long collide(int start, int end, bool once) {
+		long found = 0;
+
+		for(int i = start; i < end; i++) {
+			float r = radius[i];
+			float h = height[i];
+			int px = 0;
+			int pz = 0;
+
+			/* Look in all columns that could hold an entity overlapping this one, where it was when they were sorted */
+
+			float reach = r + widest + drift;
+			int lx = cellx(x[i] - reach);
+			int hx = cellx(x[i] + reach);
+			int lz = cellz(z[i] - reach);
+			int hz = cellz(z[i] + reach);
+
+			for(int cx = lx; cx <= hx; cx++) {
+				for(int cz = lz; cz <= hz; cz++) {
+					// Columns next to each other along z are next to each other in memory as well, as long as they are in the same chunk
+					int first = column[index(cx, cz)];
+					cz = std::min(hz, cz | (CZ / CELL - 1));
+					int last = column[index(cx, cz) + 1];
+
+					if(once)
+						first = std::max(first, i + 1);
+
+					for(int j = first; j < last; j++) {
+						float dx = x[i] - x[j];
+						float dz = z[i] - z[j];
+						float ox = r + radius[j] - fabsf(dx);
+						float oz = r + radius[j] - fabsf(dz);
+
+						// All four overlaps in one comparison, so the only branch is on whether the boxes touch, which most do not
+						float overlap = std::min(std::min(ox, oz), std::min(y[i] + h - y[j], y[j] + height[j] - y[i]));
+						if(!(overlap > 0) || j == i)
+							continue;
+
+						bool older = id[i] > id[j];
+						int qx = ox * (PUSHSCALE / 2);
+						int qz = oz * (PUSHSCALE / 2);
+						qx = (dx > 0) | ((dx == 0) & older) ? qx : -qx;
+						qz = (dz > 0) | ((dz == 0) & older) ? qz : -qz;
+						qx = ox < oz ? qx : 0;
+						qz = ox < oz ? 0 : qz;
+
+						found++;
+						px += qx;
+						pz += qz;
+
+						if(once) {
+							pushx[j] -= qx;
+							pushz[j] -= qz;
+						}
+					}
+				}
+			}
+
+			pushx[i] += px;
+			pushz[i] += pz;
+		}
+
+		return found;
+	}
+
+	/* Move entities start to end by their velocity and the push of the others.
+	   The push is added to the movement, so it also cannot move entities into blocks.
+	   Returns the farthest any of them is along x or z from where it was when they were sorted. */
+
+	float move(const superchunk *w, float dt, int start, int end) {
+		float farthest = 0;
+
+		static const float gravity = 20;
+		static const float maxfall = 40;
+		static const float jump = 7;
+		static const float maxpush = 0.25;
+
+		for(int i = start; i < end; i++) {
+			float r = radius[i];
+			float h = height[i];
+			float px = std::max(-maxpush, std::min(maxpush, pushx[i] * (1.0f / PUSHSCALE)));
+			float pz = std::max(-maxpush, std::min(maxpush, pushz[i] * (1.0f / PUSHSCALE)));
+
+			/* Entity-vs-world: move along one axis at a time, vertically first, so entities slide along walls and floors */
+
+			vy[i] = std::max(vy[i] - gravity * dt, -maxfall);
+
+			float lo[3] = {x[i] - r, y[i], z[i] - r};
+			float hi[3] = {x[i] + r, y[i] + h, z[i] + r};
+			float d[3] = {vx[i] * dt + px, vy[i] * dt, vz[i] * dt + pz};
+			static const int axes[3] = {1, 0, 2};
+			bool blocked[3];
+
+			for(int a = 0; a < 3; a++) {
+				int axis = axes[a];
+				float m = sweep(w, lo, hi, axis, d[axis]);
+				blocked[axis] = m != d[axis];
+				lo[axis] += m;
+				hi[axis] += m;
+			}
+
+			onground[i] = blocked[1] && d[1] < 0;
+			if(blocked[1])
+				vy[i] = 0;
+
+			// Walking into a wall: jump over it if possible, otherwise turn around
+			if(blocked[0] || blocked[2]) {
+				if(onground[i]) {
+					vy[i] = jump;
+				} else {
+					if(blocked[0])
+						vx[i] = -vx[i];
+					if(blocked[2])
+						vz[i] = -vz[i];
+				}
+			}
+
+			nx[i] = lo[0] + r;
+			ny[i] = lo[1];
+			nz[i] = lo[2] + r;
+			farthest = std::max(farthest, std::max(fabsf(nx[i] - sortedx[i]), fabsf(nz[i] - sortedz[i])));
+		}
+
+		return farthest;
+	}
+};
+
+/* Pathfinding for entities, over a graph with two levels. A cell is a place where an entity can stand:
+   a solid block below it, and two free blocks for it to stand in. From a cell, an entity can walk to one of its
+   four horizontal neighbours, climb up one block if there is room above its head, or drop down at most MAXDROP blocks.
+
+   Searching cell by cell over long distances takes far too long, so every chunk is summarised by its entrances:
+   the moves that go from a cell in the chunk to a cell in a neighbouring chunk. Moves in the same direction from
+   neighbouring cells form a run, and only the one in the middle of each run is kept. The cells at both ends of the entrances
+   are the nodes of the abstract graph, and nodes in the same chunk are linked with the cost of the shortest path
+   between them that stays within the chunk. A query first searches the abstract graph, and then fills in the cells
+   between consecutive nodes with an A* search within a single chunk.
+
+   When blocks change, invalidate() marks the chunks whose entrances might have changed. A rebuild finds their entrances again,
+   and links the nodes of those chunks and their neighbours again. Linking floods the chunk from every node, which takes too long
+   to do in a single tick after a large edit, so the rebuild works on a copy of the chunks it changes and is spread over as many calls
+   to update() as it needs, each doing a fixed amount of work. The copy replaces the graph when it is complete, so queries always see
+   a whole graph, even if it is a bit behind the world. Only update() changes the graph, and find() only reads it
+   and the world, so any number of queries can run at the same time on different threads, as long as neither changes. */
+
+#define MAXDROP 3
+#define NAVCHUNKS (SCX * SCY * SCZ)
+#define NAVBUDGET 16 // Chunks scanned for entrances plus nodes linked, per call to navigator::update()
+
+struct pathquery {
+	glm::ivec3 from;
+	glm::ivec3 to;
+};
+
+struct navigator {
+	navigator(): scanned(0), linked(0) {
+		for(int c = 0; c < NAVCHUNKS; c++) {
+			generated[c] = false;
+			dirty[c] = false;
+		}
+	}
+
+	// The blocks in a box have changed, so the entrances of the chunks with cells that depend on them have to be found again
+	void invalidate(int x0, int y0, int z0, int x1, int y1, int z1) {
+		// Whether a cell can be stood in and moved out of depends on the blocks next to it, from its head down to the floor of the lowest drop
+		int lo[3] = {x0 - 1, y0 - 2, z0 - 1};
+		int hi[3] = {x1 + 1, y1 + MAXDROP + 1, z1 + 1};
+
+		for(int a = 0; a < 3; a++) {
+			lo[a] = std::max(lo[a], world_lo[a]);
+			hi[a] = std::min(hi[a], world_hi[a] - 1);
+			if(lo[a] > hi[a])
+				return;
+		}
+
+		for(int cx = (lo[0] - world_lo[0]) / CX; cx <= (hi[0] - world_lo[0]) / CX; cx++)
+			for(int cy = (lo[1] - world_lo[1]) / CY; cy <= (hi[1] - world_lo[1]) / CY; cy++)
+				for(int cz = (lo[2] - world_lo[2]) / CZ; cz <= (hi[2] - world_lo[2]) / CZ; cz++)
+					dirty[(cx * SCY + cy) * SCZ + cz] = true;
+	}
+
+	/* Work on bringing the graph up to date, for at most budget chunks and nodes. Chunks that were generated since the last rebuild
+	   are picked up as well; trees may have grown into their neighbours, so those are done again too.
+	   Chunks that change while a rebuild is going on are left for the next one.
+	   Finding entrances and linking nodes is split over a number of threads, but how much is done per call
+	   only depends on the budget, so the graph changes at the same ticks no matter how many threads there are. */
+
+	void update(const superchunk *w, int budget = NAVBUDGET, int threads = 0) {
+		if(scan.empty() && !start(w))
+			return;
+
+		if(scanned < scan.size()) {
+			int n = std::min<int>(budget, scan.size() - scanned);
+			parallel(n, threads, [&](int i) { entrances(w, scan[scanned + i]); });
+			scanned += n;
+			budget -= n;
+
+			if(scanned < scan.size())
+				return;
+
+			for(size_t i = 0; i < relink.size(); i++)
+				collect(relink[i]);
+		}
+
+		int n = std::min<int>(budget, floods.size() - linked);
+		parallel(n, threads, [&](int i) { link(w, floods[linked + i].first, floods[linked + i].second); });
+		linked += n;
+
+		if(linked < floods.size())
+			return;
+
+		// Done, swap the new chunks into the graph
+		for(size_t i = 0; i < touched.size(); i++) {
+			std::swap(chunks[touched[i]], next[touched[i]]);
+			next[touched[i]] = navchunk();
+		}
+
+		scan.clear();
+		relink.clear();
+		touched.clear();
+		floods.clear();
+		scanned = linked = 0;
+	}
+
+	// Whether a rebuild is still going on
+	bool busy() const {
+		return !scan.empty();
+	}
+
+	/* Find a path from one cell to another, including both. Returns false if there is none, or if either cell is not one an entity can stand in.
+	   If there is no floor under the first cell, the path starts from the cell the entity will land in.
+	   The path is not always the shortest one, since the abstract graph only passes through one cell of every run of entrances. */
+
+	bool find(const superchunk *w, const pathquery &q, std::vector<glm::ivec3> &path) const {
+		path.clear();
+
+		glm::ivec3 from = q.from;
+		glm::ivec3 to = q.to;
+
+		// Entities that are falling or jumping start from the cell they will land in
+		while(!w->solid(from.x, from.y - 1, from.z))
+			from.y--;
+
+		int cf = chunkof(from);
+		int ct = chunkof(to);
+
+		if(cf < 0 || ct < 0 || !standable(w, from) || !standable(w, to))
+			return false;
+
+		// Nearby destinations in the same chunk can usually be reached without leaving it
+		if(cf == ct && local(w, cf, from, to, path))
+			return true;
+
+		/* How far every node in the first and last chunk is from the start and from the destination */
+
+		std::vector<int> fromcost, tocost;
+		flood(w, cf, from, fromcost, false);
+		flood(w, ct, to, tocost, true);
+
+		/* A* over the abstract graph. Nodes are numbered with the chunk in the high bits and the index of the node in that chunk in the low bits.
+		   The destination has its own number, it can be reached from every node in the last chunk from which there is a path to it within that chunk. */
+
+		static const int done = -1;
+		typedef std::pair<int, int> entry; // Estimated total cost, node
+		std::priority_queue<entry, std::vector<entry>, std::greater<entry> > open;
+		std::unordered_map<int, int> cost;
+		std::unordered_map<int, int> parent;
+
+		const navchunk &first = chunks[cf];
+		for(size_t i = 0; i < first.nodes.size(); i++) {
+			int d = fromcost[index(first.nodes[i], origin(cf))];
+			if(d == INT_MAX)
+				continue;
+
+			int n = cf << 16 | i;
+			cost[n] = d;
+			parent[n] = -2;
+			open.push(entry(d + distance(first.nodes[i], to), n));
+		}
+
+		while(!open.empty()) {
+			entry e = open.top();
+			open.pop();
+
+			int n = e.second;
+			if(n == done)
+				break;
+
+			int c = n >> 16;
+			int i = n & 0xffff;
+			const navchunk &nc = chunks[c];
+			int g = cost[n];
+
+			// Skip entries for nodes that were reached more cheaply after they were queued
+			if(e.first - distance(nc.nodes[i], to) > g)
+				continue;
+
+			if(c == ct) {
+				int d = tocost[index(nc.nodes[i], origin(ct))];
+				if(d != INT_MAX && (!cost.count(done) || g + d < cost[done])) {
+					cost[done] = g + d;
+					parent[done] = n;
+					open.push(entry(g + d, done));
+				}
+			}
+
+			for(size_t k = 0; k < nc.links[i].size(); k++)
+				relax(open, cost, parent, n, c << 16 | nc.links[i][k].node, g + nc.links[i][k].cost, nc.nodes[nc.links[i][k].node], to);
+
+			for(size_t k = 0; k < nc.out[i].size(); k++) {
+				const entrance &x = nc.exits[nc.out[i][k]];
+				if(x.target >= 0)
+					relax(open, cost, parent, n, chunkof(x.to) << 16 | x.target, g + x.cost, x.to, to);
+			}
+		}
+
+		if(!parent.count(done))
+			return false;
+
+		/* Walk back from the destination to get the nodes along the way, then fill in the cells between them */
+
+		std::vector<glm::ivec3> nodes;
+		nodes.push_back(to);
+		for(int n = parent[done]; n != -2; n = parent[n])
+			nodes.push_back(chunks[n >> 16].nodes[n & 0xffff]);
+		nodes.push_back(from);
+		std::reverse(nodes.begin(), nodes.end());
+
+		path.push_back(from);
+
+		for(size_t k = 1; k < nodes.size(); k++) {
+			const glm::ivec3 &a = nodes[k - 1];
+			const glm::ivec3 &b = nodes[k];
+
+			if(a == b)
+				continue;
+
+			// Consecutive nodes in different chunks are the two ends of an entrance, which is a single move
+			if(chunkof(a) != chunkof(b)) {
+				path.push_back(b);
+				continue;
+			}
+
+			std::vector<glm::ivec3> piece;
+			if(!local(w, chunkof(a), a, b, piece)) {
+				path.clear();
+				return false;
+			}
+
+			path.insert(path.end(), piece.begin() + 1, piece.end());
+		}
+
+		return true;
+	}
+
+	// Same as above, for a number of queries at once, split over a number of threads
+	void find(const superchunk *w, const pathquery *queries, std::vector<glm::ivec3> *paths, int n, int threads = 0) const {
+		parallel(n, threads, [=](int i) { find(w, queries[i], paths[i]); });
+	}
+
+	// Whether an entity can stand in a cell
+	static bool standable(const superchunk *w, const glm::ivec3 &p) {
+		return w->solid(p.x, p.y - 1, p.z) && !w->solid(p.x, p.y, p.z) && !w->solid(p.x, p.y + 1, p.z);
+	}
+
+private:
+	// A move from a cell in a chunk to a cell in a neighbouring chunk
+	struct entrance {
+		glm::ivec3 from;
+		glm::ivec3 to;
+		int cost;
+		int source;                             // The node at from, in this chunk
+		int target;                             // The node at to, in the chunk it is in
+	};
+
+	struct navlink {
+		int node;
+		int cost;
+	};
+
+	struct navchunk {
+		std::vector<entrance> exits;
+		std::vector<glm::ivec3> nodes;
+		std::vector<std::vector<navlink> > links; // For every node, the other nodes it can reach without leaving the chunk
+		std::vector<std::vector<int> > out;       // For every node, the entrances that leave from it
+	};
+
+	navchunk chunks[NAVCHUNKS];                // The graph that queries use
+	navchunk next[NAVCHUNKS];                  // The chunks that are being rebuilt, the others are empty
+	bool generated[NAVCHUNKS];                 // Whether the chunk had been generated when the last rebuild started
+	bool dirty[NAVCHUNKS];                     // Whether its entrances have to be found again
+
+	/* The rebuild that is going on: the chunks whose entrances are found again, the ones whose nodes are linked again,
+	   all chunks that change in the process, and the nodes to link, as (chunk, node) */
+
+	std::vector<int> scan;
+	std::vector<int> relink;
+	std::vector<int> touched;
+	std::vector<std::pair<int, int> > floods;
+	size_t scanned;
+	size_t linked;
+
+	static const int dirs[4][2];
+
+	static int chunkof(const glm::ivec3 &p) {
+		if(p.x < world_lo[0] || p.x >= world_hi[0] || p.y < world_lo[1] || p.y >= world_hi[1] || p.z < world_lo[2] || p.z >= world_hi[2])
+			return -1;
+
+		return ((p.x - world_lo[0]) / CX * SCY + (p.y - world_lo[1]) / CY) * SCZ + (p.z - world_lo[2]) / CZ;
+	}
+
+	static glm::ivec3 origin(int c) {
+		return glm::ivec3(world_lo[0] + c / (SCY * SCZ) * CX, world_lo[1] + c / SCZ % SCY * CY, world_lo[2] + c % SCZ * CZ);
+	}
+
+	// Index of a cell in the arrays of a per-chunk search
+	static int index(const glm::ivec3 &p, const glm::ivec3 &o) {
+		return ((p.x - o.x) * CY + p.y - o.y) * CZ + p.z - o.z;
+	}
+
+	static glm::ivec3 cell(int i, const glm::ivec3 &o) {
+		return glm::ivec3(o.x + i / (CY * CZ), o.y + i / CZ % CY, o.z + i % CZ);
+	}
+
+	// Lower bound of the cost of getting from one cell to another, every move costs at least 1 and goes one block sideways
+	static int distance(const glm::ivec3 &a, const glm::ivec3 &b) {
+		return abs(a.x - b.x) + abs(a.z - b.z);
+	}
+
+	// Where an entity standing in a cell ends up when it moves in one of the four directions, and at what cost. Returns false if it can't.
+	static bool step(const superchunk *w, const glm::ivec3 &a, int dir, glm::ivec3 &b, int &cost) {
+		int x = a.x + dirs[dir][0];
+		int z = a.z + dirs[dir][1];
+
+		if(!w->solid(x, a.y, z)) {
+			if(w->solid(x, a.y + 1, z))
+				return false;
+
+			// Walk, and fall if there is no floor
+			int y = a.y;
+			while(y > a.y - MAXDROP && !w->solid(x, y - 1, z))
+				y--;
+			if(!w->solid(x, y - 1, z))
+				return false;
+
+			b = glm::ivec3(x, y, z);
+			cost = 1 + a.y - y;
+			return true;
+		}
+
+		// Climb on top of the block in front, if there is room for that
+		if(w->solid(x, a.y + 1, z) || w->solid(x, a.y + 2, z) || w->solid(a.x, a.y + 2, a.z))
+			return false;
+
+		b = glm::ivec3(x, a.y + 1, z);
+		cost = 2;
+		return true;
+	}
+
+	/* Costs of the cheapest paths from a cell to all cells of chunk c, without leaving it, using Dijkstra's algorithm.
+	   If reverse is true, the costs of the cheapest paths from all cells to the given one instead.
+	   Unreachable cells get INT_MAX. */
+
+	void flood(const superchunk *w, int c, const glm::ivec3 &start, std::vector<int> &cost, bool reverse) const {
+		typedef std::pair<int, int> entry;
+		std::priority_queue<entry, std::vector<entry>, std::greater<entry> > open;
+		glm::ivec3 o = origin(c);
+
+		cost.assign(CX * CY * CZ, INT_MAX);
+		cost[index(start, o)] = 0;
+		open.push(entry(0, index(start, o)));
+
+		while(!open.empty()) {
+			entry e = open.top();
+			open.pop();
+
+			if(e.first > cost[e.second])
+				continue;
+
+			glm::ivec3 p = cell(e.second, o);
+
+			for(int dir = 0; dir < 4; dir++) {
+				if(!reverse) {
+					glm::ivec3 b;
+					int d;
+					if(step(w, p, dir, b, d) && chunkof(b) == c && e.first + d < cost[index(b, o)]) {
+						cost[index(b, o)] = e.first + d;
+						open.push(entry(e.first + d, index(b, o)));
+					}
+					continue;
+				}
+
+				// Cells from which a move in this direction ends up here, from one block lower to MAXDROP blocks higher
+				for(int dy = -1; dy <= MAXDROP; dy++) {
+					glm::ivec3 a(p.x - dirs[dir][0], p.y + dy, p.z - dirs[dir][1]);
+					glm::ivec3 b;
+					int d;
+					if(chunkof(a) == c && standable(w, a) && step(w, a, dir, b, d) && b == p && e.first + d < cost[index(a, o)]) {
+						cost[index(a, o)] = e.first + d;
+						open.push(entry(e.first + d, index(a, o)));
+					}
+				}
+			}
+		}
+	}
+
+	// Find a path between two cells in chunk c with A*, without leaving the chunk
+	bool local(const superchunk *w, int c, const glm::ivec3 &from, const glm::ivec3 &to, std::vector<glm::ivec3> &path) const {
+		typedef std::pair<int, int> entry;
+		std::priority_queue<entry, std::vector<entry>, std::greater<entry> > open;
+		std::vector<int> cost(CX * CY * CZ, INT_MAX);
+		std::vector<int> parent(CX * CY * CZ, -1);
+		glm::ivec3 o = origin(c);
+		int goal = index(to, o);
+
+		path.clear();
+		cost[index(from, o)] = 0;
+		open.push(entry(distance(from, to), index(from, o)));
+
+		while(!open.empty()) {
+			entry e = open.top();
+			open.pop();
+
+			glm::ivec3 p = cell(e.second, o);
+			int g = cost[e.second];
+
+			if(e.second == goal)
+				break;
+			if(e.first - distance(p, to) > g)
+				continue;
+
+			for(int dir = 0; dir < 4; dir++) {
+				glm::ivec3 b;
+				int d;
+				if(step(w, p, dir, b, d) && chunkof(b) == c && g + d < cost[index(b, o)]) {
+					cost[index(b, o)] = g + d;
+					parent[index(b, o)] = e.second;
+					open.push(entry(g + d + distance(b, to), index(b, o)));
+				}
+			}
+		}
+
+		if(cost[goal] == INT_MAX)
+			return false;
+
+		for(int i = goal; i != -1; i = parent[i])
+			path.push_back(cell(i, o));
+		std::reverse(path.begin(), path.end());
+		return true;
+	}
+
+	static void relax(std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int> >, std::greater<std::pair<int, int> > > &open,
+			std::unordered_map<int, int> &cost, std::unordered_map<int, int> &parent, int from, int n, int g, const glm::ivec3 &p, const glm::ivec3 &to) {
+		std::unordered_map<int, int>::iterator it = cost.find(n);
+		if(it != cost.end() && it->second <= g)
+			return;
+
+		cost[n] = g;
+		parent[n] = from;
+		open.push(std::make_pair(g + distance(p, to), n));
+	}
+
+	// Call f(n) for chunk c and every chunk next to it, also diagonally
+	template<typename F> static void around(int c, F f) {
+		int cx = c / (SCY * SCZ);
+		int cy = c / SCZ % SCY;
+		int cz = c % SCZ;
+
+		for(int dx = -1; dx <= 1; dx++)
+			for(int dy = -1; dy <= 1; dy++)
+				for(int dz = -1; dz <= 1; dz++)
+					if(cx + dx >= 0 && cx + dx < SCX && cy + dy >= 0 && cy + dy < SCY && cz + dz >= 0 && cz + dz < SCZ)
+						f(((cx + dx) * SCY + cy + dy) * SCZ + cz + dz);
+	}
+
+	// Start a rebuild of the chunks that were generated or changed since the last one. Returns false if there are none.
+	bool start(const superchunk *w) {
+		for(int cx = 0; cx < SCX; cx++) {
+			for(int cy = 0; cy < SCY; cy++) {
+				for(int cz = 0; cz < SCZ; cz++) {
+					int c = (cx * SCY + cy) * SCZ + cz;
+					if(generated[c] == w->c[cx][cy][cz]->noised)
+						continue;
+
+					generated[c] = w->c[cx][cy][cz]->noised;
+					around(c, [&](int n) { dirty[n] = true; });
+				}
+			}
+		}
+
+		std::vector<bool> relinked(NAVCHUNKS);
+		std::vector<bool> copied(NAVCHUNKS);
+
+		for(int c = 0; c < NAVCHUNKS; c++) {
+			if(!dirty[c])
+				continue;
+
+			dirty[c] = false;
+			scan.push_back(c);
+
+			// Neighbours have entrances leading into this chunk, and need the nodes at their ends
+			around(c, [&](int n) { relinked[n] = true; });
+		}
+
+		if(scan.empty())
+			return false;
+
+		// Linking a chunk also sets the targets of the entrances of its neighbours
+		for(int c = 0; c < NAVCHUNKS; c++) {
+			if(relinked[c]) {
+				relink.push_back(c);
+				around(c, [&](int n) { copied[n] = true; });
+			}
+		}
+
+		for(int c = 0; c < NAVCHUNKS; c++) {
+			if(copied[c]) {
+				touched.push_back(c);
+				next[c] = chunks[c];
+			}
+		}
+
+		return true;
+	}
+
+	// Find all moves out of chunk c, and keep the middle one of every run of them
+	void entrances(const superchunk *w, int c) {
+		navchunk &nc = next[c];
+		nc.exits.clear();
+
+		// Chunks that have not been generated yet are solid
+		if(!generated[c])
+			return;
+
+		glm::ivec3 o = origin(c);
+		std::vector<entrance> all;
+		std::vector<int> dir;
+
+		for(int x = 0; x < CX; x++) {
+			for(int y = 0; y < CY; y++) {
+				for(int z = 0; z < CZ; z++) {
+					glm::ivec3 a(o.x + x, o.y + y, o.z + z);
+					if(!standable(w, a))
+						continue;
+
+					for(int d = 0; d < 4; d++) {
+						entrance e;
+						if(!step(w, a, d, e.to, e.cost) || chunkof(e.to) == c || chunkof(e.to) < 0)
+							continue;
+
+						e.from = a;
+						e.source = e.target = -1;
+						all.push_back(e);
+						dir.push_back(d);
+					}
+				}
+			}
+		}
+
+		/* Moves in the same direction into the same chunk, from cells next to each other, are in the same run.
+		   Runs are found with a union-find, the moves are already sorted in the order they were found in. */
+
+		std::vector<int> run(all.size());
+		for(size_t i = 0; i < all.size(); i++)
+			run[i] = i;
+
+		for(size_t i = 0; i < all.size(); i++) {
+			for(size_t j = i + 1; j < all.size(); j++) {
+				glm::ivec3 d = all[j].from - all[i].from;
+				if(dir[i] != dir[j] || chunkof(all[i].to) != chunkof(all[j].to) || abs(d.x) + abs(d.z) != 1 || abs(d.y) > 1)
+					continue;
+
+				int a = i, b = j;
+				while(run[a] != a)
+					a = run[a];
+				while(run[b] != b)
+					b = run[b];
+				run[std::max(a, b)] = std::min(a, b);
+			}
+		}
+
+		std::vector<std::vector<int> > members(all.size());
+		for(size_t i = 0; i < all.size(); i++) {
+			int a = i;
+			while(run[a] != a)
+				a = run[a];
+			members[a].push_back(i);
+		}
+
+		for(size_t i = 0; i < all.size(); i++)
+			if(!members[i].empty())
+				nc.exits.push_back(all[members[i][members[i].size() / 2]]);
+	}
+
+	// Collect the nodes in chunk c, at both ends of the entrances that leave it and of those that lead into it, and queue them to be linked
+	void collect(int c) {
+		navchunk &nc = next[c];
+		glm::ivec3 o = origin(c);
+		std::map<int, int> found;
+
+		nc.nodes.clear();
+		nc.links.clear();
+		nc.out.clear();
+
+		for(size_t k = 0; k < nc.exits.size(); k++)
+			nc.exits[k].source = node(nc, found, nc.exits[k].from, o);
+
+		around(c, [&](int n) {
+			if(n == c)
+				return;
+
+			std::vector<entrance> &exits = next[n].exits;
+			for(size_t k = 0; k < exits.size(); k++)
+				if(chunkof(exits[k].to) == c)
+					exits[k].target = node(nc, found, exits[k].to, o);
+		});
+
+		nc.links.resize(nc.nodes.size());
+		nc.out.resize(nc.nodes.size());
+
+		for(size_t k = 0; k < nc.exits.size(); k++)
+			nc.out[nc.exits[k].source].push_back(k);
+
+		for(size_t i = 0; i < nc.nodes.size(); i++)
+			floods.push_back(std::make_pair(c, (int)i));
+	}
+
+	// Link node i of chunk c to the other nodes it can reach without leaving the chunk
+	void link(const superchunk *w, int c, int i) {
+		navchunk &nc = next[c];
+		glm::ivec3 o = origin(c);
+		std::vector<int> cost;
+
+		flood(w, c, nc.nodes[i], cost, false);
+
+		for(size_t j = 0; j < nc.nodes.size(); j++) {
+			int d = cost[index(nc.nodes[j], o)];
+			if(j != (size_t)i && d != INT_MAX) {
+				navlink l = {(int)j, d};
+				nc.links[i].push_back(l);
+			}
+		}
+	}
+
+	static int node(navchunk &nc, std::map<int, int> &found, const glm::ivec3 &p, const glm::ivec3 &o) {
+		std::map<int, int>::iterator it = found.find(index(p, o));
+		if(it != found.end())
+			return it->second;
+
+		found[index(p, o)] = nc.nodes.size();
+		nc.nodes.push_back(p);
+		return nc.nodes.size() - 1;
+	}
+};
+
+const int navigator::dirs[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+
+static superchunk *world;
+static entities mobs;
+static navigator nav;
+
+// Every change to the world may change where entities can walk
+static void edited(int x0, int y0, int z0, int x1, int y1, int z1) {
+	nav.invalidate(x0, y0, z0, x1, y1, z1);
+}
+
+/* The world, the camera and the input are owned by the simulation thread, which runs tick() at a fixed rate.
+   After every tick it publishes a snapshot of everything the GL thread needs to draw a frame,
+   and queues the meshes of the sections that changed. The GL thread only reads the snapshots,
+   and the GLUT callbacks only pass input on to the simulation thread. */
+
+/* Adaptive view distance. The GL thread measures how long drawing every frame takes on the CPU and on the GPU,
+   the simulation thread how long every tick takes, and the slowest of those is held near a target frame time
+   by changing how far away chunks are drawn and how many chunks are generated per tick.
+   To keep the settings from going back and forth, they only change after the frame time has been over the target,
+   or well under it, for a number of frames in a row, and then not again until the new settings had some time to take effect.
+   The fog gets thicker as the view distance shrinks, so the edge of the world fades out instead of popping in. */
+
+#define VIEWMIN 48
+#define VIEWMAX 1000
+#define MAXBUDGET 8
+
+struct viewcontrol {
+	bool enabled;             // Otherwise the settings stay as they are
+	float target;             // Frame time to aim for, in ms
+	float frame;              // Smoothed frame time
+	float tick;               // Smoothed time per tick
+	int over;                 // Frames in a row the frame time was over the target
+	int under;                // Frames in a row the frame time was well under the target
+	int cooldown;             // Frames until the settings can change again
+	std::atomic<float> radius; // Distance in blocks up to which chunks are drawn
+	std::atomic<int> budget;   // Number of chunks generated per tick
+
+	viewcontrol(): enabled(false), target(1000.0 / 60), frame(0), tick(0), over(0), under(0), cooldown(0), radius(VIEWMAX), budget(1) {}
+
+	// Feed the time of a frame into the controller, returns true if the settings changed
+	bool update(float cpu, float gpu, float ticktime) {
+		// A single long stall, like generating the first chunks, should not keep the settings down for long
+		frame = frame * 0.9 + std::min(target * 4, std::max(cpu, std::max(gpu, ticktime))) * 0.1;
+		tick = tick * 0.9 + std::min(target * 4, ticktime) * 0.1;
+
+		if(cooldown > 0) {
+			cooldown--;
+			return false;
+		}
+
+		over = frame > target ? over + 1 : 0;
+		under = frame < target * 0.7 ? under + 1 : 0;
+
+		float r = radius;
+		int b = budget;
+
+		if(over >= 10)
+			r = std::max(VIEWMIN * 1.0f, r * 0.8f);
+		else if(under >= 60)
+			r = std::min(VIEWMAX * 1.0f, r + 32);
+
+		// Generating chunks happens on the simulation thread, so it only has to fit in a tick
+		if(tick > timestep * 1e3 * 0.8)
+			b = std::max(1, b - 1);
+		else if(under >= 60 && tick < timestep * 1e3 * 0.4)
+			b = std::min(MAXBUDGET, b + 1);
+
+		if(r == radius && b == budget)
+			return false;
+
+		radius = r;
+		budget = b;
+		over = under = 0;
+		cooldown = 30;
+		return true;
+	}
+
+	// Chunks beyond the view distance are hidden by the fog
+	float fogdensity(float r) const {
+		return std::max(0.00003f, 2.7f / (r * r));
+	}
+};
+
+static viewcontrol viewing;
+
+struct snapshot {
+	int tick;
+	float ticktime;               // How long it took to make this snapshot, in ms
+	float radius;                 // The view distance this snapshot was made with
+	glm::ivec3 origin;            // The chunk the camera is in, everything is drawn relative to its lower corner
+	glm::vec3 eye;                // Position of the camera relative to the origin
+	glm::vec3 lookat;
+	glm::vec3 up;
+	int mx, my, mz, face;         // The block the camera points at, found by ray casting
+	std::vector<chunk *> visible; // Chunks to draw
+	std::vector<chunk *> far;     // Chunks to draw with the mesh of their bricks
+	std::vector<glm::vec3> boxes; // Lower and upper corner of every entity, relative to the origin
+	std::vector<sectionmesh> uploads; // Meshes to upload before drawing this snapshot, see tick()
+};
+
+/* Triple buffer of snapshots. The simulation thread fills the back buffer and swaps it with the middle one,
+   the GL thread swaps the middle buffer with its front buffer whenever that holds a newer snapshot.
+   The low two bits of triple_state hold the index of the middle buffer,
+   the FRESH bit is set when it holds a snapshot the GL thread has not picked up yet.
+   Meshes travel along with the snapshots, so handing them over needs no lock either. The GL thread empties
+   the uploads of every snapshot it picks up. When it has not picked up the middle one by the time the next
+   is published, the simulation thread takes that back first and moves its meshes in front of the new ones. */
+
+#define FRESH 4
+
+static snapshot snapshots[3];
+static std::atomic<int> triple_state(1);
+static int back_snapshot = 0;
+static int front_snapshot = 2;
+
+static void publish() {
+	int state = triple_state.load();
+
+	if((state & FRESH) && triple_state.compare_exchange_strong(state, state & 3)) {
+		std::vector<sectionmesh> &skipped = snapshots[state & 3].uploads;
+		std::vector<sectionmesh> &uploads = snapshots[back_snapshot].uploads;
+		skipped.insert(skipped.end(), std::make_move_iterator(uploads.begin()), std::make_move_iterator(uploads.end()));
+		uploads.swap(skipped);
+		skipped.clear();
+	}
+
+	back_snapshot = triple_state.exchange(back_snapshot | FRESH) & 3;
+}
+
+// Returns true if there was a newer snapshot
+static bool acquire() {
+	int state = triple_state.load();
+
+	// The simulation thread may take the middle snapshot back or publish a newer one in the meantime
+	while(state & FRESH) {
+		if(triple_state.compare_exchange_weak(state, front_snapshot)) {
+			front_snapshot = state & 3;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Input from the GLUT callbacks that has not been handled by the simulation thread yet
+struct command {
+	char kind;       // 'S' to set a block, 'B' to blow a hole in the world, 'M' to spawn mobs, 'G' to send them somewhere, 'P' to move the camera
+	int x, y, z;
+	float radius;
+	uint8_t type;
+	glm::vec3 position;
+	glm::vec3 angle;
+};
+
+static std::mutex input_lock;
+static std::vector<command> commands;
+
+// The paths mobs are following, by their id, and how far along them they are
+struct route {
+	std::vector<glm::ivec3> cells;
+	size_t next;
+	int stuck;       // Ticks since the last cell was reached
+	int retries;     // Times the path had to be found again
+};
+
+static std::unordered_map<int, route> routes;
+static float look_x, look_y;
+
+static std::thread *simulation_thread;
+static std::atomic<bool> simulating;
+
+// Calculate the forward, right and lookat vectors from the angle vector
+static void update_vectors() {
+	forward.x = sinf(angle.x);
+	forward.y = 0;
+	forward.z = cosf(angle.x);
+
+	right.x = -cosf(angle.x);
+	right.y = 0;
+	right.z = sinf(angle.x);
+
+	lookat.x = sinf(angle.x) * cosf(angle.y);
+	lookat.y = sinf(angle.y);
+	lookat.z = cosf(angle.x) * cosf(angle.y);
+
+	up = glm::cross(right, lookat);
+}
+
+static int init_resources() {
+	/* Create shaders */
+
+	program = create_program("glescraft.v.glsl", "glescraft.f.glsl");
+
+	if(program == 0)
+		return 0;
+
+	attribute_coord = get_attrib(program, "coord");
+	attribute_light = get_attrib(program, "light");
+	uniform_mvp = get_uniform(program, "mvp");
+	uniform_offset = get_uniform(program, "offset");
+	uniform_fogdensity = get_uniform(program, "fogdensity");
+	uniform_coordscale = get_uniform(program, "coordscale");
+	uniform_coordbias = get_uniform(program, "coordbias");
+
+	if(attribute_coord == -1 || attribute_light == -1 || uniform_mvp == -1 || uniform_offset == -1 || uniform_fogdensity == -1 || uniform_coordscale == -1 || uniform_coordbias == -1)
+		return 0;
+
+	/* Create and upload the texture */
+
+	glActiveTexture(GL_TEXTURE0);
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, textures.width, textures.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, textures.pixel_data);
+	glGenerateMipmap(GL_TEXTURE_2D);
+
+	/* Create the world */
+
+	world = new superchunk;
+	world->edited = edited;
+
+	position = glm::vec3(0, CY + 1, 0);
+	angle = glm::vec3(0, -0.5, 0);
+	update_vectors();
+
+	/* Create a VBO for the cursor */
+
+	glGenBuffers(1, &cursor_vbo);
+	glGenBuffers(1, &entity_vbo);
+
+	/* Create the ring buffers for streaming uploads, see streambuffer. Copying meshes needs a buffer to copy from. */
+
+	bool persistent = GLEW_ARB_buffer_storage && GLEW_ARB_copy_buffer && GLEW_ARB_sync;
+	mesh_stream.init(MESHSTREAM, persistent, persistent);
+	frame_stream.init(FRAMESTREAM, persistent, true);
+
+	/* OpenGL settings that do not change while running this program */
+
+	glUseProgram(program);
+	glUniform1i(uniform_texture, 0);
+	glUniform1f(uniform_coordscale, 1);
+	glClearColor(0.6, 0.8, 1.0, 0.0);
+	glEnable(GL_CULL_FACE);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); // Use GL_NEAREST_MIPMAP_LINEAR if you want to use mipmaps
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	glPolygonOffset(1, 1);
+
+	glEnableVertexAttribArray(attribute_coord);
+
+	return 1;
+}
+
+// What is visible decides which chunks are generated, so a recording keeps the aspect ratio it was made with,
+// even if the window gets a different size, and the picture is stretched to fit instead
+static void reshape(int w, int h) {
+	ww = w;
+	wh = h;
+	aspect = path_aspect ? path_aspect : 1.0f * w / h;
+	glViewport(0, 0, w, h);
+}
+
+/* Camera path recording and replay.
+   A recording starts with a header containing the world seed, the window size, whose aspect ratio is kept
+   while recording and replaying, whether the terrain is smooth and the version of the terrain generator,
+   followed by a record for every frame with the camera pose and the state of the movement keys,
+   and a record for every change to the world, placed before the frame in which it became visible.
+   Block edits and spawned mobs are stored with the coordinates they were applied to, so replaying them does not depend on
+   where the cursor happens to be. The world is generated from the same seed, and chunk generation only depends
+   on the camera poses, so a replay produces exactly the same world and the same frames as the recording. */
+
+static const char path_magic[4] = {'G', 'C', 'P', '3'};
+
+// Recordings from before the generator was versioned, made with version 1 of it
+static const char path_magic_v2[4] = {'G', 'C', 'P', '2'};
+
+// Recordings from before smooth terrain, with only the seed and window size in the header, made with version 0 of the generator
+static const char path_magic_v1[4] = {'G', 'C', 'P', '1'};
+
+static void record_header() {
+	int32_t header[5] = {(int32_t)world->seed, ww, wh, world->smooth, world->generator};
+	fwrite(path_magic, sizeof path_magic, 1, recording);
+	fwrite(header, sizeof header, 1, recording);
+}
+
+static void record_frame() {
+	float pose[5] = {position.x, position.y, position.z, angle.x, angle.y};
+	fputc('F', recording);
+	fwrite(pose, sizeof pose, 1, recording);
+	fputc(keys, recording);
+}
+
+// Record a command that changes the world: a call to superchunk::set() or superchunk::sphere(), or mobs being spawned or sent somewhere
+static void record_edit(const command &cmd) {
+	int32_t pos[3] = {cmd.x, cmd.y, cmd.z};
+	fputc(cmd.kind, recording);
+	fwrite(pos, sizeof pos, 1, recording);
+	if(cmd.kind == 'B')
+		fwrite(&cmd.radius, sizeof cmd.radius, 1, recording);
+	fputc(cmd.type, recording);
+}
+
+// Spawn mobs in a small area around a block, walking in random directions.
+// Mobs that would end up outside the world are put just inside its edge.
+static void spawn_mobs(int x, int y, int z, int count) {
+	const float r = 0.3, h = 1.8;
+
+	for(int i = 0; i < count; i++) {
+		float a = rand() * 2 * M_PI / RAND_MAX;
+		float speed = 1 + rand() * 2.0 / RAND_MAX;
+		float dx = rand() * 8.0 / RAND_MAX - 4;
+		float dz = rand() * 8.0 / RAND_MAX - 4;
+		float px = glm::clamp(x + 0.5f + dx, world_lo[0] + r, world_hi[0] - r);
+		float py = glm::clamp(y + rand() * 4.0f / RAND_MAX, (float)world_lo[1], world_hi[1] - h);
+		float pz = glm::clamp(z + 0.5f + dz, world_lo[2] + r, world_hi[2] - r);
+		mobs.spawn(px, py, pz, r, h, sinf(a) * speed, cosf(a) * speed);
+	}
+}
+
+/* Send all mobs to the cell on top of a block. The paths are found on a number of threads at once.
+   Mobs that can't get there stay where they are. */
+
+static void route_mobs(int x, int y, int z) {
+	std::vector<pathquery> queries(mobs.size());
+	std::vector<std::vector<glm::ivec3> > paths(mobs.size());
+
+	for(int i = 0; i < mobs.size(); i++) {
+		queries[i].from = glm::ivec3(floorf(mobs.x[i]), floorf(mobs.y[i] + 0.01), floorf(mobs.z[i]));
+		queries[i].to = glm::ivec3(x, y, z);
+	}
+
+	nav.find(world, queries.data(), paths.data(), mobs.size());
+
+	routes.clear();
+
+	for(int i = 0; i < mobs.size(); i++) {
+		if(paths[i].empty())
+			continue;
+
+		route &r = routes[mobs.id[i]];
+		r.cells.swap(paths[i]);
+		r.next = 0;
+		r.stuck = 0;
+		r.retries = 0;
+	}
+}
+
+/* Steer mobs that are following a path towards the next cell on it, and stop them at the end.
+   Mobs can be pushed off their path by other mobs, or get in each other's way in narrow passages.
+   If a mob has not reached the next cell for a while, the rest of its path is found again from where it is now,
+   and if that does not help either, it gives up. */
+
+static void steer_mobs() {
+	static const float speed = 3;
+	static const int patience = 2 * 60;
+	static const int maxretries = 3;
+
+	if(routes.empty())
+		return;
+
+	for(int i = 0; i < mobs.size(); i++) {
+		std::unordered_map<int, route>::iterator it = routes.find(mobs.id[i]);
+		if(it == routes.end())
+			continue;
+
+		route &r = it->second;
+		float dx, dz;
+
+		while(true) {
+			dx = r.cells[r.next].x + 0.5 - mobs.x[i];
+			dz = r.cells[r.next].z + 0.5 - mobs.z[i];
+			if(r.next + 1 == r.cells.size() || dx * dx + dz * dz > 0.3f * 0.3f)
+				break;
+			r.next++;
+			r.stuck = 0;
+		}
+
+		if(++r.stuck > patience) {
+			pathquery q = {glm::ivec3(floorf(mobs.x[i]), floorf(mobs.y[i] + 0.01), floorf(mobs.z[i])), r.cells.back()};
+
+			if(++r.retries > maxretries || !nav.find(world, q, r.cells)) {
+				mobs.vx[i] = mobs.vz[i] = 0;
+				routes.erase(it);
+				continue;
+			}
+
+			r.next = 0;
+			r.stuck = 0;
+			continue;
+		}
+
+		float d = sqrtf(dx * dx + dz * dz);
+
+		if(r.next + 1 == r.cells.size() && d < 0.3f) {
+			mobs.vx[i] = mobs.vz[i] = 0;
+			routes.erase(it);
+			continue;
+		}
+
+		mobs.vx[i] = dx / d * speed;
+		mobs.vz[i] = dz / d * speed;
+	}
+}
+
+// Apply a command that changes the world, live or from a recording
+static void apply(const command &cmd) {
+	if(cmd.kind == 'S') {
+		world->set(cmd.x, cmd.y, cmd.z, cmd.type);
+	} else if(cmd.kind == 'B') {
+		world->sphere(cmd.x, cmd.y, cmd.z, cmd.radius, cmd.type);
+	} else if(cmd.kind == 'M') {
+		spawn_mobs(cmd.x, cmd.y, cmd.z, cmd.type);
+	} else if(cmd.kind == 'G') {
+		route_mobs(cmd.x, cmd.y, cmd.z);
+	}
+}
+
+// Read the header of a recording, returns false if it is not a valid one
+static bool replay_header(int &seed, int &width, int &height, bool &smooth, int &generator) {
+	char magic[4];
+	int32_t header[5] = {0, 0, 0, 0, 0};
+
+	if(fread(magic, sizeof magic, 1, replaying) != 1)
+		return false;
+
+	if(!memcmp(magic, path_magic_v1, sizeof magic)) {
+		if(fread(header, sizeof *header * 3, 1, replaying) != 1)
+			return false;
+	} else if(!memcmp(magic, path_magic_v2, sizeof magic)) {
+		if(fread(header, sizeof *header * 4, 1, replaying) != 1)
+			return false;
+		header[4] = 1;
+	} else if(memcmp(magic, path_magic, sizeof magic) || fread(header, sizeof header, 1, replaying) != 1) {
+		return false;
+	}
+
+	seed = header[0];
+	width = header[1];
+	height = header[2];
+	smooth = header[3];
+	generator = header[4];
+	return generator >= 0 && generator <= GENERATOR;
+}
+
+// Apply the recorded edits up to the next frame, and set the camera pose of that frame. Returns false at the end of the recording.
+static bool replay_next() {
+	int kind;
+
+	while((kind = fgetc(replaying)) != EOF) {
+		if(kind == 'F') {
+			float pose[5];
+			if(fread(pose, sizeof pose, 1, replaying) != 1)
+				return false;
+
+			position = glm::vec3(pose[0], pose[1], pose[2]);
+			angle = glm::vec3(pose[3], pose[4], 0);
+			keys = fgetc(replaying);
+			update_vectors();
+			return true;
+		}
+
+		int32_t pos[3];
+		float radius = 0;
+
+		if(fread(pos, sizeof pos, 1, replaying) != 1 || (kind == 'B' && fread(&radius, sizeof radius, 1, replaying) != 1))
+			return false;
+
+		command cmd = {(char)kind, pos[0], pos[1], pos[2], radius, (uint8_t)fgetc(replaying)};
+		apply(cmd);
+	}
+
+	return false;
+}
+
+static double wallclock() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e3 + tv.tv_usec * 1e-3;
+}
+
+static float percentile(std::vector<float> sorted, float p) {
+	std::sort(sorted.begin(), sorted.end());
+	return sorted[std::min(sorted.size() - 1, (size_t)(p / 100 * sorted.size()))];
+}
+
+// Print the timings of every replayed frame, and a summary on stderr
+static void replay_report() {
+	// Collect the results of the GPU timer queries that are still outstanding
+	if(GLEW_ARB_timer_query) {
+		for(int i = std::max(0, replayed - 3); i < replayed; i++) {
+			GLuint64 ns;
+			glGetQueryObjectui64v(timer_query[i % 4], GL_QUERY_RESULT, &ns);
+			gpu_times[i] = ns * 1e-6;
+		}
+	}
+
+	printf("frame cpu_ms gpu_ms upload_bytes\n");
+	for(int i = 0; i < replayed; i++)
+		printf("%d %.3f %.3f %ld\n", i, cpu_times[i], gpu_times[i], upload_sizes[i]);
+
+	if(!replayed)
+		return;
+
+	fprintf(stderr, "Replayed %d frames\n", replayed);
+	fprintf(stderr, "CPU ms per frame: median %.3f, p95 %.3f, max %.3f\n", percentile(cpu_times, 50), percentile(cpu_times, 95), percentile(cpu_times, 100));
+	if(GLEW_ARB_timer_query)
+		fprintf(stderr, "GPU ms per frame: median %.3f, p95 %.3f, max %.3f\n", percentile(gpu_times, 50), percentile(gpu_times, 95), percentile(gpu_times, 100));
+
+	long total = 0;
+	for(int i = 0; i < replayed; i++)
+		total += upload_sizes[i];
+	fprintf(stderr, "Uploaded %.1f KB per frame, max %.1f KB, using %s\n", total / 1024.0 / replayed,
+			*std::max_element(upload_sizes.begin(), upload_sizes.end()) / 1024.0, mesh_stream.persistent ? "persistently mapped buffers" : "orphaned buffers");
+}
+
+/* World server. With --server PATH, glescraft runs without a window: it generates and simulates the world,
+   and streams it to any number of viewers, which are started with --connect PATH and draw the world as usual.
+   Viewers send their camera position and their edits to the server over a Unix socket.
+   The server generates the chunks nearest to the viewers, and sends every chunk once as a compressed snapshot,
+   followed by deltas with the blocks and light levels that changed since. Viewers apply those to their copy of the world,
+   which marks only the sections that changed as needing to be meshed again. They never generate or light anything themselves.
+
+   Messages from the server go through a ring buffer in shared memory, one for every viewer,
+   or through the socket if shared memory is not available or the viewer was started with --no-shm.
+   Every message starts with a byte for its kind, and the size of its payload.
+
+   From the server: 'H' hello, with the name of the shared memory, 'C' chunk snapshot, 'D' delta, 'T' entities, 'A' edit applied.
+   From a viewer: 'H' hello, with whether it wants to use shared memory, 'P' camera position, and the edits 'S', 'B', 'M' and 'G'. */
+
+#define RINGSIZE (8 << 20)
+#define HEADERSIZE 5 // Kind and payload size of a message
+#define MAXPENDING (64 << 20) // Bytes that can wait to be sent to the other side before it is given up on
+#define EDITSIZE 21  // Sequence number, coordinates, radius and block type of an edit
+
+// A ring buffer of bytes with a single writer and a single reader, in memory shared between two processes.
+// head and tail are the number of bytes written and read since the start, so they never wrap around.
+struct ringbuffer {
+	std::atomic<uint64_t> head;
+	char pad1[64 - sizeof(std::atomic<uint64_t>)];
+	std::atomic<uint64_t> tail;
+	char pad2[64 - sizeof(std::atomic<uint64_t>)];
+	uint8_t data[RINGSIZE];
+
+	// Returns how many bytes were written, which is less than n if the buffer is full
+	size_t write(const uint8_t *src, size_t n) {
+		uint64_t h = head.load(std::memory_order_relaxed);
+		uint64_t t = tail.load(std::memory_order_acquire);
+		n = std::min(n, (size_t)(RINGSIZE - (h - t)));
+
+		size_t i = h % RINGSIZE;
+		size_t first = std::min(n, RINGSIZE - i);
+		memcpy(data + i, src, first);
+		memcpy(data, src + first, n - first);
+
+		head.store(h + n, std::memory_order_release);
+		return n;
+	}
+
+	// Returns how many bytes were read, which is less than n if the buffer is empty
+	size_t read(uint8_t *dst, size_t n) {
+		uint64_t t = tail.load(std::memory_order_relaxed);
+		uint64_t h = head.load(std::memory_order_acquire);
+		n = std::min(n, (size_t)(h - t));
+
+		size_t i = t % RINGSIZE;
+		size_t first = std::min(n, RINGSIZE - i);
+		memcpy(dst, data + i, first);
+		memcpy(dst + first, data, n - first);
+
+		tail.store(t + n, std::memory_order_release);
+		return n;
+	}
+};
+
+// Create a ring buffer for a new viewer, returns NULL if shared memory is not available
+static ringbuffer *create_ring(std::string &name) {
+	static int rings = 0;
+	char buf[64];
+	snprintf(buf, sizeof buf, "/glescraft-%d-%d", (int)getpid(), rings++);
+
+	int fd = shm_open(buf, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if(fd < 0) {
+		perror(buf);
+		return NULL;
+	}
+
+	// The new memory is filled with zeroes, so head and tail start out at 0
+	void *ring = MAP_FAILED;
+	if(ftruncate(fd, sizeof(ringbuffer)) == 0)
+		ring = mmap(NULL, sizeof(ringbuffer), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if(ring == MAP_FAILED) {
+		perror(buf);
+		shm_unlink(buf);
+		return NULL;
+	}
+
+	name = buf;
+	return (ringbuffer *)ring;
+}
+
+// Map the ring buffer the server created for us. Nobody else needs to find it, so its name is removed right away.
+static ringbuffer *open_ring(const char *name) {
+	int fd = shm_open(name, O_RDWR, 0);
+	if(fd < 0) {
+		perror(name);
+		return NULL;
+	}
+
+	void *ring = mmap(NULL, sizeof(ringbuffer), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	shm_unlink(name);
+
+	if(ring == MAP_FAILED) {
+		perror(name);
+		return NULL;
+	}
+
+	return (ringbuffer *)ring;
+}
+
+// One end of the connection between the world server and a viewer. Sending and receiving never blocks.
+struct channel {
+	int fd;
+	ringbuffer *outring;      // If set, messages are sent through this instead of through the socket
+	ringbuffer *inring;       // If set, messages are received through this instead of through the socket
+	std::vector<uint8_t> out; // Messages that did not fit in the socket or the ring buffer yet
+	size_t outpos;            // How much of out was sent already
+	std::vector<uint8_t> in;  // Bytes that were received, but not handled yet
+	size_t inpos;
+	bool closed;
+	uint64_t received;        // Bytes received in total
+
+	channel(int fd): fd(fd), outring(0), inring(0), outpos(0), inpos(0), closed(false), received(0) {}
+
+	// Bytes that still have to be sent
+	size_t pending() const {
+		return out.size() - outpos;
+	}
+
+	// Queue a message. If the other side does not keep up and too much is waiting already, close the channel instead.
+	void send(char kind, const void *data, uint32_t size) {
+		if(closed)
+			return;
+
+		if(pending() + HEADERSIZE + size > MAXPENDING) {
+			fprintf(stderr, "More than %d bytes are waiting to be sent, giving up on the other side\n", MAXPENDING);
+			closed = true;
+			return;
+		}
+
+		size_t n = out.size();
+		out.resize(n + HEADERSIZE + size);
+		out[n] = kind;
+		memcpy(&out[n + 1], &size, sizeof size);
+		if(size)
+			memcpy(&out[n + HEADERSIZE], data, size);
+	}
+
+	// Send as much as possible, returns false if the other side is gone
+	bool flush() {
+		while(outpos < out.size() && !closed) {
+			ssize_t n;
+
+			if(outring) {
+				n = outring->write(out.data() + outpos, out.size() - outpos);
+			} else {
+				n = ::send(fd, out.data() + outpos, out.size() - outpos, MSG_DONTWAIT | MSG_NOSIGNAL);
+				if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+					closed = true;
+			}
+
+			if(n <= 0)
+				break;
+			outpos += n;
+		}
+
+		// What was sent is only removed once it is most of the buffer, so sending a bit at a time does not move the rest every time
+		if(outpos == out.size()) {
+			out.clear();
+			outpos = 0;
+		} else if(outpos > out.size() / 2) {
+			out.erase(out.begin(), out.begin() + outpos);
+			outpos = 0;
+		}
+
+		return !closed;
+	}
+
+	// Receive whatever has arrived, returns false if the other side is gone
+	bool fill() {
+		in.erase(in.begin(), in.begin() + inpos);
+		inpos = 0;
+
+		uint8_t buf[65536];
+
+		while(!closed) {
+			ssize_t n;
+
+			if(inring) {
+				n = inring->read(buf, sizeof buf);
+
+				// Nothing else comes through the socket, but it still tells us when the other side is gone
+				if(!n && recv(fd, buf, 1, MSG_DONTWAIT | MSG_PEEK) == 0)
+					closed = true;
+			} else {
+				n = recv(fd, buf, sizeof buf, MSG_DONTWAIT);
+				if(n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+					closed = true;
+			}
+
+			if(n <= 0)
+				break;
+
+			in.insert(in.end(), buf, buf + n);
+			received += n;
+		}
+
+		return !closed;
+	}
+
+	// Get the next complete message, if there is one. The payload stays valid until the next call to fill().
+	bool next(char &kind, const uint8_t *&data, uint32_t &size) {
+		if(in.size() - inpos < HEADERSIZE)
+			return false;
+
+		memcpy(&size, &in[inpos + 1], sizeof size);
+		if(in.size() - inpos - HEADERSIZE < size)
+			return false;
+
+		kind = in[inpos];
+		data = in.data() + inpos + HEADERSIZE;
+		inpos += HEADERSIZE + size;
+		return true;
+	}
+};
+
+// Add a value to the payload of a message, and read it back
+template<typename T> static void put(std::vector<uint8_t> &msg, const T &value) {
+	const uint8_t *p = (const uint8_t *)&value;
+	msg.insert(msg.end(), p, p + sizeof value);
+}
+
+template<typename T> static T take(const uint8_t *&p) {
+	T value;
+	memcpy(&value, p, sizeof value);
+	p += sizeof value;
+	return value;
+}
+
+// The contents of a chunk as the viewers know it, so only the differences have to be sent when it changes
+struct published {
+	uint8_t blk[CX][CY][CZ];
+	uint8_t light[CX][CY][CZ];
+};
+
+// A viewer connected to the world server
+struct viewer {
+	channel link;
+	std::string shm;    // Name of the shared memory with its ring buffer, empty if it only uses the socket
+	bool ready;         // It said hello, and was sent the world as it is
+	glm::vec3 position;
+	float radius;       // How far away from it chunks should be generated, 0 until it sent its position
+
+	viewer(int fd): link(fd), ready(false), radius(0) {}
+};
+
+static published *shadow[CHUNKSLOTS];
+static std::vector<viewer *> viewers;
+static volatile sig_atomic_t serving;
+
+static chunk *chunk_slot(int i) {
+	return world->c[i / (SCY * SCZ)][i / SCZ % SCY][i % SCZ];
+}
+
+static void chunk_message(const chunk *ch, const published *p, std::vector<uint8_t> &msg) {
+	put(msg, (int32_t)ch->ax);
+	put(msg, (int32_t)ch->ay);
+	put(msg, (int32_t)ch->az);
+	compress(&p->blk[0][0][0], sizeof p->blk, msg);
+	compress(&p->light[0][0][0], sizeof p->light, msg);
+}
+
+static void broadcast(char kind, const std::vector<uint8_t> &msg) {
+	for(size_t i = 0; i < viewers.size(); i++)
+		if(viewers[i]->ready)
+			viewers[i]->link.send(kind, msg.data(), msg.size());
+}
+
+/* Send every chunk that was generated since the last call as a snapshot, and the blocks that changed in the others as deltas.
+   The server never meshes anything, so it uses the changed flags of the sections to find out where to look for differences. */
+
+static void publish_changes() {
+	std::vector<uint8_t> msg;
+
+	for(int i = 0; i < CHUNKSLOTS; i++) {
+		chunk *ch = chunk_slot(i);
+		if(!ch->noised)
+			continue;
+
+		msg.clear();
+		published *p = shadow[i];
+
+		if(!p) {
+			p = shadow[i] = new published;
+			memcpy(p->blk, ch->blk, sizeof p->blk);
+			memcpy(p->light, ch->light, sizeof p->light);
+			for(int s = 0; s < SECTIONS; s++)
+				ch->sec[s].changed = false;
+
+			chunk_message(ch, p, msg);
+			broadcast('C', msg);
+			continue;
+		}
+
+		put(msg, (int32_t)ch->ax);
+		put(msg, (int32_t)ch->ay);
+		put(msg, (int32_t)ch->az);
+		size_t header = msg.size();
+
+		for(int s = 0; s < SECTIONS; s++) {
+			if(!ch->sec[s].changed)
+				continue;
+
+			ch->sec[s].changed = false;
+
+			for(int x = 0; x < CX; x++) {
+				for(int y = s * SY; y < (s + 1) * SY; y++) {
+					for(int z = 0; z < CZ; z++) {
+						if(ch->blk[x][y][z] == p->blk[x][y][z] && ch->light[x][y][z] == p->light[x][y][z])
+							continue;
+
+						p->blk[x][y][z] = ch->blk[x][y][z];
+						p->light[x][y][z] = ch->light[x][y][z];
+						put(msg, (uint16_t)((x * CY + y) * CZ + z));
+						put(msg, p->blk[x][y][z]);
+						put(msg, p->light[x][y][z]);
+					}
+				}
+			}
+		}
+
+		if(msg.size() > header)
+			broadcast('D', msg);
+	}
+}
+
+// Send a new viewer everything that was published before it connected
+static void welcome(viewer *v) {
+	std::vector<uint8_t> msg;
+
+	for(int i = 0; i < CHUNKSLOTS; i++) {
+		if(!shadow[i])
+			continue;
+
+		msg.clear();
+		chunk_message(chunk_slot(i), shadow[i], msg);
+		v->link.send('C', msg.data(), msg.size());
+	}
+}
+
+// Handle the messages a viewer sent
+static void handle(viewer *v) {
+	char kind;
+	const uint8_t *data;
+	uint32_t size;
+
+	while(v->link.next(kind, data, size)) {
+		if(kind == 'H' && size == 1 && !v->ready) {
+			ringbuffer *ring = data[0] ? create_ring(v->shm) : NULL;
+
+			// The hello itself still goes through the socket
+			v->link.send('H', v->shm.data(), v->shm.size());
+			v->link.flush();
+			v->link.outring = ring;
+			v->ready = true;
+			welcome(v);
+		} else if(kind == 'P' && size == 4 * sizeof(float)) {
+			v->position.x = take<float>(data);
+			v->position.y = take<float>(data);
+			v->position.z = take<float>(data);
+			v->radius = take<float>(data);
+		} else if(kind && strchr("SBMG", kind) && size == EDITSIZE) {
+			uint32_t seq = take<uint32_t>(data);
+			command cmd;
+			cmd.kind = kind;
+			cmd.x = take<int32_t>(data);
+			cmd.y = take<int32_t>(data);
+			cmd.z = take<int32_t>(data);
+			cmd.radius = take<float>(data);
+			cmd.type = take<uint8_t>(data);
+
+			// Send the changes right away, followed by the acknowledgement, instead of waiting for the next tick
+			apply(cmd);
+			publish_changes();
+			v->link.send('A', &seq, sizeof seq);
+		} else {
+			fprintf(stderr, "Unexpected message '%c' of %u bytes from a viewer\n", kind, size);
+			v->link.closed = true;
+			return;
+		}
+	}
+}
+
+static void disconnect(viewer *v) {
+	close(v->link.fd);
+	if(v->link.outring)
+		munmap(v->link.outring, sizeof(ringbuffer));
+	if(!v->shm.empty())
+		shm_unlink(v->shm.c_str());
+	delete v;
+}
+
+// Generate the missing chunks nearest to any of the viewers, up to MAXBUDGET per tick.
+// The server does not know where the viewers are looking, so this only goes by distance.
+static void generate_near() {
+	std::vector<std::pair<float, int> > missing;
+
+	for(int i = 0; i < CHUNKSLOTS; i++) {
+		chunk *ch = chunk_slot(i);
+		if(ch->initialized)
+			continue;
+
+		glm::vec3 center(ch->ax * CX + CX / 2, ch->ay * CY + CY / 2, ch->az * CZ + CZ / 2);
+		float nearest = 1.0 / 0.0;
+
+		for(size_t j = 0; j < viewers.size(); j++) {
+			float d = glm::length(center - viewers[j]->position);
+			if(viewers[j]->radius > 0 && d - CY <= viewers[j]->radius)
+				nearest = std::min(nearest, d);
+		}
+
+		if(nearest < 1.0 / 0.0)
+			missing.push_back(std::make_pair(nearest, i));
+	}
+
+	int budget = std::min(MAXBUDGET, (int)missing.size());
+	std::partial_sort(missing.begin(), missing.begin() + budget, missing.end());
+
+	for(int i = 0; i < budget; i++)
+		world->initialize(chunk_slot(missing[i].second));
+}
+
+static void stop_serving(int) {
+	serving = false;
+}
+
+// Run the world server on a Unix socket at path, until it is interrupted.
+// The size x size chunk columns in the middle of the world are generated before it starts listening.
+static int serve(const char *path, int seed, int size) {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+
+	if(strlen(path) >= sizeof addr.sun_path) {
+		fprintf(stderr, "%s: path too long for a Unix socket\n", path);
+		return 1;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	world = new superchunk;
+	world->seed = seed;
+	world->edited = edited;
+	srand(seed);
+
+	int x0 = (SCX - size) / 2;
+	int z0 = (SCZ - size) / 2;
+
+	for(int x = x0; x < x0 + size; x++)
+		for(int y = 0; y < SCY; y++)
+			for(int z = z0; z < z0 + size; z++)
+				world->generate(world->c[x][y][z]);
+
+	publish_changes();
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(path);
+
+	if(listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof addr) < 0 || listen(listener, 8) < 0) {
+		perror(path);
+		return 1;
+	}
+
+	serving = true;
+	signal(SIGINT, stop_serving);
+	signal(SIGTERM, stop_serving);
+
+	printf("Serving a world with seed %d on %s\n", seed, path);
+	fflush(stdout);
+
+	double next = wallclock();
+	int ticks = 0;
+	std::vector<struct pollfd> fds;
+
+	while(serving) {
+		/* Sleep until the next tick, or until a viewer sends something. While there are messages
+		   that did not fit in a ring buffer or socket yet, wake up often to try again. */
+
+		fds.clear();
+		struct pollfd pfd = {listener, POLLIN, 0};
+		fds.push_back(pfd);
+
+		double wait = next - wallclock();
+
+		for(size_t i = 0; i < viewers.size(); i++) {
+			pfd.fd = viewers[i]->link.fd;
+			fds.push_back(pfd);
+			if(viewers[i]->link.pending())
+				wait = std::min(wait, 1.0);
+		}
+
+		poll(fds.data(), fds.size(), wait > 0 ? (int)ceil(wait) : 0);
+
+		if(fds[0].revents & POLLIN) {
+			int fd = accept(listener, NULL, NULL);
+			if(fd >= 0)
+				viewers.push_back(new viewer(fd));
+		}
+
+		for(size_t i = 0; i < viewers.size(); i++) {
+			viewers[i]->link.fill();
+			handle(viewers[i]);
+		}
+
+		if(wallclock() >= next) {
+			if(ticks++ % FLOWTICKS == 0)
+				world->flow();
+
+			generate_near();
+			nav.update(world);
+			steer_mobs();
+			mobs.tick(world, timestep);
+			publish_changes();
+
+			std::vector<uint8_t> msg;
+			put(msg, (int32_t)mobs.size());
+			for(int i = 0; i < mobs.size(); i++) {
+				put(msg, glm::vec3(mobs.x[i] - mobs.radius[i], mobs.y[i], mobs.z[i] - mobs.radius[i]));
+				put(msg, glm::vec3(mobs.x[i] + mobs.radius[i], mobs.y[i] + mobs.height[i], mobs.z[i] + mobs.radius[i]));
+			}
+			broadcast('T', msg);
+
+			next += timestep * 1000;
+			if(wallclock() - next > timestep * 4000)
+				next = wallclock();
+		}
+
+		for(size_t i = 0; i < viewers.size();) {
+			if(viewers[i]->link.flush()) {
+				i++;
+			} else {
+				disconnect(viewers[i]);
+				viewers.erase(viewers.begin() + i);
+			}
+		}
+	}
+
+	for(size_t i = 0; i < viewers.size(); i++)
+		disconnect(viewers[i]);
+	viewers.clear();
+
+	close(listener);
+	unlink(path);
+	return 0;
+}
+
+// The connection of a viewer to the world server
+struct upstream {
+	channel link;
+	uint32_t sent;                // Sequence number of the last edit sent to the server
+	uint32_t acknowledged;        // and of the last one the server has applied
+	int chunks;                   // Chunk snapshots received
+	int deltas;                   // Deltas received
+	std::vector<glm::vec3> boxes; // Lower and upper corner of every entity
+
+	upstream(int fd): link(fd), sent(0), acknowledged(0), chunks(0), deltas(0) {}
 };
 
-static superchunk *world;
+static upstream *server;
 
-// Calculate the forward, right and lookat vectors from the angle vector
-static void update_vectors() {
-	forward.x = sinf(angle.x);
-	forward.y = 0;
-	forward.z = cosf(angle.x);
+static void disconnect_server() {
+	close(server->link.fd);
+	if(server->link.inring)
+		munmap(server->link.inring, sizeof(ringbuffer));
+	delete server;
+	server = NULL;
+}
 
-	right.x = -cosf(angle.x);
-	right.y = 0;
-	right.z = sinf(angle.x);
+// Connect to the world server at path, through shared memory if possible. After this, the world is not generated here anymore.
+static bool connect_server(const char *path, bool useshm) {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof addr.sun_path - 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+		perror(path);
+		if(fd >= 0)
+			close(fd);
+		return false;
+	}
 
-	lookat.x = sinf(angle.x) * cosf(angle.y);
-	lookat.y = sinf(angle.y);
-	lookat.z = cosf(angle.x) * cosf(angle.y);
+	server = new upstream(fd);
 
-	up = glm::cross(right, lookat);
+	uint8_t hello = useshm;
+	server->link.send('H', &hello, sizeof hello);
+	server->link.flush();
+
+	char kind;
+	const uint8_t *data;
+	uint32_t size;
+
+	// Wait up to five seconds for the reply
+	for(int i = 0; !server->link.next(kind, data, size); i++) {
+		struct pollfd pfd = {fd, POLLIN, 0};
+		if(i == 50 || poll(&pfd, 1, 100) < 0 || !server->link.fill()) {
+			fprintf(stderr, "%s: no reply from the world server\n", path);
+			disconnect_server();
+			return false;
+		}
+	}
+
+	if(kind != 'H') {
+		fprintf(stderr, "%s: not a world server\n", path);
+		disconnect_server();
+		return false;
+	}
+
+	if(size) {
+		std::string name((const char *)data, size);
+		server->link.inring = open_ring(name.c_str());
+		if(!server->link.inring) {
+			disconnect_server();
+			return false;
+		}
+	}
+
+	world->remote = true;
+	return true;
 }
 
-static int init_resources() {
-	/* Create shaders */
+static chunk *remote_chunk(const uint8_t *&p) {
+	int x = take<int32_t>(p) + SCX / 2;
+	int y = take<int32_t>(p) + SCY / 2;
+	int z = take<int32_t>(p) + SCZ / 2;
 
-	program = create_program("glescraft.v.glsl", "glescraft.f.glsl");
+	if(x < 0 || x >= SCX || y < 0 || y >= SCY || z < 0 || z >= SCZ)
+		return NULL;
 
-	if(program == 0)
-		return 0;
+	// It is about to be written to
+	world->c[x][y][z]->unpack();
+	return world->c[x][y][z];
+}
 
-	attribute_coord = get_attrib(program, "coord");
-	uniform_mvp = get_uniform(program, "mvp");
+// Apply everything the world server sent since the last call
+static void receive_world() {
+	if(!server->link.closed && !server->link.fill())
+		fprintf(stderr, "Lost the connection to the world server\n");
 
-	if(attribute_coord == -1 || uniform_mvp == -1)
-		return 0;
+	char kind;
+	const uint8_t *data;
+	uint32_t size;
 
-	/* Create and upload the texture */
+	while(server->link.next(kind, data, size)) {
+		const uint8_t *end = data + size;
 
-	glActiveTexture(GL_TEXTURE0);
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, textures.width, textures.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, textures.pixel_data);
-	glGenerateMipmap(GL_TEXTURE_2D);
+		if(kind == 'C' && size >= 12) {
+			chunk *ch = remote_chunk(data);
 
-	/* Create the world */
+			if(!ch || !expand(data, end, &ch->blk[0][0][0], CX * CY * CZ) || !expand(data, end, &ch->light[0][0][0], CX * CY * CZ)) {
+				fprintf(stderr, "Invalid chunk from the world server\n");
+				continue;
+			}
 
-	world = new superchunk;
+			ch->blocks = superchunk::count(&ch->blk[0][0][0], CX * CY * CZ);
+			ch->smooth = world->smooth;
+			ch->noised = true;
+			ch->initialized = true;
+
+			// Its own sections have to be meshed, and the ones touching it in the neighbouring chunks again
+			ch->touch(0, 0, 0, CX - 1, CY - 1, CZ - 1);
+			server->chunks++;
+		} else if(kind == 'D' && size >= 12 && (size - 12) % 4 == 0) {
+			chunk *ch = remote_chunk(data);
+			if(!ch)
+				continue;
+
+			while(data < end) {
+				int i = take<uint16_t>(data);
+				uint8_t type = take<uint8_t>(data);
+				uint8_t light = take<uint8_t>(data);
+
+				if(i >= CX * CY * CZ)
+					break;
 
-	position = glm::vec3(0, CY + 1, 0);
-	angle = glm::vec3(0, -0.5, 0);
-	update_vectors();
+				int x = i / (CY * CZ);
+				int y = i / CZ % CY;
+				int z = i % CZ;
 
-	/* Create a VBO for the cursor */
+				ch->blocks += (type != 0) - (ch->blk[x][y][z] != 0);
+				ch->blk[x][y][z] = type;
+				ch->light[x][y][z] = light;
+				ch->touch(x, y, z, x, y, z);
+			}
 
-	glGenBuffers(1, &cursor_vbo);
+			server->deltas++;
+		} else if(kind == 'T' && size >= 4) {
+			uint32_t n = take<int32_t>(data);
+			if(size != 4 + n * 2 * sizeof(glm::vec3))
+				continue;
 
-	/* OpenGL settings that do not change while running this program */
+			server->boxes.resize(n * 2);
+			memcpy(server->boxes.data(), data, n * 2 * sizeof(glm::vec3));
+		} else if(kind == 'A' && size == 4) {
+			server->acknowledged = take<uint32_t>(data);
+		}
+	}
+}
 
-	glUseProgram(program);
-	glUniform1i(uniform_texture, 0);
-	glClearColor(0.6, 0.8, 1.0, 0.0);
-	glEnable(GL_CULL_FACE);
+// Send an edit to the world server, which applies it and sends back what changed
+static void send_command(const command &cmd) {
+	std::vector<uint8_t> msg;
+	put(msg, ++server->sent);
+	put(msg, (int32_t)cmd.x);
+	put(msg, (int32_t)cmd.y);
+	put(msg, (int32_t)cmd.z);
+	put(msg, cmd.radius);
+	put(msg, cmd.type);
+	server->link.send(cmd.kind, msg.data(), msg.size());
+}
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); // Use GL_NEAREST_MIPMAP_LINEAR if you want to use mipmaps
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+// Tell the world server where the camera is, so it generates the chunks around it
+static void send_view(const glm::vec3 &position, float radius) {
+	float view[4] = {position.x, position.y, position.z, radius};
+	server->link.send('P', view, sizeof view);
+}
 
-	glPolygonOffset(1, 1);
+static void queue(const command &cmd) {
+	std::lock_guard<std::mutex> lock(input_lock);
+	commands.push_back(cmd);
+}
 
-	glEnableVertexAttribArray(attribute_coord);
+// Advance the world by one timestep, and publish the result
+static void tick() {
+	static const float movespeed = 10;
+	static int ticks = 0;
 
-	return 1;
+	double start = wallclock();
+
+	std::vector<command> todo;
+	float dx, dy;
+
+	{
+		std::lock_guard<std::mutex> lock(input_lock);
+		todo.swap(commands);
+		dx = look_x;
+		dy = look_y;
+		look_x = look_y = 0;
+	}
+
+	if(replaying) {
+		// The camera follows the recording, and live input is ignored
+		if(!replay_next()) {
+			replay_done = true;
+			return;
+		}
+	} else {
+		for(size_t i = 0; i < todo.size(); i++) {
+			const command &cmd = todo[i];
+
+			if(cmd.kind == 'P') {
+				position = cmd.position;
+				angle = cmd.angle;
+			} else if(server) {
+				send_command(cmd);
+			} else {
+				apply(cmd);
+			}
+
+			if(recording && cmd.kind != 'P')
+				record_edit(cmd);
+		}
+
+		angle.x -= dx;
+		angle.y -= dy;
+
+		if(angle.x < -M_PI)
+			angle.x += M_PI * 2;
+		if(angle.x > M_PI)
+			angle.x -= M_PI * 2;
+		if(angle.y < -M_PI / 2)
+			angle.y = -M_PI / 2;
+		if(angle.y > M_PI / 2)
+			angle.y = M_PI / 2;
+
+		update_vectors();
+
+		float dt = timestep;
+
+		if(keys & 1)
+			position -= right * movespeed * dt;
+		if(keys & 2)
+			position += right * movespeed * dt;
+		if(keys & 4)
+			position += forward * movespeed * dt;
+		if(keys & 8)
+			position -= forward * movespeed * dt;
+		if(keys & 16)
+			position.y += movespeed * dt;
+		if(keys & 32)
+			position.y -= movespeed * dt;
+	}
+
+	if(recording)
+		record_frame();
+
+	if(server) {
+		// The world server simulates the world, we only get to see the result
+		receive_world();
+	} else {
+		if(ticks % FLOWTICKS == 0)
+			world->flow();
+
+		// Bring the graph used for finding paths up to date with the chunks that were generated or changed, a bit every tick
+		nav.update(world);
+
+		steer_mobs();
+		mobs.tick(world, timestep);
+	}
+
+	snapshot &f = snapshots[back_snapshot];
+	f.tick = ticks++;
+	f.origin = glm::ivec3(floorf(position.x / CX), floorf(position.y / CY), floorf(position.z / CZ));
+	f.eye = position - glm::vec3(f.origin.x * CX, f.origin.y * CY, f.origin.z * CZ);
+	f.lookat = lookat;
+	f.up = up;
+
+	glm::vec3 corner(f.origin.x * CX, f.origin.y * CY, f.origin.z * CZ);
+
+	if(server) {
+		f.boxes.resize(server->boxes.size());
+		for(size_t i = 0; i < f.boxes.size(); i++)
+			f.boxes[i] = server->boxes[i] - corner;
+	} else {
+		f.boxes.resize(mobs.size() * 2);
+		for(int i = 0; i < mobs.size(); i++) {
+			f.boxes[i * 2] = glm::vec3(mobs.x[i] - mobs.radius[i], mobs.y[i], mobs.z[i] - mobs.radius[i]) - corner;
+			f.boxes[i * 2 + 1] = glm::vec3(mobs.x[i] + mobs.radius[i], mobs.y[i] + mobs.height[i], mobs.z[i] + mobs.radius[i]) - corner;
+		}
+	}
+
+	/* Find the visible chunks, with the same projection the GL thread will use */
+
+	f.radius = viewing.radius;
+
+	glm::mat4 view = glm::lookAt(f.eye, f.eye + lookat, up);
+	glm::mat4 projection = glm::perspective(45.0f, aspect.load(), 0.01f, f.radius);
+
+	std::vector<sectionmesh> meshes;
+	f.visible.clear();
+	f.far.clear();
+	world->cull(projection * view, f.origin, f.radius, viewing.budget, f.visible, f.far, meshes);
+
+	/* Cast a ray to find out which block we are looking at, and through which face */
+
+	rayhit hit;
+
+	if(world->raycast(position, lookat, 10, hit)) {
+		f.mx = hit.x;
+		f.my = hit.y;
+		f.mz = hit.z;
+		f.face = hit.face;
+	} else {
+		/* If we are looking at air, move the cursor out of sight */
+		f.mx = f.my = f.mz = 99999;
+		f.face = 0;
+	}
+
+	/* The meshes go with the snapshot, so they are uploaded before it is drawn */
+
+	f.uploads.insert(f.uploads.end(), std::make_move_iterator(meshes.begin()), std::make_move_iterator(meshes.end()));
+
+	if(server) {
+		send_view(position, f.radius);
+		server->link.flush();
+	}
+
+	f.ticktime = wallclock() - start;
+	publish();
 }
 
-static void reshape(int w, int h) {
-	ww = w;
-	wh = h;
-	glViewport(0, 0, w, h);
+static void simulation() {
+	double next = wallclock();
+
+	while(simulating) {
+		if(replaying) {
+			// Every recorded tick is drawn exactly once, so wait until the GL thread has picked up the previous snapshot
+			if(replay_done || (triple_state.load() & FRESH)) {
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+				continue;
+			}
+		} else {
+			double wait = next - wallclock();
+			if(wait > 0)
+				std::this_thread::sleep_for(std::chrono::microseconds((int)(wait * 1000)));
+
+			// If generation took so long that we are more than a few ticks behind, don't try to catch up
+			next += timestep * 1000;
+			if(wallclock() - next > timestep * 4000)
+				next = wallclock();
+		}
+
+		tick();
+	}
+}
+
+static void stop_simulation() {
+	if(!simulation_thread)
+		return;
+
+	simulating = false;
+	simulation_thread->join();
+	delete simulation_thread;
+	simulation_thread = NULL;
+}
+
+/* Draw count vertices of four floats each, which are written to the frame stream first.
+   If they do not fit in it, even after waiting for the GPU, they are uploaded to the fallback VBO the old way. */
+
+static void draw_streamed(GLenum mode, GLuint fallback, const void *data, int count) {
+	size_t n = count * 4 * sizeof(float);
+	uint64_t pos;
+
+	if(!frame_stream.reserve(n, pos)) {
+		frame_stream.reclaim(true);
+
+		if(!frame_stream.reserve(n, pos)) {
+			glBindBuffer(GL_ARRAY_BUFFER, fallback);
+			glBufferData(GL_ARRAY_BUFFER, n, data, GL_DYNAMIC_DRAW);
+			glVertexAttribPointer(attribute_coord, 4, GL_FLOAT, GL_FALSE, 0, 0);
+			glDrawArrays(mode, 0, count);
+			upload_bytes += n;
+			return;
+		}
+	}
+
+	memcpy(frame_stream.at(pos), data, n);
+	glBindBuffer(GL_ARRAY_BUFFER, frame_stream.vbo);
+	if(!frame_stream.persistent)
+		frame_stream.stream(pos, n);
+
+	glVertexAttribPointer(attribute_coord, 4, GL_FLOAT, GL_FALSE, 0, (void *)(pos % frame_stream.size));
+	glDrawArrays(mode, 0, count);
+	upload_bytes += n;
 }
 
 // Not really GLSL fract(), but the absolute distance to the nearest integer value
@@ -780,13 +5227,93 @@ static float fract(float value) {
 		return f;
 }
 
+/* The commands to draw the chunks of a frame. With lots of chunks, they are split over a number of threads,
+   each recording the commands for a part of the chunks, in the order they are drawn, into its own command buffer.
+   The GL thread then executes the command buffers in order. */
+
+static std::vector<command_buffer> chunk_commands;
+
+static void record_chunks(const snapshot &f) {
+	int n = f.visible.size() + f.far.size();
+	int threads = worker_pool::shared().size();
+
+	// Recording the commands for a chunk takes very little time, so every thread needs quite a few of them
+	threads = std::max(1, std::min(threads, n / 256));
+	chunk_commands.resize(threads);
+
+	auto record = [&f](command_buffer &cmd, int start, int end) {
+		cmd.reset();
+
+		// Chunks that are far away only have the mesh of their bricks drawn
+		for(int i = start; i < end; i++) {
+			bool far = i >= (int)f.visible.size();
+			chunk *c = far ? f.far[i - f.visible.size()] : f.visible[i];
+			cmd.uniform3f(uniform_offset, (c->ax - f.origin.x) * CX, (c->ay - f.origin.y) * CY, (c->az - f.origin.z) * CZ);
+			c->render(cmd, far);
+		}
+	};
+
+	int per = (n + threads - 1) / threads;
+
+	worker_pool::shared().run(threads, [&](int i) { record(chunk_commands[i], std::min(n, i * per), std::min(n, (i + 1) * per)); });
+}
+
 static void display() {
-	glm::mat4 view = glm::lookAt(position, position + lookat, up);
-	glm::mat4 projection = glm::perspective(45.0f, 1.0f*ww/wh, 0.01f, 1000.0f);
+	// When replaying, only draw new snapshots, so every recorded tick is drawn exactly once
+	if(!acquire() && replaying)
+		return;
+
+	snapshot &f = snapshots[front_snapshot];
+	now = f.tick * timestep;
+
+	double start = wallclock();
+
+	if(GLEW_ARB_timer_query)
+		glBeginQuery(GL_TIME_ELAPSED, timer_query[frames % 4]);
+
+	/* Upload the meshes that the simulation thread has built. Once they have been copied, the mesh stream can be reused
+	   up to the end of the furthest one. Meshes built on different threads are not in the order they were written in. */
+
+	mesh_stream.reclaim(false);
+	frame_stream.reclaim(false);
+	upload_bytes = 0;
+
+	std::vector<sectionmesh> todo;
+	todo.swap(f.uploads);
+
+	uint64_t consumed = 0;
+
+	for(size_t i = 0; i < todo.size(); i++) {
+		sectionmesh &m = todo[i];
+		upload_bytes += m.bytes;
+
+		if(!m.streamed) {
+			m.c->upload(m, m.data.data());
+			continue;
+		}
+
+		if(mesh_stream.persistent)
+			m.c->copy(m, mesh_stream.vbo, m.pos % mesh_stream.size);
+		else
+			m.c->upload(m, mesh_stream.at(m.pos));
+
+		consumed = std::max(consumed, m.pos + m.bytes);
+	}
+
+	if(consumed)
+		mesh_stream.retire(consumed);
+
+	/* Everything is drawn relative to the chunk the camera is in, so the coordinates that are sent to the GPU
+	   stay small and precise, no matter how far away from the center of the world the camera is.
+	   Chunks only need an offset in whole chunks from there, instead of their own model matrix. */
+
+	glm::mat4 view = glm::lookAt(f.eye, f.eye + f.lookat, f.up);
+	glm::mat4 projection = glm::perspective(45.0f, aspect.load(), 0.01f, f.radius);
 
 	glm::mat4 mvp = projection * view;
 
 	glUniformMatrix4fv(uniform_mvp, 1, GL_FALSE, glm::value_ptr(mvp));
+	glUniform1f(uniform_fogdensity, viewing.fogdensity(f.radius));
 
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glEnable(GL_DEPTH_TEST);
@@ -794,7 +5321,13 @@ static void display() {
 
 	/* Then draw chunks */
 
-	world->render(mvp);
+	glEnableVertexAttribArray(attribute_light);
+
+	record_chunks(f);
+	for(size_t i = 0; i < chunk_commands.size(); i++)
+		chunk_commands[i].execute();
+
+	glUniform3f(uniform_offset, 0, 0, 0);
 
 	/* At which voxel are we looking? */
 
@@ -806,7 +5339,7 @@ static void display() {
 
 		glm::vec4 viewport = glm::vec4(0, 0, ww, wh);
 		glm::vec3 wincoord = glm::vec3(ww / 2, wh / 2, depth);
-		glm::vec3 objcoord = glm::unProject(wincoord, view, projection, viewport);
+		glm::vec3 objcoord = glm::unProject(wincoord, view, projection, viewport) + glm::vec3(f.origin.x * CX, f.origin.y * CY, f.origin.z * CZ);
 
 		/* Find out which block it belongs to */
 
@@ -833,62 +5366,54 @@ static void display() {
 			else
 				face = 2; // Z
 
-		if(face == 0 && lookat.x > 0)
+		if(face == 0 && f.lookat.x > 0)
 			face += 3;
-		if(face == 1 && lookat.y > 0)
+		if(face == 1 && f.lookat.y > 0)
 			face += 3;
-		if(face == 2 && lookat.z > 0)
+		if(face == 2 && f.lookat.z > 0)
 			face += 3;
 	} else {
-		/* Very naive ray casting algorithm to find out which block we are looking at */
-
-		glm::vec3 testpos = position;
-		glm::vec3 prevpos = position;
-
-		for(int i = 0; i < 100; i++) {
-			/* Advance from our currect position to the direction we are looking at, in small steps */
-
-			prevpos = testpos;
-			testpos += lookat * 0.1f;
+		/* The simulation thread has already cast a ray to find out which block we are looking at */
 
-			mx = floorf(testpos.x);
-			my = floorf(testpos.y);
-			mz = floorf(testpos.z);
-
-			/* If we find a block that is not air, we are done */
+		mx = f.mx;
+		my = f.my;
+		mz = f.mz;
+		face = f.face;
+	}
 
-			if(world->get(mx, my, mz))
-				break;
+	/* Draw a box around every entity */
+
+	glDisableVertexAttribArray(attribute_light);
+	glVertexAttrib1f(attribute_light, 255);
+
+	if(!f.boxes.empty()) {
+		static std::vector<glm::vec4> lines;
+		lines.clear();
+
+		for(size_t i = 0; i < f.boxes.size(); i += 2) {
+			const glm::vec3 &lo = f.boxes[i];
+			const glm::vec3 &hi = f.boxes[i + 1];
+
+			for(int e = 0; e < 12; e++) {
+				// Each edge runs along one axis, the other two coordinates are taken from the corners
+				int axis = e / 4;
+				int a1 = (axis + 1) % 3;
+				int a2 = (axis + 2) % 3;
+				glm::vec4 v(lo, 13);
+				v[a1] = e & 1 ? hi[a1] : lo[a1];
+				v[a2] = e & 2 ? hi[a2] : lo[a2];
+				lines.push_back(v);
+				v[axis] = hi[axis];
+				lines.push_back(v);
+			}
 		}
 
-		/* Find out which face of the block we are looking at */
-
-		int px = floorf(prevpos.x);
-		int py = floorf(prevpos.y);
-		int pz = floorf(prevpos.z);
-
-		if(px > mx)
-			face = 0;
-		else if(px < mx)
-			face = 3;
-		else if(py > my)
-			face = 1;
-		else if(py < my)
-			face = 4;
-		else if(pz > mz)
-			face = 2;
-		else if(pz < mz)
-			face = 5;
-
-		/* If we are looking at air, move the cursor out of sight */
-
-		if(!world->get(mx, my, mz))
-			mx = my = mz = 99999;
+		draw_streamed(GL_LINES, entity_vbo, lines.data(), lines.size());
 	}
 
-	float bx = mx;
-	float by = my;
-	float bz = mz;
+	float bx = mx - f.origin.x * CX;
+	float by = my - f.origin.y * CY;
+	float bz = mz - f.origin.z * CZ;
 
 	/* Render a box around the block we are pointing at */
 
@@ -923,11 +5448,7 @@ static void display() {
 
 	glDisable(GL_POLYGON_OFFSET_FILL);
 	glDisable(GL_CULL_FACE);
-	glUniformMatrix4fv(uniform_mvp, 1, GL_FALSE, glm::value_ptr(mvp));
-	glBindBuffer(GL_ARRAY_BUFFER, cursor_vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof box, box, GL_DYNAMIC_DRAW);
-	glVertexAttribPointer(attribute_coord, 4, GL_FLOAT, GL_FALSE, 0, 0);
-	glDrawArrays(GL_LINES, 0, 24);
+	draw_streamed(GL_LINES, cursor_vbo, box, 24);
 
 	/* Draw a cross in the center of the screen */
 
@@ -941,16 +5462,47 @@ static void display() {
 	glDisable(GL_DEPTH_TEST);
 	glm::mat4 one(1);
 	glUniformMatrix4fv(uniform_mvp, 1, GL_FALSE, glm::value_ptr(one));
-	glBufferData(GL_ARRAY_BUFFER, sizeof cross, cross, GL_DYNAMIC_DRAW);
-	glVertexAttribPointer(attribute_coord, 4, GL_FLOAT, GL_FALSE, 0, 0);
-	glDrawArrays(GL_LINES, 0, 4);
+	draw_streamed(GL_LINES, cursor_vbo, cross, 4);
+
+	frame_stream.retire(frame_stream.head);
+
+	/* And we are done. Measure the time spent issuing GL commands for this frame, and the time the GPU spent executing them.
+	   Timer query results are read three frames later, so we don't have to wait for them. */
 
-	/* And we are done */
+	float cpu = wallclock() - start;
+	float gpu = 0;
+
+	if(GLEW_ARB_timer_query) {
+		glEndQuery(GL_TIME_ELAPSED);
+
+		if(frames >= 3) {
+			GLuint64 ns;
+			glGetQueryObjectui64v(timer_query[(frames - 3) % 4], GL_QUERY_RESULT, &ns);
+			gpu = ns * 1e-6;
+		}
+	}
+
+	frames++;
+
+	if(replaying) {
+		cpu_times.push_back(cpu);
+		gpu_times.push_back(0);
+		upload_sizes.push_back(upload_bytes);
+		if(replayed >= 3)
+			gpu_times[replayed - 3] = gpu;
+		replayed++;
+	} else if(viewing.enabled && viewing.update(cpu, gpu, f.ticktime)) {
+		printf("Frame time %.1f ms (target %.1f ms), tick %.1f ms: view distance %.0f blocks, generating %d chunks per tick\n",
+				viewing.frame, viewing.target, viewing.tick, viewing.radius.load(), viewing.budget.load());
+	}
 
 	glutSwapBuffers();
 }
 
 static void special(int key, int x, int y) {
+	if(replaying)
+		return;
+
 	switch(key) {
 		case GLUT_KEY_LEFT:
 			keys |= 1;
@@ -970,16 +5522,20 @@ static void special(int key, int x, int y) {
 		case GLUT_KEY_PAGE_DOWN:
 			keys |= 32;
 			break;
-		case GLUT_KEY_HOME:
-			position = glm::vec3(0, CY + 1, 0);
-			angle = glm::vec3(0, -0.5, 0);
-			update_vectors();
+		case GLUT_KEY_HOME: {
+			command cmd = {'P'};
+			cmd.position = glm::vec3(0, CY + 1, 0);
+			cmd.angle = glm::vec3(0, -0.5, 0);
+			queue(cmd);
 			break;
-		case GLUT_KEY_END:
-			position = glm::vec3(0, CX * SCX, 0);
-			angle = glm::vec3(0, -M_PI * 0.49, 0);
-			update_vectors();
+		}
+		case GLUT_KEY_END: {
+			command cmd = {'P'};
+			cmd.position = glm::vec3(0, CX * SCX, 0);
+			cmd.angle = glm::vec3(0, -M_PI * 0.49, 0);
+			queue(cmd);
 			break;
+		}
 		case GLUT_KEY_F1:
 			select_using_depthbuffer = !select_using_depthbuffer;
 			if(select_using_depthbuffer)
@@ -987,6 +5543,28 @@ static void special(int key, int x, int y) {
 			else
 				printf("Using ray casting selection method\n");
 			break;
+		case GLUT_KEY_F2: {
+			// Blow a hole in the world around the block we are pointing at
+			command cmd = {'B', mx, my, mz, 4.5, 0};
+			queue(cmd);
+			break;
+		}
+		case GLUT_KEY_F3: {
+			// Spawn mobs on top of the block we are pointing at, if any
+			if(mx == 99999)
+				break;
+			command cmd = {'M', mx, my + 1, mz, 0, 100};
+			queue(cmd);
+			break;
+		}
+		case GLUT_KEY_F4: {
+			// Send all mobs to the top of the block we are pointing at, if any
+			if(mx == 99999)
+				break;
+			command cmd = {'G', mx, my + 1, mz, 0, 0};
+			queue(cmd);
+			break;
+		}
 	}
 }
 
@@ -1013,27 +5591,14 @@ static void specialup(int key, int x, int y) {
 	}
 }
 
+// Movement happens in the simulation thread, here we just keep drawing
 static void idle() {
-	static int pt = 0;
-	static const float movespeed = 10;
-
-	now = time(0);
-	int t = glutGet(GLUT_ELAPSED_TIME);
-	float dt = (t - pt) * 1.0e-3;
-	pt = t;
-	
-	if(keys & 1)
-		position -= right * movespeed * dt;
-	if(keys & 2)
-		position += right * movespeed * dt;
-	if(keys & 4)
-		position += forward * movespeed * dt;
-	if(keys & 8)
-		position -= forward * movespeed * dt;
-	if(keys & 16)
-		position.y += movespeed * dt;
-	if(keys & 32)
-		position.y -= movespeed * dt;
+	// Stop after the last snapshot of a replay has been drawn
+	if(replaying && replay_done && !(triple_state.load() & FRESH)) {
+		stop_simulation();
+		replay_report();
+		exit(0);
+	}
 
 	glutPostRedisplay();
 }
@@ -1042,20 +5607,15 @@ static void motion(int x, int y) {
 	static bool warp = false;
 	static const float mousespeed = 0.001;
 
-	if(!warp) {
-		angle.x -= (x - ww / 2) * mousespeed;
-		angle.y -= (y - wh / 2) * mousespeed;
-
-		if(angle.x < -M_PI)
-			angle.x += M_PI * 2;
-		if(angle.x > M_PI)
-			angle.x -= M_PI * 2;
-		if(angle.y < -M_PI / 2)
-			angle.y = -M_PI / 2;
-		if(angle.y > M_PI / 2)
-			angle.y = M_PI / 2;
+	if(replaying)
+		return;
 
-		update_vectors();
+	if(!warp) {
+		{
+			std::lock_guard<std::mutex> lock(input_lock);
+			look_x += (x - ww / 2) * mousespeed;
+			look_y += (y - wh / 2) * mousespeed;
+		}
 
 		// Force the mouse pointer back to the center of the screen.
 		// This causes another call to motion(), which we need to ignore.
@@ -1067,7 +5627,7 @@ static void motion(int x, int y) {
 }
 
 static void mouse(int button, int state, int x, int y) {
-	if(state != GLUT_DOWN)
+	if(state != GLUT_DOWN || replaying)
 		return;
 
 	// Scrollwheel
@@ -1097,20 +5657,84 @@ static void mouse(int button, int state, int x, int y) {
 			mz++;
 		if(face == 5)
 			mz--;
-		world->set(mx, my, mz, buildtype);
+		command cmd = {'S', mx, my, mz, 0, buildtype};
+		queue(cmd);
 	} else {
-		world->set(mx, my, mz, 0);
+		command cmd = {'S', mx, my, mz, 0, 0};
+		queue(cmd);
 	}
 }
 
 static void free_resources() {
 	glDeleteProgram(program);
+	if(server)
+		disconnect_server();
 }
 
 int main(int argc, char* argv[]) {
+	int width = 640;
+	int height = 480;
+	int seed = 0;
+	bool smooth = false;
+	int generator = GENERATOR;
+	const char *connect_path = NULL;
+	bool useshm = true;
+
+	// The world server does not open a window, so handle that before GLUT gets to see the arguments
+	if(argc > 1 && !strcmp(argv[1], "--server")) {
+		if(argc == 3)
+			return serve(argv[2], time(NULL), 0);
+		if(argc == 5 && !strcmp(argv[3], "--seed"))
+			return serve(argv[2], atoi(argv[4]), 0);
+
+		fprintf(stderr, "Usage: %s --server PATH [--seed N]\n", argv[0]);
+		return 1;
+	}
+
 	glutInit(&argc, argv);
+
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "--record") && i + 1 < argc) {
+			recording = fopen(argv[++i], "wb");
+			if(!recording) {
+				perror(argv[i]);
+				return 1;
+			}
+		} else if(!strcmp(argv[i], "--replay") && i + 1 < argc) {
+			replaying = fopen(argv[++i], "rb");
+			if(!replaying) {
+				perror(argv[i]);
+				return 1;
+			}
+			if(!replay_header(seed, width, height, smooth, generator)) {
+				fprintf(stderr, "%s is not a camera path recording\n", argv[i]);
+				return 1;
+			}
+		} else if(!strcmp(argv[i], "--timestep") && i + 1 < argc) {
+			timestep = atof(argv[++i]);
+		} else if(!strcmp(argv[i], "--target") && i + 1 < argc) {
+			viewing.target = atof(argv[++i]);
+		} else if(!strcmp(argv[i], "--connect") && i + 1 < argc) {
+			connect_path = argv[++i];
+		} else if(!strcmp(argv[i], "--no-shm")) {
+			useshm = false;
+		} else if(!strcmp(argv[i], "--smooth")) {
+			smooth = true;
+		} else {
+			fprintf(stderr, "Usage: %s [--target MS] [--smooth] [--record FILE | --replay FILE [--timestep SECONDS] | --connect PATH [--no-shm]]\n", argv[0]);
+			fprintf(stderr, "       %s --server PATH [--seed N]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	// Recordings rely on the world being generated here
+	if(connect_path && (recording || replaying)) {
+		fprintf(stderr, "Recording and replaying are not possible while connected to a world server\n");
+		return 1;
+	}
+
 	glutInitDisplayMode(GLUT_RGB | GLUT_DEPTH | GLUT_DOUBLE);
-	glutInitWindowSize(640, 480);
+	glutInitWindowSize(width, height);
 	glutCreateWindow("GLEScraft");
 
 	GLenum glew_status = glewInit();
@@ -1124,15 +5748,62 @@ int main(int argc, char* argv[]) {
 		return 1;
 	}
 
-	printf("Use the mouse to look around.\n");
-	printf("Use cursor keys, pageup and pagedown to move around.\n");
-	printf("Use home and end to go to two predetermined positions.\n");
-	printf("Press the left mouse button to build a block.\n");
-	printf("Press the right mouse button to remove a block.\n");
-	printf("Use the scrollwheel to select different types of blocks.\n");
-	printf("Press F1 to toggle between depth buffer and ray casting methods for cube selection.\n");
+	if(!replaying) {
+		printf("Use the mouse to look around.\n");
+		printf("Use cursor keys, pageup and pagedown to move around.\n");
+		printf("Use home and end to go to two predetermined positions.\n");
+		printf("Press the left mouse button to build a block.\n");
+		printf("Press the right mouse button to remove a block.\n");
+		printf("Use the scrollwheel to select different types of blocks.\n");
+		printf("Press F1 to toggle between depth buffer and ray casting methods for cube selection.\n");
+		printf("Press F2 to blow a hole in the world.\n");
+		printf("Press F3 to spawn mobs.\n");
+		printf("Press F4 to send the mobs to the block you are pointing at.\n");
+		printf("Start with --record FILE to record the camera path, and --replay FILE to replay it.\n");
+		printf("Start with --target MS to set the frame time the view distance is adapted to.\n");
+		printf("Start with --smooth to draw the terrain as a smooth surface instead of blocks.\n");
+		printf("Start with --server PATH to run a world server, and --connect PATH to view its world.\n");
+	}
 
 	if (init_resources()) {
+		/* Mobs are spawned using rand(), and so are trees in old recordings, so seed it to get the same mobs and trees when replaying */
+
+		if(replaying)
+			world->seed = seed;
+
+		world->smooth = smooth;
+		world->generator = generator;
+
+		if(GLEW_ARB_timer_query)
+			glGenQueries(4, timer_query);
+
+		// Recordings are made with fixed settings, so they replay the same way on any machine
+		viewing.enabled = !recording && !replaying;
+
+		if(recording || replaying)
+			srand(world->seed);
+
+		if(connect_path && !connect_server(connect_path, useshm))
+			return 1;
+
+		if(recording) {
+			ww = width;
+			wh = height;
+			record_header();
+		}
+
+		/* Make the first snapshot before starting the simulation thread, so there is always something to draw */
+
+		aspect = 1.0f * width / height;
+		if(recording || replaying)
+			path_aspect = aspect;
+		update_vectors();
+		tick();
+
+		simulating = true;
+		simulation_thread = new std::thread(simulation);
+		atexit(stop_simulation);
+
 		glutSetCursor(GLUT_CURSOR_NONE);
 		glutWarpPointer(320, 240);
 		glutDisplayFunc(display);
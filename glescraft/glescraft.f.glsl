@@ -1,8 +1,9 @@
 varying vec4 texcoord;
+varying float brightness;
 uniform sampler2D texture;
 
 const vec4 fogcolor = vec4(0.6, 0.8, 1.0, 1.0);
-const float fogdensity = .00003;
+uniform float fogdensity;
 
 void main(void) {
 	vec2 coord2d;
@@ -24,8 +25,8 @@ void main(void) {
 	if(color.a < 0.4)
 		discard;
 
-	// Attenuate sides of blocks
-	color.xyz *= intensity;
+	// Attenuate sides of blocks, and apply the light baked into the vertices
+	color.xyz *= intensity * brightness;
 
 	// Calculate strength of fog
 	float z = gl_FragCoord.z / gl_FragCoord.w;
@@ -1,11 +1,23 @@
 attribute vec4 coord;
+attribute float light;
 uniform mat4 mvp;
+uniform vec3 offset;
+uniform float coordscale;
+uniform vec3 coordbias;
 varying vec4 texcoord;
+varying float brightness;
 
 void main(void) {
-	// Just pass the original vertex coordinates to the fragment shader as texture coordinates
-	texcoord = coord;
+	// Just pass the original vertex coordinates to the fragment shader as texture coordinates.
+	// Smooth terrain has fixed point coordinates relative to the middle of its section, those are turned back into blocks first.
+	texcoord = vec4(coord.xyz * coordscale + coordbias, coord.w);
 
-	// Apply the model-view-projection matrix to the xyz components of the vertex coordinates
-	gl_Position = mvp * vec4(coord.xyz, 1);
+	// The light value has the skylight in the high nibble and the block light in the low nibble.
+	// Use the brightest of the two, with a bit of ambient light so caves are not pitch black.
+	float sky = floor(light / 16.0);
+	float block = light - sky * 16.0;
+	brightness = 0.1 + 0.9 * max(sky, block) / 15.0;
+
+	// Move the vertex to where its chunk is relative to the camera's chunk, and apply the view-projection matrix
+	gl_Position = mvp * vec4(texcoord.xyz + offset, 1);
 }
@@ -23,6 +23,8 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include "../common/shader_utils.h"
+#include "../common/command_buffer.h"
+#include "../common/worker_pool.h"
 
 #define GROUND_SIZE 20
 
@@ -52,6 +54,16 @@ static unsigned int fps_frames = 0;
 static float zNear = 0.01;
 static float fovy = 45;
 
+/* The GL commands for a frame are recorded into command buffers while
+   going through the scene, and executed once they are complete. The
+   main view and the overview are recorded at the same time, on the
+   threads of the shared worker pool. */
+command_buffer commands, view_commands, overview_commands;
+
+/* Unit cube for drawing bounding boxes, see Mesh::draw_bbox(), and the
+   lines showing the camera in the overview */
+GLuint vbo_bbox_vertices, ibo_bbox_elements, vbo_camera;
+
 class Mesh {
 private:
   GLuint vbo_vertices, vbo_normals, ibo_elements;
@@ -99,13 +111,21 @@ public:
   }
 
   /**
-   * Draw the object
+   * Record the commands to draw the object
+   */
+  void draw(command_buffer& cmd) const {
+    draw(cmd, this->object2world);
+  }
+
+  /**
+   * Record the commands to draw the object with another transformation
+   * matrix, so the same mesh can be drawn in several places
    */
-  void draw() {
+  void draw(command_buffer& cmd, const glm::mat4& object2world) const {
     if (this->vbo_vertices != 0) {
-      glEnableVertexAttribArray(attribute_v_coord);
-      glBindBuffer(GL_ARRAY_BUFFER, this->vbo_vertices);
-      glVertexAttribPointer(
+      cmd.enable_vertex_attrib_array(attribute_v_coord);
+      cmd.bind_buffer(GL_ARRAY_BUFFER, this->vbo_vertices);
+      cmd.vertex_attrib_pointer(
         attribute_v_coord,  // attribute
         4,                  // number of elements per vertex, here (x,y,z,w)
         GL_FLOAT,           // the type of each element
@@ -116,9 +136,9 @@ public:
     }
 
     if (this->vbo_normals != 0) {
-      glEnableVertexAttribArray(attribute_v_normal);
-      glBindBuffer(GL_ARRAY_BUFFER, this->vbo_normals);
-      glVertexAttribPointer(
+      cmd.enable_vertex_attrib_array(attribute_v_normal);
+      cmd.bind_buffer(GL_ARRAY_BUFFER, this->vbo_normals);
+      cmd.vertex_attrib_pointer(
         attribute_v_normal, // attribute
         3,                  // number of elements per vertex, here (x,y,z)
         GL_FLOAT,           // the type of each element
@@ -129,60 +149,31 @@ public:
     }
     
     /* Apply object's transformation matrix */
-    glUniformMatrix4fv(uniform_m, 1, GL_FALSE, glm::value_ptr(this->object2world));
-    glm::mat3 m_3x3_inv_transp = glm::transpose(glm::inverse(glm::mat3(this->object2world)));
-    glUniformMatrix3fv(uniform_m_3x3_inv_transp, 1, GL_FALSE, glm::value_ptr(m_3x3_inv_transp));
+    cmd.uniform_matrix4fv(uniform_m, glm::value_ptr(object2world));
+    glm::mat3 m_3x3_inv_transp = glm::transpose(glm::inverse(glm::mat3(object2world)));
+    cmd.uniform_matrix3fv(uniform_m_3x3_inv_transp, glm::value_ptr(m_3x3_inv_transp));
     
     /* Push each element in buffer_vertices to the vertex shader */
     if (this->ibo_elements != 0) {
-      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ibo_elements);
-      int size;  glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
-      glDrawElements(GL_TRIANGLES, size/sizeof(GLushort), GL_UNSIGNED_SHORT, 0);
+      cmd.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, this->ibo_elements);
+      cmd.draw_elements(GL_TRIANGLES, this->elements.size(), GL_UNSIGNED_SHORT, 0);
     } else {
-      glDrawArrays(GL_TRIANGLES, 0, this->vertices.size());
+      cmd.draw_arrays(GL_TRIANGLES, 0, this->vertices.size());
     }
 
     if (this->vbo_normals != 0)
-      glDisableVertexAttribArray(attribute_v_coord);
+      cmd.disable_vertex_attrib_array(attribute_v_coord);
     if (this->vbo_vertices != 0)
-      glDisableVertexAttribArray(attribute_v_normal);
+      cmd.disable_vertex_attrib_array(attribute_v_normal);
   }
 
   /**
-   * Draw object bounding box
+   * Record the commands to draw the object bounding box
    */
-  void draw_bbox() {
+  void draw_bbox(command_buffer& cmd) const {
     if (this->vertices.size() == 0)
       return;
     
-    // Cube 1x1x1, centered on origin
-    GLfloat vertices[] = {
-      -0.5, -0.5, -0.5, 1.0,
-       0.5, -0.5, -0.5, 1.0,
-       0.5,  0.5, -0.5, 1.0,
-      -0.5,  0.5, -0.5, 1.0,
-      -0.5, -0.5,  0.5, 1.0,
-       0.5, -0.5,  0.5, 1.0,
-       0.5,  0.5,  0.5, 1.0,
-      -0.5,  0.5,  0.5, 1.0,
-    };
-    GLuint vbo_vertices;
-    glGenBuffers(1, &vbo_vertices);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_vertices);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-    GLushort elements[] = {
-      0, 1, 2, 3,
-      4, 5, 6, 7,
-      0, 4, 1, 5, 2, 6, 3, 7
-    };
-    GLuint ibo_elements;
-    glGenBuffers(1, &ibo_elements);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_elements);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(elements), elements, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
     GLfloat
       min_x, max_x,
       min_y, max_y,
@@ -204,11 +195,11 @@ public:
     
     /* Apply object's transformation matrix */
     glm::mat4 m = this->object2world * transform;
-    glUniformMatrix4fv(uniform_m, 1, GL_FALSE, glm::value_ptr(m));
+    cmd.uniform_matrix4fv(uniform_m, glm::value_ptr(m));
     
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_vertices);
-    glEnableVertexAttribArray(attribute_v_coord);
-    glVertexAttribPointer(
+    cmd.bind_buffer(GL_ARRAY_BUFFER, vbo_bbox_vertices);
+    cmd.enable_vertex_attrib_array(attribute_v_coord);
+    cmd.vertex_attrib_pointer(
       attribute_v_coord,  // attribute
       4,                  // number of elements per vertex, here (x,y,z,w)
       GL_FLOAT,           // the type of each element
@@ -217,25 +208,23 @@ public:
       0                   // offset of first element
     );
     
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_elements);
-    glDrawElements(GL_LINE_LOOP, 4, GL_UNSIGNED_SHORT, 0);
-    glDrawElements(GL_LINE_LOOP, 4, GL_UNSIGNED_SHORT, (GLvoid*)(4*sizeof(GLushort)));
-    glDrawElements(GL_LINES, 8, GL_UNSIGNED_SHORT, (GLvoid*)(8*sizeof(GLushort)));
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    cmd.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, ibo_bbox_elements);
+    cmd.draw_elements(GL_LINE_LOOP, 4, GL_UNSIGNED_SHORT, 0);
+    cmd.draw_elements(GL_LINE_LOOP, 4, GL_UNSIGNED_SHORT, (GLvoid*)(4*sizeof(GLushort)));
+    cmd.draw_elements(GL_LINES, 8, GL_UNSIGNED_SHORT, (GLvoid*)(8*sizeof(GLushort)));
+    cmd.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     
-    glDisableVertexAttribArray(attribute_v_coord);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    
-    glDeleteBuffers(1, &vbo_vertices);
-    glDeleteBuffers(1, &ibo_elements);
+    cmd.disable_vertex_attrib_array(attribute_v_coord);
+    cmd.bind_buffer(GL_ARRAY_BUFFER, 0);
   }
 };
 Mesh ground, main_object, light_bbox;
 Mesh portals[2];
+Mesh portal_frame;
 
 
-void draw_scene(vector<glm::mat4> view_stack, int rec, int outer_portal);
-void draw_portals(vector<glm::mat4> view_stack, int rec, int outer_portal);
+void draw_scene(command_buffer& cmd, vector<glm::mat4> view_stack, int rec, int outer_portal);
+void draw_portals(command_buffer& cmd, vector<glm::mat4> view_stack, int rec, int outer_portal);
 
 void load_obj(const char* filename, Mesh* mesh) {
   ifstream in(filename, ios::in);
@@ -321,6 +310,98 @@ void create_portal(Mesh* portal, int screen_width, int screen_height, float zNea
   }
 }
 
+/**
+ * Create a 0.05 frame around a portal
+ */
+void create_portal_frame(Mesh* frame) {
+  frame->vertices.push_back(glm::vec4(-1.00, -1.05, 0, 1));
+  frame->vertices.push_back(glm::vec4(-1.00,  1.05, 0, 1));
+  frame->vertices.push_back(glm::vec4(-1.05, -1.05, 0, 1));
+
+  frame->vertices.push_back(glm::vec4(-1.05, -1.05, 0, 1));
+  frame->vertices.push_back(glm::vec4(-1.00,  1.05, 0, 1));
+  frame->vertices.push_back(glm::vec4(-1.05,  1.05, 0, 1));
+
+  frame->vertices.push_back(glm::vec4( 1.05, -1.05, 0, 1));
+  frame->vertices.push_back(glm::vec4( 1.05,  1.05, 0, 1));
+  frame->vertices.push_back(glm::vec4( 1.00, -1.05, 0, 1));
+
+  frame->vertices.push_back(glm::vec4( 1.00, -1.05, 0, 1));
+  frame->vertices.push_back(glm::vec4( 1.05,  1.05, 0, 1));
+  frame->vertices.push_back(glm::vec4( 1.00,  1.05, 0, 1));
+
+  frame->vertices.push_back(glm::vec4(-1.00,  1.05, 0, 1));
+  frame->vertices.push_back(glm::vec4(-1.00,  1.00, 0, 1));
+  frame->vertices.push_back(glm::vec4( 1.00,  1.05, 0, 1));
+
+  frame->vertices.push_back(glm::vec4( 1.00,  1.05, 0, 1));
+  frame->vertices.push_back(glm::vec4(-1.00,  1.00, 0, 1));
+  frame->vertices.push_back(glm::vec4( 1.00,  1.00, 0, 1));
+
+  frame->vertices.push_back(glm::vec4(-1.00, -1.00, 0, 1));
+  frame->vertices.push_back(glm::vec4(-1.00, -1.05, 0, 1));
+  frame->vertices.push_back(glm::vec4( 1.00, -1.00, 0, 1));
+
+  frame->vertices.push_back(glm::vec4( 1.00, -1.00, 0, 1));
+  frame->vertices.push_back(glm::vec4(-1.00, -1.05, 0, 1));
+  frame->vertices.push_back(glm::vec4( 1.00, -1.05, 0, 1));
+
+  for (unsigned int i = 0; i < frame->vertices.size(); i++)
+    frame->normals.push_back(glm::vec3(0,0,1));
+}
+
+/**
+ * Store the unit cube used for bounding boxes, and the lines showing
+ * the camera, in graphic card buffers. Recorded commands only refer to
+ * buffers, so these must stay around for as long as they are drawn.
+ */
+void upload_helpers() {
+  // Cube 1x1x1, centered on origin
+  GLfloat bbox_vertices[] = {
+    -0.5, -0.5, -0.5, 1.0,
+     0.5, -0.5, -0.5, 1.0,
+     0.5,  0.5, -0.5, 1.0,
+    -0.5,  0.5, -0.5, 1.0,
+    -0.5, -0.5,  0.5, 1.0,
+     0.5, -0.5,  0.5, 1.0,
+     0.5,  0.5,  0.5, 1.0,
+    -0.5,  0.5,  0.5, 1.0,
+  };
+  glGenBuffers(1, &vbo_bbox_vertices);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo_bbox_vertices);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(bbox_vertices), bbox_vertices, GL_STATIC_DRAW);
+
+  GLushort bbox_elements[] = {
+    0, 1, 2, 3,
+    4, 5, 6, 7,
+    0, 4, 1, 5, 2, 6, 3, 7
+  };
+  glGenBuffers(1, &ibo_bbox_elements);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_bbox_elements);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(bbox_elements), bbox_elements, GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+  GLfloat camera_vertices[] = {
+    -1, -1, 0, 1,
+     1, -1, 0, 1,
+     1, -1, 0, 1,
+    -1,  1, 0, 1,
+    -1,  1, 0, 1,
+    -1, -1, 0, 1,
+
+    -1,  1, 0, 1,
+     1, -1, 0, 1,
+     1, -1, 0, 1,
+     1,  1, 0, 1,
+     1,  1, 0, 1,
+    -1,  1, 0, 1,
+  };
+  glGenBuffers(1, &vbo_camera);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo_camera);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(camera_vertices), camera_vertices, GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
 int init_resources(char* model_filename, char* vshader_filename, char* fshader_filename)
 {
   load_obj(model_filename, &main_object);
@@ -371,6 +452,9 @@ int init_resources(char* model_filename, char* vshader_filename, char* fshader_f
   light_bbox.upload();
   portals[0].upload();
   portals[1].upload();
+  create_portal_frame(&portal_frame);
+  portal_frame.upload();
+  upload_helpers();
 
 
   /* Compile and link shaders */
@@ -681,12 +765,12 @@ void logic() {
   // Projection
   glm::mat4 camera2screen = glm::perspective(fovy, 1.0f*screen_width/screen_height, zNear, 100.0f);
 
-  glUseProgram(program);
-  glUniformMatrix4fv(uniform_v, 1, GL_FALSE, glm::value_ptr(world2camera));
-  glUniformMatrix4fv(uniform_p, 1, GL_FALSE, glm::value_ptr(camera2screen));
+  commands.use_program(program);
+  commands.uniform_matrix4fv(uniform_v, glm::value_ptr(world2camera));
+  commands.uniform_matrix4fv(uniform_p, glm::value_ptr(camera2screen));
 
   glm::mat4 v_inv = glm::inverse(world2camera);
-  glUniformMatrix4fv(uniform_v_inv, 1, GL_FALSE, glm::value_ptr(v_inv));
+  commands.uniform_matrix4fv(uniform_v_inv, glm::value_ptr(v_inv));
 
   glutPostRedisplay();
 }
@@ -694,138 +778,20 @@ void logic() {
 /**
  * Draw a frame around the portal.
  */
-void draw_portal_bbox(Mesh* portal) {
-  // 0.05 frame around the portal
-  Mesh portal_bbox;
-  portal_bbox.vertices.push_back(glm::vec4(-1.00, -1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4(-1.00,  1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4(-1.05, -1.05, 0, 1));
-
-  portal_bbox.vertices.push_back(glm::vec4(-1.05, -1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4(-1.00,  1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4(-1.05,  1.05, 0, 1));
-
-  portal_bbox.vertices.push_back(glm::vec4( 1.05, -1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4( 1.05,  1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4( 1.00, -1.05, 0, 1));
-
-  portal_bbox.vertices.push_back(glm::vec4( 1.00, -1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4( 1.05,  1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4( 1.00,  1.05, 0, 1));
-
-  portal_bbox.vertices.push_back(glm::vec4(-1.00,  1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4(-1.00,  1.00, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4( 1.00,  1.05, 0, 1));
-
-  portal_bbox.vertices.push_back(glm::vec4( 1.00,  1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4(-1.00,  1.00, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4( 1.00,  1.00, 0, 1));
-
-  portal_bbox.vertices.push_back(glm::vec4(-1.00, -1.00, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4(-1.00, -1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4( 1.00, -1.00, 0, 1));
-
-  portal_bbox.vertices.push_back(glm::vec4( 1.00, -1.00, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4(-1.00, -1.05, 0, 1));
-  portal_bbox.vertices.push_back(glm::vec4( 1.00, -1.05, 0, 1));
-
-  for (int i = 0; i < portal_bbox.vertices.size(); i++)
-    portal_bbox.normals.push_back(glm::vec3(0,0,1));
-
-  portal_bbox.upload();
-
-  /* Apply object's transformation matrix */
-  portal_bbox.object2world = portal->object2world;
-  portal_bbox.draw();
-  portal_bbox.object2world = portal->object2world * glm::rotate(glm::mat4(1), glm::radians(180.0f), glm::vec3(0, 1, 0));
-  portal_bbox.draw();
-}
-
-/**
- * Fill screen with a black square aligned with the perspective
- */
-void fill_screen() {
-  GLfloat vertices[] = {
-    -1, -1, 0, 1,
-     1, -1, 0, 1,
-    -1,  1, 0, 1,
-    -1,  1, 0, 1,
-     1, -1, 0, 1,
-     1,  1, 0, 1,
-  };
-  GLuint vbo_vertices;
-  glGenBuffers(1, &vbo_vertices);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo_vertices);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-  /* Apply object's transformation matrix */
-  glm::mat4 m = glm::inverse(glm::perspective(fovy, 1.0f*screen_width/screen_height, zNear, 100.0f));
-  glUniformMatrix4fv(uniform_m, 1, GL_FALSE, glm::value_ptr(m));
-
-  // Save current view matrix - useful since we're going to
-  // recursively draw the scene from different points of View
-  GLuint cur_program;
-  GLfloat save_v[16];
-  GLfloat save_v_inv[16];
-  glGetIntegerv(GL_CURRENT_PROGRAM, (GLint*)&cur_program);
-  glGetUniformfv(cur_program, uniform_v, save_v);
-  glGetUniformfv(cur_program, uniform_v_inv, save_v_inv);
-
-  glUniformMatrix4fv(uniform_v, 1, GL_FALSE, glm::value_ptr(glm::mat4(1.0)));
-
-  glBindBuffer(GL_ARRAY_BUFFER, vbo_vertices);
-  glEnableVertexAttribArray(attribute_v_coord);
-  glVertexAttribPointer(
-    attribute_v_coord,  // attribute
-    4,                  // number of elements per vertex, here (x,y,z,w)
-    GL_FLOAT,           // the type of each element
-    GL_FALSE,           // take our values as-is
-    0,                  // no extra data between each position
-    0                   // offset of first element
-  );
-
-  glDrawArrays(GL_TRIANGLES, 0, sizeof(vertices)/sizeof(vertices[0])/4);
-
-  glDisableVertexAttribArray(attribute_v_coord);
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-  glDeleteBuffers(1, &vbo_vertices);
-
-  // Restore view matrix
-  glUniformMatrix4fv(uniform_v, 1, GL_FALSE, save_v);
-  glUniformMatrix4fv(uniform_v_inv, 1, GL_FALSE, save_v_inv);
+void draw_portal_bbox(command_buffer& cmd, Mesh* portal) {
+  /* Both views are recorded at the same time, so portal_frame itself is not modified */
+  portal_frame.draw(cmd, portal->object2world);
+  portal_frame.draw(cmd, portal->object2world * glm::rotate(glm::mat4(1), glm::radians(180.0f), glm::vec3(0, 1, 0)));
 }
 
-void draw_camera() {
-  GLfloat vertices[] = {
-    -1, -1, 0, 1,
-     1, -1, 0, 1,
-     1, -1, 0, 1,
-    -1,  1, 0, 1,
-    -1,  1, 0, 1,
-    -1, -1, 0, 1,
-
-    -1,  1, 0, 1,
-     1, -1, 0, 1,
-     1, -1, 0, 1,
-     1,  1, 0, 1,
-     1,  1, 0, 1,
-    -1,  1, 0, 1,
-  };
-  GLuint vbo_vertices;
-  glGenBuffers(1, &vbo_vertices);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo_vertices);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-
+void draw_camera(command_buffer& cmd) {
   /* Apply object's transformation matrix */
   glm::mat4 m = glm::inverse(transforms[MODE_CAMERA]);
-  glUniformMatrix4fv(uniform_m, 1, GL_FALSE, glm::value_ptr(m));
+  cmd.uniform_matrix4fv(uniform_m, glm::value_ptr(m));
 
-  glBindBuffer(GL_ARRAY_BUFFER, vbo_vertices);
-  glEnableVertexAttribArray(attribute_v_coord);
-  glVertexAttribPointer(
+  cmd.bind_buffer(GL_ARRAY_BUFFER, vbo_camera);
+  cmd.enable_vertex_attrib_array(attribute_v_coord);
+  cmd.vertex_attrib_pointer(
     attribute_v_coord,  // attribute
     4,                  // number of elements per vertex, here (x,y,z,w)
     GL_FLOAT,           // the type of each element
@@ -834,98 +800,49 @@ void draw_camera() {
     0                   // offset of first element
   );
 
-  glDrawArrays(GL_LINES, 0, 6);
-  glDrawArrays(GL_LINES, 6, 6);
+  cmd.draw_arrays(GL_LINES, 0, 6);
+  cmd.draw_arrays(GL_LINES, 6, 6);
 
-  glDisableVertexAttribArray(attribute_v_coord);
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-  glDeleteBuffers(1, &vbo_vertices);
+  cmd.disable_vertex_attrib_array(attribute_v_coord);
+  cmd.bind_buffer(GL_ARRAY_BUFFER, 0);
 }
 
-void draw_portal_stencil(vector<glm::mat4> view_stack, Mesh* portal) {
-  GLboolean save_color_mask[4];
-  GLboolean save_depth_mask;
-  glGetBooleanv(GL_COLOR_WRITEMASK, save_color_mask);
-  glGetBooleanv(GL_DEPTH_WRITEMASK, &save_depth_mask);
-
-  //bool debug = (view_stack.size() == 4);
-  bool debug = false;
-
-  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-  glDepthMask(GL_FALSE);
-  glStencilFunc(GL_NEVER, 0, 0xFF);
-  glStencilOp(GL_INCR, GL_KEEP, GL_KEEP);  // draw 1s on test fail (always)
+/**
+ * Draw the stencil of the portal as seen through all the portals in
+ * the view stack. Color and depth writes are always on when this is
+ * called, so they are simply turned back on at the end.
+ */
+void draw_portal_stencil(command_buffer& cmd, vector<glm::mat4> view_stack, Mesh* portal) {
+  cmd.color_mask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  cmd.depth_mask(GL_FALSE);
+  cmd.stencil_func(GL_NEVER, 0, 0xFF);
+  cmd.stencil_op(GL_INCR, GL_KEEP, GL_KEEP);  // draw 1s on test fail (always)
   // Note: in Mesa 8's software renderer, nothing is drawn on the
   // stencil buffer, looks like a bug; doesn't happen in stencil/cube.cpp.
   // draw stencil pattern
-  glClear(GL_STENCIL_BUFFER_BIT);  // needs mask=0xFF
-  glUniformMatrix4fv(uniform_v, 1, GL_FALSE, glm::value_ptr(view_stack[0]));
-  portal->draw();
-  if (debug) {
-      glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-      glClear(GL_COLOR_BUFFER_BIT);
-      glStencilMask(0x00);
-      glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
-      fill_screen();
-      glutSwapBuffers();
-      cout << "swap" << endl;
-      sleep(1);
-      glStencilMask(0xFF);
-      glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-    }
+  cmd.clear(GL_STENCIL_BUFFER_BIT);  // needs mask=0xFF
+  cmd.uniform_matrix4fv(uniform_v, glm::value_ptr(view_stack[0]));
+  portal->draw(cmd);
   for (unsigned int i = 1; i < view_stack.size() - 1; i++) {  // -1 to ignore last view
     // Increment intersection for current portal
-    glStencilFunc(GL_EQUAL, 0, 0xFF);
-    glStencilOp(GL_INCR, GL_KEEP, GL_KEEP);  // draw 1s on test fail (always)
-    glUniformMatrix4fv(uniform_v, 1, GL_FALSE, glm::value_ptr(view_stack[i]));
-    portal->draw();
-    if (debug) {
-      glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-      glClear(GL_COLOR_BUFFER_BIT);
-      glStencilMask(0x00);
-      glStencilFunc(GL_LEQUAL, 1, 0xFF);
-      glDisable(GL_STENCIL_TEST);
-      portal->draw();
-      glEnable(GL_STENCIL_TEST);
-      //fill_screen();
-      glutSwapBuffers();
-      cout << "swap" << endl;
-      sleep(1);
-      glStencilMask(0xFF);
-      glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-    }
+    cmd.stencil_func(GL_EQUAL, 0, 0xFF);
+    cmd.stencil_op(GL_INCR, GL_KEEP, GL_KEEP);  // draw 1s on test fail (always)
+    cmd.uniform_matrix4fv(uniform_v, glm::value_ptr(view_stack[i]));
+    portal->draw(cmd);
     // Decremental outer portal -> only sub-portal intersection remains
-    glStencilFunc(GL_NEVER, 0, 0xFF);
-    glStencilOp(GL_DECR, GL_KEEP, GL_KEEP);  // draw 1s on test fail (always)
-    glUniformMatrix4fv(uniform_v, 1, GL_FALSE, glm::value_ptr(view_stack[i-1]));
-    portal->draw();
-    if (debug) {
-      glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-      glClear(GL_COLOR_BUFFER_BIT);
-      glStencilMask(0x00);
-      glStencilFunc(GL_LEQUAL, 1, 0xFF);
-      fill_screen();
-      glutSwapBuffers();
-      cout << "swap" << endl;
-      sleep(1);
-      glStencilMask(0xFF);
-      glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-    }
+    cmd.stencil_func(GL_NEVER, 0, 0xFF);
+    cmd.stencil_op(GL_DECR, GL_KEEP, GL_KEEP);  // draw 1s on test fail (always)
+    cmd.uniform_matrix4fv(uniform_v, glm::value_ptr(view_stack[i-1]));
+    portal->draw(cmd);
   }
 
-  //glColorMask(GL_TRUE, GL_TRUE, GL_FALSE, GL_TRUE);  // blue-ish filter if drawing on white or grey
-  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-  glDepthMask(GL_TRUE);
-  glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+  //cmd.color_mask(GL_TRUE, GL_TRUE, GL_FALSE, GL_TRUE);  // blue-ish filter if drawing on white or grey
+  cmd.color_mask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  cmd.depth_mask(GL_TRUE);
+  cmd.stencil_op(GL_KEEP, GL_KEEP, GL_KEEP);
   /* Fill 1 or more */
-  glStencilFunc(GL_LEQUAL, 1, 0xFF);
-  // glutSwapBuffers();
-  // cout << "rec=" << rec << ", i=" << i << endl;
-  // sleep(1);
-  glColorMask(save_color_mask[0], save_color_mask[1], save_color_mask[2], save_color_mask[3]);
-  glDepthMask(save_depth_mask);
-  glUniformMatrix4fv(uniform_v, 1, GL_FALSE, glm::value_ptr(view_stack.back()));
+  cmd.stencil_func(GL_LEQUAL, 1, 0xFF);
+  cmd.uniform_matrix4fv(uniform_v, glm::value_ptr(view_stack.back()));
   // -Ready to draw main scene-
 }
 
@@ -1012,15 +929,15 @@ bool clip_portal(vector<glm::mat4> view_stack, Mesh* outer_portal, rect* scissor
 /**
  * Draw the active portals contents
  */
-void draw_portals(vector<glm::mat4> view_stack, int rec, int outer_portal) {
+void draw_portals(command_buffer& cmd, vector<glm::mat4> view_stack, int rec, int outer_portal) {
   //if (rec >= 2) return;
   // TODO: replace rec with size threshold for MV * portal.bbox ?
 
-  GLboolean save_stencil_test;
-  glGetBooleanv(GL_STENCIL_TEST, &save_stencil_test);
+  // The stencil test is only on while drawing the contents of a portal
+  bool save_stencil_test = (outer_portal != -1);
 
-  glEnable(GL_STENCIL_TEST);
-  glEnable(GL_SCISSOR_TEST);
+  cmd.enable(GL_STENCIL_TEST);
+  cmd.enable(GL_SCISSOR_TEST);
   for (int i = 0; i < 2; i++) {
     // Important: don't draw outer_portal's outgoing portal - only
     // draw the same portal when displaying a sub-portal (seen from
@@ -1028,38 +945,35 @@ void draw_portals(vector<glm::mat4> view_stack, int rec, int outer_portal) {
     if (outer_portal == -1 || i == outer_portal) {
       glm::mat4 portal_cam = portal_view(view_stack.back(), &portals[i], &portals[(i+1)%2]);
       view_stack.push_back(portal_cam);
-      // draw_portal_stencil(view_stack, &portals[i]);
-      draw_scene(view_stack, rec + 1, i);
+      // draw_portal_stencil(cmd, view_stack, &portals[i]);
+      draw_scene(cmd, view_stack, rec + 1, i);
       view_stack.pop_back();
-      glUniformMatrix4fv(uniform_v, 1, GL_FALSE, glm::value_ptr(view_stack.back()));
-      glUniformMatrix4fv(uniform_v_inv, 1, GL_FALSE, glm::value_ptr(glm::inverse(view_stack.back())));
+      cmd.uniform_matrix4fv(uniform_v, glm::value_ptr(view_stack.back()));
+      cmd.uniform_matrix4fv(uniform_v_inv, glm::value_ptr(glm::inverse(view_stack.back())));
       // TODO: write something without lines, I don't have confidence in its interaction with the stencil buffer
       //glLineWidth(1);
     }
   }
   if (!save_stencil_test) {
-    glDisable(GL_STENCIL_TEST);
-    glDisable(GL_SCISSOR_TEST);
+    cmd.disable(GL_STENCIL_TEST);
+    cmd.disable(GL_SCISSOR_TEST);
   }
 
   // Draw portal in the depth buffer so they are not overwritten
-  glClear(GL_DEPTH_BUFFER_BIT);
-
-  GLboolean save_color_mask[4];
-  GLboolean save_depth_mask;
-  glGetBooleanv(GL_COLOR_WRITEMASK, save_color_mask);
-  glGetBooleanv(GL_DEPTH_WRITEMASK, &save_depth_mask);
-  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-  glDepthMask(GL_TRUE);
+  cmd.clear(GL_DEPTH_BUFFER_BIT);
+
+  // Color and depth writes are always on here
+  cmd.color_mask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  cmd.depth_mask(GL_TRUE);
   for (int i = 0; i < 2; i++)
-    portals[i].draw();
-  glColorMask(save_color_mask[0], save_color_mask[1], save_color_mask[2], save_color_mask[3]);
-  glDepthMask(save_depth_mask);
+    portals[i].draw(cmd);
+  cmd.color_mask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  cmd.depth_mask(GL_TRUE);
 }
 
-void draw_scene(vector<glm::mat4> view_stack, int rec, int outer_portal = -1) {
+void draw_scene(command_buffer& cmd, vector<glm::mat4> view_stack, int rec, int outer_portal = -1) {
   if (rec >= 5) {
-    //draw_portal_stencil(view_stack, &portals[outer_portal]);
+    //draw_portal_stencil(cmd, view_stack, &portals[outer_portal]);
     //draw_mesh(&portals[(outer_portal+1)%2]);
     return;
   }
@@ -1071,76 +985,97 @@ void draw_scene(vector<glm::mat4> view_stack, int rec, int outer_portal = -1) {
   }
 
   // Set view matrix
-  glUniformMatrix4fv(uniform_v, 1, GL_FALSE, glm::value_ptr(view_stack.back()));
-  glUniformMatrix4fv(uniform_v_inv, 1, GL_FALSE, glm::value_ptr(glm::inverse(view_stack.back())));
+  cmd.uniform_matrix4fv(uniform_v, glm::value_ptr(view_stack.back()));
+  cmd.uniform_matrix4fv(uniform_v_inv, glm::value_ptr(glm::inverse(view_stack.back())));
 
-  glClear(GL_DEPTH_BUFFER_BIT);
+  cmd.clear(GL_DEPTH_BUFFER_BIT);
 
   // Draw portals contents
-  draw_portals(view_stack, rec, outer_portal);
+  draw_portals(cmd, view_stack, rec, outer_portal);
 
   if (outer_portal != -1) {
     // clip the current view as much as possible, more efficient than
     // using the stencil buffer
-    glScissor(scissor.x, scissor.y, scissor.w, scissor.h);
+    cmd.scissor(scissor.x, scissor.y, scissor.w, scissor.h);
 
     // draw the current stencil - or actually recreate it if we just
     // drew a sub-portal and hence messed the stencil buffer
-    draw_portal_stencil(view_stack, &portals[outer_portal]);
+    draw_portal_stencil(cmd, view_stack, &portals[outer_portal]);
   }
   
   // Draw portals frames after the stencil buffer is set
   for (int i = 0; i < 2; i++) {
-    draw_portal_bbox(&portals[i]);
-    //portals[i].draw_bbox();
+    draw_portal_bbox(cmd, &portals[i]);
+    //portals[i].draw_bbox(cmd);
   }
   
   /* Draw scene */
-  //light_bbox.draw_bbox();
-  main_object.draw();
-  ground.draw();
-  //portals[0].draw();
+  //light_bbox.draw_bbox(cmd);
+  main_object.draw(cmd);
+  ground.draw(cmd);
+  //portals[0].draw(cmd);
 
   // Restore view matrix
   view_stack.pop_back();
   if (view_stack.size() > 0) {
-    glUniformMatrix4fv(uniform_v, 1, GL_FALSE, glm::value_ptr(view_stack.back()));
-    glUniformMatrix4fv(uniform_v_inv, 1, GL_FALSE, glm::value_ptr(glm::inverse(view_stack.back())));
+    cmd.uniform_matrix4fv(uniform_v, glm::value_ptr(view_stack.back()));
+    cmd.uniform_matrix4fv(uniform_v_inv, glm::value_ptr(glm::inverse(view_stack.back())));
   }
-
-  // glutSwapBuffers();
-  // cout << "rec=" << rec << endl;
-  // sleep(2);
 }
 
-void draw() {
-  glClearColor(0.45, 0.45, 0.45, 1.0);
-  glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT|GL_STENCIL_BUFFER_BIT);
-
-  glUseProgram(program);
+/**
+ * Record the main view, seen by the camera
+ */
+void draw_view(command_buffer& cmd) {
+  cmd.reset();
 
   vector<glm::mat4> view_stack;
   view_stack.push_back(transforms[MODE_CAMERA]);
 
-  glViewport(0, 0, screen_width, screen_height);
-  draw_scene(view_stack, 1);
+  cmd.viewport(0, 0, screen_width, screen_height);
+  draw_scene(cmd, view_stack, 1);
+}
+
+/**
+ * Record the overview in the lower right corner, seen from above
+ */
+void draw_overview(command_buffer& cmd) {
+  cmd.reset();
 
-  glViewport(2*screen_width/3, 0, screen_width/3, screen_height/3);
-  glClear(GL_DEPTH_BUFFER_BIT);
-  view_stack.clear();
+  vector<glm::mat4> view_stack;
   view_stack.push_back(glm::lookAt(
     glm::vec3(0.0,  9.0,-2.0),   // eye
     glm::vec3(0.0,  0.0,-2.0),   // direction
     glm::vec3(0.0,  0.0,-1.0))   // up
   );
-  draw_scene(view_stack, 4);
-  draw_camera();
+
+  cmd.viewport(2*screen_width/3, 0, screen_width/3, screen_height/3);
+  cmd.clear(GL_DEPTH_BUFFER_BIT);
+  draw_scene(cmd, view_stack, 4);
+  draw_camera(cmd);
+}
+
+void draw() {
+  commands.clear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT|GL_STENCIL_BUFFER_BIT);
+  commands.use_program(program);
+
+  // Both views only read the scene, so they can be recorded at the same time
+  worker_pool::shared().run(2, [](int i) {
+    if (i == 0)
+      draw_view(view_commands);
+    else
+      draw_overview(overview_commands);
+  });
 }
 
 void onDisplay()
 {
+  commands.reset();
   logic();
   draw();
+  commands.execute();
+  view_commands.execute();
+  overview_commands.execute();
   glutSwapBuffers();
 }
 
@@ -1172,6 +1107,9 @@ void onReshape(int width, int height) {
 void free_resources()
 {
   glDeleteProgram(program);
+  glDeleteBuffers(1, &vbo_bbox_vertices);
+  glDeleteBuffers(1, &ibo_bbox_elements);
+  glDeleteBuffers(1, &vbo_camera);
 }
 
 
@@ -1212,6 +1150,7 @@ int main(int argc, char* argv[]) {
     glutMouseFunc(onMouse);
     glutMotionFunc(onMotion);
     glutReshapeFunc(onReshape);
+    glClearColor(0.45, 0.45, 0.45, 1.0);
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glEnable(GL_DEPTH_TEST);
@@ -21,6 +21,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include "../common/shader_utils.h"
+#include "../common/command_buffer.h"
 
 #define GROUND_SIZE 20
 
@@ -45,6 +46,13 @@ int last_ticks = 0;
 static unsigned int fps_start = glutGet(GLUT_ELAPSED_TIME);
 static unsigned int fps_frames = 0;
 
+/* The GL commands for a frame are recorded into this command buffer
+   while going through the scene, and executed once it is complete */
+command_buffer commands;
+
+/* Unit cube for drawing bounding boxes, see Mesh::draw_bbox() */
+GLuint vbo_bbox_vertices, ibo_bbox_elements;
+
 class Mesh {
 private:
   GLuint vbo_vertices, vbo_normals, ibo_elements;
@@ -92,13 +100,13 @@ public:
   }
 
   /**
-   * Draw the object
+   * Record the commands to draw the object
    */
-  void draw() {
+  void draw(command_buffer& cmd) {
     if (this->vbo_vertices != 0) {
-      glEnableVertexAttribArray(attribute_v_coord);
-      glBindBuffer(GL_ARRAY_BUFFER, this->vbo_vertices);
-      glVertexAttribPointer(
+      cmd.enable_vertex_attrib_array(attribute_v_coord);
+      cmd.bind_buffer(GL_ARRAY_BUFFER, this->vbo_vertices);
+      cmd.vertex_attrib_pointer(
         attribute_v_coord,  // attribute
         4,                  // number of elements per vertex, here (x,y,z,w)
         GL_FLOAT,           // the type of each element
@@ -109,9 +117,9 @@ public:
     }
 
     if (this->vbo_normals != 0) {
-      glEnableVertexAttribArray(attribute_v_normal);
-      glBindBuffer(GL_ARRAY_BUFFER, this->vbo_normals);
-      glVertexAttribPointer(
+      cmd.enable_vertex_attrib_array(attribute_v_normal);
+      cmd.bind_buffer(GL_ARRAY_BUFFER, this->vbo_normals);
+      cmd.vertex_attrib_pointer(
         attribute_v_normal, // attribute
         3,                  // number of elements per vertex, here (x,y,z)
         GL_FLOAT,           // the type of each element
@@ -122,62 +130,33 @@ public:
     }
     
     /* Apply object's transformation matrix */
-    glUniformMatrix4fv(uniform_m, 1, GL_FALSE, glm::value_ptr(this->object2world));
+    cmd.uniform_matrix4fv(uniform_m, glm::value_ptr(this->object2world));
     /* Transform normal vectors with transpose of inverse of upper left
        3x3 model matrix (ex-gl_NormalMatrix): */
     glm::mat3 m_3x3_inv_transp = glm::transpose(glm::inverse(glm::mat3(this->object2world)));
-    glUniformMatrix3fv(uniform_m_3x3_inv_transp, 1, GL_FALSE, glm::value_ptr(m_3x3_inv_transp));
+    cmd.uniform_matrix3fv(uniform_m_3x3_inv_transp, glm::value_ptr(m_3x3_inv_transp));
     
     /* Push each element in buffer_vertices to the vertex shader */
     if (this->ibo_elements != 0) {
-      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ibo_elements);
-      int size;  glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
-      glDrawElements(GL_TRIANGLES, size/sizeof(GLushort), GL_UNSIGNED_SHORT, 0);
+      cmd.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, this->ibo_elements);
+      cmd.draw_elements(GL_TRIANGLES, this->elements.size(), GL_UNSIGNED_SHORT, 0);
     } else {
-      glDrawArrays(GL_TRIANGLES, 0, this->vertices.size());
+      cmd.draw_arrays(GL_TRIANGLES, 0, this->vertices.size());
     }
 
     if (this->vbo_normals != 0)
-      glDisableVertexAttribArray(attribute_v_normal);
+      cmd.disable_vertex_attrib_array(attribute_v_normal);
     if (this->vbo_vertices != 0)
-      glDisableVertexAttribArray(attribute_v_coord);
+      cmd.disable_vertex_attrib_array(attribute_v_coord);
   }
 
   /**
-   * Draw object bounding box
+   * Record the commands to draw the object bounding box
    */
-  void draw_bbox() {
+  void draw_bbox(command_buffer& cmd) {
     if (this->vertices.size() == 0)
       return;
     
-    // Cube 1x1x1, centered on origin
-    GLfloat vertices[] = {
-      -0.5, -0.5, -0.5, 1.0,
-       0.5, -0.5, -0.5, 1.0,
-       0.5,  0.5, -0.5, 1.0,
-      -0.5,  0.5, -0.5, 1.0,
-      -0.5, -0.5,  0.5, 1.0,
-       0.5, -0.5,  0.5, 1.0,
-       0.5,  0.5,  0.5, 1.0,
-      -0.5,  0.5,  0.5, 1.0,
-    };
-    GLuint vbo_vertices;
-    glGenBuffers(1, &vbo_vertices);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_vertices);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-    GLushort elements[] = {
-      0, 1, 2, 3,
-      4, 5, 6, 7,
-      0, 4, 1, 5, 2, 6, 3, 7
-    };
-    GLuint ibo_elements;
-    glGenBuffers(1, &ibo_elements);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_elements);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(elements), elements, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
     GLfloat
       min_x, max_x,
       min_y, max_y,
@@ -199,11 +178,11 @@ public:
     
     /* Apply object's transformation matrix */
     glm::mat4 m = this->object2world * transform;
-    glUniformMatrix4fv(uniform_m, 1, GL_FALSE, glm::value_ptr(m));
+    cmd.uniform_matrix4fv(uniform_m, glm::value_ptr(m));
     
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_vertices);
-    glEnableVertexAttribArray(attribute_v_coord);
-    glVertexAttribPointer(
+    cmd.bind_buffer(GL_ARRAY_BUFFER, vbo_bbox_vertices);
+    cmd.enable_vertex_attrib_array(attribute_v_coord);
+    cmd.vertex_attrib_pointer(
       attribute_v_coord,  // attribute
       4,                  // number of elements per vertex, here (x,y,z,w)
       GL_FLOAT,           // the type of each element
@@ -212,17 +191,14 @@ public:
       0                   // offset of first element
     );
     
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_elements);
-    glDrawElements(GL_LINE_LOOP, 4, GL_UNSIGNED_SHORT, 0);
-    glDrawElements(GL_LINE_LOOP, 4, GL_UNSIGNED_SHORT, (GLvoid*)(4*sizeof(GLushort)));
-    glDrawElements(GL_LINES, 8, GL_UNSIGNED_SHORT, (GLvoid*)(8*sizeof(GLushort)));
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    cmd.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, ibo_bbox_elements);
+    cmd.draw_elements(GL_LINE_LOOP, 4, GL_UNSIGNED_SHORT, 0);
+    cmd.draw_elements(GL_LINE_LOOP, 4, GL_UNSIGNED_SHORT, (GLvoid*)(4*sizeof(GLushort)));
+    cmd.draw_elements(GL_LINES, 8, GL_UNSIGNED_SHORT, (GLvoid*)(8*sizeof(GLushort)));
+    cmd.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     
-    glDisableVertexAttribArray(attribute_v_coord);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    
-    glDeleteBuffers(1, &vbo_vertices);
-    glDeleteBuffers(1, &ibo_elements);
+    cmd.disable_vertex_attrib_array(attribute_v_coord);
+    cmd.bind_buffer(GL_ARRAY_BUFFER, 0);
   }
 };
 Mesh ground, main_object, light_bbox;
@@ -277,6 +253,39 @@ void load_obj(const char* filename, Mesh* mesh) {
   }
 }
 
+/**
+ * Store the unit cube used for bounding boxes in graphic card
+ * buffers. Recorded commands only refer to buffers, so these must
+ * stay around for as long as bounding boxes are drawn.
+ */
+void upload_bbox() {
+  // Cube 1x1x1, centered on origin
+  GLfloat vertices[] = {
+    -0.5, -0.5, -0.5, 1.0,
+     0.5, -0.5, -0.5, 1.0,
+     0.5,  0.5, -0.5, 1.0,
+    -0.5,  0.5, -0.5, 1.0,
+    -0.5, -0.5,  0.5, 1.0,
+     0.5, -0.5,  0.5, 1.0,
+     0.5,  0.5,  0.5, 1.0,
+    -0.5,  0.5,  0.5, 1.0,
+  };
+  glGenBuffers(1, &vbo_bbox_vertices);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo_bbox_vertices);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  GLushort elements[] = {
+    0, 1, 2, 3,
+    4, 5, 6, 7,
+    0, 4, 1, 5, 2, 6, 3, 7
+  };
+  glGenBuffers(1, &ibo_bbox_elements);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_bbox_elements);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(elements), elements, GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
 int init_resources(char* model_filename, char* vshader_filename, char* fshader_filename)
 {
   load_obj(model_filename, &main_object);
@@ -309,6 +318,7 @@ int init_resources(char* model_filename, char* vshader_filename, char* fshader_f
   main_object.upload();
   ground.upload();
   light_bbox.upload();
+  upload_bbox();
  
 
   /* Compile and link shaders */
@@ -548,31 +558,32 @@ void logic() {
   // Projection
   glm::mat4 camera2screen = glm::perspective(45.0f, 1.0f*screen_width/screen_height, 0.1f, 100.0f);
 
-  glUseProgram(program);
-  glUniformMatrix4fv(uniform_v, 1, GL_FALSE, glm::value_ptr(world2camera));
-  glUniformMatrix4fv(uniform_p, 1, GL_FALSE, glm::value_ptr(camera2screen));
+  commands.use_program(program);
+  commands.uniform_matrix4fv(uniform_v, glm::value_ptr(world2camera));
+  commands.uniform_matrix4fv(uniform_p, glm::value_ptr(camera2screen));
 
   glm::mat4 v_inv = glm::inverse(world2camera);
-  glUniformMatrix4fv(uniform_v_inv, 1, GL_FALSE, glm::value_ptr(v_inv));
+  commands.uniform_matrix4fv(uniform_v_inv, glm::value_ptr(v_inv));
 
   glutPostRedisplay();
 }
 
 void draw() {
-  glClearColor(0.45, 0.45, 0.45, 1.0);
-  glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+  commands.clear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 
-  glUseProgram(program);
+  commands.use_program(program);
 
-  main_object.draw();
-  ground.draw();
-  light_bbox.draw_bbox();
+  main_object.draw(commands);
+  ground.draw(commands);
+  light_bbox.draw_bbox(commands);
 }
 
 void onDisplay()
 {
+  commands.reset();
   logic();
   draw();
+  commands.execute();
   glutSwapBuffers();
 }
 
@@ -602,6 +613,8 @@ void onReshape(int width, int height) {
 void free_resources()
 {
   glDeleteProgram(program);
+  glDeleteBuffers(1, &vbo_bbox_vertices);
+  glDeleteBuffers(1, &ibo_bbox_elements);
 }
 
 
@@ -641,6 +654,7 @@ int main(int argc, char* argv[]) {
     glutMouseFunc(onMouse);
     glutMotionFunc(onMotion);
     glutReshapeFunc(onReshape);
+    glClearColor(0.45, 0.45, 0.45, 1.0);
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glEnable(GL_DEPTH_TEST);